@@ -0,0 +1,1578 @@
+/*
+Модуль benchmark.cpp измеряет скорость чтения и записи BMP изображений
+классом Image для разных глубин цвета и размеров изображений.
+Запуск без параметров выполняет все замеры. Запуск
+benchmark --suite [CSV файл] [наибольший размер] выполняет только набор
+замеров записи и чтения всех глубин цвета и размеров и сохраняет
+результаты в CSV файл.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <clocale>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../Image/image.h"
+#include "../Image/image_advanced.h"
+#include "../Image/image_filter.h"
+#include "../Image/image_histogram.h"
+#include "../Image/image_pipeline.h"
+#include "../Image/image_probe.h"
+#include "../Image/image_pyramid.h"
+#include "../Image/image_region.h"
+#include "../Image/image_resize.h"
+#include "../Image/image_stream.h"
+#include "../Image/image_transform.h"
+#include "../Image/image_view.h"
+
+
+// Имя временного файла для замеров
+const char BENCH_FILENAME[] = "benchmark.bmp";
+// Число повторений каждого замера
+const int BENCH_REPEATS = 5;
+// Наименьшее и наибольшее число повторений замера набора тестов
+const int SUITE_MIN_REPEATS = 3;
+const int SUITE_MAX_REPEATS = 1000;
+// Наименьшее время замера набора тестов в секундах
+const double SUITE_MIN_TIME = 0.5;
+
+
+/**
+ * Функция возвращает текущее время в секундах.
+ * @return: время в секундах от произвольного момента.
+ */
+double get_time()
+{
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+/**
+ * Функция измеряет скорость записи и чтения изображения заданного
+ * размера и выводит результат.
+ * @param bit_count: глубина цвета;
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ */
+void bench_image(unsigned short bit_count, unsigned long width,
+    unsigned long height)
+{
+    // Сообщения класса Image во время замеров не выводим
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    Image image(7, bit_count, width, height);
+    double write_time = 0;
+    double read_time = 0;
+    for (int i = 0; i < BENCH_REPEATS; i++)
+    {
+        double start = get_time();
+        image.write_image(BENCH_FILENAME);
+        write_time += get_time() - start;
+        start = get_time();
+        Image loaded(BENCH_FILENAME);
+        read_time += get_time() - start;
+    }
+    std::cout.rdbuf(out);
+    // Объем данных о пикселях в файле
+    double megabytes = (width * bit_count + 31) / 32 * 4. * height /
+        (1024. * 1024.);
+    printf("%2u bit %6lux%-6lu  write %8.1f MB/s  read %8.1f MB/s\n",
+        bit_count, width, height,
+        megabytes * BENCH_REPEATS / write_time,
+        megabytes * BENCH_REPEATS / read_time);
+}
+
+
+/**
+ * Функция сравнивает загрузку изображения в память с отображением файла
+ * классом ImageView. В обоих случаях все пиксели просматриваются один раз.
+ * @param bit_count: глубина цвета;
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ */
+void bench_view(unsigned short bit_count, unsigned long width,
+    unsigned long height)
+{
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    Image image(7, bit_count, width, height);
+    image.write_image(BENCH_FILENAME);
+    double view_time = 0;
+    unsigned long sum = 0;
+    for (int i = 0; i < BENCH_REPEATS; i++)
+    {
+        double start = get_time();
+        ImageView view(BENCH_FILENAME);
+        for (unsigned long row = 0; row < view.get_height(); row++)
+        {
+            const RGBTriple* pixels = view.get_row(row);
+            for (unsigned long j = 0; j < view.get_width(); j++)
+            {
+                sum += pixels[j].green;
+            }
+        }
+        view_time += get_time() - start;
+    }
+    std::cout.rdbuf(out);
+    double megabytes = (width * bit_count + 31) / 32 * 4. * height /
+        (1024. * 1024.);
+    printf("%2u bit %6lux%-6lu  view %8.1f MB/s  (%lu)\n", bit_count, width,
+        height, megabytes * BENCH_REPEATS / view_time, sum % 10);
+}
+
+
+/**
+ * Функция измеряет копирование и перемещение изображения и выводит число
+ * выделений памяти под массивы пикселей для каждого способа. Перемещение
+ * и копирование при записи не должны выделять память, первая запись в
+ * копию должна выделить массив ровно один раз.
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ * @return: 0, если число выделений не совпало с ожидаемым.
+ */
+int bench_copy(unsigned long width, unsigned long height)
+{
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    Image image(7, 24, width, height);
+    std::cout.rdbuf(out);
+    // Глубокое копирование
+    unsigned long allocations = Image::get_allocations();
+    double start = get_time();
+    for (int i = 0; i < BENCH_REPEATS; i++)
+    {
+        Image copy(image);
+    }
+    double copy_time = (get_time() - start) / BENCH_REPEATS;
+    unsigned long copy_allocations = Image::get_allocations() - allocations;
+    // Перемещение туда и обратно
+    allocations = Image::get_allocations();
+    start = get_time();
+    for (int i = 0; i < BENCH_REPEATS; i++)
+    {
+        Image moved(std::move(image));
+        image = std::move(moved);
+    }
+    double move_time = (get_time() - start) / BENCH_REPEATS;
+    unsigned long move_allocations = Image::get_allocations() - allocations;
+    // Копирование при записи: копии разделяют массив, пока одна из них
+    // не запросит его для изменения
+    image.set_copy_on_write(true);
+    allocations = Image::get_allocations();
+    start = get_time();
+    for (int i = 0; i < BENCH_REPEATS; i++)
+    {
+        Image shared(image);
+    }
+    double shared_time = (get_time() - start) / BENCH_REPEATS;
+    unsigned long shared_allocations = Image::get_allocations() - allocations;
+    Image written(image);
+    allocations = Image::get_allocations();
+    written.get_data()[0].red = 1;
+    unsigned long write_allocations = Image::get_allocations() - allocations;
+    printf("copy %6lux%-6lu  deep %8.3f ms (%lu alloc)  move %8.3f ms "
+        "(%lu alloc)  cow %8.3f ms (%lu alloc, %lu on write)\n", width,
+        height, copy_time * 1000, copy_allocations, move_time * 1000,
+        move_allocations, shared_time * 1000, shared_allocations,
+        write_allocations);
+    if (move_allocations != 0 || shared_allocations != 0 ||
+        write_allocations != 1)
+    {
+        std::cout << "Ошибка! Перемещение и копирование при записи не " <<
+            "должны выделять память, первая запись - ровно один раз.\n";
+        return 0;
+    }
+    return 1;
+}
+
+
+/**
+ * Функция измеряет скорость функций преобразования пикселей для каждого
+ * набора инструкций, который поддерживает процессор.
+ * @param count: число пикселей в преобразуемой строке.
+ */
+void bench_convert(size_t count)
+{
+    RGBQuad* quads = new RGBQuad[count];
+    RGBTriple* triples = new RGBTriple[count];
+    unsigned char* indices = new unsigned char[count];
+    std::vector<unsigned char> planes(count * 3);
+    RGBQuad palette[256];
+    for (size_t i = 0; i < count; i++)
+    {
+        quads[i] = { (unsigned char)i, (unsigned char)(i >> 8),
+            (unsigned char)(i >> 16), 0 };
+        indices[i] = (unsigned char)(i * 7);
+    }
+    for (int i = 0; i < 256; i++)
+    {
+        palette[i] = { (unsigned char)i, (unsigned char)(255 - i),
+            (unsigned char)(i / 2), 0 };
+    }
+    const char* names[] = { "scalar", "ssse3", "avx2" };
+    SimdLevel best = detect_simd_level();
+    for (int level = SIMD_SCALAR; level <= best; level++)
+    {
+        set_simd_level((SimdLevel)level);
+        double times[5] = { 0, 0, 0, 0, 0 };
+        for (int i = 0; i < BENCH_REPEATS; i++)
+        {
+            double start = get_time();
+            convert_bgr_to_luma(triples, planes.data(), count, LUMA_BT601);
+            times[3] += get_time() - start;
+            start = get_time();
+            convert_bgr_to_ycbcr(triples, planes.data(), &planes[count],
+                &planes[count * 2], count, LUMA_BT709);
+            times[4] += get_time() - start;
+            start = get_time();
+            convert_bgra_to_bgr(quads, triples, count);
+            times[0] += get_time() - start;
+            start = get_time();
+            convert_bgr_to_bgra(triples, quads, count);
+            times[1] += get_time() - start;
+            start = get_time();
+            convert_palette_to_bgr(indices, palette, triples, count);
+            times[2] += get_time() - start;
+        }
+        double megapixels = count * BENCH_REPEATS / 1e6;
+        printf("convert %-6s  bgra->bgr %8.1f Mpx/s  bgr->bgra %8.1f Mpx/s  "
+            "index->bgr %8.1f Mpx/s\n", names[level], megapixels / times[0],
+            megapixels / times[1], megapixels / times[2]);
+        printf("convert %-6s  bgr->y    %8.1f Mpx/s  bgr->ycbcr %7.1f "
+            "Mpx/s\n", names[level], megapixels / times[3],
+            megapixels / times[4]);
+    }
+    set_simd_level(best);
+    delete[] quads;
+    delete[] triples;
+    delete[] indices;
+}
+
+
+/**
+ * Функция измеряет скорость распаковки 16- и 32-битных пикселей с
+ * масками каналов для каждого набора инструкций, который поддерживает
+ * процессор.
+ * @param count: число пикселей в преобразуемой строке.
+ */
+void bench_bit_fields(size_t count)
+{
+    unsigned char* src = new unsigned char[count * 4];
+    RGBTriple* triples = new RGBTriple[count];
+    unsigned long seed = 1;
+    for (size_t i = 0; i < count * 4; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        src[i] = (unsigned char)(seed >> 16);
+    }
+    // Маски 565 и 32-битные пиксели с порядком байтов RGBA
+    BitFields fields_565 = make_bit_fields({ 0xF800, 0x07E0, 0x001F });
+    BitFields fields_rgba = make_bit_fields({ 0xFF, 0xFF00, 0xFF0000 });
+    const char* names[] = { "scalar", "ssse3", "avx2" };
+    SimdLevel best = detect_simd_level();
+    for (int level = SIMD_SCALAR; level <= best; level++)
+    {
+        set_simd_level((SimdLevel)level);
+        double times[2] = { 0, 0 };
+        for (int i = 0; i < BENCH_REPEATS; i++)
+        {
+            double start = get_time();
+            convert_bit_fields_16_to_bgr(src, triples, count, fields_565);
+            times[0] += get_time() - start;
+            start = get_time();
+            convert_bit_fields_32_to_bgr(src, triples, count, fields_rgba);
+            times[1] += get_time() - start;
+        }
+        double megapixels = count * BENCH_REPEATS / 1e6;
+        printf("bitfields %-6s  565->bgr %8.1f Mpx/s  rgba->bgr %8.1f "
+            "Mpx/s\n", names[level], megapixels / times[0],
+            megapixels / times[1]);
+    }
+    set_simd_level(best);
+    delete[] src;
+    delete[] triples;
+}
+
+
+/**
+ * Функция создает палитровый BMP файл с псевдослучайными индексами.
+ * @param bit_count: глубина цвета (1, 4 или 8);
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ */
+void write_indexed_file(unsigned short bit_count, unsigned long width,
+    unsigned long height)
+{
+    unsigned long colors_num = 1UL << bit_count;
+    unsigned long row_size = (width * bit_count + 31) / 32 * 4;
+    BMPFileHeader file_header;
+    BMPInfoHeader info_header;
+    info_header.size = sizeof(BMPInfoHeader);
+    info_header.width = width;
+    info_header.height = height;
+    info_header.bit_count = bit_count;
+    info_header.colors_used = colors_num;
+    file_header.offset_data = sizeof(BMPFileHeader) + sizeof(BMPInfoHeader) +
+        colors_num * sizeof(RGBQuad);
+    file_header.file_size = file_header.offset_data + row_size * height;
+    FILE* file = open_file(BENCH_FILENAME, "wb");
+    fwrite(&file_header, sizeof(BMPFileHeader), 1, file);
+    fwrite(&info_header, sizeof(BMPInfoHeader), 1, file);
+    for (unsigned long i = 0; i < colors_num; i++)
+    {
+        RGBQuad color = { (unsigned char)i, (unsigned char)(i * 3),
+            (unsigned char)(i * 5), 0 };
+        fwrite(&color, sizeof(RGBQuad), 1, file);
+    }
+    unsigned char* row = new unsigned char[row_size];
+    unsigned long seed = 1;
+    for (unsigned long i = 0; i < height; i++)
+    {
+        for (unsigned long j = 0; j < row_size; j++)
+        {
+            seed = seed * 1103515245 + 12345;
+            row[j] = (unsigned char)(seed >> 16);
+        }
+        fwrite(row, 1, row_size, file);
+    }
+    delete[] row;
+    fclose(file);
+}
+
+
+/**
+ * Функция измеряет скорость чтения палитрового изображения классом
+ * ImageAdvanced с разворачиванием в цвета и с хранением индексов.
+ * @param bit_count: глубина цвета (1, 4 или 8);
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ */
+void bench_indexed(unsigned short bit_count, unsigned long width,
+    unsigned long height)
+{
+    write_indexed_file(bit_count, width, height);
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    double read_time = 0;
+    double indexed_time = 0;
+    for (int i = 0; i < BENCH_REPEATS; i++)
+    {
+        double start = get_time();
+        ImageAdvanced loaded(BENCH_FILENAME);
+        read_time += get_time() - start;
+        start = get_time();
+        ImageAdvanced indexed(BENCH_FILENAME, STORAGE_INDEXED);
+        indexed_time += get_time() - start;
+    }
+    std::cout.rdbuf(out);
+    double megabytes = (width * bit_count + 31) / 32 * 4. * height /
+        (1024. * 1024.);
+    printf("%2u bit %6lux%-6lu  read %8.1f MB/s  %8.1f Mpx/s  "
+        "indexed %8.1f MB/s (%.1f MB vs %.1f MB)\n", bit_count, width, height,
+        megabytes * BENCH_REPEATS / read_time,
+        width * height * BENCH_REPEATS / read_time / 1e6,
+        megabytes * BENCH_REPEATS / indexed_time, megabytes,
+        width * height * 3. / (1024. * 1024.));
+}
+
+
+/**
+ * Функция измеряет скорость загрузки изображения одним потоком и
+ * полосами строк во всех потоках процессора и проверяет, что пиксели
+ * совпадают.
+ * @param bit_count: глубина цвета;
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ */
+void bench_threads(unsigned short bit_count, unsigned long width,
+    unsigned long height)
+{
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    ImageAdvanced image(0, bit_count, width, height);
+    RGBTriple* data = image.get_data();
+    for (size_t i = 0; i < (size_t)width * height; i++)
+    {
+        data[i].blue = (unsigned char)i;
+        data[i].green = (unsigned char)(i >> 8);
+        data[i].red = (unsigned char)(i >> 16);
+    }
+    image.write_image(BENCH_FILENAME);
+    double times[2] = { 0, 0 };
+    bool same = true;
+    for (int i = 0; i < BENCH_REPEATS; i++)
+    {
+        ImageAdvanced loaded[2];
+        loaded[1].set_threads(0);
+        for (int k = 0; k < 2; k++)
+        {
+            double start = get_time();
+            loaded[k].load_image(BENCH_FILENAME);
+            times[k] += get_time() - start;
+        }
+        same = same && memcmp(loaded[0].get_data(), loaded[1].get_data(),
+            (size_t)width * height * sizeof(RGBTriple)) == 0;
+    }
+    std::cout.rdbuf(out);
+    double megabytes = (width * bit_count + 31) / 32 * 4. * height /
+        (1024. * 1024.);
+    printf("%2u bit %6lux%-6lu  1 thread %8.1f MB/s  %2u threads %8.1f MB/s"
+        "  x%.2f%s\n", bit_count, width, height,
+        megabytes * BENCH_REPEATS / times[0], get_hardware_threads(),
+        megabytes * BENCH_REPEATS / times[1], times[0] / times[1],
+        same ? "" : "  ОШИБКА: пиксели различаются");
+}
+
+
+/**
+ * Функция измеряет скорость построчной записи и чтения изображения
+ * через кольцо строк и сравнивает память кольца с памятью всего
+ * изображения. Прочитанные строки сверяются с загрузкой load_image.
+ * @param bit_count: глубина цвета (24 или 32);
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ */
+void bench_stream(unsigned short bit_count, unsigned long width,
+    unsigned long height)
+{
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    double write_time = 0;
+    double read_time = 0;
+    unsigned long ring_rows = 0;
+    for (int i = 0; i < BENCH_REPEATS; i++)
+    {
+        double start = get_time();
+        ImageWriter writer;
+        writer.open_image(BENCH_FILENAME, width, height, bit_count);
+        writer.write_rows([width](unsigned long row, RGBTriple* pixels)
+        {
+            for (unsigned long j = 0; j < width; j++)
+            {
+                pixels[j].blue = (unsigned char)j;
+                pixels[j].green = (unsigned char)row;
+                pixels[j].red = (unsigned char)(j + row);
+            }
+            return true;
+        });
+        writer.close_image();
+        write_time += get_time() - start;
+        start = get_time();
+        ImageReader reader(BENCH_FILENAME);
+        ring_rows = reader.get_ring_size();
+        unsigned long sum = 0;
+        reader.read_rows([&sum](unsigned long, const RGBTriple* pixels)
+        {
+            sum += pixels[0].red;
+            return true;
+        });
+        read_time += get_time() - start;
+    }
+    Image loaded(BENCH_FILENAME);
+    ImageReader reader(BENCH_FILENAME);
+    bool same = true;
+    reader.read_rows([&](unsigned long row, const RGBTriple* pixels)
+    {
+        same = same && memcmp(pixels, &loaded.get_data()[row * width],
+            width * sizeof(RGBTriple)) == 0;
+        return true;
+    });
+    std::cout.rdbuf(out);
+    double megabytes = (width * bit_count + 31) / 32 * 4. * height /
+        (1024. * 1024.);
+    printf("%2u bit %6lux%-6lu  stream write %8.1f MB/s  read %8.1f MB/s"
+        "  ring %.2f MB vs %.1f MB%s\n", bit_count, width, height,
+        megabytes * BENCH_REPEATS / write_time,
+        megabytes * BENCH_REPEATS / read_time,
+        ring_rows * width * (3. + bit_count / 8.) / (1024. * 1024.),
+        width * height * 3. / (1024. * 1024.),
+        same ? "" : "  ОШИБКА: строки различаются");
+}
+
+
+/**
+ * Функция измеряет скорость записи палитрового изображения из цветов:
+ * построение палитры медианным сечением, поиск ближайших цветов и
+ * упаковку строк. Исходное изображение - плавный градиент с шумом.
+ * @param bit_count: глубина цвета (1, 4 или 8);
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ */
+void bench_quantize(unsigned short bit_count, unsigned long width,
+    unsigned long height)
+{
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    ImageAdvanced image(0, 24, width, height);
+    RGBTriple* data = image.get_data();
+    unsigned long seed = 1;
+    for (unsigned long i = 0; i < height; i++)
+    {
+        for (unsigned long j = 0; j < width; j++)
+        {
+            seed = seed * 1103515245 + 12345;
+            unsigned char noise = (unsigned char)((seed >> 16) & 15);
+            data[i * width + j].red = (unsigned char)(j * 240 / width + noise);
+            data[i * width + j].green = (unsigned char)(i * 240 / height +
+                noise);
+            data[i * width + j].blue = (unsigned char)((i + j) % 240 + noise);
+        }
+    }
+    double palette_time = 0;
+    double write_time = 0;
+    for (int i = 0; i < BENCH_REPEATS; i++)
+    {
+        ImageAdvanced copy(image);
+        double start = get_time();
+        copy.set_bit_count(bit_count);
+        palette_time += get_time() - start;
+        start = get_time();
+        copy.write_image(BENCH_FILENAME);
+        write_time += get_time() - start;
+    }
+    std::cout.rdbuf(out);
+    printf("%2u bit %6lux%-6lu  palette %8.1f Mpx/s  quantized write "
+        "%8.1f Mpx/s\n", bit_count, width, height,
+        width * height * BENCH_REPEATS / palette_time / 1e6,
+        width * height * BENCH_REPEATS / write_time / 1e6);
+}
+
+
+/**
+ * Функция измеряет скорость записи и чтения палитрового изображения
+ * без сжатия и со сжатием RLE и сравнивает размеры файлов. Исходное
+ * изображение - крупные одноцветные области с редкими отдельными
+ * пикселями, как у схем и иконок.
+ * @param bit_count: глубина цвета (4 или 8);
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ */
+void bench_rle(unsigned short bit_count, unsigned long width,
+    unsigned long height)
+{
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    ImageAdvanced image(0, bit_count, width, height);
+    const RGBQuad* palette = image.get_palette();
+    unsigned long colors_num = 1UL << bit_count;
+    RGBTriple* data = image.get_data();
+    unsigned long seed = 1;
+    for (unsigned long i = 0; i < height; i++)
+    {
+        for (unsigned long j = 0; j < width; j++)
+        {
+            seed = seed * 1103515245 + 12345;
+            unsigned long index = (i / 64 * 7 + j / 256 * 3) % colors_num;
+            if ((seed >> 16) % 64 == 0)
+            {
+                index = (seed >> 8) % colors_num;
+            }
+            RGBTriple color = { palette[index].blue, palette[index].green,
+                palette[index].red };
+            data[i * width + j] = color;
+        }
+    }
+    double times[4] = {};
+    long sizes[2] = {};
+    unsigned long types[2] = { COMPRESSION_RGB,
+        bit_count == 8 ? COMPRESSION_RLE8 : COMPRESSION_RLE4 };
+    for (int k = 0; k < 2; k++)
+    {
+        image.set_compression(types[k]);
+        for (int i = 0; i < BENCH_REPEATS; i++)
+        {
+            double start = get_time();
+            image.write_image(BENCH_FILENAME);
+            times[k * 2] += get_time() - start;
+            start = get_time();
+            ImageAdvanced loaded(BENCH_FILENAME, STORAGE_INDEXED);
+            times[k * 2 + 1] += get_time() - start;
+        }
+        FILE* file = open_file(BENCH_FILENAME, "rb");
+        fseek(file, 0, SEEK_END);
+        sizes[k] = ftell(file);
+        fclose(file);
+    }
+    std::cout.rdbuf(out);
+    double pixels = width * height * (double)BENCH_REPEATS / 1e6;
+    printf("%2u bit %6lux%-6lu  raw write %8.1f read %8.1f Mpx/s  "
+        "rle write %8.1f read %8.1f Mpx/s  (%.2f MB vs %.2f MB)\n",
+        bit_count, width, height, pixels / times[0], pixels / times[1],
+        pixels / times[2], pixels / times[3], sizes[1] / (1024. * 1024.),
+        sizes[0] / (1024. * 1024.));
+}
+
+
+/**
+ * Функция сравнивает чтение только заголовков BMP файла с загрузкой
+ * всего изображения классом Image.
+ * @param bit_count: глубина цвета;
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ */
+void bench_probe(unsigned short bit_count, unsigned long width,
+    unsigned long height)
+{
+    // Заголовки читаются намного быстрее, поэтому повторяются чаще
+    const int probe_repeats = BENCH_REPEATS * 1000;
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    Image image(7, bit_count, width, height);
+    image.write_image(BENCH_FILENAME);
+    double load_time = 0;
+    for (int i = 0; i < BENCH_REPEATS; i++)
+    {
+        double start = get_time();
+        Image loaded(BENCH_FILENAME);
+        load_time += get_time() - start;
+    }
+    ImageInfo info = {};
+    int probed = 0;
+    double start = get_time();
+    for (int i = 0; i < probe_repeats; i++)
+    {
+        probed += probe_image(BENCH_FILENAME, info);
+    }
+    double probe_time = get_time() - start;
+    std::cout.rdbuf(out);
+    printf("%2u bit %6lux%-6lu  load %10.3f ms  probe %8.3f ms  "
+        "probed %d/%d, %.1f MB\n", bit_count, width, height,
+        load_time * 1000 / BENCH_REPEATS, probe_time * 1000 / probe_repeats,
+        probed, probe_repeats, get_image_memory(info) / (1024. * 1024.));
+}
+
+
+/**
+ * Функция заполняет изображение псевдослучайными пикселями. Пиксели
+ * палитровых изображений берутся из палитры, поэтому запись не тратит
+ * время на поиск ближайших цветов и измеряет только упаковку строк.
+ * @param image: изображение.
+ */
+void fill_synthetic(ImageAdvanced& image)
+{
+    const RGBQuad* palette = image.get_palette();
+    unsigned long colors_num = 1UL << image.get_bit_count();
+    RGBTriple* data = image.get_data();
+    size_t count = (size_t)image.get_width() * image.get_height();
+    unsigned long seed = 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        if (palette)
+        {
+            const RGBQuad& color = palette[(seed >> 16) % colors_num];
+            data[i] = { color.blue, color.green, color.red };
+        }
+        else
+        {
+            data[i] = { (unsigned char)(seed >> 8), (unsigned char)(seed >> 16),
+                (unsigned char)(seed >> 24) };
+        }
+    }
+}
+
+
+/**
+ * Функция сравнивает запись и чтение изображения через временный файл с
+ * записью в буфер в памяти и чтением из него. Данные в буфере должны
+ * совпадать с файлом, а прочитанные из буфера пиксели - с пикселями,
+ * прочитанными из файла.
+ * @param bit_count: глубина цвета;
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ */
+void bench_memory(unsigned short bit_count, unsigned long width,
+    unsigned long height)
+{
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    ImageAdvanced image(7, bit_count, width, height);
+    fill_synthetic(image);
+    double file_time = 0;
+    double memory_time = 0;
+    std::vector<unsigned char> bytes;
+    ImageAdvanced from_file;
+    ImageAdvanced from_memory;
+    for (int i = 0; i < BENCH_REPEATS; i++)
+    {
+        // Круг через временный файл, который нужен без чтения из памяти
+        double start = get_time();
+        image.write_image(BENCH_FILENAME);
+        from_file.load_image(BENCH_FILENAME);
+        file_time += get_time() - start;
+        start = get_time();
+        image.write_image(bytes);
+        from_memory.load_image(bytes.data(), bytes.size());
+        memory_time += get_time() - start;
+    }
+    std::cout.rdbuf(out);
+    // Сверяем буфер с файлом и пиксели, прочитанные двумя способами
+    bool same = false;
+    FILE* file = open_file(BENCH_FILENAME, "rb");
+    if (file)
+    {
+        std::vector<unsigned char> file_bytes(bytes.size() + 1);
+        size_t size = fread(file_bytes.data(), 1, file_bytes.size(), file);
+        fclose(file);
+        same = size == bytes.size() &&
+            memcmp(file_bytes.data(), bytes.data(), size) == 0;
+    }
+    size_t pixels = (size_t)width * height;
+    same = same && from_memory.get_width() == width &&
+        from_memory.get_height() == height &&
+        memcmp(from_file.get_data(), from_memory.get_data(),
+        pixels * sizeof(RGBTriple)) == 0;
+    printf("%2u bit %6lux%-6lu  file %9.3f ms  memory %9.3f ms  "
+        "x%.2f  %s\n", bit_count, width, height,
+        file_time * 1000 / BENCH_REPEATS, memory_time * 1000 / BENCH_REPEATS,
+        memory_time > 0 ? file_time / memory_time : 0,
+        same ? "OK" : "ОШИБКА");
+}
+
+
+/**
+ * Функция измеряет нарезку изображения на плитки. Для сравнения плитки
+ * получаются полной копией изображения, как без прямоугольников, затем
+ * прямоугольниками ImageRegion, которые записываются в память без
+ * копирования и вырезаются в отдельные изображения. Вырезанные плитки
+ * сверяются с пикселями изображения.
+ * @param width: ширина изображения;
+ * @param height: высота изображения;
+ * @param tile: сторона плитки.
+ */
+void bench_region(unsigned long width, unsigned long height,
+    unsigned long tile)
+{
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    ImageAdvanced image(7, 24, width, height);
+    fill_synthetic(image);
+    double copy_time = 0;
+    double write_time = 0;
+    double crop_time = 0;
+    unsigned long tiles = 0;
+    bool same = true;
+    std::vector<unsigned char> bytes;
+    for (unsigned long row = 0; row < height; row += tile)
+    {
+        for (unsigned long column = 0; column < width; column += tile)
+        {
+            // Цикл для прохода по плиткам изображения
+            double start = get_time();
+            Image copy(image);
+            copy_time += get_time() - start;
+            start = get_time();
+            ImageRegion region(image, row, column, tile, tile);
+            region.write_image(bytes);
+            write_time += get_time() - start;
+            start = get_time();
+            Image cropped = region.crop();
+            crop_time += get_time() - start;
+            for (unsigned long i = 0; i < cropped.get_height(); i++)
+            {
+                same = same && memcmp(&cropped.get_data()[(size_t)i *
+                    cropped.get_width()], region.get_row(i),
+                    cropped.get_width() * sizeof(RGBTriple)) == 0;
+            }
+            tiles++;
+        }
+    }
+    std::cout.rdbuf(out);
+    printf("%6lux%-6lu tiles %4lux%-4lu x%-5lu  full copy %9.3f ms  "
+        "region write %8.3f ms  crop %8.3f ms  %s\n", width, height, tile,
+        tile, tiles, copy_time * 1000, write_time * 1000, crop_time * 1000,
+        same ? "OK" : "ОШИБКА");
+}
+
+
+/**
+ * Функция сравнивает цепочку операций, выполненную отдельными проходами
+ * по всему массиву пикселей, с той же цепочкой ImagePipeline за один
+ * проход по строкам. Цепочка: таблица контраста, оттенки серого, порог,
+ * отражение слева направо и запись в память 32-битным изображением.
+ * Результаты двух способов должны совпадать.
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ */
+void bench_pipeline(unsigned long width, unsigned long height)
+{
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    ImageAdvanced image(7, 24, width, height);
+    fill_synthetic(image);
+    unsigned char contrast[256];
+    unsigned char threshold[256];
+    for (int i = 0; i < 256; i++)
+    {
+        int value = (i - 64) * 2;
+        contrast[i] = (unsigned char)(value < 0 ? 0 : value > 255 ? 255 :
+            value);
+        threshold[i] = i >= 128 ? 255 : 0;
+    }
+    size_t count = (size_t)width * height;
+    std::vector<unsigned char> passes_bytes;
+    std::vector<unsigned char> fused_bytes;
+    double passes_time = 0;
+    double fused_time = 0;
+    for (int r = 0; r < BENCH_REPEATS; r++)
+    {
+        // Каждая операция проходит весь массив пикселей
+        double start = get_time();
+        ImageAdvanced copy(image);
+        RGBTriple* data = copy.get_data();
+        for (size_t i = 0; i < count; i++)
+        {
+            data[i].blue = contrast[data[i].blue];
+            data[i].green = contrast[data[i].green];
+            data[i].red = contrast[data[i].red];
+        }
+        for (unsigned long i = 0; i < height; i++)
+        {
+            convert_row_to_grayscale(&data[(size_t)i * width], width);
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            data[i].blue = data[i].green = data[i].red =
+                threshold[data[i].green];
+        }
+        for (unsigned long i = 0; i < height; i++)
+        {
+            std::reverse(&data[(size_t)i * width],
+                &data[(size_t)(i + 1) * width]);
+        }
+        copy.set_bit_count(32);
+        copy.write_image(passes_bytes);
+        passes_time += get_time() - start;
+        start = get_time();
+        ImagePipeline pipeline(image);
+        pipeline.add_lut(contrast).add_threshold(128).add_flip_horizontal();
+        pipeline.set_bit_count(32);
+        pipeline.write_image(fused_bytes);
+        fused_time += get_time() - start;
+    }
+    std::cout.rdbuf(out);
+    printf("%6lux%-6lu  passes %9.3f ms  fused %9.3f ms  x%.2f  %s\n",
+        width, height, passes_time * 1000 / BENCH_REPEATS,
+        fused_time * 1000 / BENCH_REPEATS,
+        fused_time > 0 ? passes_time / fused_time : 0,
+        passes_bytes == fused_bytes ? "OK" : "ОШИБКА");
+}
+
+
+/**
+ * Функция измеряет скорость фильтров ImageFilter скалярным кодом и
+ * инструкциями AVX2 в одном потоке, а также лучшей реализацией во всех
+ * потоках. Результаты всех способов должны совпадать побайтно.
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ */
+void bench_filter(unsigned long width, unsigned long height)
+{
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    ImageAdvanced image(7, 24, width, height);
+    fill_synthetic(image);
+    std::cout.rdbuf(out);
+    const char* names[] = { "gauss 1.5", "box 3", "sharpen" };
+    SimdLevel best = detect_simd_level();
+    size_t size = (size_t)width * height * sizeof(RGBTriple);
+    for (int kind = 0; kind < 3; kind++)
+    {
+        ImageFilter filter(image);
+        if (kind == 0)
+        {
+            filter.set_gaussian_blur(1.5);
+        }
+        else if (kind == 1)
+        {
+            filter.set_box_blur(3);
+        }
+        else
+        {
+            filter.set_sharpen(0.5);
+        }
+        // Замеры: скалярный код, лучшая реализация в одном потоке и во
+        // всех потоках
+        SimdLevel levels[] = { SIMD_SCALAR, best, best };
+        unsigned threads[] = { 1, 1, 0 };
+        double times[3] = { 0, 0, 0 };
+        Image reference;
+        bool equal = true;
+        for (int m = 0; m < 3; m++)
+        {
+            set_simd_level(levels[m]);
+            filter.set_threads(threads[m]);
+            for (int r = 0; r < BENCH_REPEATS; r++)
+            {
+                double start = get_time();
+                Image result = filter.run();
+                times[m] += get_time() - start;
+                if (m == 0 && r == 0)
+                {
+                    reference = std::move(result);
+                }
+                else if (memcmp(result.get_data(), reference.get_data(),
+                    size) != 0)
+                {
+                    equal = false;
+                }
+            }
+        }
+        set_simd_level(best);
+        double megapixels = (double)width * height * BENCH_REPEATS / 1e6;
+        printf("filter %-9s  scalar %7.1f Mpx/s  simd %7.1f Mpx/s  "
+            "threads %7.1f Mpx/s  %s\n", names[kind], megapixels / times[0],
+            megapixels / times[1], megapixels / times[2],
+            equal ? "OK" : "ОШИБКА");
+    }
+}
+
+
+/**
+ * Функция сравнивает построение гистограмм и статистик каналов простым
+ * циклом по пикселям с ImageHistogram скалярным кодом и лучшей
+ * реализацией в одном потоке и во всех потоках. Гистограммы и средние
+ * значения всех способов должны совпадать.
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ */
+void bench_histogram(unsigned long width, unsigned long height)
+{
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    ImageAdvanced image(7, 24, width, height);
+    fill_synthetic(image);
+    std::cout.rdbuf(out);
+    const RGBTriple* data = image.get_data();
+    size_t count = (size_t)width * height;
+    std::vector<std::uint64_t> naive(4 * 256);
+    double naive_means[3] = { 0, 0, 0 };
+    double naive_time = 0;
+    for (int r = 0; r < BENCH_REPEATS; r++)
+    {
+        // Гистограммы и статистики каналов считаются по каждому пикселю
+        double start = get_time();
+        std::fill(naive.begin(), naive.end(), 0);
+        int mins[3] = { 255, 255, 255 };
+        int maxs[3] = { 0, 0, 0 };
+        double sums[3] = { 0, 0, 0 };
+        double squares[3] = { 0, 0, 0 };
+        for (size_t i = 0; i < count; i++)
+        {
+            int values[3] = { data[i].blue, data[i].green, data[i].red };
+            for (int c = 0; c < 3; c++)
+            {
+                naive[c * 256 + values[c]]++;
+                mins[c] = std::min(mins[c], values[c]);
+                maxs[c] = std::max(maxs[c], values[c]);
+                sums[c] += values[c];
+                squares[c] += values[c] * values[c];
+            }
+            naive[768 + ((77 * values[2] + 150 * values[1] +
+                29 * values[0] + 128) >> 8)]++;
+        }
+        for (int c = 0; c < 3; c++)
+        {
+            naive_means[c] = sums[c] / count;
+        }
+        naive_time += get_time() - start;
+    }
+    SimdLevel best = detect_simd_level();
+    SimdLevel levels[] = { SIMD_SCALAR, best, best };
+    unsigned threads[] = { 1, 1, 0 };
+    double times[3] = { 0, 0, 0 };
+    bool equal = true;
+    for (int m = 0; m < 3; m++)
+    {
+        set_simd_level(levels[m]);
+        ImageHistogram histogram;
+        histogram.set_threads(threads[m]);
+        for (int r = 0; r < BENCH_REPEATS; r++)
+        {
+            double start = get_time();
+            histogram.compute(image);
+            for (int c = 0; c < 3; c++)
+            {
+                HistogramChannel channel = (HistogramChannel)c;
+                histogram.get_min(channel);
+                histogram.get_max(channel);
+                histogram.get_variance(channel);
+            }
+            times[m] += get_time() - start;
+        }
+        for (int c = 0; c < 3; c++)
+        {
+            equal = equal && std::fabs(histogram.get_mean(
+                (HistogramChannel)c) - naive_means[c]) < 1e-6;
+        }
+        for (int c = 0; c < 4; c++)
+        {
+            equal = equal && std::equal(naive.begin() + c * 256,
+                naive.begin() + (c + 1) * 256,
+                histogram.get_histogram((HistogramChannel)c));
+        }
+    }
+    set_simd_level(best);
+    double megapixels = (double)count * BENCH_REPEATS / 1e6;
+    printf("histogram  naive %7.1f Mpx/s  scalar %7.1f Mpx/s  "
+        "simd %7.1f Mpx/s  threads %7.1f Mpx/s  %s\n",
+        megapixels / naive_time, megapixels / times[0],
+        megapixels / times[1], megapixels / times[2],
+        equal ? "OK" : "ОШИБКА");
+}
+
+
+/**
+ * Функция сравнивает получение оттенков серого, как их получают без
+ * библиотеки: загрузка 24-битных цветов и перевод в яркость простым
+ * циклом, с загрузкой ImageAdvanced в режиме STORAGE_GRAYSCALE, который
+ * переводит строки в яркость при чтении. Яркость обоих способов должна
+ * совпадать, выводится и память под пиксели.
+ * @param bit_count: глубина цвета;
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ */
+void bench_grayscale(unsigned short bit_count, unsigned long width,
+    unsigned long height)
+{
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    ImageAdvanced image(7, bit_count, width, height);
+    fill_synthetic(image);
+    std::vector<unsigned char> bytes;
+    image.write_image(bytes);
+    size_t count = (size_t)width * height;
+    std::vector<unsigned char> naive(count);
+    double naive_time = 0;
+    double gray_time = 0;
+    ImageAdvanced colors;
+    ImageAdvanced gray;
+    gray.set_storage_mode(STORAGE_GRAYSCALE);
+    for (int r = 0; r < BENCH_REPEATS; r++)
+    {
+        // Цвета загружаются целиком, яркость считается вторым проходом
+        double start = get_time();
+        colors.load_image(bytes.data(), bytes.size());
+        const RGBTriple* data = colors.get_data();
+        for (size_t i = 0; i < count; i++)
+        {
+            naive[i] = (unsigned char)((77 * data[i].red +
+                150 * data[i].green + 29 * data[i].blue + 128) >> 8);
+        }
+        naive_time += get_time() - start;
+        start = get_time();
+        gray.load_image(bytes.data(), bytes.size());
+        gray_time += get_time() - start;
+    }
+    std::cout.rdbuf(out);
+    bool equal = gray.get_bit_count() == 8 && gray.is_indexed();
+    for (unsigned long i = 0; equal && i < height; i++)
+    {
+        equal = memcmp(gray.get_index_row(i), &naive[(size_t)i * width],
+            width) == 0;
+    }
+    double colors_size = (double)count * (sizeof(RGBTriple) + 1) / 1e6;
+    double gray_size = (double)get_bmp_row_size(width, 8) * height / 1e6;
+    printf("grayscale %2u bit  colors+loop %8.3f ms %7.1f MB  "
+        "direct %8.3f ms %7.1f MB  %s\n", bit_count,
+        naive_time * 1000 / BENCH_REPEATS, colors_size,
+        gray_time * 1000 / BENCH_REPEATS, gray_size,
+        equal ? "OK" : "ОШИБКА");
+}
+
+
+/**
+ * Функция сравнивает поворот на 90 градусов простым циклом по пикселям
+ * результата, который читает источник по столбцам через все
+ * изображение, с поворотом ImageTransform плитками в одном потоке и во
+ * всех потоках, выводит скорость поворота на 180 градусов и
+ * транспонирования, а также время загрузки файла со строками сверху
+ * вниз. Результаты должны совпадать с простым циклом и исходными
+ * пикселями.
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ */
+void bench_transform(unsigned long width, unsigned long height)
+{
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    ImageAdvanced image(7, 24, width, height);
+    fill_synthetic(image);
+    const RGBTriple* data = image.get_data();
+    size_t count = (size_t)width * height;
+    std::vector<RGBTriple> naive(count);
+    ImageTransform transform(image);
+    double naive_time = 0;
+    double times[4] = { 0, 0, 0, 0 };
+    bool equal = true;
+    for (int r = 0; r < BENCH_REPEATS; r++)
+    {
+        // Строка i результата - столбец width - 1 - i источника
+        double start = get_time();
+        for (unsigned long i = 0; i < width; i++)
+        {
+            for (unsigned long j = 0; j < height; j++)
+            {
+                naive[(size_t)i * height + j] =
+                    data[(size_t)j * width + width - 1 - i];
+            }
+        }
+        naive_time += get_time() - start;
+        transform.set_threads(1);
+        start = get_time();
+        Image rotated = transform.run(TRANSFORM_ROTATE_90);
+        times[0] += get_time() - start;
+        transform.set_threads(0);
+        start = get_time();
+        Image threaded = transform.run(TRANSFORM_ROTATE_90);
+        times[1] += get_time() - start;
+        equal = equal && memcmp(rotated.get_data(), naive.data(),
+            count * sizeof(RGBTriple)) == 0 && memcmp(threaded.get_data(),
+            naive.data(), count * sizeof(RGBTriple)) == 0;
+        transform.set_threads(1);
+        start = get_time();
+        Image half_turn = transform.run(TRANSFORM_ROTATE_180);
+        times[2] += get_time() - start;
+        start = get_time();
+        Image transposed = transform.run(TRANSFORM_TRANSPOSE);
+        times[3] += get_time() - start;
+        // Два поворота на 90 градусов дают поворот на 180 градусов
+        Image twice = ImageTransform(rotated).run(TRANSFORM_ROTATE_90);
+        equal = equal && memcmp(twice.get_data(), half_turn.get_data(),
+            count * sizeof(RGBTriple)) == 0;
+    }
+    // Файл со строками сверху вниз читается и пишется без переворота
+    std::vector<unsigned char> bytes;
+    std::vector<unsigned char> top_down_bytes;
+    image.write_image(bytes);
+    image.set_top_down(true);
+    image.write_image(top_down_bytes);
+    double load_times[2] = { 0, 0 };
+    ImageAdvanced loaded[2];
+    for (int r = 0; r < BENCH_REPEATS; r++)
+    {
+        double start = get_time();
+        loaded[0].load_image(bytes.data(), bytes.size());
+        load_times[0] += get_time() - start;
+        start = get_time();
+        loaded[1].load_image(top_down_bytes.data(), top_down_bytes.size());
+        load_times[1] += get_time() - start;
+    }
+    std::cout.rdbuf(out);
+    bool loaded_equal = !loaded[0].is_top_down() &&
+        loaded[1].is_top_down() && memcmp(loaded[1].get_data(), data,
+        count * sizeof(RGBTriple)) == 0;
+    ImageRegion flipped = ImageRegion(image).flip_vertical();
+    loaded_equal = loaded_equal && memcmp(flipped.get_row(0),
+        data + (size_t)(height - 1) * width, width * sizeof(RGBTriple)) == 0;
+    double megapixels = (double)count * BENCH_REPEATS / 1e6;
+    printf("transform rotate 90  naive %7.1f Mpx/s  tiled %7.1f Mpx/s  "
+        "threads %7.1f Mpx/s  %s\n", megapixels / naive_time,
+        megapixels / times[0], megapixels / times[1],
+        equal ? "OK" : "ОШИБКА");
+    printf("transform rotate 180 %7.1f Mpx/s  transpose %7.1f Mpx/s\n",
+        megapixels / times[2], megapixels / times[3]);
+    printf("transform load bottom-up %8.3f ms  top-down %8.3f ms  %s\n",
+        load_times[0] * 1000 / BENCH_REPEATS,
+        load_times[1] * 1000 / BENCH_REPEATS,
+        loaded_equal ? "OK" : "ОШИБКА");
+}
+
+
+/**
+ * Функция сравнивает время изменения размера простой билинейной
+ * интерполяцией каждого пикселя результата в числах с плавающей точкой
+ * с ImageResize всеми фильтрами: скалярным кодом и инструкциями AVX2 в
+ * одном потоке, а также лучшей реализацией во всех потоках. Простая
+ * интерполяция при уменьшении читает лишь 4 пикселя на пиксель
+ * результата и дает наложение частот. Результаты ImageResize всех
+ * способов должны совпадать побайтно.
+ * @param width: ширина исходного изображения;
+ * @param height: высота исходного изображения;
+ * @param result_width: ширина результата;
+ * @param result_height: высота результата.
+ */
+void bench_resize(unsigned long width, unsigned long height,
+    unsigned long result_width, unsigned long result_height)
+{
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    ImageAdvanced image(7, 24, width, height);
+    fill_synthetic(image);
+    std::cout.rdbuf(out);
+    const RGBTriple* data = image.get_data();
+    size_t count = (size_t)result_width * result_height;
+    std::vector<RGBTriple> naive(count);
+    double naive_time = 0;
+    double scale_x = (double)width / result_width;
+    double scale_y = (double)height / result_height;
+    for (int r = 0; r < BENCH_REPEATS; r++)
+    {
+        // Каждый пиксель результата - смесь четырех ближайших пикселей
+        double start = get_time();
+        for (unsigned long i = 0; i < result_height; i++)
+        {
+            double y = (i + 0.5) * scale_y - 0.5;
+            y = y < 0 ? 0 : y > height - 1 ? height - 1 : y;
+            unsigned long y0 = (unsigned long)y;
+            unsigned long y1 = y0 + 1 < height ? y0 + 1 : y0;
+            double fy = y - y0;
+            for (unsigned long j = 0; j < result_width; j++)
+            {
+                double x = (j + 0.5) * scale_x - 0.5;
+                x = x < 0 ? 0 : x > width - 1 ? width - 1 : x;
+                unsigned long x0 = (unsigned long)x;
+                unsigned long x1 = x0 + 1 < width ? x0 + 1 : x0;
+                double fx = x - x0;
+                const unsigned char* p[4] = {
+                    (const unsigned char*)&data[(size_t)y0 * width + x0],
+                    (const unsigned char*)&data[(size_t)y0 * width + x1],
+                    (const unsigned char*)&data[(size_t)y1 * width + x0],
+                    (const unsigned char*)&data[(size_t)y1 * width + x1] };
+                unsigned char* dst = (unsigned char*)&naive[(size_t)i *
+                    result_width + j];
+                for (int c = 0; c < 3; c++)
+                {
+                    double top = p[0][c] + (p[1][c] - p[0][c]) * fx;
+                    double bottom = p[2][c] + (p[3][c] - p[2][c]) * fx;
+                    dst[c] = (unsigned char)(top + (bottom - top) * fy +
+                        0.5);
+                }
+            }
+        }
+        naive_time += get_time() - start;
+    }
+    printf("resize %lux%lu -> %lux%lu  naive bilinear %8.3f ms\n",
+        width, height, result_width, result_height,
+        naive_time * 1000 / BENCH_REPEATS);
+    const char* names[] = { "box", "bilinear", "bicubic", "lanczos" };
+    SimdLevel best = detect_simd_level();
+    for (int kind = 0; kind < 4; kind++)
+    {
+        ImageResize resize(image);
+        resize.set_filter((ResizeFilter)kind);
+        // Замеры: скалярный код, лучшая реализация в одном потоке и во
+        // всех потоках
+        SimdLevel levels[] = { SIMD_SCALAR, best, best };
+        unsigned threads[] = { 1, 1, 0 };
+        double times[3] = { 0, 0, 0 };
+        Image reference;
+        bool equal = true;
+        for (int m = 0; m < 3; m++)
+        {
+            set_simd_level(levels[m]);
+            resize.set_threads(threads[m]);
+            for (int r = 0; r < BENCH_REPEATS; r++)
+            {
+                double start = get_time();
+                Image result = resize.run(result_width, result_height);
+                times[m] += get_time() - start;
+                if (m == 0 && r == 0)
+                {
+                    reference = std::move(result);
+                }
+                else if (memcmp(result.get_data(), reference.get_data(),
+                    count * sizeof(RGBTriple)) != 0)
+                {
+                    equal = false;
+                }
+            }
+        }
+        set_simd_level(best);
+        printf("resize %-8s  scalar %8.3f ms  simd %8.3f ms  threads "
+            "%8.3f ms  %s\n", names[kind], times[0] * 1000 / BENCH_REPEATS,
+            times[1] * 1000 / BENCH_REPEATS, times[2] * 1000 / BENCH_REPEATS,
+            equal ? "OK" : "ОШИБКА");
+    }
+}
+
+
+/**
+ * Функция сравнивает построение пирамиды изображения, как его строят
+ * без библиотеки: загрузка всего изображения и уменьшение вдвое уровня
+ * за уровнем, с построением ImagePyramid за один проход чтения файла.
+ * Уровни обоих способов должны совпадать, выводится и память под
+ * пиксели исходного изображения и уровней.
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ */
+void bench_pyramid(unsigned long width, unsigned long height)
+{
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    ImageAdvanced image(7, 24, width, height);
+    fill_synthetic(image);
+    image.write_image(BENCH_FILENAME);
+    double naive_time = 0;
+    double pyramid_time = 0;
+    std::vector<std::vector<RGBTriple>> naive;
+    std::vector<Image> levels;
+    size_t naive_size = 0;
+    size_t levels_size = 0;
+    for (int r = 0; r < BENCH_REPEATS; r++)
+    {
+        // Каждый уровень получается из предыдущего, загруженного целиком
+        double start = get_time();
+        Image loaded(BENCH_FILENAME);
+        naive.clear();
+        const RGBTriple* source = loaded.get_data();
+        unsigned long w = width;
+        unsigned long h = height;
+        naive_size = (size_t)w * h;
+        while (w > PYRAMID_MIN_SIZE || h > PYRAMID_MIN_SIZE)
+        {
+            unsigned long next_w = (w + 1) / 2;
+            unsigned long next_h = (h + 1) / 2;
+            std::vector<RGBTriple> level((size_t)next_w * next_h);
+            for (unsigned long i = 0; i < next_h; i++)
+            {
+                unsigned long second = 2 * i + 1 < h ? 2 * i + 1 : 2 * i;
+                reduce_rows(source + (size_t)2 * i * w,
+                    source + (size_t)second * w, w,
+                    &level[(size_t)i * next_w]);
+            }
+            naive.push_back(std::move(level));
+            source = naive.back().data();
+            naive_size += (size_t)next_w * next_h;
+            w = next_w;
+            h = next_h;
+        }
+        naive_time += get_time() - start;
+        start = get_time();
+        ImagePyramid pyramid;
+        pyramid.build_images(BENCH_FILENAME, levels);
+        pyramid_time += get_time() - start;
+        levels_size = 0;
+        for (unsigned long k = 1; k <= pyramid.get_levels_num(); k++)
+        {
+            // Уровни и по строке ожидающих пары строк на уровень
+            levels_size += (size_t)(pyramid.get_level_height(k) + 2) *
+                pyramid.get_level_width(k);
+        }
+    }
+    std::cout.rdbuf(out);
+    bool equal = levels.size() == naive.size();
+    for (size_t k = 0; equal && k < levels.size(); k++)
+    {
+        equal = memcmp(levels[k].get_data(), naive[k].data(),
+            naive[k].size() * sizeof(RGBTriple)) == 0;
+    }
+    printf("pyramid %lux%lu %zu levels  load+reduce %8.3f ms %7.1f MB  "
+        "streaming %8.3f ms %7.1f MB  %s\n", width, height, levels.size(),
+        naive_time * 1000 / BENCH_REPEATS,
+        (double)naive_size * sizeof(RGBTriple) / 1e6,
+        pyramid_time * 1000 / BENCH_REPEATS,
+        (double)levels_size * sizeof(RGBTriple) / 1e6,
+        equal ? "OK" : "ОШИБКА");
+}
+
+
+/**
+ * Функция измеряет скорость записи и чтения изображений всех глубин
+ * цвета и размеров от миниатюр до 16K, с шириной, кратной 4, и с
+ * нечетной шириной. Каждый замер повторяется, пока не наберется
+ * SUITE_MIN_TIME секунд. Результаты выводятся в консоль и, если задано
+ * имя файла, в CSV файл для сравнения между версиями.
+ * @param csv_name: имя CSV файла или nullptr;
+ * @param max_size: наибольшая ширина и высота изображения.
+ * @return: 0, если CSV файл не удалось создать.
+ */
+int bench_suite(const char* csv_name, unsigned long max_size)
+{
+    FILE* csv = nullptr;
+    if (csv_name)
+    {
+        csv = open_file(csv_name, "w");
+        if (!csv)
+        {
+            std::cout << "Ошибка! Не удалось создать файл '" << csv_name <<
+                "'.\n";
+            return 0;
+        }
+        fprintf(csv, "bit_count,width,height,repeats,data_mb,write_mb_s,"
+            "write_ns_px,read_mb_s,read_ns_px,simd,threads\n");
+    }
+    const char* simd_names[] = { "scalar", "ssse3", "avx2" };
+    const char* simd = simd_names[get_pixel_kernels().level];
+    const unsigned short bit_counts[] = { 1, 4, 8, 16, 24, 32 };
+    const unsigned long sizes[] = { 128, 1024, 4096, 16384 };
+    for (unsigned short bit_count : bit_counts)
+    {
+        for (unsigned long size : sizes)
+        {
+            if (size > max_size)
+            {
+                continue;
+            }
+            // Ширина, кратная 4, и нечетная ширина с выравниванием строк
+            for (unsigned long width : { size, size - 1 })
+            {
+                unsigned long height = size;
+                std::ostringstream quiet;
+                std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+                ImageAdvanced image(0, bit_count, width, height);
+                fill_synthetic(image);
+                double write_time = 0;
+                double read_time = 0;
+                int repeats = 0;
+                while (repeats < SUITE_MIN_REPEATS ||
+                    (write_time + read_time < SUITE_MIN_TIME &&
+                    repeats < SUITE_MAX_REPEATS))
+                {
+                    double start = get_time();
+                    image.write_image(BENCH_FILENAME);
+                    write_time += get_time() - start;
+                    start = get_time();
+                    ImageAdvanced loaded(BENCH_FILENAME);
+                    read_time += get_time() - start;
+                    repeats++;
+                }
+                std::cout.rdbuf(out);
+                double megabytes = (width * bit_count + 31) / 32 * 4. *
+                    height / (1024. * 1024.);
+                double pixels = (double)width * height * repeats;
+                double write_speed = megabytes * repeats / write_time;
+                double read_speed = megabytes * repeats / read_time;
+                printf("suite %2u bit %6lux%-6lu  write %8.1f MB/s %7.2f "
+                    "ns/px  read %8.1f MB/s %7.2f ns/px  (%d)\n", bit_count,
+                    width, height, write_speed, write_time * 1e9 / pixels,
+                    read_speed, read_time * 1e9 / pixels, repeats);
+                if (csv)
+                {
+                    fprintf(csv, "%u,%lu,%lu,%d,%.6f,%.1f,%.3f,%.1f,%.3f,%s,"
+                        "%u\n", bit_count, width, height, repeats,
+                        megabytes, write_speed, write_time * 1e9 / pixels,
+                        read_speed, read_time * 1e9 / pixels, simd,
+                        image.get_threads());
+                }
+            }
+        }
+    }
+    if (csv)
+    {
+        fclose(csv);
+    }
+    return 1;
+}
+
+
+/**
+ * Функция выводит время этапов записи и загрузки изображения по
+ * счетчикам класса Image. Счетчики ведутся, только если программа
+ * собрана с макросом IMAGE_STATS.
+ * @param bit_count: глубина цвета;
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
+ */
+void bench_stages(unsigned short bit_count, unsigned long width,
+    unsigned long height)
+{
+    std::ostringstream quiet;
+    std::streambuf* out = std::cout.rdbuf(quiet.rdbuf());
+    ImageAdvanced image(0, bit_count, width, height);
+    fill_synthetic(image);
+    image.write_image(BENCH_FILENAME);
+    ImageStats stats[2] = { image.get_last_stats() };
+    ImageAdvanced loaded(BENCH_FILENAME);
+    stats[1] = loaded.get_last_stats();
+    std::cout.rdbuf(out);
+    const char* names[2] = { "write", "load" };
+    for (int k = 0; k < 2; k++)
+    {
+        printf("stages %2u bit %6lux%-6lu %-5s  total %8.3f ms  headers "
+            "%7.3f  alloc %7.3f  io %8.3f  convert %8.3f ms  %" PRIu64
+            " io calls\n",
+            bit_count, width, height, names[k], stats[k].total_time * 1000,
+            stats[k].stage_time[STAGE_HEADERS] * 1000,
+            stats[k].stage_time[STAGE_ALLOCATION] * 1000,
+            stats[k].stage_time[STAGE_IO] * 1000,
+            stats[k].stage_time[STAGE_CONVERT] * 1000,
+            stats[k].io_calls);
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    setlocale(LC_ALL, "Rus");
+    if (argc > 1 && std::string(argv[1]) == "--suite")
+    {
+        // Запуск: benchmark --suite [CSV файл] [наибольший размер]
+        const char* csv_name = argc > 2 ? argv[2] : nullptr;
+        unsigned long max_size = argc > 3 ?
+            strtoul(argv[3], nullptr, 10) : 16384;
+        int result = bench_suite(csv_name, max_size);
+        remove(BENCH_FILENAME);
+        return result ? 0 : 1;
+    }
+    bench_image(16, 4096, 2048);
+    unsigned short bit_counts[] = { 24, 32 };
+    for (unsigned short bit_count : bit_counts)
+    {
+        // Ширина, кратная 4, и нечетная ширина с выравниванием строк
+        bench_image(bit_count, 4096, 2048);
+        bench_image(bit_count, 4095, 2048);
+        bench_view(bit_count, 4096, 2048);
+    }
+    unsigned short indexed_bit_counts[] = { 1, 4, 8 };
+    for (unsigned short bit_count : indexed_bit_counts)
+    {
+        bench_indexed(bit_count, 4096, 2048);
+        bench_indexed(bit_count, 4095, 2048);
+    }
+    for (unsigned short bit_count : indexed_bit_counts)
+    {
+        bench_quantize(bit_count, 4096, 2048);
+    }
+    bench_rle(4, 4096, 2048);
+    bench_rle(8, 4096, 2048);
+    unsigned short thread_bit_counts[] = { 1, 8, 24, 32 };
+    for (unsigned short bit_count : thread_bit_counts)
+    {
+        bench_threads(bit_count, 8192, 8192);
+    }
+    for (unsigned short bit_count : bit_counts)
+    {
+        bench_stream(bit_count, 16384, 4096);
+    }
+    int copy_result = bench_copy(4096, 2048);
+    bench_probe(24, 4096, 2048);
+    unsigned short memory_bit_counts[] = { 8, 24, 32 };
+    for (unsigned short bit_count : memory_bit_counts)
+    {
+        bench_memory(bit_count, 4096, 2048);
+    }
+    bench_region(4096, 2048, 256);
+    bench_pipeline(4096, 2048);
+    bench_filter(4096, 2048);
+    bench_histogram(4096, 2048);
+    bench_grayscale(24, 4096, 2048);
+    bench_grayscale(8, 4096, 2048);
+    bench_transform(4096, 2048);
+    bench_resize(4096, 2048, 512, 256);
+    bench_resize(1024, 512, 4096, 2048);
+    bench_pyramid(4096, 2048);
+    bench_convert(4096 * 2048);
+    bench_bit_fields(4096 * 2048);
+    if (STATS_ENABLED)
+    {
+        // Программа собрана с макросом IMAGE_STATS
+        unsigned short stage_bit_counts[] = { 1, 8, 24, 32 };
+        for (unsigned short bit_count : stage_bit_counts)
+        {
+            bench_stages(bit_count, 4096, 2048);
+        }
+        dump_total_stats(stdout);
+    }
+    remove(BENCH_FILENAME);
+    return copy_result ? 0 : 1;
+}
@@ -0,0 +1,290 @@
+/*
+Модуль converter.cpp - пакетный конвертер BMP изображений. Программа
+обходит входной каталог, читает каждый BMP файл классом ImageAdvanced,
+меняет глубину цвета и записывает результат в выходной каталог с той же
+структурой подкаталогов. Файлы обрабатываются параллельно пулом потоков
+с кражей работы.
+Запуск: converter <входной каталог> <выходной каталог> <глубина цвета>
+[число потоков]
+Режим converter --index <каталог> <файл индекса> только обновляет индекс
+сведений о BMP файлах каталога (см. image_index.h).
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <clocale>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+#include "../Image/image_advanced.h"
+#include "../Image/image_index.h"
+#include "../Image/thread_pool.h"
+
+namespace fs = std::filesystem;
+
+
+/**
+ * Структура для хранения задачи преобразования одного файла и ее
+ * результата.
+ */
+struct ConvertTask
+{
+    // Входной файл
+    fs::path input;
+    // Выходной файл
+    fs::path output;
+    // Размер входного файла в байтах
+    std::uintmax_t input_size;
+    // Объем памяти пикселей изображения по заголовкам файла
+    std::uint64_t memory;
+    // Размер выходного файла в байтах
+    std::uintmax_t output_size;
+    // Время преобразования в секундах
+    double time;
+    // Если true, файл преобразован
+    bool done;
+    // Этап, на котором преобразование не удалось, или nullptr
+    const char* error;
+};
+
+
+/**
+ * Буфер потока вывода, отбрасывающий все символы. Сообщения классов
+ * изображений о каждом файле при пакетной работе не нужны и из разных
+ * потоков перемешиваются, поэтому они отключаются намеренно, а этап
+ * ошибки каждого файла выводится в отчете.
+ */
+class NullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c)
+    {
+        return c;
+    }
+};
+
+
+/**
+ * Функция возвращает текущее время в секундах.
+ * @return: время в секундах от произвольного момента.
+ */
+double get_time()
+{
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+/**
+ * Функция находит BMP файлы во входном каталоге и его подкаталогах,
+ * создает для них подкаталоги в выходном каталоге и составляет список
+ * задач. Заголовки файлов читаются заранее, и задачи упорядочиваются по
+ * убыванию объема памяти изображений: у сжатых файлов размер файла
+ * плохо отражает стоимость преобразования.
+ * @param input_dir: входной каталог;
+ * @param output_dir: выходной каталог;
+ * @param tasks: список для задач.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int collect_tasks(const fs::path& input_dir, const fs::path& output_dir,
+    std::vector<ConvertTask>& tasks)
+{
+    ImageIndex index;
+    if (!index.update_index(input_dir.string().c_str()))
+    {
+        return 0;
+    }
+    std::error_code error;
+    for (size_t i = 0; i < index.get_size(); i++)
+    {
+        const IndexEntry& entry = index.get_entry(i);
+        ConvertTask task;
+        task.input = entry.path;
+        task.output = output_dir / fs::relative(task.input, input_dir);
+        task.input_size = entry.info.file_size;
+        task.memory = entry.valid ? get_image_memory(entry.info) : 0;
+        task.output_size = 0;
+        task.time = 0;
+        task.done = false;
+        task.error = nullptr;
+        fs::create_directories(task.output.parent_path(), error);
+        tasks.push_back(task);
+    }
+    // Большие изображения раздаются первыми, мелкие выравнивают нагрузку
+    // в конце пакета
+    std::stable_sort(tasks.begin(), tasks.end(),
+        [](const ConvertTask& a, const ConvertTask& b)
+        { return a.memory > b.memory; });
+    return 1;
+}
+
+
+/**
+ * Функция преобразует один файл: читает изображение, меняет глубину
+ * цвета и записывает результат. Файл считается преобразованным, только
+ * если запись завершилась без ошибок.
+ * @param task: задача преобразования;
+ * @param bit_count: глубина цвета результата.
+ */
+void convert_file(ConvertTask& task, unsigned short bit_count)
+{
+    double start = get_time();
+    ImageAdvanced image;
+    if (!image.load_image(task.input.string().c_str()))
+    {
+        task.error = "не удалось прочитать";
+    }
+    else if (!image.set_bit_count(bit_count))
+    {
+        task.error = "не удалось изменить глубину цвета";
+    }
+    else if (!image.write_image(task.output.string().c_str()))
+    {
+        task.error = "не удалось записать";
+    }
+    else
+    {
+        std::error_code error;
+        task.output_size = fs::file_size(task.output, error);
+        task.done = true;
+    }
+    task.time = get_time() - start;
+}
+
+
+/**
+ * Функция выводит скорость преобразования каждого файла и общую
+ * скорость пакета.
+ * @param tasks: выполненные задачи;
+ * @param wall_time: время работы всего пакета в секундах;
+ * @param threads: число потоков.
+ */
+void print_report(const std::vector<ConvertTask>& tasks, double wall_time,
+    unsigned threads)
+{
+    const double megabyte = 1024. * 1024.;
+    double total = 0;
+    size_t failed = 0;
+    for (const ConvertTask& task : tasks)
+    {
+        double size = task.input_size / megabyte;
+        if (!task.done)
+        {
+            failed++;
+            printf("%-48s  ОШИБКА: %s\n", task.input.string().c_str(),
+                task.error ? task.error : "не обработан");
+            continue;
+        }
+        total += size;
+        printf("%-48s %9.2f MB %9.1f ms %9.1f MB/s\n",
+            task.input.string().c_str(), size, task.time * 1000,
+            task.time > 0 ? size / task.time : 0);
+    }
+    size_t converted = tasks.size() - failed;
+    printf("Файлов: %zu, преобразовано: %zu, ошибок: %zu, потоков: %u\n",
+        tasks.size(), converted, failed, threads);
+    printf("Прочитано %.2f MB за %.3f с: %.1f MB/s, %.1f изображений/с\n",
+        total, wall_time, wall_time > 0 ? total / wall_time : 0,
+        wall_time > 0 ? converted / wall_time : 0);
+}
+
+
+/**
+ * Функция обновляет индекс BMP файлов каталога и выводит сводку по нему.
+ * Если файла индекса еще нет или он поврежден, индекс строится заново.
+ * @param directory: каталог с изображениями;
+ * @param filename: имя файла индекса.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int update_index(const char* directory, const char* filename)
+{
+    const double megabyte = 1024. * 1024.;
+    ImageIndex index;
+    std::error_code error;
+    if (fs::exists(filename, error))
+    {
+        index.load_index(filename);
+    }
+    double start = get_time();
+    if (!index.update_index(directory) || !index.save_index(filename))
+    {
+        return 0;
+    }
+    double time = get_time() - start;
+    size_t invalid = 0;
+    std::uint64_t memory = 0;
+    std::uint64_t largest = 0;
+    for (size_t i = 0; i < index.get_size(); i++)
+    {
+        const IndexEntry& entry = index.get_entry(i);
+        if (!entry.valid)
+        {
+            invalid++;
+            continue;
+        }
+        std::uint64_t size = get_image_memory(entry.info);
+        memory += size;
+        largest = size > largest ? size : largest;
+    }
+    printf("Файлов: %zu, прочитано заголовков: %zu, из индекса: %zu, "
+        "удалено: %zu, неверных: %zu\n", index.get_size(),
+        index.get_probed(), index.get_reused(), index.get_removed(), invalid);
+    printf("Память изображений: %.2f MB, наибольшее изображение: %.2f MB, "
+        "обновление за %.3f с\n", memory / megabyte, largest / megabyte,
+        time);
+    return 1;
+}
+
+
+int main(int argc, char* argv[])
+{
+    setlocale(LC_ALL, "Rus");
+    if (argc == 4 && std::string(argv[1]) == "--index")
+    {
+        return update_index(argv[2], argv[3]) ? 0 : 1;
+    }
+    if (argc < 4)
+    {
+        std::cout << "Запуск: converter <входной каталог> " <<
+            "<выходной каталог> <глубина цвета> [число потоков]\n" <<
+            "или: converter --index <каталог> <файл индекса>\n";
+        return 1;
+    }
+    fs::path input_dir = argv[1];
+    fs::path output_dir = argv[2];
+    unsigned short bit_count = (unsigned short)atoi(argv[3]);
+    unsigned threads = argc > 4 ? (unsigned)atoi(argv[4]) : 0;
+    if (!get_format_codec(bit_count))
+    {
+        std::cout << "Ошибка! Глубина цвета должна быть 1, 4, 8, 16, " <<
+            "24 или 32 бит.\n";
+        return 1;
+    }
+    std::vector<ConvertTask> tasks;
+    if (!collect_tasks(input_dir, output_dir, tasks))
+    {
+        return 1;
+    }
+    WorkStealingPool pool(threads);
+    std::vector<std::function<void()>> jobs;
+    for (ConvertTask& task : tasks)
+    {
+        ConvertTask* current = &task;
+        jobs.push_back([current, bit_count]
+            { convert_file(*current, bit_count); });
+    }
+    // Сообщения о каждом файле отключаем на время работы пакета
+    NullBuffer null_buffer;
+    std::streambuf* out = std::cout.rdbuf(&null_buffer);
+    double start = get_time();
+    pool.run(jobs);
+    double wall_time = get_time() - start;
+    std::cout.rdbuf(out);
+    print_report(tasks, wall_time, pool.get_size());
+    return 0;
+}
@@ -0,0 +1,629 @@
+/*
+Модуль bit_fields.h содержит преобразование 16- и 32-битных пикселей,
+каналы которых заданы масками (BI_BITFIELDS), в цвета BGR и обратно.
+Каналы выделяются векторными сдвигами и умножениями, реализация
+выбирается по набору инструкций из pixel_convert.h.
+*/
+
+#pragma once
+#ifndef BIT_FIELDS_H
+#define BIT_FIELDS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "bmp_format.h"
+#include "pixel_convert.h"
+
+
+/**
+ * Структура с параметрами выделения одного канала из пикселя. Канал
+ * получается как (((pixel & mask) >> shift) * multiplier) >> scale_shift:
+ * каналы короче 8 бит повторяют свои биты до 8 бит (abcde -> abcdeabc),
+ * у длинных каналов остаются старшие 8 бит.
+ */
+struct ChannelField
+{
+    // Маска канала
+    std::uint32_t mask;
+    // Сдвиг вправо после наложения маски
+    unsigned shift;
+    // Множитель, повторяющий биты канала
+    unsigned multiplier;
+    // Сдвиг вправо после умножения
+    unsigned scale_shift;
+};
+
+
+/**
+ * Структура с параметрами преобразования пикселей с масками каналов.
+ */
+struct BitFields
+{
+    // Каналы в порядке синий, зеленый, красный
+    ChannelField channels[3];
+    // Если true, пиксель совпадает с BGRA и каналы не нужно выделять
+    bool bgra;
+    // Биты пикселя для каждого 8-битного значения каждого канала
+    std::uint32_t encode_table[3][256];
+};
+
+
+/**
+ * Функция возвращает маски каналов, которые подразумеваются для
+ * несжатых 16- и 32-битных изображений: 5-5-5 и 8-8-8.
+ * @param bit_count: глубина цвета.
+ * @return: маски каналов.
+ */
+BitMasks get_default_masks(unsigned short bit_count)
+{
+    BitMasks masks = { 0x00FF0000, 0x0000FF00, 0x000000FF };
+    if (bit_count == 16)
+    {
+        masks = { 0x7C00, 0x03E0, 0x001F };
+    }
+    return masks;
+}
+
+
+/**
+ * Функция определяет положение и длину маски.
+ * @param mask: маска;
+ * @param shift: номер младшего бита маски;
+ * @param bits: число бит от младшего бита до первого нулевого.
+ */
+void get_mask_range(std::uint32_t mask, unsigned& shift, unsigned& bits)
+{
+    shift = 0;
+    bits = 0;
+    while (mask && !(mask & 1))
+    {
+        mask >>= 1;
+        shift++;
+    }
+    while (mask & 1)
+    {
+        mask >>= 1;
+        bits++;
+    }
+}
+
+
+/**
+ * Функция проверяет маски каналов: каждая маска не пуста, ее биты идут
+ * подряд, маски не пересекаются и помещаются в пиксель.
+ * @param masks: маски каналов;
+ * @param bit_count: глубина цвета (16 или 32).
+ * @return: true, если маски подходят, иначе false.
+ */
+bool check_bit_masks(const BitMasks& masks, unsigned short bit_count)
+{
+    if (bit_count != 16 && bit_count != 32)
+    {
+        return false;
+    }
+    std::uint32_t channels[3] = { (std::uint32_t)masks.red,
+        (std::uint32_t)masks.green, (std::uint32_t)masks.blue };
+    std::uint32_t limit = bit_count == 16 ? 0xFFFF : 0xFFFFFFFF;
+    std::uint32_t used = 0;
+    for (std::uint32_t mask : channels)
+    {
+        if (mask == 0 || (mask & ~limit) || (mask & used))
+        {
+            return false;
+        }
+        unsigned shift;
+        unsigned bits;
+        get_mask_range(mask, shift, bits);
+        if (shift + bits < 32 && (mask >> (shift + bits)) != 0)
+        {
+            // Биты маски идут с разрывом
+            return false;
+        }
+        used |= mask;
+    }
+    return true;
+}
+
+
+/**
+ * Функция определяет, совпадают ли маски каналов.
+ * @param a: первые маски;
+ * @param b: вторые маски.
+ * @return: true, если совпадают, иначе false.
+ */
+bool is_same_masks(const BitMasks& a, const BitMasks& b)
+{
+    return a.red == b.red && a.green == b.green && a.blue == b.blue;
+}
+
+
+/**
+ * Функция определяет, нужно ли записывать маски каналов в файл: маски
+ * записываются, если они отличаются от масок по умолчанию.
+ * @param masks: маски каналов;
+ * @param bit_count: глубина цвета.
+ * @return: true, если маски записываются, иначе false.
+ */
+bool need_bit_fields(const BitMasks& masks, unsigned short bit_count)
+{
+    return (bit_count == 16 || bit_count == 32) &&
+        !is_same_masks(masks, get_default_masks(bit_count));
+}
+
+
+/**
+ * Функция вычисляет параметры выделения канала и таблицу записи канала.
+ * @param mask: маска канала;
+ * @param field: параметры выделения канала;
+ * @param table: таблица на 256 значений пикселя для каждой яркости.
+ */
+void make_channel_field(std::uint32_t mask, ChannelField& field,
+    std::uint32_t* table)
+{
+    unsigned shift;
+    unsigned bits;
+    get_mask_range(mask, shift, bits);
+    field.mask = mask;
+    field.shift = shift;
+    field.multiplier = 1;
+    field.scale_shift = 0;
+    if (bits >= 8)
+    {
+        // Оставляем старшие 8 бит канала
+        field.shift = shift + bits - 8;
+    }
+    else if (bits > 0)
+    {
+        // Повторяем биты канала, пока они не займут 8 бит
+        unsigned copies = (8 + bits - 1) / bits;
+        field.multiplier = 0;
+        for (unsigned k = 0; k < copies; k++)
+        {
+            field.multiplier |= 1u << (k * bits);
+        }
+        field.scale_shift = copies * bits - 8;
+    }
+    std::uint64_t max = bits ? (((std::uint64_t)1 << bits) - 1) : 0;
+    for (unsigned value = 0; value < 256; value++)
+    {
+        // Яркость переводится в значение канала с округлением
+        table[value] = (std::uint32_t)((value * max + 127) / 255) << shift;
+    }
+}
+
+
+/**
+ * Функция вычисляет параметры преобразования пикселей по маскам каналов.
+ * @param masks: проверенные маски каналов.
+ * @return: параметры преобразования.
+ */
+BitFields make_bit_fields(const BitMasks& masks)
+{
+    BitFields fields;
+    make_channel_field((std::uint32_t)masks.blue, fields.channels[0],
+        fields.encode_table[0]);
+    make_channel_field((std::uint32_t)masks.green, fields.channels[1],
+        fields.encode_table[1]);
+    make_channel_field((std::uint32_t)masks.red, fields.channels[2],
+        fields.encode_table[2]);
+    fields.bgra = is_same_masks(masks, get_default_masks(32));
+    return fields;
+}
+
+
+/**
+ * Функция возвращает параметры преобразования для масок по умолчанию.
+ * @param bit_count: глубина цвета (16 или 32).
+ * @return: ссылка на параметры преобразования.
+ */
+const BitFields& get_default_bit_fields(unsigned short bit_count)
+{
+    static const BitFields fields_16 = make_bit_fields(get_default_masks(16));
+    static const BitFields fields_32 = make_bit_fields(get_default_masks(32));
+    return bit_count == 16 ? fields_16 : fields_32;
+}
+
+
+/**
+ * Функция читает маски каналов BMP файла. При сжатии BI_BITFIELDS маски
+ * записаны сразу после первых 40 байт заголовка изображения (в
+ * заголовках версий 4 и 5 они входят в заголовок), иначе используются
+ * маски по умолчанию.
+ * @param file: BMP файл;
+ * @param header: заголовок изображения;
+ * @param masks: маски каналов.
+ * @return: 0, если маски не подходят к глубине цвета.
+ */
+int read_bit_masks(FILE* file, const BMPInfoHeader& header, BitMasks& masks)
+{
+    masks = get_default_masks(header.bit_count);
+    if (header.compression != COMPRESSION_BITFIELDS)
+    {
+        return 1;
+    }
+    fseek(file, sizeof(BMPFileHeader) + sizeof(BMPInfoHeader), SEEK_SET);
+    if (fread(&masks, sizeof(BitMasks), 1, file) != 1)
+    {
+        return 0;
+    }
+    return check_bit_masks(masks, header.bit_count) ? 1 : 0;
+}
+
+
+/**
+ * Функция выделяет 8-битный канал из пикселя скалярным кодом.
+ * @param pixel: пиксель;
+ * @param field: параметры канала.
+ * @return: значение канала.
+ */
+unsigned char get_channel(std::uint32_t pixel, const ChannelField& field)
+{
+    return (unsigned char)((((pixel & field.mask) >> field.shift) *
+        field.multiplier) >> field.scale_shift);
+}
+
+
+/**
+ * Функция преобразует 16-битные пиксели с масками каналов в BGR
+ * скалярным кодом.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей;
+ * @param fields: параметры каналов.
+ */
+void bit_fields_16_to_bgr_scalar(const unsigned char* src, RGBTriple* dst,
+    size_t count, const BitFields& fields)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        std::uint32_t pixel = src[i * 2] | (src[i * 2 + 1] << 8);
+        dst[i].blue = get_channel(pixel, fields.channels[0]);
+        dst[i].green = get_channel(pixel, fields.channels[1]);
+        dst[i].red = get_channel(pixel, fields.channels[2]);
+    }
+}
+
+
+/**
+ * Функция преобразует 32-битные пиксели с масками каналов в BGR
+ * скалярным кодом.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей;
+ * @param fields: параметры каналов.
+ */
+void bit_fields_32_to_bgr_scalar(const unsigned char* src, RGBTriple* dst,
+    size_t count, const BitFields& fields)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        std::uint32_t pixel;
+        memcpy(&pixel, src + i * 4, sizeof(pixel));
+        dst[i].blue = get_channel(pixel, fields.channels[0]);
+        dst[i].green = get_channel(pixel, fields.channels[1]);
+        dst[i].red = get_channel(pixel, fields.channels[2]);
+    }
+}
+
+
+#ifdef IMAGE_SIMD_X86
+/**
+ * Функция преобразует 16-битные пиксели с масками каналов в BGR
+ * инструкциями SSSE3. За шаг обрабатываются 8 пикселей: каналы
+ * выделяются в 16-битных элементах, собираются в BGRA и переставляются
+ * в BGR. Запись 16 байт захватывает 4 байта следующего шага.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей;
+ * @param fields: параметры каналов.
+ */
+IMAGE_TARGET_SSSE3
+void bit_fields_16_to_bgr_ssse3(const unsigned char* src, RGBTriple* dst,
+    size_t count, const BitFields& fields)
+{
+    __m128i masks[3];
+    __m128i shifts[3];
+    __m128i multipliers[3];
+    __m128i scale_shifts[3];
+    for (int k = 0; k < 3; k++)
+    {
+        const ChannelField& field = fields.channels[k];
+        masks[k] = _mm_set1_epi16((short)field.mask);
+        shifts[k] = _mm_cvtsi32_si128((int)field.shift);
+        multipliers[k] = _mm_set1_epi16((short)field.multiplier);
+        scale_shifts[k] = _mm_cvtsi32_si128((int)field.scale_shift);
+    }
+    const __m128i order = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13,
+        14, -1, -1, -1, -1);
+    size_t i = 0;
+    for (; i + 10 <= count; i += 8)
+    {
+        __m128i px = _mm_loadu_si128((const __m128i*)(src + i * 2));
+        __m128i channels[3];
+        for (int k = 0; k < 3; k++)
+        {
+            __m128i value = _mm_srl_epi16(_mm_and_si128(px, masks[k]),
+                shifts[k]);
+            channels[k] = _mm_srl_epi16(_mm_mullo_epi16(value,
+                multipliers[k]), scale_shifts[k]);
+        }
+        __m128i bg = _mm_or_si128(channels[0],
+            _mm_slli_epi16(channels[1], 8));
+        __m128i low = _mm_unpacklo_epi16(bg, channels[2]);
+        __m128i high = _mm_unpackhi_epi16(bg, channels[2]);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(low, order));
+        _mm_storeu_si128((__m128i*)(dst + i + 4),
+            _mm_shuffle_epi8(high, order));
+    }
+    bit_fields_16_to_bgr_scalar(src + i * 2, dst + i, count - i, fields);
+}
+
+
+/**
+ * Функция преобразует 32-битные пиксели с масками каналов в BGR
+ * инструкциями SSSE3. За шаг обрабатываются 4 пикселя.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей;
+ * @param fields: параметры каналов.
+ */
+IMAGE_TARGET_SSSE3
+void bit_fields_32_to_bgr_ssse3(const unsigned char* src, RGBTriple* dst,
+    size_t count, const BitFields& fields)
+{
+    __m128i masks[3];
+    __m128i shifts[3];
+    __m128i multipliers[3];
+    __m128i scale_shifts[3];
+    for (int k = 0; k < 3; k++)
+    {
+        const ChannelField& field = fields.channels[k];
+        masks[k] = _mm_set1_epi32((int)field.mask);
+        shifts[k] = _mm_cvtsi32_si128((int)field.shift);
+        multipliers[k] = _mm_set1_epi32((int)field.multiplier);
+        scale_shifts[k] = _mm_cvtsi32_si128((int)field.scale_shift);
+    }
+    const __m128i order = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13,
+        14, -1, -1, -1, -1);
+    size_t i = 0;
+    for (; i + 6 <= count; i += 4)
+    {
+        __m128i px = _mm_loadu_si128((const __m128i*)(src + i * 4));
+        __m128i channels[3];
+        for (int k = 0; k < 3; k++)
+        {
+            // Значение канала меньше 2^16, поэтому достаточно умножения
+            // младших 16-битных половин
+            __m128i value = _mm_srl_epi32(_mm_and_si128(px, masks[k]),
+                shifts[k]);
+            channels[k] = _mm_srl_epi32(_mm_mullo_epi16(value,
+                multipliers[k]), scale_shifts[k]);
+        }
+        __m128i bgra = _mm_or_si128(channels[0], _mm_or_si128(
+            _mm_slli_epi32(channels[1], 8), _mm_slli_epi32(channels[2], 16)));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(bgra, order));
+    }
+    bit_fields_32_to_bgr_scalar(src + i * 4, dst + i, count - i, fields);
+}
+
+
+/**
+ * Функция преобразует 16-битные пиксели с масками каналов в BGR
+ * инструкциями AVX2. За шаг обрабатываются 16 пикселей.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей;
+ * @param fields: параметры каналов.
+ */
+IMAGE_TARGET_AVX2
+void bit_fields_16_to_bgr_avx2(const unsigned char* src, RGBTriple* dst,
+    size_t count, const BitFields& fields)
+{
+    __m256i masks[3];
+    __m128i shifts[3];
+    __m256i multipliers[3];
+    __m128i scale_shifts[3];
+    for (int k = 0; k < 3; k++)
+    {
+        const ChannelField& field = fields.channels[k];
+        masks[k] = _mm256_set1_epi16((short)field.mask);
+        shifts[k] = _mm_cvtsi32_si128((int)field.shift);
+        multipliers[k] = _mm256_set1_epi16((short)field.multiplier);
+        scale_shifts[k] = _mm_cvtsi32_si128((int)field.scale_shift);
+    }
+    const __m256i order = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12,
+        13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1,
+        -1, -1, -1);
+    size_t i = 0;
+    for (; i + 18 <= count; i += 16)
+    {
+        __m256i px = _mm256_loadu_si256((const __m256i*)(src + i * 2));
+        __m256i channels[3];
+        for (int k = 0; k < 3; k++)
+        {
+            __m256i value = _mm256_srl_epi16(_mm256_and_si256(px, masks[k]),
+                shifts[k]);
+            channels[k] = _mm256_srl_epi16(_mm256_mullo_epi16(value,
+                multipliers[k]), scale_shifts[k]);
+        }
+        __m256i bg = _mm256_or_si256(channels[0],
+            _mm256_slli_epi16(channels[1], 8));
+        // Распаковка идет внутри 128-битных половин: low содержит
+        // пиксели 0-3 и 8-11, high - пиксели 4-7 и 12-15
+        __m256i low = _mm256_shuffle_epi8(_mm256_unpacklo_epi16(bg,
+            channels[2]), order);
+        __m256i high = _mm256_shuffle_epi8(_mm256_unpackhi_epi16(bg,
+            channels[2]), order);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm256_castsi256_si128(low));
+        _mm_storeu_si128((__m128i*)(dst + i + 4),
+            _mm256_castsi256_si128(high));
+        _mm_storeu_si128((__m128i*)(dst + i + 8),
+            _mm256_extracti128_si256(low, 1));
+        _mm_storeu_si128((__m128i*)(dst + i + 12),
+            _mm256_extracti128_si256(high, 1));
+    }
+    bit_fields_16_to_bgr_scalar(src + i * 2, dst + i, count - i, fields);
+}
+
+
+/**
+ * Функция преобразует 32-битные пиксели с масками каналов в BGR
+ * инструкциями AVX2. За шаг обрабатываются 8 пикселей.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей;
+ * @param fields: параметры каналов.
+ */
+IMAGE_TARGET_AVX2
+void bit_fields_32_to_bgr_avx2(const unsigned char* src, RGBTriple* dst,
+    size_t count, const BitFields& fields)
+{
+    __m256i masks[3];
+    __m128i shifts[3];
+    __m256i multipliers[3];
+    __m128i scale_shifts[3];
+    for (int k = 0; k < 3; k++)
+    {
+        const ChannelField& field = fields.channels[k];
+        masks[k] = _mm256_set1_epi32((int)field.mask);
+        shifts[k] = _mm_cvtsi32_si128((int)field.shift);
+        multipliers[k] = _mm256_set1_epi32((int)field.multiplier);
+        scale_shifts[k] = _mm_cvtsi32_si128((int)field.scale_shift);
+    }
+    const __m256i order = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12,
+        13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1,
+        -1, -1, -1);
+    size_t i = 0;
+    for (; i + 10 <= count; i += 8)
+    {
+        __m256i px = _mm256_loadu_si256((const __m256i*)(src + i * 4));
+        __m256i channels[3];
+        for (int k = 0; k < 3; k++)
+        {
+            __m256i value = _mm256_srl_epi32(_mm256_and_si256(px, masks[k]),
+                shifts[k]);
+            channels[k] = _mm256_srl_epi32(_mm256_mullo_epi16(value,
+                multipliers[k]), scale_shifts[k]);
+        }
+        __m256i bgra = _mm256_or_si256(channels[0], _mm256_or_si256(
+            _mm256_slli_epi32(channels[1], 8),
+            _mm256_slli_epi32(channels[2], 16)));
+        __m256i bgr = _mm256_shuffle_epi8(bgra, order);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm256_castsi256_si128(bgr));
+        _mm_storeu_si128((__m128i*)(dst + i + 4),
+            _mm256_extracti128_si256(bgr, 1));
+    }
+    bit_fields_32_to_bgr_scalar(src + i * 4, dst + i, count - i, fields);
+}
+#endif
+
+
+/**
+ * Функция преобразует 16-битные пиксели с масками каналов в BGR.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей;
+ * @param fields: параметры каналов.
+ */
+void convert_bit_fields_16_to_bgr(const unsigned char* src, RGBTriple* dst,
+    size_t count, const BitFields& fields)
+{
+#ifdef IMAGE_SIMD_X86
+    SimdLevel level = get_pixel_kernels().level;
+    if (level == SIMD_AVX2)
+    {
+        bit_fields_16_to_bgr_avx2(src, dst, count, fields);
+        return;
+    }
+    if (level == SIMD_SSSE3)
+    {
+        bit_fields_16_to_bgr_ssse3(src, dst, count, fields);
+        return;
+    }
+#endif
+    bit_fields_16_to_bgr_scalar(src, dst, count, fields);
+}
+
+
+/**
+ * Функция преобразует 32-битные пиксели с масками каналов в BGR. Если
+ * маски совпадают с BGRA, каналы не выделяются, а байты переставляются.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей;
+ * @param fields: параметры каналов.
+ */
+void convert_bit_fields_32_to_bgr(const unsigned char* src, RGBTriple* dst,
+    size_t count, const BitFields& fields)
+{
+    if (fields.bgra)
+    {
+        convert_bgra_to_bgr((const RGBQuad*)src, dst, count);
+        return;
+    }
+#ifdef IMAGE_SIMD_X86
+    SimdLevel level = get_pixel_kernels().level;
+    if (level == SIMD_AVX2)
+    {
+        bit_fields_32_to_bgr_avx2(src, dst, count, fields);
+        return;
+    }
+    if (level == SIMD_SSSE3)
+    {
+        bit_fields_32_to_bgr_ssse3(src, dst, count, fields);
+        return;
+    }
+#endif
+    bit_fields_32_to_bgr_scalar(src, dst, count, fields);
+}
+
+
+/**
+ * Функция преобразует пиксели BGR в 16-битные пиксели с масками каналов
+ * по таблицам каналов.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей;
+ * @param fields: параметры каналов.
+ */
+void convert_bgr_to_bit_fields_16(const RGBTriple* src, unsigned char* dst,
+    size_t count, const BitFields& fields)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        std::uint32_t pixel = fields.encode_table[0][src[i].blue] |
+            fields.encode_table[1][src[i].green] |
+            fields.encode_table[2][src[i].red];
+        dst[i * 2] = (unsigned char)pixel;
+        dst[i * 2 + 1] = (unsigned char)(pixel >> 8);
+    }
+}
+
+
+/**
+ * Функция преобразует пиксели BGR в 32-битные пиксели с масками каналов.
+ * Если маски совпадают с BGRA, байты переставляются без таблиц.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей;
+ * @param fields: параметры каналов.
+ */
+void convert_bgr_to_bit_fields_32(const RGBTriple* src, unsigned char* dst,
+    size_t count, const BitFields& fields)
+{
+    if (fields.bgra)
+    {
+        convert_bgr_to_bgra(src, (RGBQuad*)dst, count);
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        std::uint32_t pixel = fields.encode_table[0][src[i].blue] |
+            fields.encode_table[1][src[i].green] |
+            fields.encode_table[2][src[i].red];
+        memcpy(dst + i * 4, &pixel, sizeof(pixel));
+    }
+}
+
+#endif
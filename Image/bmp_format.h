@@ -0,0 +1,153 @@
+/*
+Модуль bmp_format.h содержит определения структур заголовков и пикселей
+BMP файла и функции, переводящие высоту заголовка файла со строками
+сверху вниз в число строк и обратно.
+*/
+
+#pragma once
+#ifndef BMP_FORMAT_H
+#define BMP_FORMAT_H
+
+#include <cstdint>
+
+
+// Типы сжатия BMP файла (поле compression заголовка изображения)
+// Без сжатия
+const unsigned long COMPRESSION_RGB = 0;
+// Сжатие длинами серий 8-битных индексов палитры
+const unsigned long COMPRESSION_RLE8 = 1;
+// Сжатие длинами серий 4-битных индексов палитры
+const unsigned long COMPRESSION_RLE4 = 2;
+// Каналы 16- и 32-битных пикселей заданы масками после заголовка
+const unsigned long COMPRESSION_BITFIELDS = 3;
+
+
+#pragma pack(push, 1)
+/**
+ * Структура для хранения данных из заголовка BMP файла.
+ */
+struct BMPFileHeader
+{
+    // Тип файла (0x4D42 для BMP)
+    unsigned short file_type{ 0x4D42 };
+    // Размер файла в байтах (bit_count * height * width + offset_bits)
+    unsigned long file_size{ 0 };
+    // Зарезервирован (всегда 0)
+    unsigned short reserved1{ 0 };
+    // Зарезервирован (всегда 0)
+    unsigned short reserved2{ 0 };
+    // Смещение данных о пикселях от начала файла в байтах
+    unsigned long offset_data{ 0 };
+};
+#pragma pack(pop)
+
+
+/**
+ * Структура для хранения данных из заголовка изображения.
+ */
+struct BMPInfoHeader
+{
+    // Число байтов, необходимое для этой структуры (40)
+    unsigned long size{ 0 };
+    // Ширина точечного рисунка в пикселях
+    unsigned long width{ 0 };
+    // Высота точечного рисунка в пикселях
+    unsigned long height{ 0 };
+    // Число плоскостей целевого устройства (всегда 1)
+    unsigned short planes{ 1 };
+    // Глубина цвета, число бит на точку (0, 1, 4, 8, 16, 24, 32)
+    unsigned short bit_count{ 0 };
+    // Тип сжатия (0 для несжатого изображения)
+    unsigned long compression{ 0 };
+    // Размер изображения в байтах (bit_count * height * width)
+    unsigned long size_image{ 0 };
+    // Разрешающая способность по горизонтали
+    unsigned long x_px_per_meter{ 0 };
+    // Разрешающая способность по вертикали
+    unsigned long y_px_per_meter{ 0 };
+    // Число индексов используемых цветов (если все цвета, то 0)
+    unsigned long colors_used{ 0 };
+    // Число необходимых цветов (если требуются все цвета, то 0)
+    unsigned long colors_important{ 0 };
+};
+
+
+/**
+ * Структура для хранения масок каналов 16- и 32-битных пикселей. При
+ * сжатии BI_BITFIELDS маски записываются сразу после заголовка
+ * изображения.
+ */
+struct BitMasks
+{
+    // Маска красного канала
+    unsigned long red;
+    // Маска зеленого канала
+    unsigned long green;
+    // Маска синего канала
+    unsigned long blue;
+};
+
+
+/**
+ * Структура для цветовых значений пикселя изображения.
+ */
+struct RGBQuad
+{
+    unsigned char blue; // синий цвет
+    unsigned char green; // зеленый цвет
+    unsigned char red; // красный цвет
+    unsigned char reserved;
+};
+
+
+/**
+ * Структура для цветовых значений пикселя изображения.
+ */
+struct RGBTriple
+{
+    unsigned char blue; // синий цвет
+    unsigned char green; // зеленый цвет
+    unsigned char red; // красный цвет
+};
+
+
+/**
+ * Функция приводит высоту из прочитанного заголовка изображения к числу
+ * строк. BMP файл, строки которого идут сверху вниз, хранит высоту
+ * отрицательным 32-битным числом.
+ * @param info_header: заголовок изображения.
+ * @return: true, если строки в файле идут сверху вниз, иначе false.
+ */
+bool read_top_down(BMPInfoHeader& info_header)
+{
+    std::int32_t height = (std::int32_t)info_header.height;
+    if (height >= 0)
+    {
+        return false;
+    }
+    info_header.height = (unsigned long)(-(std::int64_t)height);
+    return true;
+}
+
+
+/**
+ * Функция возвращает заголовок изображения в том виде, в котором он
+ * записывается в файл: у изображения со строками сверху вниз высота
+ * отрицательна.
+ * @param info_header: заголовок изображения с числом строк;
+ * @param top_down: если true, строки записываются сверху вниз.
+ * @return: заголовок для записи.
+ */
+BMPInfoHeader get_file_info_header(const BMPInfoHeader& info_header,
+    bool top_down)
+{
+    BMPInfoHeader file_info_header = info_header;
+    if (top_down)
+    {
+        file_info_header.height = (unsigned long)(std::uint32_t)(
+            -(std::int32_t)info_header.height);
+    }
+    return file_info_header;
+}
+
+#endif
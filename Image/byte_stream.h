@@ -0,0 +1,695 @@
+/*
+Модуль byte_stream.h содержит потоки байтов, через которые классы
+изображений читают и записывают BMP данные: файл, массив байтов в памяти
+и растущий буфер в памяти. Функции чтения и записи строк пикселей
+работают с любым потоком, поэтому загрузка из памяти и запись в память
+используют те же функции преобразования строк, что и работа с файлами.
+*/
+
+#pragma once
+#ifndef BYTE_STREAM_H
+#define BYTE_STREAM_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <share.h>
+#endif
+#include "bit_fields.h"
+#include "bmp_format.h"
+
+
+/**
+ * Функция открывает файл с совместным доступом, чтобы потоки чтения
+ * могли открыть этот же файл еще раз.
+ * @param filename: имя файла;
+ * @param mode: режим открытия.
+ * @return: открытый файл или nullptr.
+ */
+FILE* open_file(const char* filename, const char* mode)
+{
+    FILE* file = nullptr;
+#ifdef _WIN32
+    // fopen_s открывает файл без совместного доступа
+    file = _fsopen(filename, mode, _SH_DENYNO);
+#else
+    file = fopen(filename, mode);
+#endif
+    return file;
+}
+
+
+/**
+ * Функция устанавливает положение в файле. Смещение может быть больше
+ * 2 ГБ.
+ * @param file: открытый файл;
+ * @param offset: смещение от начала файла.
+ * @return: 0, если положение установлено.
+ */
+int seek_file(FILE* file, long long offset)
+{
+#ifdef _WIN32
+    return _fseeki64(file, offset, SEEK_SET);
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+
+/**
+ * Функция возвращает размер открытого файла. Размер может быть больше
+ * 2 ГБ. Положение в файле переносится в конец.
+ * @param file: открытый файл.
+ * @return: размер в байтах.
+ */
+std::uint64_t get_file_size(FILE* file)
+{
+#ifdef _WIN32
+    _fseeki64(file, 0, SEEK_END);
+    long long size = _ftelli64(file);
+#else
+    fseeko(file, 0, SEEK_END);
+    long long size = (long long)ftello(file);
+#endif
+    return size > 0 ? (std::uint64_t)size : 0;
+}
+
+
+/**
+ * Базовый класс потока байтов BMP данных. Методы чтения и записи
+ * повторяют fread и fwrite. Потоки в памяти дополнительно отдают
+ * указатели прямо на свои байты, чтобы строки пикселей преобразовывались
+ * без промежуточного буфера.
+ */
+class ByteStream
+{
+public:
+    // Деструктор класса
+    virtual ~ByteStream();
+    // Метод читает элементы заданного размера
+    virtual size_t read(void*, size_t, size_t) = 0;
+    // Метод записывает элементы заданного размера
+    virtual size_t write(const void*, size_t, size_t) = 0;
+    // Метод устанавливает положение от начала потока
+    virtual int seek(std::uint64_t) = 0;
+    // Метод возвращает положение от начала потока
+    virtual std::uint64_t tell() = 0;
+    // Метод возвращает размер потока в байтах
+    virtual std::uint64_t get_size() = 0;
+    // Метод открывает независимый поток для чтения тех же данных
+    virtual ByteStream* open_copy() const = 0;
+    // Метод возвращает следующие байты для чтения без копирования
+    virtual const unsigned char* map_read(size_t);
+    // Метод возвращает место для записи следующих байтов
+    virtual unsigned char* map_write(size_t);
+};
+
+
+/**
+ * Деструктор класса ByteStream.
+ */
+ByteStream::~ByteStream()
+{
+}
+
+
+/**
+ * Метод класса ByteStream возвращает указатель на следующие байты
+ * потока и сдвигает положение за них. Поток, который не хранит байты в
+ * памяти, указатель не отдает.
+ * @param size: число байтов.
+ * @return: указатель на байты или nullptr, если байты нельзя получить
+ * без копирования или в потоке их меньше size.
+ */
+const unsigned char* ByteStream::map_read(size_t)
+{
+    return nullptr;
+}
+
+
+/**
+ * Метод класса ByteStream возвращает указатель на место для следующих
+ * байтов потока и сдвигает положение за них. Место заполнено нулями.
+ * @param size: число байтов.
+ * @return: указатель на место или nullptr, если поток не хранит байты
+ * в памяти.
+ */
+unsigned char* ByteStream::map_write(size_t)
+{
+    return nullptr;
+}
+
+
+/**
+ * Класс потока байтов BMP файла.
+ */
+class FileStream : public ByteStream
+{
+protected:
+    // Открытый файл
+    FILE* file;
+    // Имя файла для открытия копий потока
+    std::string filename;
+    // Если true, запись в файл не удалась
+    bool failed;
+
+public:
+    // Конструктор класса без параметров
+    FileStream();
+    // Деструктор класса
+    ~FileStream();
+    // Метод открывает файл
+    int open(const char*, const char*);
+    // Метод закрывает файл и сообщает, была ли запись успешной
+    int close();
+    // Метод читает элементы заданного размера
+    size_t read(void*, size_t, size_t);
+    // Метод записывает элементы заданного размера
+    size_t write(const void*, size_t, size_t);
+    // Метод устанавливает положение от начала файла
+    int seek(std::uint64_t);
+    // Метод возвращает положение от начала файла
+    std::uint64_t tell();
+    // Метод возвращает размер файла
+    std::uint64_t get_size();
+    // Метод открывает файл еще раз для чтения
+    ByteStream* open_copy() const;
+
+private:
+    // Копировать открытый файл нельзя
+    FileStream(const FileStream&);
+    FileStream& operator = (const FileStream&);
+};
+
+
+/**
+ * Конструктор класса FileStream без параметров. Создает поток без
+ * открытого файла.
+ */
+FileStream::FileStream()
+{
+    file = nullptr;
+    failed = false;
+}
+
+
+/**
+ * Деструктор класса FileStream. Закрывает файл.
+ */
+FileStream::~FileStream()
+{
+    close();
+}
+
+
+/**
+ * Метод класса FileStream открывает файл с совместным доступом.
+ * Прежний файл закрывается.
+ * @param name: имя файла;
+ * @param mode: режим открытия.
+ * @return: 0, если файл не удалось открыть.
+ */
+int FileStream::open(const char* name, const char* mode)
+{
+    close();
+    file = open_file(name, mode);
+    filename = name;
+    failed = false;
+    return file ? 1 : 0;
+}
+
+
+/**
+ * Метод класса FileStream закрывает файл. Ошибки записи накапливаются
+ * до закрытия, поэтому записанный файл верен, только если метод вернул 1.
+ * @return: 0, если запись или закрытие файла не удались.
+ */
+int FileStream::close()
+{
+    if (file && fclose(file) != 0)
+    {
+        failed = true;
+    }
+    file = nullptr;
+    int result = failed ? 0 : 1;
+    failed = false;
+    return result;
+}
+
+
+/**
+ * Метод класса FileStream читает элементы из файла.
+ * @param buffer: массив для элементов;
+ * @param size: размер элемента в байтах;
+ * @param count: число элементов.
+ * @return: число прочитанных целиком элементов.
+ */
+size_t FileStream::read(void* buffer, size_t size, size_t count)
+{
+    return fread(buffer, size, count, file);
+}
+
+
+/**
+ * Метод класса FileStream записывает элементы в файл.
+ * @param buffer: массив элементов;
+ * @param size: размер элемента в байтах;
+ * @param count: число элементов.
+ * @return: число записанных элементов; неполная запись запоминается до
+ * закрытия файла.
+ */
+size_t FileStream::write(const void* buffer, size_t size, size_t count)
+{
+    size_t written = fwrite(buffer, size, count, file);
+    if (written != count && size != 0)
+    {
+        failed = true;
+    }
+    return written;
+}
+
+
+/**
+ * Метод класса FileStream устанавливает положение в файле.
+ * @param offset: смещение от начала файла.
+ * @return: 0, если положение установлено.
+ */
+int FileStream::seek(std::uint64_t offset)
+{
+    return seek_file(file, (long long)offset);
+}
+
+
+/**
+ * Метод класса FileStream возвращает положение в файле.
+ * @return: смещение от начала файла.
+ */
+std::uint64_t FileStream::tell()
+{
+#ifdef _WIN32
+    long long position = _ftelli64(file);
+#else
+    long long position = (long long)ftello(file);
+#endif
+    return position > 0 ? (std::uint64_t)position : 0;
+}
+
+
+/**
+ * Метод класса FileStream возвращает размер файла. Положение в файле
+ * не меняется.
+ * @return: размер в байтах.
+ */
+std::uint64_t FileStream::get_size()
+{
+    std::uint64_t position = tell();
+    std::uint64_t size = get_file_size(file);
+    seek(position);
+    return size;
+}
+
+
+/**
+ * Метод класса FileStream открывает этот же файл еще раз для чтения,
+ * чтобы полосы строк читались в потоках независимо.
+ * @return: новый поток, который нужно удалить, или nullptr.
+ */
+ByteStream* FileStream::open_copy() const
+{
+    FileStream* copy = new FileStream;
+    if (!copy->open(filename.c_str(), "rb"))
+    {
+        delete copy;
+        return nullptr;
+    }
+    return copy;
+}
+
+
+/**
+ * Класс потока для чтения BMP данных из массива байтов в памяти,
+ * например из буфера, принятого по сети. Массив не копируется и должен
+ * существовать, пока существует поток.
+ */
+class MemoryReader : public ByteStream
+{
+protected:
+    // Массив байтов
+    const unsigned char* bytes;
+    // Размер массива в байтах
+    size_t size;
+    // Положение от начала массива
+    size_t position;
+
+public:
+    // Конструктор класса, читающий массив байтов
+    MemoryReader(const unsigned char*, size_t);
+    // Метод читает элементы заданного размера
+    size_t read(void*, size_t, size_t);
+    // Метод записывать не дает
+    size_t write(const void*, size_t, size_t);
+    // Метод устанавливает положение от начала массива
+    int seek(std::uint64_t);
+    // Метод возвращает положение от начала массива
+    std::uint64_t tell();
+    // Метод возвращает размер массива
+    std::uint64_t get_size();
+    // Метод открывает поток для чтения того же массива
+    ByteStream* open_copy() const;
+    // Метод возвращает следующие байты массива без копирования
+    const unsigned char* map_read(size_t);
+};
+
+
+/**
+ * Конструктор класса MemoryReader.
+ * @param data: массив байтов;
+ * @param length: размер массива в байтах.
+ */
+MemoryReader::MemoryReader(const unsigned char* data, size_t length)
+{
+    bytes = data;
+    size = data ? length : 0;
+    position = 0;
+}
+
+
+/**
+ * Метод класса MemoryReader читает элементы из массива. Как и fread,
+ * метод копирует все доступные байты, но возвращает число целых
+ * элементов.
+ * @param buffer: массив для элементов;
+ * @param element_size: размер элемента в байтах;
+ * @param count: число элементов.
+ * @return: число прочитанных целиком элементов.
+ */
+size_t MemoryReader::read(void* buffer, size_t element_size, size_t count)
+{
+    if (element_size == 0)
+    {
+        return 0;
+    }
+    size_t available = size - position;
+    size_t bytes_num = element_size * count;
+    if (bytes_num > available)
+    {
+        bytes_num = available;
+    }
+    if (bytes_num == 0)
+    {
+        return 0;
+    }
+    memcpy(buffer, bytes + position, bytes_num);
+    position += bytes_num;
+    return bytes_num / element_size;
+}
+
+
+/**
+ * Метод класса MemoryReader не записывает элементы: массив доступен
+ * только для чтения.
+ * @return: 0.
+ */
+size_t MemoryReader::write(const void*, size_t, size_t)
+{
+    return 0;
+}
+
+
+/**
+ * Метод класса MemoryReader устанавливает положение в массиве.
+ * @param offset: смещение от начала массива.
+ * @return: 0, если положение установлено, иначе положение переносится
+ * в конец массива.
+ */
+int MemoryReader::seek(std::uint64_t offset)
+{
+    if (offset > size)
+    {
+        position = size;
+        return 1;
+    }
+    position = (size_t)offset;
+    return 0;
+}
+
+
+/**
+ * Метод класса MemoryReader возвращает положение в массиве.
+ * @return: смещение от начала массива.
+ */
+std::uint64_t MemoryReader::tell()
+{
+    return position;
+}
+
+
+/**
+ * Метод класса MemoryReader возвращает размер массива.
+ * @return: размер в байтах.
+ */
+std::uint64_t MemoryReader::get_size()
+{
+    return size;
+}
+
+
+/**
+ * Метод класса MemoryReader открывает поток для чтения того же массива
+ * с начала.
+ * @return: новый поток, который нужно удалить.
+ */
+ByteStream* MemoryReader::open_copy() const
+{
+    return new MemoryReader(bytes, size);
+}
+
+
+/**
+ * Метод класса MemoryReader возвращает указатель на следующие байты
+ * массива и сдвигает положение за них.
+ * @param length: число байтов.
+ * @return: указатель на байты или nullptr, если в массиве их меньше.
+ */
+const unsigned char* MemoryReader::map_read(size_t length)
+{
+    if (length > size - position)
+    {
+        return nullptr;
+    }
+    const unsigned char* mapped = bytes + position;
+    position += length;
+    return mapped;
+}
+
+
+/**
+ * Класс потока для записи BMP данных в растущий буфер в памяти. Запись
+ * за концом буфера увеличивает его, промежутки заполняются нулями.
+ */
+class MemoryWriter : public ByteStream
+{
+protected:
+    // Буфер для записи
+    std::vector<unsigned char>* buffer;
+    // Положение от начала буфера
+    size_t position;
+
+public:
+    // Конструктор класса, записывающий в буфер
+    MemoryWriter(std::vector<unsigned char>&);
+    // Метод читает элементы заданного размера
+    size_t read(void*, size_t, size_t);
+    // Метод записывает элементы заданного размера
+    size_t write(const void*, size_t, size_t);
+    // Метод устанавливает положение от начала буфера
+    int seek(std::uint64_t);
+    // Метод возвращает положение от начала буфера
+    std::uint64_t tell();
+    // Метод возвращает размер буфера
+    std::uint64_t get_size();
+    // Метод не открывает копий: буфер меняется при записи
+    ByteStream* open_copy() const;
+    // Метод возвращает место в буфере для записи следующих байтов
+    unsigned char* map_write(size_t);
+
+private:
+    // Метод увеличивает буфер так, чтобы в нем поместились байты
+    unsigned char* reserve(size_t);
+};
+
+
+/**
+ * Конструктор класса MemoryWriter. Запись начинается с начала буфера,
+ * прежнее содержимое буфера удаляется.
+ * @param bytes: буфер для записи.
+ */
+MemoryWriter::MemoryWriter(std::vector<unsigned char>& bytes)
+{
+    buffer = &bytes;
+    buffer->clear();
+    position = 0;
+}
+
+
+/**
+ * Метод класса MemoryWriter увеличивает буфер так, чтобы с текущего
+ * положения в нем поместились length байтов, и сдвигает положение за
+ * них.
+ * @param length: число байтов.
+ * @return: указатель на место для байтов.
+ */
+unsigned char* MemoryWriter::reserve(size_t length)
+{
+    if (buffer->size() < position + length)
+    {
+        // vector увеличивает емкость с запасом, поэтому запись
+        // небольшими частями не копирует буфер каждый раз
+        buffer->resize(position + length);
+    }
+    unsigned char* place = buffer->data() + position;
+    position += length;
+    return place;
+}
+
+
+/**
+ * Метод класса MemoryWriter читает элементы из уже записанной части
+ * буфера.
+ * @param bytes: массив для элементов;
+ * @param element_size: размер элемента в байтах;
+ * @param count: число элементов.
+ * @return: число прочитанных целиком элементов.
+ */
+size_t MemoryWriter::read(void* bytes, size_t element_size, size_t count)
+{
+    if (element_size == 0 || position >= buffer->size())
+    {
+        return 0;
+    }
+    size_t available = buffer->size() - position;
+    size_t bytes_num = element_size * count;
+    if (bytes_num > available)
+    {
+        bytes_num = available;
+    }
+    memcpy(bytes, buffer->data() + position, bytes_num);
+    position += bytes_num;
+    return bytes_num / element_size;
+}
+
+
+/**
+ * Метод класса MemoryWriter записывает элементы в буфер.
+ * @param bytes: массив элементов;
+ * @param element_size: размер элемента в байтах;
+ * @param count: число элементов.
+ * @return: число записанных элементов.
+ */
+size_t MemoryWriter::write(const void* bytes, size_t element_size,
+    size_t count)
+{
+    size_t bytes_num = element_size * count;
+    if (bytes_num != 0)
+    {
+        memcpy(reserve(bytes_num), bytes, bytes_num);
+    }
+    return count;
+}
+
+
+/**
+ * Метод класса MemoryWriter устанавливает положение в буфере. Положение
+ * может быть за концом буфера, как у файла, открытого для записи.
+ * @param offset: смещение от начала буфера.
+ * @return: 0.
+ */
+int MemoryWriter::seek(std::uint64_t offset)
+{
+    position = (size_t)offset;
+    return 0;
+}
+
+
+/**
+ * Метод класса MemoryWriter возвращает положение в буфере.
+ * @return: смещение от начала буфера.
+ */
+std::uint64_t MemoryWriter::tell()
+{
+    return position;
+}
+
+
+/**
+ * Метод класса MemoryWriter возвращает размер записанного буфера.
+ * @return: размер в байтах.
+ */
+std::uint64_t MemoryWriter::get_size()
+{
+    return buffer->size();
+}
+
+
+/**
+ * Метод класса MemoryWriter не открывает копий потока: указатели на
+ * байты буфера меняются при его увеличении.
+ * @return: nullptr.
+ */
+ByteStream* MemoryWriter::open_copy() const
+{
+    return nullptr;
+}
+
+
+/**
+ * Метод класса MemoryWriter возвращает место в буфере для следующих
+ * байтов, чтобы строки пикселей преобразовывались прямо в буфер.
+ * @param length: число байтов.
+ * @return: указатель на место, заполненное нулями.
+ */
+unsigned char* MemoryWriter::map_write(size_t length)
+{
+    size_t start = position;
+    size_t size = buffer->size();
+    unsigned char* place = reserve(length);
+    if (start < size)
+    {
+        // Место перекрывает уже записанные байты, новые байты буфера
+        // vector заполняет нулями сам
+        size_t written = size - start;
+        memset(place, 0, written < length ? written : length);
+    }
+    return place;
+}
+
+
+/**
+ * Функция читает маски каналов BMP данных из потока. При сжатии
+ * BI_BITFIELDS маски записаны сразу после первых 40 байт заголовка
+ * изображения, иначе используются маски по умолчанию.
+ * @param stream: поток BMP данных;
+ * @param header: заголовок изображения;
+ * @param masks: маски каналов.
+ * @return: 0, если маски не подходят к глубине цвета.
+ */
+int read_bit_masks(ByteStream& stream, const BMPInfoHeader& header,
+    BitMasks& masks)
+{
+    masks = get_default_masks(header.bit_count);
+    if (header.compression != COMPRESSION_BITFIELDS)
+    {
+        return 1;
+    }
+    stream.seek(sizeof(BMPFileHeader) + sizeof(BMPInfoHeader));
+    if (stream.read(&masks, sizeof(BitMasks), 1) != 1)
+    {
+        return 0;
+    }
+    return check_bit_masks(masks, header.bit_count) ? 1 : 0;
+}
+
+#endif
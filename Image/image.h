@@ -1,179 +1,280 @@
 /*
- image.h    Image,  
- BMP .
+Модуль image.h содержит определение класса Image, хранящего данные
+о BMP изображении.
 */
 
 #pragma once
 #ifndef IMAGE_H
 #define IMAGE_H
 
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <utility>
+#include <vector>
+#include "bit_fields.h"
+#include "bmp_format.h"
+#include "byte_stream.h"
+#include "image_probe.h"
+#include "image_stats.h"
+#include "pixel_convert.h"
+#include "pixel_format.h"
+#include "thread_pool.h"
 
 
-#pragma pack(push, 1)
-/**
- *       BMP .
- */
-struct BMPFileHeader
-{
-    //   (0x4D42  BMP)
-    unsigned short file_type{ 0x4D42 };
-    //     (bit_count * height * width + offset_bits)
-    unsigned long file_size{ 0 };
-    //  ( 0)
-    unsigned short reserved1{ 0 };
-    //  ( 0)
-    unsigned short reserved2{ 0 };
-    //         
-    unsigned long offset_data{ 0 };
-};
-#pragma pack(pop)
-
-
-/**
- *       .
- */
-struct BMPInfoHeader
-{
-    //  ,     (40)
-    unsigned long size{ 0 };
-    //     
-    unsigned long width{ 0 };
-    //     
-    unsigned long height{ 0 };
-    //     ( 1)
-    unsigned short planes{ 1 };
-    //  ,     (0, 1, 4, 8, 16, 24, 32)
-    unsigned short bit_count{ 0 };
-    //   (0   )
-    unsigned long compression{ 0 };
-    //     (bit_count * height * width)
-    unsigned long size_image{ 0 };
-    //    
-    unsigned long x_px_per_meter{ 0 };
-    //    
-    unsigned long y_px_per_meter{ 0 };
-    //     (  ,  0)
-    unsigned long colors_used{ 0 };
-    //    (   ,  0)
-    unsigned long colors_important{ 0 };
-};
+// Функция чтения строк [first, first + rows) из потока, установленного
+// на первую из них
+typedef std::function<void(ByteStream&, unsigned long, unsigned long)>
+    RowReader;
 
 
 /**
- *      .
+ * Функция заполняет поля заголовков, зависящие от размеров изображения,
+ * палитры и масок каналов. Записывается только заголовок
+ * BITMAPINFOHEADER, поэтому его размер и смещение поля пикселей
+ * пересчитываются. Ширина, высота и глубина цвета берутся из заголовка
+ * изображения.
+ * @param file_header: заголовок файла;
+ * @param info_header: заголовок изображения;
+ * @param colors_num: число цветов палитры, которая будет записана;
+ * @param bit_fields: true, если за заголовком записываются маски каналов.
  */
-struct RGBQuad
+void fill_headers(BMPFileHeader& file_header, BMPInfoHeader& info_header,
+    unsigned long colors_num, bool bit_fields)
 {
-    unsigned char blue; //  
-    unsigned char green; //  
-    unsigned char red; //  
-    unsigned char reserved;
-};
+    info_header.size = sizeof(BMPInfoHeader);
+    info_header.compression = COMPRESSION_RGB;
+    info_header.colors_used = colors_num;
+    info_header.size_image = (unsigned long)get_bmp_row_size(
+        info_header.width, info_header.bit_count) * info_header.height;
+    file_header.offset_data = sizeof(BMPFileHeader) + sizeof(BMPInfoHeader) +
+        colors_num * sizeof(RGBQuad);
+    if (bit_fields)
+    {
+        // Маски каналов записываются между заголовком и пикселями
+        info_header.compression = COMPRESSION_BITFIELDS;
+        file_header.offset_data += sizeof(BitMasks);
+    }
+    file_header.file_size = file_header.offset_data + info_header.size_image;
+}
 
 
 /**
- *      .
+ * Структура для хранения массива пикселей, который могут совместно
+ * использовать несколько изображений (копирование при записи).
  */
-struct RGBTriple
+struct PixelBuffer
 {
-    unsigned char blue; //  
-    unsigned char green; //  
-    unsigned char red; //  
+    // Массив пикселей
+    RGBTriple* pixels;
+    // Число пикселей в массиве
+    size_t size;
+    // Число изображений, использующих массив
+    std::atomic<unsigned long> references;
 };
 
 
+class ImageFilter;
+class ImagePipeline;
+class ImageRegion;
+class ImageResize;
+class ImageTransform;
+
+
 /**
- *     BMP .
+ * Класс для работы с BMP изображениями.
  */
 class Image
 {
 protected:
-    //     
+    // Параметр для хранения заголовка файла
     BMPFileHeader file_header;
-    //     
+    // Параметр для хранения заголовка изображения
     BMPInfoHeader bmp_info_header;
-    //        
+    // Маски каналов 16- и 32-битных пикселей
+    BitMasks masks;
+    // Если true, строки в файле идут сверху вниз (отрицательная высота в
+    // заголовке). Массив data всегда хранит строки снизу вверх
+    bool top_down;
+    // Одномерный массив для хранения цветов о пикселях изображения
     RGBTriple* data;
+    // Буфер, которому принадлежит массив data
+    PixelBuffer* buffer;
+    // Если true, копии изображения разделяют буфер до первой записи
+    bool copy_on_write;
+    // Число потоков для чтения массива пикселей
+    unsigned threads;
+    // Число выделений памяти под массивы пикселей за время работы
+    static std::atomic<unsigned long> allocations;
+    // Счетчики последнего вызова загрузки или записи (при IMAGE_STATS)
+    StatsCollector stats;
 
 public:
-    //    
+    // Конструктор класса без параметров
     Image();
-    //  ,    BMP 
+    // Конструктор класса, считывающий изображение из BMP файла
     Image(const char*);
-    //  ,  
-    Image(Image&);
-    //  ,     
+    // Конструктор класса, копирующий изображение
+    Image(const Image&);
+    // Конструктор класса, перемещающий изображение
+    Image(Image&&) noexcept;
+    // Конструктор класса, создающий новое изображение по параметрам
     Image(unsigned char, unsigned short, unsigned long,
         unsigned long);
-    //  
+    // Деструктор класса
     ~Image();
-    //   
-    Image operator = (Image);
-    //     BMP 
+    // Переопределение оператора присваивания с копированием
+    Image& operator = (const Image&);
+    // Переопределение оператора присваивания с перемещением
+    Image& operator = (Image&&) noexcept;
+    // Метод загружает изображение из BMP файла
     int load_image(const char*);
-    //     BMP 
-    void write_image(const char*);
+    // Метод загружает изображение из BMP данных в памяти
+    int load_image(const unsigned char*, size_t);
+    // Метод записывает изображение в BMP файл
+    int write_image(const char*);
+    // Метод записывает изображение BMP данными в буфер в памяти
+    int write_image(std::vector<unsigned char>&);
+    // Метод включает или выключает копирование при записи
+    void set_copy_on_write(bool);
+    // Метод определяет, разделяет ли изображение буфер с другими
+    bool is_shared() const;
+    // Метод задает число потоков для чтения массива пикселей
+    void set_threads(unsigned);
+    // Метод возвращает число потоков для чтения массива пикселей
+    unsigned get_threads() const;
+    // Метод возвращает массив пикселей для изменения
+    RGBTriple* get_data();
+    // Метод возвращает массив пикселей для чтения
+    const RGBTriple* get_data() const;
+    // Метод возвращает ширину изображения
+    unsigned long get_width() const;
+    // Метод возвращает высоту изображения
+    unsigned long get_height() const;
+    // Метод возвращает глубину цвета изображения
+    unsigned short get_bit_count() const;
+    // Метод задает маски каналов 16- и 32-битных пикселей
+    int set_bit_masks(unsigned long, unsigned long, unsigned long);
+    // Метод возвращает маски каналов
+    BitMasks get_bit_masks() const;
+    // Метод задает порядок строк, в котором изображение записывается
+    void set_top_down(bool);
+    // Метод определяет, идут ли строки в файле сверху вниз
+    bool is_top_down() const;
+    // Метод возвращает число выделений памяти под массивы пикселей
+    static unsigned long get_allocations();
+    // Метод возвращает счетчики последней загрузки или записи
+    ImageStats get_last_stats() const;
 
 protected:
-    //  ,    
-    bool check_empty();
-    //     
-    bool copy_image(Image&);
-    //      24- BMP 
-    void read_data_24(FILE*);
-    //      32- BMP 
-    void read_data_32(FILE*);
-    //      24- BMP 
-    void write_data_24(FILE*);
-    //      32- BMP 
-    void write_data_32(FILE*);
+    // Метод определяет, является ли изображение пустым
+    bool check_empty() const;
+    // Метод копирует изображение по ссылке
+    bool copy_image(const Image&);
+    // Метод выделяет новый массив пикселей
+    void allocate_data(size_t);
+    // Метод освобождает массив пикселей
+    void release_data();
+    // Метод делает массив пикселей собственным перед записью
+    void detach_data();
+    // Метод возвращает размер строки пикселей в BMP файле с выравниванием
+    unsigned long get_row_size() const;
+    // Метод возвращает число строк, читаемых или записываемых за один вызов
+    unsigned long get_rows_in_block();
+    // Метод заполняет размеры и смещения в заголовках перед записью
+    void update_headers(unsigned long);
+    // Метод определяет, записываются ли маски каналов в файл
+    bool check_bit_fields() const;
+    // Метод проверяет прочитанные заголовки по размеру BMP данных
+    int check_headers(std::uint64_t);
+    // Метод читает изображение из потока BMP данных
+    int read_stream(ByteStream&);
+    // Метод записывает изображение в поток BMP данных
+    int write_stream(ByteStream&);
+    // Метод записывает маски каналов после заголовка изображения
+    void write_bit_masks(ByteStream&);
+    // Метод читает массив пикселей полосами строк в нескольких потоках
+    void read_rows(ByteStream&, const RowReader&);
+    // Метод читает строки пикселей из потока BMP данных
+    void read_data(ByteStream&, unsigned long, unsigned long,
+        const RowContext&);
+    // Метод записывает массив пикселей в поток BMP данных
+    void write_data(ByteStream&, const RowContext&);
+    // Метод возвращает место строки файла с номером 0 и шаг между
+    // строками файла в массиве data
+    RGBTriple* get_file_rows(ptrdiff_t&) const;
+    // Метод возвращает номер строки массива пикселей для строки файла
+    unsigned long get_data_row(unsigned long) const;
+    // Метод записывает заголовок изображения с высотой, учитывающей
+    // порядок строк
+    void write_info_header(ByteStream&, bool);
+
+    // Прямоугольник изображения, цепочка операций, фильтр,
+    // преобразования и изменение размера создают новые изображения
+    friend class ImageRegion;
+    friend class ImagePipeline;
+    friend class ImageFilter;
+    friend class ImageTransform;
+    friend class ImageResize;
 };
 
 
+// Число выделений памяти под массивы пикселей за время работы
+std::atomic<unsigned long> Image::allocations(0);
+
+
 /**
- *   Image  .   
- *     .
+ * Конструктор класса Image без параметров. Заголовки файла и
+ * изображения принимают значения по умолчанию.
  */
 Image::Image()
 {
-    //     
+    // Одномерный массив с данными пикселей
     data = nullptr;
+    buffer = nullptr;
+    copy_on_write = false;
+    threads = 1;
+    top_down = false;
+    masks = get_default_masks(bmp_info_header.bit_count);
 }
 
 
 /**
- *   Image,    BMP .
- * @param filename:    .
+ * Конструктор класса Image, считывающий изображение из BMP файла.
+ * @param filename: имя файла с изображением.
  */
-Image::Image(const char* filename)
+Image::Image(const char* filename) : Image()
 {
     load_image(filename);
 }
 
 
 /**
- *   Image,   .
- * @param mode:    ;
- * @param bit_count:  ;
- * @param width:  ;
- * @param height:  .
+ * Конструктор класса Image, создающий новое изображение.
+ * @param mode: значение для цветов пикселя;
+ * @param bit_count: глубина изображения;
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
  */
 Image::Image(unsigned char mode, unsigned short bit_count,
-    unsigned long width, unsigned long height)
+    unsigned long width, unsigned long height) : Image()
 {
-    //   
+    // Заполняем заголовок изображения
     bmp_info_header.size = sizeof(BMPInfoHeader);
-    bmp_info_header.bit_count = bit_count; //  
-    bmp_info_header.height = height; // 
-    bmp_info_header.width = width; // 
-    //    
+    bmp_info_header.bit_count = bit_count; // глубина цвета
+    bmp_info_header.height = height; // высота
+    bmp_info_header.width = width; // ширина
+    masks = get_default_masks(bit_count);
+    // Заполняем поля файлового заголовка
     file_header.offset_data = sizeof(BMPFileHeader) + sizeof(BMPInfoHeader);
     file_header.file_size = bit_count * height * width + 
         file_header.offset_data;
-    //      
-    data = new RGBTriple[width * height];
-    //     
+    // Выделяем память для данных о пикселях
+    allocate_data((size_t)width * height);
+    // Записываем в массив заданный цвет
     RGBTriple rgbtriple = { mode, mode, mode };
     for (unsigned int i = 0; i < height; i++)
     {
@@ -182,37 +283,50 @@ Image::Image(unsigned char mode, unsigned short bit_count,
             data[i * width + j] = rgbtriple;
         }
     }
-    std::cout << " .\n";
+    std::cout << "Изображение создано.\n";
 }
 
 
 /**
- *    Image.
- * @param image:   BMP,   .
+ * Конструктор копий класса Image. Если у исходного изображения включено
+ * копирование при записи, копия разделяет с ним массив пикселей.
+ * @param image: готовое изображение BMP, которуе будет скопировано.
  */
-Image::Image(Image& image)
+Image::Image(const Image& image) : Image()
 {
     copy_image(image);
 }
 
 
 /**
- *   Image.
+ * Конструктор перемещения класса Image. Массив пикселей забирается у
+ * исходного изображения без копирования.
+ * @param image: изображение, которое будет перемещено.
+ */
+Image::Image(Image&& image) noexcept : Image()
+{
+    *this = std::move(image);
+}
+
+
+/**
+ * Деструктор класса Image.
  */
 Image::~Image()
 {
-    //   
-    delete[] data;
+    // Удаляем массив пикселей
+    release_data();
 }
 
 
 /**
- *    =   Image.
- * @param image: ,  .
+ * Переопределение оператора присваивания = для класса Image.
+ * @param image: изображение, которое копируется.
+ * @return: ссылка на это изображение.
  */
-Image Image::operator = (Image image)
+Image& Image::operator = (const Image& image)
 {
-    if (check_empty())
+    if (this != &image)
     {
         copy_image(image);
     }
@@ -221,37 +335,292 @@ Image Image::operator = (Image image)
 
 
 /**
- *   Image     .
- * @param image:   ,   .
+ * Переопределение оператора присваивания = с перемещением для класса
+ * Image. Исходное изображение становится пустым.
+ * @param image: изображение, которое перемещается.
+ * @return: ссылка на это изображение.
  */
-bool Image::copy_image(Image& image)
+Image& Image::operator = (Image&& image) noexcept
 {
-    //   
+    if (this != &image)
+    {
+        release_data();
+        file_header = image.file_header;
+        bmp_info_header = image.bmp_info_header;
+        masks = image.masks;
+        top_down = image.top_down;
+        data = image.data;
+        buffer = image.buffer;
+        copy_on_write = image.copy_on_write;
+        threads = image.threads;
+        image.file_header = BMPFileHeader();
+        image.bmp_info_header = BMPInfoHeader();
+        image.data = nullptr;
+        image.buffer = nullptr;
+    }
+    return *this;
+}
+
+
+/**
+ * Метод класа Image для копирования изображения по ссылке. Если у
+ * исходного изображения включено копирование при записи, массив
+ * пикселей не копируется, а разделяется.
+ * @param image: ссылка на изображение, которое нужно скопировать.
+ */
+bool Image::copy_image(const Image& image)
+{
+    // Освобождаем собственный массив пикселей
+    release_data();
+    // Копируем заголовок файла
     file_header = image.file_header;
-    //   
+    // Копируем заголовок изображения
     bmp_info_header = image.bmp_info_header;
-    //     
-    int height = image.bmp_info_header.height;
-    int width = image.bmp_info_header.width;
-    //    
-    data = new RGBTriple[width * height];
-    for (unsigned int i = 0; i < image.bmp_info_header.height; i++)
+    masks = image.masks;
+    top_down = image.top_down;
+    copy_on_write = image.copy_on_write;
+    threads = image.threads;
+    if (!image.buffer)
     {
-        for (unsigned int j = 0; j < image.bmp_info_header.width; j++)
-        {
-            data[i * width + j] = image.data[i * width + j];
-        }
+        return true;
     }
+    if (copy_on_write)
+    {
+        // Разделяем массив пикселей до первой записи
+        buffer = image.buffer;
+        buffer->references++;
+        data = buffer->pixels;
+        return true;
+    }
+    // Копируем массив пикселей изображения
+    allocate_data(image.buffer->size);
+    memcpy(data, image.data, image.buffer->size * sizeof(RGBTriple));
     return true;
 }
 
 
 /**
- *   Image ,   -
- *   .
- * @return: true,  ,  false.
+ * Метод класса Image выделяет новый массив пикселей. Прежний массив
+ * освобождается.
+ * @param size: число пикселей.
+ */
+void Image::allocate_data(size_t size)
+{
+    StageTimer timer(&stats, STAGE_ALLOCATION);
+    release_data();
+    buffer = new PixelBuffer;
+    buffer->pixels = new RGBTriple[size];
+    buffer->size = size;
+    buffer->references = 1;
+    data = buffer->pixels;
+    allocations++;
+    count_allocation(&stats, (std::uint64_t)size * sizeof(RGBTriple));
+}
+
+
+/**
+ * Метод класса Image освобождает массив пикселей. Если массив
+ * разделяется с другими изображениями, уменьшается только число ссылок.
+ */
+void Image::release_data()
+{
+    if (buffer && --buffer->references == 0)
+    {
+        // Изображение было последним владельцем массива
+        delete[] buffer->pixels;
+        delete buffer;
+    }
+    buffer = nullptr;
+    data = nullptr;
+}
+
+
+/**
+ * Метод класса Image делает массив пикселей собственным. Вызывается
+ * перед изменением пикселей: если массив разделяется с другими
+ * изображениями, он копируется.
+ */
+void Image::detach_data()
+{
+    if (!buffer || buffer->references == 1)
+    {
+        return;
+    }
+    PixelBuffer* shared = buffer;
+    buffer = nullptr;
+    allocate_data(shared->size);
+    memcpy(data, shared->pixels, shared->size * sizeof(RGBTriple));
+    if (--shared->references == 0)
+    {
+        // Другие владельцы успели освободить массив
+        delete[] shared->pixels;
+        delete shared;
+    }
+}
+
+
+/**
+ * Метод класса Image включает или выключает копирование при записи.
+ * Копии изображения с включенным режимом разделяют массив пикселей,
+ * пока одна из них не запросит его для изменения.
+ * @param enabled: true, чтобы включить режим.
+ */
+void Image::set_copy_on_write(bool enabled)
+{
+    copy_on_write = enabled;
+}
+
+
+/**
+ * Метод класса Image определяет, разделяет ли изображение массив
+ * пикселей с другими изображениями.
+ * @return: true, если разделяет, иначе false.
+ */
+bool Image::is_shared() const
+{
+    return buffer && buffer->references > 1;
+}
+
+
+/**
+ * Метод класса Image возвращает массив пикселей для изменения. Если
+ * массив разделяется с другими изображениями, он сначала копируется.
+ * @return: указатель на первый пиксель.
+ */
+RGBTriple* Image::get_data()
+{
+    detach_data();
+    return data;
+}
+
+
+/**
+ * Метод класса Image возвращает массив пикселей для чтения.
+ * @return: указатель на первый пиксель.
+ */
+const RGBTriple* Image::get_data() const
+{
+    return data;
+}
+
+
+/**
+ * Метод класса Image возвращает ширину изображения.
+ * @return: ширина в пикселях.
+ */
+unsigned long Image::get_width() const
+{
+    return bmp_info_header.width;
+}
+
+
+/**
+ * Метод класса Image возвращает высоту изображения.
+ * @return: высота в пикселях.
+ */
+unsigned long Image::get_height() const
+{
+    return bmp_info_header.height;
+}
+
+
+/**
+ * Метод класса Image задает порядок строк, в котором изображение
+ * записывается в файл. Изображение, прочитанное из файла со строками
+ * сверху вниз, по умолчанию записывается так же. Массив пикселей не
+ * меняется: строки переставляются при записи.
+ * @param enabled: если true, строки записываются сверху вниз.
+ */
+void Image::set_top_down(bool enabled)
+{
+    top_down = enabled;
+}
+
+
+/**
+ * Метод класса Image определяет, идут ли строки в файле сверху вниз.
+ * @return: true, если строки идут сверху вниз, иначе false.
+ */
+bool Image::is_top_down() const
+{
+    return top_down;
+}
+
+
+/**
+ * Метод класса Image возвращает глубину цвета изображения.
+ * @return: число бит на пиксель.
+ */
+unsigned short Image::get_bit_count() const
+{
+    return bmp_info_header.bit_count;
+}
+
+
+/**
+ * Метод класса Image задает маски каналов, с которыми 16- или 32-битное
+ * изображение будет записано. Маски, отличные от масок по умолчанию,
+ * записываются в файл со сжатием BI_BITFIELDS, например 5-6-5:
+ * set_bit_masks(0xF800, 0x07E0, 0x001F).
+ * @param red: маска красного канала;
+ * @param green: маска зеленого канала;
+ * @param blue: маска синего канала.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int Image::set_bit_masks(unsigned long red, unsigned long green,
+    unsigned long blue)
+{
+    BitMasks new_masks = { red, green, blue };
+    if (!check_bit_masks(new_masks, bmp_info_header.bit_count))
+    {
+        std::cout << "Ошибка! Маски каналов должны быть непрерывными, " <<
+            "не пересекаться и помещаться в 16- или 32-битный пиксель.\n";
+        return 0;
+    }
+    masks = new_masks;
+    return 1;
+}
+
+
+/**
+ * Метод класса Image возвращает маски каналов 16- и 32-битных пикселей.
+ * @return: маски каналов.
+ */
+BitMasks Image::get_bit_masks() const
+{
+    return masks;
+}
+
+
+/**
+ * Метод класса Image возвращает число выделений памяти под массивы
+ * пикселей за время работы программы.
+ * @return: число выделений.
+ */
+unsigned long Image::get_allocations()
+{
+    return allocations;
+}
+
+
+/**
+ * Метод класса Image возвращает счетчики последнего успешного вызова
+ * load_image или write_image. Счетчики ведутся, только если модуль
+ * собран с макросом IMAGE_STATS.
+ * @return: счетчики вызова; без IMAGE_STATS все счетчики нулевые.
+ */
+ImageStats Image::get_last_stats() const
+{
+    return stats.get_last();
+}
+
+
+/**
+ * Метод класса Image определяет, является ли изображение-объект
+ * этого класса пустым.
+ * @return: true, если является, иначе false.
  */
-bool Image::check_empty()
+bool Image::check_empty() const
 {
     if (bmp_info_header.size == 0)
     {
@@ -262,202 +631,453 @@ bool Image::check_empty()
 
 
 /**
- *   Image     BMP .
- * @param filename:    .
- * @returm: 0,      .
+ * Метод класса Image для загрузки изображения из BMP файла.
+ * @param filename: имя файла с изображением.
+ * @returm: 0, если при выполнении функции произошла ошибка.
  */
 int Image::load_image(const char* filename)
 {
-    //  BMP 
-    FILE* file;
-    fopen_s(&file, filename, "rb");
-    if (!file)
+    stats.begin();
+    StageTimer open_timer(&stats, STAGE_HEADERS);
+    // Открываем BMP файл с совместным доступом для потоков чтения
+    FileStream file;
+    if (!file.open(filename, "rb"))
     {
-        //     
-        std::cout << "!     '" << 
+        // Если файл не был открыт
+        std::cout << "Ошибка! Не удалось открыть файл '" << 
             filename << "'.\n";
         return 0;
     }
-    //   
-    fread(&file_header, sizeof(BMPFileHeader), 1, file);
-    if (file_header.file_type != 0x4D42)
+    open_timer.stop();
+    if (!read_stream(file))
     {
-        //    BMP 
-        fclose(file);
-        std::cout << "!     BMP .\n";
         return 0;
     }
-    //   
-    fread(&bmp_info_header, sizeof(BMPInfoHeader), 1, file);
-    if (bmp_info_header.compression != 0 ||
-        (bmp_info_header.bit_count != 24 && bmp_info_header.bit_count != 32))
+    std::cout << "Изображение из BMP файла '" << filename <<
+        "' прочитано.\n";
+    stats.finish(OPERATION_LOAD);
+    return 1;
+}
+
+
+/**
+ * Метод класса Image для загрузки изображения из BMP данных в памяти,
+ * например из принятого по сети буфера. Данные читаются теми же
+ * функциями формата, что и файл, без временного файла.
+ * @param bytes: BMP данные;
+ * @param size: размер данных в байтах.
+ * @returm: 0, если при выполнении функции произошла ошибка.
+ */
+int Image::load_image(const unsigned char* bytes, size_t size)
+{
+    stats.begin();
+    MemoryReader memory(bytes, size);
+    if (!read_stream(memory))
     {
-        //       
-        //   24  32
-        fclose(file);
-        std::cout << "!     " <<
-            "    24  32 .\n";
         return 0;
     }
-    //      
-    fseek(file, file_header.offset_data, SEEK_SET);
-    //      
-    data = new RGBTriple[bmp_info_header.width * bmp_info_header.height];
-    //     BMP 
-    if (bmp_info_header.bit_count == 24)
+    std::cout << "Изображение из памяти прочитано.\n";
+    stats.finish(OPERATION_LOAD);
+    return 1;
+}
+
+
+/**
+ * Метод класса Image проверяет прочитанные заголовки до выделения
+ * памяти и чтения пикселей: размеры и поля заголовков берутся из
+ * непроверенных данных, а поле пикселей должно помещаться в BMP данные.
+ * @param size: размер BMP данных в байтах.
+ * @return: 0, если заголовки неверны.
+ */
+int Image::check_headers(std::uint64_t size)
+{
+    ImageInfo info;
+    const char* error = check_image_headers(file_header, bmp_info_header,
+        size, info);
+    if (!error && get_image_memory(info) > SIZE_MAX)
     {
-        //   24-
-        read_data_24(file);
+        error = "Изображение не помещается в память.";
     }
-    else
+    if (error)
     {
-        //   32-
-        read_data_32(file);
+        std::cout << "Ошибка! " << error << "\n";
+        return 0;
     }
-    std::cout << "  BMP  '" << filename <<
-        "' .\n";
-    //  ,   
-    fclose(file);
     return 1;
 }
 
 
 /**
- *   Image      
- * 24-  BMP.
- * @param file:  BMP .
+ * Метод класса Image читает заголовки и массив пикселей из потока BMP
+ * данных.
+ * @param stream: поток, установленный на начало BMP данных.
+ * @returm: 0, если при выполнении функции произошла ошибка.
  */
-void Image::read_data_24(FILE* file)
+int Image::read_stream(ByteStream& stream)
 {
-    //   24-,    ,
-    //   4
-    int padding = bmp_info_header.width % 4;
-    for (unsigned int i = 0; i < bmp_info_header.height; i++)
+    StageTimer headers_timer(&stats, STAGE_HEADERS);
+    // Считываем файловый заголовок
+    bool read = stream.read(&file_header, sizeof(BMPFileHeader), 1) == 1;
+    count_read(&stats, sizeof(BMPFileHeader));
+    // Считываем заголовок изображения
+    read = read && file_header.file_type == 0x4D42 &&
+        stream.read(&bmp_info_header, sizeof(BMPInfoHeader), 1) == 1;
+    if (!read)
     {
-        //       
-        for (unsigned int j = 0; j < bmp_info_header.width; j++)
-        {
-            //       .
-            //     RGBTriple
-            fread(&data[i * bmp_info_header.width + j], sizeof(RGBTriple),
-                1, file);
-        }
-        fseek(file, padding, SEEK_CUR);
+        // Работаем только с BMP файлами
+        std::cout << "Ошибка! Файл не имеет требуемый BMP формат.\n";
+        return 0;
+    }
+    count_read(&stats, sizeof(BMPInfoHeader));
+    if (!check_headers(stream.get_size()))
+    {
+        return 0;
     }
+    top_down = read_top_down(bmp_info_header);
+    unsigned short bit_count = bmp_info_header.bit_count;
+    if ((bit_count != 16 && bit_count != 24 && bit_count != 32) ||
+        (bmp_info_header.compression != COMPRESSION_RGB &&
+        (bmp_info_header.compression != COMPRESSION_BITFIELDS ||
+        bit_count == 24)))
+    {
+        // Работаем только с несжатыми беспалитровыми изображениями с
+        // грубиной цвета 16, 24 или 32 и с масками каналов
+        std::cout << "Ошибка! Изображение должно быть несжатым " <<
+            "беспалитровым с глубиной цвета 16, 24 или 32 бит.\n";
+        return 0;
+    }
+    if (!read_bit_masks(stream, bmp_info_header, masks))
+    {
+        std::cout << "Ошибка! Маски каналов изображения не подходят к " <<
+            "глубине цвета.\n";
+        return 0;
+    }
+    if (bmp_info_header.compression == COMPRESSION_BITFIELDS)
+    {
+        count_read(&stats, sizeof(BitMasks));
+    }
+    // Сдвигаем положение курсора на поле пикселей
+    stream.seek(file_header.offset_data);
+    BitFields fields = make_bit_fields(masks);
+    headers_timer.stop();
+    // Выделяем память для данных о пикселях
+    allocate_data((size_t)bmp_info_header.width * bmp_info_header.height);
+    // Читаем массив пикселей из BMP данных, беспалитровым форматам
+    // данные палитры не нужны
+    RowContext context = {};
+    context.fields = &fields;
+    context.stats = &stats;
+    read_rows(stream, [this, &context](ByteStream& band,
+        unsigned long first, unsigned long rows)
+        { read_data(band, first, rows, context); });
+    return 1;
+}
+
+
+/**
+ * Метод класса Image возвращает размер строки пикселей в BMP файле.
+ * Строка дополняется байтами до кратности 4.
+ * @return: размер строки в байтах.
+ */
+unsigned long Image::get_row_size() const
+{
+    return (unsigned long)get_bmp_row_size(bmp_info_header.width,
+        bmp_info_header.bit_count);
+}
+
+
+/**
+ * Метод класса Image возвращает число строк пикселей, которые
+ * помещаются в буфер блочного чтения и записи.
+ * @return: число строк в блоке (не меньше 1).
+ */
+unsigned long Image::get_rows_in_block()
+{
+    return get_block_rows(get_row_size(), bmp_info_header.height);
 }
 
 
 /**
- *   Image      
- * 32-  BMP.
- * @param file:  BMP .
+ * Метод класса Image читает массив пикселей. Если задано больше одного
+ * потока, строки делятся на полосы, каждая полоса читается в пуле
+ * потоков через собственную копию потока BMP данных прямо в свои строки
+ * data. Смещение каждой строки известно заранее, так как строки
+ * несжатого изображения имеют одинаковый размер.
+ * @param stream: поток, установленный на поле пикселей;
+ * @param reader: функция чтения полосы строк.
  */
-void Image::read_data_32(FILE* file)
+void Image::read_rows(ByteStream& stream, const RowReader& reader)
 {
-    //   32-,    4
-    RGBQuad px;
-    for (unsigned int i = 0; i < bmp_info_header.height; i++)
+    unsigned long height = bmp_info_header.height;
+    // Полоса не меньше блока чтения и делится поровну между потоками
+    unsigned long band = get_rows_in_block();
+    if (threads > 1 && band < (height + threads - 1) / threads)
     {
-        //       
-        for (unsigned int j = 0; j < bmp_info_header.width; j++)
+        band = (height + threads - 1) / threads;
+    }
+    if (threads <= 1 || band >= height)
+    {
+        reader(stream, 0, height);
+        return;
+    }
+    std::uint64_t offset = file_header.offset_data;
+    std::uint64_t row_size = get_row_size();
+    std::atomic<bool> failed(false);
+    get_thread_pool().parallel_for(0, height, band,
+        [&](size_t first, size_t last)
         {
-            //       .
-            //     RGBTriple
-            fread(&px, sizeof(RGBQuad), 1, file);
-            data[i * bmp_info_header.width + j].blue = px.blue;
-            data[i * bmp_info_header.width + j].green = px.green;
-            data[i * bmp_info_header.width + j].red = px.red;
-        }
+            ByteStream* band_stream = stream.open_copy();
+            if (!band_stream)
+            {
+                failed = true;
+                return;
+            }
+            band_stream->seek(offset + first * row_size);
+            reader(*band_stream, (unsigned long)first,
+                (unsigned long)(last - first));
+            delete band_stream;
+        });
+    if (failed)
+    {
+        // Копию потока не удалось открыть, читаем все строки через
+        // основной поток, он по-прежнему установлен на поле пикселей
+        reader(stream, 0, height);
+    }
+}
+
+
+/**
+ * Метод класса Image задает число потоков, которыми читается массив
+ * пикселей при загрузке. По умолчанию изображение читается одним
+ * потоком.
+ * @param count: число потоков, 0 - по числу ядер процессора.
+ */
+void Image::set_threads(unsigned count)
+{
+    threads = count ? count : get_hardware_threads();
+}
+
+
+/**
+ * Метод класса Image возвращает число потоков для чтения массива
+ * пикселей.
+ * @return: число потоков.
+ */
+unsigned Image::get_threads() const
+{
+    return threads;
+}
+
+
+/**
+ * Метод класса Image заполняет поля заголовков, зависящие от размеров
+ * изображения и палитры.
+ * @param colors_num: число цветов палитры, которая будет записана.
+ */
+void Image::update_headers(unsigned long colors_num)
+{
+    fill_headers(file_header, bmp_info_header, colors_num,
+        check_bit_fields());
+}
+
+
+/**
+ * Метод класса Image определяет, нужно ли записывать маски каналов:
+ * маски записываются, если они отличаются от масок по умолчанию.
+ * @return: true, если маски записываются, иначе false.
+ */
+bool Image::check_bit_fields() const
+{
+    return need_bit_fields(masks, bmp_info_header.bit_count);
+}
+
+
+/**
+ * Метод класса Image записывает маски каналов, если изображение
+ * записывается со сжатием BI_BITFIELDS.
+ * @param stream: поток, установленный после заголовка изображения.
+ */
+void Image::write_bit_masks(ByteStream& stream)
+{
+    if (bmp_info_header.compression == COMPRESSION_BITFIELDS)
+    {
+        stream.write(&masks, sizeof(BitMasks), 1);
+        count_write(&stats, sizeof(BitMasks));
     }
 }
 
 
 /**
- *   Image    BMP .
- * @param filename:  ,     .
+ * Метод класса Image читает строки пикселей из потока BMP данных
+ * функцией формата, выбранной по глубине цвета.
+ * @param stream: поток, установленный на первую строку;
+ * @param first: номер первой строки;
+ * @param count: число строк;
+ * @param context: палитра и таблицы палитрового формата.
  */
-void Image::write_image(const char* filename)
+void Image::read_data(ByteStream& stream, unsigned long first,
+    unsigned long count, const RowContext& context)
 {
-    //  
-    FILE* file;
-    fopen_s(&file, filename, "wb");
-    if (!file)
+    const FormatCodec* codec = get_format_codec(bmp_info_header.bit_count);
+    ptrdiff_t stride;
+    RGBTriple* rows = get_file_rows(stride);
+    codec->read_rows(stream, rows, bmp_info_header.width, first, count,
+        stride, context);
+}
+
+
+/**
+ * Метод класса Image возвращает место строки файла с номером 0 в массиве
+ * data и шаг между строками файла. Строки файла, записанного сверху
+ * вниз, идут в data в обратном порядке, поэтому шаг отрицательный.
+ * @param stride: шаг между строками в пикселях.
+ * @return: указатель на строку файла с номером 0.
+ */
+RGBTriple* Image::get_file_rows(ptrdiff_t& stride) const
+{
+    stride = (ptrdiff_t)bmp_info_header.width;
+    if (!top_down || bmp_info_header.height == 0)
     {
-        //     
-        std::cout << "!     '" << 
+        return data;
+    }
+    stride = -stride;
+    return data + (size_t)(bmp_info_header.height - 1) *
+        bmp_info_header.width;
+}
+
+
+/**
+ * Метод класса Image возвращает номер строки массива пикселей (снизу
+ * вверх) для строки файла с заданным номером.
+ * @param file_row: номер строки в файле.
+ * @return: номер строки массива пикселей.
+ */
+unsigned long Image::get_data_row(unsigned long file_row) const
+{
+    return top_down ? bmp_info_header.height - 1 - file_row : file_row;
+}
+
+
+/**
+ * Метод класса Image записывает заголовок изображения. Если строки
+ * записываются сверху вниз, высота записывается отрицательной.
+ * @param stream: поток, установленный после файлового заголовка;
+ * @param rows_top_down: если true, строки записываются сверху вниз.
+ */
+void Image::write_info_header(ByteStream& stream, bool rows_top_down)
+{
+    BMPInfoHeader info_header = get_file_info_header(bmp_info_header,
+        rows_top_down);
+    stream.write(&info_header, sizeof(BMPInfoHeader), 1);
+    count_write(&stats, sizeof(BMPInfoHeader));
+}
+
+
+/**
+ * Метод класса Image записывает изображение в BMP файл.
+ * @param filename: имя файла, в который нужно сохранить изображение.
+ * @return: 0, если при выполнении функции произошла ошибка, в том числе
+ * если файл записан не полностью.
+ */
+int Image::write_image(const char* filename)
+{
+    stats.begin();
+    StageTimer open_timer(&stats, STAGE_HEADERS);
+    // Открываем файл
+    FileStream file;
+    if (!file.open(filename, "wb"))
+    {
+        // Если файл не был открыт
+        std::cout << "Ошибка! Не удалось открыть файл '" << 
             filename << "'.\n";
-        return;
+        return 0;
     }
-    //   
-    fwrite(&file_header, sizeof(BMPFileHeader), 1, file);
-    //   
-    fwrite(&bmp_info_header, sizeof(BMPInfoHeader), 1, file);
-    //      
-    unsigned char temp = 0;
-    int count = file_header.offset_data - sizeof(BMPFileHeader) - 
-        sizeof(BMPInfoHeader);
-    fwrite(&temp, sizeof(unsigned char), count, file);
-    //     BMP 
-    if (bmp_info_header.bit_count == 24)
+    open_timer.stop();
+    if (!write_stream(file))
     {
-        //   24-
-        write_data_24(file);
+        return 0;
     }
-    else
+    if (!file.close())
     {
-        //   32-
-        write_data_32(file);
+        std::cout << "Ошибка! Не удалось записать файл '" << filename <<
+            "'.\n";
+        return 0;
     }
+    stats.finish(OPERATION_WRITE);
+    return 1;
 }
 
 
 /**
- *   Image     24- BMP .
- * @param file:   .
+ * Метод класса Image записывает изображение BMP данными в буфер в
+ * памяти, например для отправки по сети. Данные записываются теми же
+ * функциями формата, что и файл, без временного файла.
+ * @param bytes: буфер, прежнее содержимое которого заменяется BMP
+ * данными; при ошибке буфер остается пустым.
+ * @return: 0, если при выполнении функции произошла ошибка.
  */
-void Image::write_data_24(FILE* file)
+int Image::write_image(std::vector<unsigned char>& bytes)
 {
-    //   24-,    ,
-    //   4
-    int padding = bmp_info_header.width % 4;
-    for (unsigned int i = 0; i < bmp_info_header.height; i++)
+    stats.begin();
+    MemoryWriter memory(bytes);
+    if (!write_stream(memory))
     {
-        //       
-        for (unsigned int j = 0; j < bmp_info_header.width; j++)
-        {
-            //       .
-            //   RGBTriple
-            fwrite(&data[i * bmp_info_header.width + j], sizeof(RGBTriple),
-                1, file);
-        }
-        unsigned char temp = 0;
-        fwrite(&temp, sizeof(unsigned char), padding, file);
+        return 0;
     }
+    stats.finish(OPERATION_WRITE);
+    return 1;
 }
 
 
 /**
- *   Image     32- BMP .
- * @param file:   .
+ * Метод класса Image записывает заголовки и массив пикселей в поток BMP
+ * данных.
+ * @param stream: поток, установленный на начало BMP данных.
+ * @return: 0, если при выполнении функции произошла ошибка.
  */
-void Image::write_data_32(FILE* file)
+int Image::write_stream(ByteStream& stream)
 {
-    //   32-,     4
-    RGBQuad px;
-    for (unsigned int i = 0; i < bmp_info_header.height; i++)
+    StageTimer headers_timer(&stats, STAGE_HEADERS);
+    const FormatCodec* codec = get_format_codec(bmp_info_header.bit_count);
+    if (!codec || codec->indexed)
     {
-        //       
-        for (unsigned int j = 0; j < bmp_info_header.width; j++)
-        {
-            //       .
-            //   RGBQuad
-            px.blue = data[i * bmp_info_header.width + j].blue;
-            px.green = data[i * bmp_info_header.width + j].green;
-            px.red = data[i * bmp_info_header.width + j].red;
-            px.reserved = 0;
-            fwrite(&px, sizeof(RGBQuad), 1, file);
-        }
+        // Палитровые изображения записывает класс ImageAdvanced
+        std::cout << "Ошибка! Изображение должно быть беспалитровым с " <<
+            "глубиной цвета 16, 24 или 32 бит.\n";
+        return 0;
     }
+    // Пиксели записываются сразу за заголовками и масками каналов
+    update_headers(0);
+    // Записываем файловый заголовок
+    stream.write(&file_header, sizeof(BMPFileHeader), 1);
+    count_write(&stats, sizeof(BMPFileHeader));
+    // Записываем заголовок изображения
+    write_info_header(stream, top_down);
+    write_bit_masks(stream);
+    BitFields fields = make_bit_fields(masks);
+    headers_timer.stop();
+    // Записываем массив пикселей в BMP данные
+    RowContext context = {};
+    context.fields = &fields;
+    context.stats = &stats;
+    write_data(stream, context);
+    return 1;
+}
+
+
+/**
+ * Метод класса Image записывает массив пикселей в поток BMP данных
+ * функцией формата, выбранной по глубине цвета.
+ * @param stream: поток для записи;
+ * @param context: палитра и поиск цветов палитрового формата.
+ */
+void Image::write_data(ByteStream& stream, const RowContext& context)
+{
+    const FormatCodec* codec = get_format_codec(bmp_info_header.bit_count);
+    ptrdiff_t stride;
+    const RGBTriple* rows = get_file_rows(stride);
+    codec->write_rows(stream, rows, bmp_info_header.width,
+        bmp_info_header.height, stride, context);
 }
 
 #endif
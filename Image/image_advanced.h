@@ -1,7 +1,7 @@
 /*
- image_advanced.h    ImageAdvanced,  
- BMP .       
- .
+Модуль image_advanced.h содержит определение класса ImageAdvanced, хранящего данные
+о BMP изображении. Класс работает с палитровыми изображениями и позволяет
+масштабировать изображения.
 */
 
 #pragma once
@@ -9,163 +9,321 @@
 #define IMAGE_ADVANCED_H
 
 #include <iostream>
+#include <vector>
 #include <math.h>
 #include "image.h"
+#include "palette_quantizer.h"
+#include "rle_codec.h"
 
 
 /**
- *     BMP .
+ * Способы хранения пикселей палитровых изображений.
+ */
+enum StorageMode
+{
+    // Пиксели разворачиваются в цвета RGBTriple
+    STORAGE_RGB = 0,
+    // Пиксели хранятся упакованными индексами палитры, как в файле
+    STORAGE_INDEXED = 1,
+    // Пиксели любой глубины цвета переводятся в яркость по весам BT.601
+    // и хранятся 8-битными индексами палитры оттенков серого
+    STORAGE_GRAYSCALE = 2
+};
+
+
+/**
+ * Класс для работы с BMP изображениями.
  */
 class ImageAdvanced: public Image
 {
 protected:
-    RGBQuad* palette; //   
+    RGBQuad* palette; // палитра используемых цветов
+    // Способ хранения пикселей палитровых изображений
+    StorageMode storage_mode;
+    // Упакованные индексы цветов строками BMP файла (с выравниванием)
+    unsigned char* indices;
+    // Таблица распаковки байта индексов в цвета для 1- и 4-битных строк
+    mutable RGBTriple* unpack_table;
+    // Тип сжатия, с которым изображение будет записано
+    unsigned long compression;
 
 public:
-    //    
+    // Конструктор класса без параметров
     ImageAdvanced();
-    //  ,    BMP 
+    // Конструктор класса, считывающий изображение из BMP файла
     ImageAdvanced(const char*);
-    //  ,  
-    ImageAdvanced(ImageAdvanced&);
-    //  ,     
+    // Конструктор класса, считывающий изображение с заданным хранением
+    ImageAdvanced(const char*, StorageMode);
+    // Конструктор класса, копирующий изображение
+    ImageAdvanced(const ImageAdvanced&);
+    // Конструктор класса, перемещающий изображение
+    ImageAdvanced(ImageAdvanced&&) noexcept;
+    // Конструктор класса, создающий новое изображение по параметрам
     ImageAdvanced(unsigned char, unsigned short, unsigned long,
         unsigned long);
-    //  
+    // Деструктор класса
     ~ImageAdvanced();
-    //   
-    ImageAdvanced operator = (ImageAdvanced);
-    //     BMP 
+    // Переопределение оператора присваивания с копированием
+    ImageAdvanced& operator = (const ImageAdvanced&);
+    // Переопределение оператора присваивания с перемещением
+    ImageAdvanced& operator = (ImageAdvanced&&) noexcept;
+    // Метод загружает изображение из BMP файла
     int load_image(const char*);
-    //     BMP 
-    void write_image(const char*);
+    // Метод загружает изображение из BMP данных в памяти
+    int load_image(const unsigned char*, size_t);
+    // Метод записывает изображение в BMP файл
+    int write_image(const char*);
+    // Метод записывает изображение BMP данными в буфер в памяти
+    int write_image(std::vector<unsigned char>&);
+    // Метод задает способ хранения пикселей палитровых изображений
+    void set_storage_mode(StorageMode);
+    // Метод возвращает способ хранения пикселей
+    StorageMode get_storage_mode() const;
+    // Метод определяет, хранятся ли пиксели индексами палитры
+    bool is_indexed() const;
+    // Метод возвращает упакованную строку индексов
+    const unsigned char* get_index_row(unsigned long) const;
+    // Метод разворачивает строку пикселей в цвета
+    void get_row(unsigned long, RGBTriple*) const;
+    // Метод возвращает палитру
+    const RGBQuad* get_palette() const;
+    // Метод задает палитру для записи палитрового изображения
+    int set_palette(const RGBQuad*, unsigned long);
+    // Метод меняет глубину цвета, с которой изображение будет записано
+    int set_bit_count(unsigned short);
+    // Метод задает тип сжатия, с которым изображение будет записано
+    int set_compression(unsigned long);
+    // Метод возвращает тип сжатия
+    unsigned long get_compression() const;
     
 private:
-    //  ,    
-    bool check_palette();
-    //     
-    bool copy_image(ImageAdvanced&);
-    //      1- BMP 
-    void read_data_1(FILE*);
-    //      4- BMP 
-    void read_data_4(FILE*);
-    //      8- BMP 
-    void read_data_8(FILE*);
-    //      1- BMP 
-    void write_data_1(FILE*);
-    //      4- BMP 
-    void write_data_4(FILE*);
-    //      8- BMP 
-    void write_data_8(FILE*);
+    // Метод проверяет, содержит ли изображение палитру
+    bool check_palette() const;
+    // Метод проверяет, подходит ли тип сжатия к глубине цвета
+    bool check_compression(unsigned long) const;
+    // Метод возвращает число цветов в палитре
+    unsigned long get_palette_size() const;
+    // Метод копирует палитру другого изображения
+    void copy_palette(const ImageAdvanced&);
+    // Метод копирует индексы другого изображения
+    void copy_indices(const ImageAdvanced&);
+    // Метод освобождает индексы и таблицу распаковки
+    void release_indices();
+    // Метод разворачивает индексы в массив цветов
+    void expand_indices();
+    // Метод строит палитру по цветам пикселей
+    void build_palette_from_data();
+    // Метод читает изображение из потока BMP данных
+    int read_stream(ByteStream&);
+    // Метод записывает изображение в поток BMP данных
+    int write_stream(ByteStream&);
+    // Метод читает строки упакованных индексов палитрового изображения
+    void read_indices(ByteStream&, unsigned long, unsigned long);
+    // Метод читает массив пикселей сразу строками яркости
+    void read_grayscale(ByteStream&);
+    // Метод читает строки пикселей и переводит их в яркость
+    void read_gray_rows(ByteStream&, unsigned long, unsigned long,
+        unsigned char*, const RowContext&, const unsigned char*);
+    // Метод переводит загруженные пиксели в оттенки серого
+    void convert_to_grayscale();
+    // Метод заменяет пиксели строками яркости и задает палитру оттенков
+    // серого
+    void set_gray_indices(unsigned char*);
+    // Метод записывает палитру и заполняет промежуток до пикселей
+    void write_palette(ByteStream&);
+    // Метод читает и распаковывает массив пикселей, сжатый RLE
+    void read_rle(ByteStream&);
+    // Метод сжимает и записывает массив пикселей методом RLE
+    unsigned long write_rle(ByteStream&);
+    // Метод готовит палитру и таблицу распаковки для чтения строк
+    RowContext get_read_context() const;
 };
 
 
 /**
- *   ImageAdvanced  .   
- *     .
+ * Конструктор класса ImageAdvanced без параметров. Заголовки файла и
+ * изображения принимают значения по умолчанию.
  */
 ImageAdvanced::ImageAdvanced() : Image()
 {
+    palette = nullptr;
+    storage_mode = STORAGE_RGB;
+    indices = nullptr;
+    unpack_table = nullptr;
+    compression = COMPRESSION_RGB;
 }
 
 
 /**
- *   ImageAdvanced,   
- * BMP .
- * @param filename:    .
+ * Конструктор класса ImageAdvanced, считывающий изображение из
+ * BMP файла.
+ * @param filename: имя файла с изображением.
  */
-ImageAdvanced::ImageAdvanced(const char* filename)
+ImageAdvanced::ImageAdvanced(const char* filename) : ImageAdvanced()
 {
     load_image(filename);
 }
 
 
 /**
- *   ImageAdvanced,   .
- * @param mode:    ;
- * @param bit_count:  ;
- * @param width:  ;
- * @param height:  .
+ * Конструктор класса ImageAdvanced, считывающий изображение из
+ * BMP файла с заданным способом хранения пикселей.
+ * @param filename: имя файла с изображением;
+ * @param mode: способ хранения пикселей палитровых изображений.
+ */
+ImageAdvanced::ImageAdvanced(const char* filename, StorageMode mode) :
+    ImageAdvanced()
+{
+    storage_mode = mode;
+    load_image(filename);
+}
+
+
+/**
+ * Конструктор класса ImageAdvanced, создающий новое изображение.
+ * @param mode: значение для цветов пикселя;
+ * @param bit_count: глубина изображения;
+ * @param width: ширина изображения;
+ * @param height: высота изображения.
  */
 ImageAdvanced::ImageAdvanced(unsigned char mode, unsigned short bit_count,
     unsigned long width, unsigned long height) : 
     Image(mode, bit_count, width, height)
 {
+    palette = nullptr;
+    storage_mode = STORAGE_RGB;
+    indices = nullptr;
+    unpack_table = nullptr;
+    compression = COMPRESSION_RGB;
     if (!check_palette())
     {
-        //     , 
-        //  
+        // Если изображение не содержит палитру, создание
+        // изображения закончено
         return;
     }
-    //    .
-    //    
-    unsigned char colors_num = (char)pow(2, bit_count);
-    //        
+    // Если изображение содержит палитру.
+    // Количество цветов в палитре
+    unsigned short colors_num = (unsigned short)pow(2, bit_count);
+    // Меняем некоторые поля в заголовках файла и изображения
     bmp_info_header.colors_used = colors_num;
     file_header.offset_data = sizeof(BMPFileHeader) + 
         sizeof(BMPInfoHeader) + colors_num * sizeof(RGBQuad);
     file_header.file_size = bit_count * height * width + 
         file_header.offset_data;
-    //   
+    // Создаем палитру цветов
     palette = new RGBQuad[colors_num];
-    palette[0] = { 0, 0, 0, 0 };
-    palette[1].blue = palette[1].green = palette[1].red =
-        palette[0].blue + (char)pow(2, 8 - bit_count) - 1;
-    palette[1].reserved = 0;
-    for (unsigned char i = 2; i < colors_num; i++)
+    for (unsigned short i = 0; i < colors_num; i++)
     {
+        // Оттенки серого равномерно от черного до белого
         palette[i].blue = palette[i].green = palette[i].red =
-            palette[i - 1].blue + (char)pow(2, 8 - bit_count);
+            (unsigned char)(i * 255 / (colors_num - 1));
         palette[i].reserved = 0;
     }
 }
 
 
 /**
- *    ImageAdvanced.
- * @param image:   BMP,   .
+ * Конструктор копий класса ImageAdvanced.
+ * @param image: готовое изображение BMP, которуе будет скопировано.
+ */
+ImageAdvanced::ImageAdvanced(const ImageAdvanced& image) : Image(image)
+{
+    palette = nullptr;
+    storage_mode = image.storage_mode;
+    indices = nullptr;
+    unpack_table = nullptr;
+    compression = image.compression;
+    copy_palette(image);
+    copy_indices(image);
+}
+
+
+/**
+ * Конструктор перемещения класса ImageAdvanced. Массив пикселей и
+ * палитра забираются у исходного изображения без копирования.
+ * @param image: изображение, которое будет перемещено.
  */
-ImageAdvanced::ImageAdvanced(ImageAdvanced& image)
+ImageAdvanced::ImageAdvanced(ImageAdvanced&& image) noexcept :
+    Image(std::move(image))
 {
-    copy_image(image);
+    palette = image.palette;
+    storage_mode = image.storage_mode;
+    indices = image.indices;
+    unpack_table = image.unpack_table;
+    compression = image.compression;
+    image.palette = nullptr;
+    image.indices = nullptr;
+    image.unpack_table = nullptr;
 }
 
 
 /**
- *   Image.
+ * Деструктор класса Image.
  */
 ImageAdvanced::~ImageAdvanced()
 {
-    //  
+    // Удаляем палитру и индексы
     delete[] palette;
+    release_indices();
 }
 
 
 /**
- *    =   ImageAdvanced.
- * @param image: ,  .
+ * Переопределение оператора присваивания = для класса ImageAdvanced.
+ * @param image: изображение, которое копируется.
+ * @return: ссылка на это изображение.
  */
-ImageAdvanced ImageAdvanced::operator = (ImageAdvanced image)
+ImageAdvanced& ImageAdvanced::operator = (const ImageAdvanced& image)
 {
-    if (check_empty())
+    if (this != &image)
     {
-        copy_image(image);
+        Image::operator = (image);
+        storage_mode = image.storage_mode;
+        compression = image.compression;
+        copy_palette(image);
+        copy_indices(image);
     }
     return *this;
 }
 
 
 /**
- *   ImageAdvanced ,   
- * .
- * @return: true,  ,  false.
+ * Переопределение оператора присваивания = с перемещением для класса
+ * ImageAdvanced. Исходное изображение становится пустым.
+ * @param image: изображение, которое перемещается.
+ * @return: ссылка на это изображение.
  */
-bool ImageAdvanced::check_palette()
+ImageAdvanced& ImageAdvanced::operator = (ImageAdvanced&& image) noexcept
+{
+    if (this != &image)
+    {
+        Image::operator = (std::move(image));
+        delete[] palette;
+        release_indices();
+        palette = image.palette;
+        storage_mode = image.storage_mode;
+        indices = image.indices;
+        unpack_table = image.unpack_table;
+        compression = image.compression;
+        image.palette = nullptr;
+        image.indices = nullptr;
+        image.unpack_table = nullptr;
+    }
+    return *this;
+}
+
+
+/**
+ * Метод класса ImageAdvanced проверяет, содержит ли изображение
+ * палитру.
+ * @return: true, если содержит, иначе false.
+ */
+bool ImageAdvanced::check_palette() const
 {
     if (bmp_info_header.bit_count == 1 || bmp_info_header.bit_count == 4 ||
         bmp_info_header.bit_count == 8)
     {
-        //  
+        // Изображение палитровое
         return true;
     }
     return false;
@@ -173,332 +331,1043 @@ bool ImageAdvanced::check_palette()
 
 
 /**
- *   ImageAdvanced     .
- * @param image:   ,   .
+ * Метод класса ImageAdvanced проверяет, подходит ли тип сжатия к
+ * глубине цвета изображения: RLE8 сжимает 8-битные изображения, RLE4 -
+ * 4-битные, маски каналов бывают у 16- и 32-битных изображений.
+ * @param type: тип сжатия.
+ * @return: true, если подходит, иначе false.
+ */
+bool ImageAdvanced::check_compression(unsigned long type) const
+{
+    unsigned short bit_count = bmp_info_header.bit_count;
+    return type == COMPRESSION_RGB ||
+        (type == COMPRESSION_RLE8 && bit_count == 8) ||
+        (type == COMPRESSION_RLE4 && bit_count == 4) ||
+        (type == COMPRESSION_BITFIELDS && (bit_count == 16 ||
+        bit_count == 32));
+}
+
+
+/**
+ * Метод класса ImageAdvanced возвращает число цветов в палитре. Если
+ * в заголовке число цветов не указано, палитра полная.
+ * @return: число цветов, 0 для беспалитровых изображений.
  */
-bool ImageAdvanced::copy_image(ImageAdvanced& image)
+unsigned long ImageAdvanced::get_palette_size() const
 {
-    //   
-    file_header = image.file_header;
-    //   
-    bmp_info_header = image.bmp_info_header;
-    //     
-    int height = image.bmp_info_header.height;
-    int width = image.bmp_info_header.width;
-    //    
-    data = new RGBTriple[width * height];
-    for (unsigned int i = 0; i < image.bmp_info_header.height; i++)
+    if (!check_palette())
     {
-        for (unsigned int j = 0; j < image.bmp_info_header.width; j++)
-        {
-            data[i * width + j] = image.data[i * width + j];
-        }
+        return 0;
     }
-    //   ,  
-    if (check_palette())
+    unsigned long colors_num = 1UL << bmp_info_header.bit_count;
+    if (bmp_info_header.colors_used != 0 &&
+        bmp_info_header.colors_used < colors_num)
     {
-        //  
-        palette = new RGBQuad[bmp_info_header.colors_used];
-        for (unsigned short i = 0; i < bmp_info_header.colors_used; i++)
-        {
-            palette[i] = image.palette[i];
-        }
+        return bmp_info_header.colors_used;
     }
-    return true;
+    return colors_num;
 }
 
 
 /**
- *   ImageAdvanced     BMP .
- * @param filename:    .
- * @returm: 0,      .
+ * Метод класа ImageAdvanced для копирования палитры другого
+ * изображения. Прежняя палитра освобождается.
+ * @param image: ссылка на изображение, палитру которого нужно
+ * скопировать.
+ */
+void ImageAdvanced::copy_palette(const ImageAdvanced& image)
+{
+    delete[] palette;
+    palette = nullptr;
+    // Если изображение палитровое, копируем палитру
+    if (image.palette && check_palette())
+    {
+        // Палитра всегда хранится полной, по числу возможных индексов
+        unsigned long colors_num = 1UL << bmp_info_header.bit_count;
+        palette = new RGBQuad[colors_num];
+        memcpy(palette, image.palette, colors_num * sizeof(RGBQuad));
+    }
+}
+
+
+/**
+ * Метод класа ImageAdvanced для копирования упакованных индексов другого
+ * изображения. Прежние индексы освобождаются.
+ * @param image: ссылка на изображение, индексы которого нужно
+ * скопировать.
+ */
+void ImageAdvanced::copy_indices(const ImageAdvanced& image)
+{
+    release_indices();
+    if (image.indices)
+    {
+        size_t size = (size_t)get_row_size() * bmp_info_header.height;
+        indices = new unsigned char[size];
+        memcpy(indices, image.indices, size);
+    }
+}
+
+
+/**
+ * Метод класса ImageAdvanced освобождает упакованные индексы и таблицу
+ * распаковки.
+ */
+void ImageAdvanced::release_indices()
+{
+    delete[] indices;
+    delete[] unpack_table;
+    indices = nullptr;
+    unpack_table = nullptr;
+}
+
+
+/**
+ * Метод класса ImageAdvanced для загрузки изображения из BMP файла.
+ * @param filename: имя файла с изображением.
+ * @returm: 0, если при выполнении функции произошла ошибка.
  */
 int ImageAdvanced::load_image(const char* filename)
 {
-    //  BMP 
-    FILE* file;
-    fopen_s(&file, filename, "rb");
-    if (!file)
+    stats.begin();
+    StageTimer open_timer(&stats, STAGE_HEADERS);
+    // Открываем BMP файл с совместным доступом для потоков чтения
+    FileStream file;
+    if (!file.open(filename, "rb"))
     {
-        //     
-        std::cout << "!     '" <<
+        // Если файл не был открыт
+        std::cout << "Ошибка! Не удалось открыть файл '" <<
             filename << "'.\n";
         return 0;
     }
-    //   
-    fread(&file_header, sizeof(BMPFileHeader), 1, file);
-    if (file_header.file_type != 0x4D42)
+    open_timer.stop();
+    if (!read_stream(file))
+    {
+        return 0;
+    }
+    std::cout << "Изображение из BMP файла '" << filename <<
+        "' прочитано.\n";
+    stats.finish(OPERATION_LOAD);
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageAdvanced для загрузки изображения из BMP данных в
+ * памяти, например из принятого по сети буфера.
+ * @param bytes: BMP данные;
+ * @param size: размер данных в байтах.
+ * @returm: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageAdvanced::load_image(const unsigned char* bytes, size_t size)
+{
+    stats.begin();
+    MemoryReader memory(bytes, size);
+    if (!read_stream(memory))
     {
-        //    BMP 
-        fclose(file);
-        std::cout << "!     BMP .\n";
         return 0;
     }
-    //   
-    fread(&bmp_info_header, sizeof(BMPInfoHeader), 1, file);
-    if (bmp_info_header.compression != 0)
+    std::cout << "Изображение из памяти прочитано.\n";
+    stats.finish(OPERATION_LOAD);
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageAdvanced читает заголовки, палитру и массив
+ * пикселей из потока BMP данных.
+ * @param stream: поток, установленный на начало BMP данных.
+ * @returm: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageAdvanced::read_stream(ByteStream& stream)
+{
+    StageTimer headers_timer(&stats, STAGE_HEADERS);
+    // Считываем файловый заголовок
+    bool read = stream.read(&file_header, sizeof(BMPFileHeader), 1) == 1;
+    count_read(&stats, sizeof(BMPFileHeader));
+    // Считываем заголовок изображения
+    read = read && file_header.file_type == 0x4D42 &&
+        stream.read(&bmp_info_header, sizeof(BMPInfoHeader), 1) == 1;
+    if (!read)
     {
-        //     
-        fclose(file);
-        std::cout << "!    .\n";
+        // Работаем только с BMP файлами
+        std::cout << "Ошибка! Файл не имеет требуемый BMP формат.\n";
         return 0;
     }
-    //   ,  
+    count_read(&stats, sizeof(BMPInfoHeader));
+    if (!check_headers(stream.get_size()))
+    {
+        return 0;
+    }
+    top_down = read_top_down(bmp_info_header);
+    if (!check_compression(bmp_info_header.compression))
+    {
+        // Работаем с несжатыми изображениями, со сжатием RLE8 и RLE4 и
+        // с масками каналов
+        std::cout << "Ошибка! Изображение должно быть несжатым, " <<
+            "сжатым RLE8 (8 бит) или RLE4 (4 бит) или с масками " <<
+            "каналов (16 и 32 бит).\n";
+        return 0;
+    }
+    if (!get_format_codec(bmp_info_header.bit_count))
+    {
+        // Формат пикселей не поддерживается
+        std::cout << "Ошибка! Глубина цвета должна быть 1, 4, 8, 16, " <<
+            "24 или 32 бит.\n";
+        return 0;
+    }
+    if (!read_bit_masks(stream, bmp_info_header, masks))
+    {
+        std::cout << "Ошибка! Маски каналов изображения не подходят к " <<
+            "глубине цвета.\n";
+        return 0;
+    }
+    if (bmp_info_header.compression == COMPRESSION_BITFIELDS)
+    {
+        count_read(&stats, sizeof(BitMasks));
+    }
+    // Если изображение палитровое, считываем палитру
+    delete[] palette;
+    palette = nullptr;
+    release_indices();
     if (check_palette())
     {
-        //  
-        fread(&palette, sizeof(RGBQuad), bmp_info_header.colors_used, 
-            file);
+        // Считываем палитру, она следует сразу за заголовком изображения
+        stream.seek(sizeof(BMPFileHeader) + bmp_info_header.size);
+        unsigned long colors_num = get_palette_size();
+        palette = new RGBQuad[1UL << bmp_info_header.bit_count];
+        memset(palette, 0, (1UL << bmp_info_header.bit_count) *
+            sizeof(RGBQuad));
+        stream.read(palette, sizeof(RGBQuad), colors_num);
+        count_read(&stats, colors_num * sizeof(RGBQuad));
     }
-    //      
-    fseek(file, file_header.offset_data, SEEK_SET);
-    //      
-    data = new RGBTriple[bmp_info_header.width * bmp_info_header.height];
-    //     BMP 
-    if (bmp_info_header.bit_count == 1)
+    // Сдвигаем положение курсора на поле пикселей
+    stream.seek(file_header.offset_data);
+    headers_timer.stop();
+    // Маски каналов задают формат пикселей, а не сжатие массива
+    compression = check_palette() ? bmp_info_header.compression :
+        COMPRESSION_RGB;
+    if (compression != COMPRESSION_RGB && top_down)
     {
-        //   1-
-        read_data_1(file);
+        // Строки сжатого изображения всегда идут снизу вверх
+        std::cout << "Ошибка! Изображение, сжатое RLE, не может " <<
+            "храниться сверху вниз.\n";
+        return 0;
     }
-    else if (bmp_info_header.bit_count == 4)
+    if (compression != COMPRESSION_RGB)
     {
-        //   4-
-        read_data_4(file);
+        // Строки сжатого изображения имеют разный размер, поэтому
+        // массив пикселей распаковывается целиком одним потоком
+        read_rle(stream);
+        if (storage_mode == STORAGE_RGB)
+        {
+            expand_indices();
+        }
+        else if (storage_mode == STORAGE_GRAYSCALE)
+        {
+            convert_to_grayscale();
+        }
+        return 1;
     }
-    else if (bmp_info_header.bit_count == 8)
+    if (storage_mode == STORAGE_GRAYSCALE)
     {
-        //   8-
-        read_data_8(file);
+        // Строки переводятся в яркость при чтении, массив цветов не
+        // создается
+        read_grayscale(stream);
+        return 1;
     }
-    else if (bmp_info_header.bit_count == 24)
+    if (check_palette() && storage_mode == STORAGE_INDEXED)
     {
-        //   24-
-        read_data_24(file);
+        // Пиксели хранятся упакованными индексами, цвета не нужны
+        release_data();
+        StageTimer allocation_timer(&stats, STAGE_ALLOCATION);
+        size_t rows_size = (size_t)get_row_size() * bmp_info_header.height;
+        indices = new unsigned char[rows_size];
+        count_allocation(&stats, rows_size);
+        allocation_timer.stop();
+        read_rows(stream, [this](ByteStream& band, unsigned long first,
+            unsigned long rows) { read_indices(band, first, rows); });
+        return 1;
     }
-    else if (bmp_info_header.bit_count == 32)
+    // Выделяем память для данных о пикселях
+    allocate_data((size_t)bmp_info_header.width * bmp_info_header.height);
+    // Читаем массив пикселей из BMP данных функцией формата
+    BitFields fields = make_bit_fields(masks);
+    RowContext context = get_read_context();
+    context.fields = &fields;
+    context.stats = &stats;
+    read_rows(stream, [this, &context](ByteStream& band,
+        unsigned long first, unsigned long rows)
+        { read_data(band, first, rows, context); });
+    return 1;
+}
+
+
+/**
+ * Метод класса Image записывает изображение в BMP файл.
+ * @param filename: имя файла, в который нужно сохранить изображение.
+ * @return: 0, если при выполнении функции произошла ошибка, в том числе
+ * если файл записан не полностью.
+ */
+int ImageAdvanced::write_image(const char* filename)
+{
+    stats.begin();
+    StageTimer open_timer(&stats, STAGE_HEADERS);
+    // Открываем файл
+    FileStream file;
+    if (!file.open(filename, "wb"))
+    {
+        // Если файл не был открыт
+        std::cout << "Ошибка! Не удалось открыть файл '" << filename << "'.\n";
+        return 0;
+    }
+    open_timer.stop();
+    if (!write_stream(file))
+    {
+        return 0;
+    }
+    if (!file.close())
     {
-        //   32-
-        read_data_32(file);
+        std::cout << "Ошибка! Не удалось записать файл '" << filename <<
+            "'.\n";
+        return 0;
     }
-    std::cout << "  BMP  '" << filename <<
-        "' .\n";
-    //  ,   
-    fclose(file);
+    stats.finish(OPERATION_WRITE);
     return 1;
 }
 
 
 /**
- *   Image      
- * 1-  BMP.
- * @param file:  BMP .
+ * Метод класса ImageAdvanced записывает изображение BMP данными в буфер
+ * в памяти, например для отправки по сети.
+ * @param bytes: буфер, прежнее содержимое которого заменяется BMP
+ * данными.
+ * @return: 0, если при выполнении функции произошла ошибка.
  */
-void ImageAdvanced::read_data_1(FILE* file)
+int ImageAdvanced::write_image(std::vector<unsigned char>& bytes)
 {
-    //   1-,    ,
-    //   4
-    int padding = (3 * int(ceil(bmp_info_header.width / 8.))) % 4;
-    for (unsigned int i = 0; i < bmp_info_header.height; i++)
+    stats.begin();
+    MemoryWriter memory(bytes);
+    if (!write_stream(memory))
     {
-        //       .
-        //      
-        unsigned int j = 0;
-        while (j < bmp_info_header.width)
+        return 0;
+    }
+    stats.finish(OPERATION_WRITE);
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageAdvanced записывает заголовки, маски каналов,
+ * палитру и массив пикселей в поток BMP данных.
+ * @param stream: поток, установленный на начало BMP данных.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageAdvanced::write_stream(ByteStream& stream)
+{
+    StageTimer headers_timer(&stats, STAGE_HEADERS);
+    if (check_palette() && !indices && !palette)
+    {
+        // Палитры нет, строим ее по цветам пикселей
+        StageTimer convert_timer(&stats, STAGE_CONVERT);
+        build_palette_from_data();
+    }
+    // Палитра и пиксели записываются сразу за заголовками
+    update_headers(get_palette_size());
+    if (compression != COMPRESSION_RGB)
+    {
+        bmp_info_header.compression = compression;
+    }
+    // Записываем файловый заголовок
+    stream.write(&file_header, sizeof(BMPFileHeader), 1);
+    count_write(&stats, sizeof(BMPFileHeader));
+    // Записываем заголовок изображения, строки сжатого изображения
+    // всегда идут снизу вверх
+    write_info_header(stream, top_down && compression == COMPRESSION_RGB);
+    // Записываем маски каналов, палитру и сдвигаем положение курсора на
+    // поле пикселей
+    write_bit_masks(stream);
+    write_palette(stream);
+    headers_timer.stop();
+    if (compression != COMPRESSION_RGB)
+    {
+        // Размер сжатых данных известен только после записи, заголовки
+        // записываются повторно
+        bmp_info_header.size_image = write_rle(stream);
+        file_header.file_size = file_header.offset_data +
+            bmp_info_header.size_image;
+        StageTimer timer(&stats, STAGE_HEADERS);
+        stream.seek(0);
+        stream.write(&file_header, sizeof(BMPFileHeader), 1);
+        count_write(&stats, sizeof(BMPFileHeader));
+        write_info_header(stream, false);
+    }
+    else if (indices)
+    {
+        // Индексы уже упакованы строками BMP файла исходной глубины,
+        // строки сверху вниз записываются по одной
+        StageTimer timer(&stats, STAGE_IO);
+        unsigned long height = bmp_info_header.height;
+        unsigned long rows = top_down ? 1 : height;
+        for (unsigned long i = 0; i < height; i += rows)
         {
-            //       .
-            //  
-            unsigned char byte;
-            fread(&byte, sizeof(unsigned char), 1, file);
-            //         
-            unsigned char mask = 0x80;
-            for (int shift = 7; shift >= 0; shift--)
-            {
-                //     7-shift  
-                unsigned char color_index = (mask & byte)>>shift;
-                if (j < bmp_info_header.width)
-                {
-                    data[i * bmp_info_header.width + j].blue = 
-                        palette[color_index].blue;
-                    data[i * bmp_info_header.width + j].green =
-                        palette[color_index].green;
-                    data[i * bmp_info_header.width + j].red =
-                        palette[color_index].red;
-                    j++;
-                }
-                else
-                {
-                    //      
-                    break;
-                }
-                mask >>= 1; //    1  
-            }
+            size_t written = stream.write(get_index_row(get_data_row(i)),
+                get_row_size(), rows);
+            count_write(&stats, (std::uint64_t)written * get_row_size());
         }
-        fseek(file, padding, SEEK_CUR);
+    }
+    else if (check_palette())
+    {
+        // Цвета заменяются индексами ближайших цветов палитры
+        StageTimer convert_timer(&stats, STAGE_CONVERT);
+        PaletteLookup lookup(palette, get_palette_size());
+        convert_timer.stop();
+        unsigned char* row_indices =
+            new unsigned char[bmp_info_header.width + 1];
+        RowContext context = { palette, nullptr, &lookup, row_indices,
+            nullptr, &stats };
+        write_data(stream, context);
+        delete[] row_indices;
+    }
+    else
+    {
+        // Беспалитровым форматам данные палитры не нужны
+        BitFields fields = make_bit_fields(masks);
+        RowContext context = {};
+        context.fields = &fields;
+        context.stats = &stats;
+        write_data(stream, context);
+    }
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageAdvanced записывает палитру после заголовков и
+ * заполняет нулями промежуток до начала поля пикселей.
+ * @param stream: поток, установленный после заголовков и масок каналов.
+ */
+void ImageAdvanced::write_palette(ByteStream& stream)
+{
+    std::uint64_t position = stream.tell();
+    if (palette)
+    {
+        unsigned long colors_num = get_palette_size();
+        stream.write(palette, sizeof(RGBQuad), colors_num);
+        count_write(&stats, colors_num * sizeof(RGBQuad));
+        position += colors_num * sizeof(RGBQuad);
+    }
+    const unsigned char zero = 0;
+    for (; position < file_header.offset_data; position++)
+    {
+        stream.write(&zero, 1, 1);
     }
 }
 
 
 /**
- *   Image      
- * 4-  BMP.
- * @param file:  BMP .
+ * Метод класса ImageAdvanced читает строки упакованных индексов
+ * палитрового изображения одним вызовом чтения, строки сохраняются
+ * вместе с выравниванием. Строки файла, записанного сверху вниз,
+ * читаются по одной на свои места.
+ * @param stream: поток, установленный на первую строку;
+ * @param first: номер первой строки файла;
+ * @param count: число строк.
  */
-void ImageAdvanced::read_data_4(FILE* file)
+void ImageAdvanced::read_indices(ByteStream& stream, unsigned long first,
+    unsigned long count)
 {
-    //   4-,    ,
-    //   4
-    int padding = (3 * int(ceil(bmp_info_header.width / 2.))) % 4;
-    for (unsigned int i = 0; i < bmp_info_header.height; i++)
+    unsigned long rows_num = top_down ? 1 : count;
+    size_t size = (size_t)get_row_size() * rows_num;
+    StageTimer timer(&stats, STAGE_IO);
+    for (unsigned long i = first; i < first + count; i += rows_num)
     {
-        //       .
-        //      
-        unsigned int j = 0;
-        while (j < bmp_info_header.width)
+        unsigned char* rows = indices + (size_t)get_row_size() *
+            get_data_row(i);
+        size_t read = stream.read(rows, 1, size);
+        count_read(&stats, read);
+        // Недостающие байты поврежденного файла заполняем нулями
+        memset(rows + read, 0, size - read);
+    }
+}
+
+
+/**
+ * Метод класса ImageAdvanced читает массив пикселей сразу строками
+ * яркости: массив цветов RGBTriple не создается, памяти нужно втрое
+ * меньше, чем при хранении цветами. После чтения изображение становится
+ * 8-битным с палитрой оттенков серого.
+ * @param stream: поток, установленный на поле пикселей.
+ */
+void ImageAdvanced::read_grayscale(ByteStream& stream)
+{
+    release_data();
+    unsigned long width = bmp_info_header.width;
+    size_t gray_row_size = (size_t)get_bmp_row_size(width, 8);
+    StageTimer allocation_timer(&stats, STAGE_ALLOCATION);
+    size_t rows_size = gray_row_size * bmp_info_header.height;
+    unsigned char* gray = new unsigned char[rows_size];
+    count_allocation(&stats, rows_size);
+    allocation_timer.stop();
+    BitFields fields = make_bit_fields(masks);
+    RowContext context = get_read_context();
+    context.fields = &fields;
+    context.stats = &stats;
+    // Яркость цветов палитры считается заранее, индексы 8-битных строк
+    // заменяются ею по таблице
+    unsigned char palette_luma[256] = {};
+    if (palette)
+    {
+        size_t colors_num = (size_t)1 << bmp_info_header.bit_count;
+        unsigned char colors[256];
+        RGBTriple triples[256];
+        for (size_t k = 0; k < colors_num; k++)
         {
-            //       .
-            //  
-            unsigned char byte;
-            fread(&byte, sizeof(unsigned char), 1, file);
-            //        
-            unsigned char mask = 0xF0;
-            for (int shift = 1; shift >= 0; shift--)
+            colors[k] = (unsigned char)k;
+        }
+        convert_palette_to_bgr(colors, palette, triples, colors_num);
+        convert_bgr_to_luma(triples, palette_luma, colors_num, LUMA_BT601);
+    }
+    read_rows(stream, [this, gray, &context, &palette_luma](
+        ByteStream& band, unsigned long first, unsigned long rows)
+        { read_gray_rows(band, first, rows, gray, context, palette_luma); });
+    set_gray_indices(gray);
+}
+
+
+/**
+ * Метод класса ImageAdvanced читает строки [first, first + count)
+ * массива пикселей блоками и переводит их в яркость по весам BT.601.
+ * 24-битные строки переводятся прямо из прочитанных байтов, 8-битные -
+ * по таблице яркости палитры, остальные форматы сначала разворачиваются
+ * по одной строке в цвета.
+ * @param stream: поток, установленный на первую строку;
+ * @param first: номер первой строки файла;
+ * @param count: число строк;
+ * @param gray: строки яркости с выравниванием 8-битных строк BMP файла;
+ * @param context: палитра и таблицы формата исходных строк;
+ * @param palette_luma: яркость цветов палитры.
+ */
+void ImageAdvanced::read_gray_rows(ByteStream& stream, unsigned long first,
+    unsigned long count, unsigned char* gray, const RowContext& context,
+    const unsigned char* palette_luma)
+{
+    unsigned long width = bmp_info_header.width;
+    unsigned short bit_count = bmp_info_header.bit_count;
+    unsigned long row_size = get_row_size();
+    size_t gray_row_size = (size_t)get_bmp_row_size(width, 8);
+    const FormatCodec* codec = get_format_codec(bit_count);
+    unsigned long rows_in_block = get_block_rows(row_size, count);
+    unsigned char* buffer = nullptr;
+    const unsigned char* mapped = stream.map_read((size_t)count * row_size);
+    if (mapped)
+    {
+        // Строки лежат в памяти, переводим их без копирования
+        count_read(&stats, (std::uint64_t)count * row_size);
+        rows_in_block = count;
+    }
+    else
+    {
+        StageTimer allocation_timer(&stats, STAGE_ALLOCATION);
+        buffer = new unsigned char[(size_t)rows_in_block * row_size];
+        count_allocation(&stats, (std::uint64_t)rows_in_block * row_size);
+    }
+    std::vector<RGBTriple> colors;
+    if (bit_count != 8 && bit_count != 24)
+    {
+        colors.resize(width);
+    }
+    for (unsigned long i = first; i < first + count; i += rows_in_block)
+    {
+        // Цикл для прохода по блокам строк пикселей
+        unsigned long rows = rows_in_block;
+        if (rows > first + count - i)
+        {
+            rows = first + count - i;
+        }
+        const unsigned char* block = buffer;
+        if (mapped)
+        {
+            block = mapped + (size_t)(i - first) * row_size;
+        }
+        else
+        {
+            size_t size = (size_t)rows * row_size;
+            StageTimer io_timer(&stats, STAGE_IO);
+            size_t read = stream.read(buffer, 1, size);
+            count_read(&stats, read);
+            io_timer.stop();
+            // Недостающие байты поврежденного файла заполняем нулями
+            memset(buffer + read, 0, size - read);
+        }
+        StageTimer convert_timer(&stats, STAGE_CONVERT);
+        for (unsigned long r = 0; r < rows; r++)
+        {
+            // Цикл для прохода по строкам блока
+            const unsigned char* src = block + (size_t)r * row_size;
+            unsigned char* dst = gray + (size_t)get_data_row(i + r) *
+                gray_row_size;
+            if (bit_count == 24)
             {
-                //     1-shift  
-                unsigned char color_index = (mask & byte) >> (shift * 4);
-                if (j < bmp_info_header.width)
-                {
-                    data[i * bmp_info_header.width + j].blue =
-                        palette[color_index].blue;
-                    data[i * bmp_info_header.width + j].green =
-                        palette[color_index].green;
-                    data[i * bmp_info_header.width + j].red =
-                        palette[color_index].red;
-                    j++;
-                }
-                else
+                convert_bgr_to_luma((const RGBTriple*)src, dst, width,
+                    LUMA_BT601);
+            }
+            else if (bit_count == 8)
+            {
+                for (unsigned long j = 0; j < width; j++)
                 {
-                    //      
-                    break;
+                    dst[j] = palette_luma[src[j]];
                 }
-                mask >>= 4; //    4  
             }
+            else
+            {
+                codec->decode_row(src, colors.data(), width, context);
+                convert_bgr_to_luma(colors.data(), dst, width, LUMA_BT601);
+            }
+            memset(dst + width, 0, gray_row_size - width);
         }
-        fseek(file, padding, SEEK_CUR);
     }
+    delete[] buffer;
+}
+
+
+/**
+ * Метод класса ImageAdvanced переводит загруженные пиксели в яркость по
+ * весам BT.601 и делает изображение 8-битным с палитрой оттенков серого.
+ * Работает при любом способе хранения пикселей.
+ */
+void ImageAdvanced::convert_to_grayscale()
+{
+    if (!indices && !data)
+    {
+        // Пикселей нет
+        return;
+    }
+    unsigned long width = bmp_info_header.width;
+    size_t gray_row_size = (size_t)get_bmp_row_size(width, 8);
+    size_t rows_size = gray_row_size * bmp_info_header.height;
+    unsigned char* gray = new unsigned char[rows_size];
+    count_allocation(&stats, rows_size);
+    StageTimer timer(&stats, STAGE_CONVERT);
+    std::vector<RGBTriple> colors(width);
+    for (unsigned long i = 0; i < bmp_info_header.height; i++)
+    {
+        // Цикл для прохода по строкам пикселей
+        unsigned char* dst = gray + i * gray_row_size;
+        get_row(i, colors.data());
+        convert_bgr_to_luma(colors.data(), dst, width, LUMA_BT601);
+        memset(dst + width, 0, gray_row_size - width);
+    }
+    timer.stop();
+    set_gray_indices(gray);
 }
 
 
 /**
- *   Image      
- * 8-  BMP.
- * @param file:  BMP .
+ * Метод класса ImageAdvanced заменяет пиксели строками яркости и задает
+ * 8-битную глубину цвета с палитрой из 256 оттенков серого, в которой
+ * индекс совпадает с яркостью. Изображение записывается как 8-битное
+ * палитровое без поиска цветов.
+ * @param gray: строки яркости с выравниванием 8-битных строк BMP файла,
+ * изображение становится их владельцем.
  */
-void ImageAdvanced::read_data_8(FILE* file)
+void ImageAdvanced::set_gray_indices(unsigned char* gray)
 {
-    //   8-,   
-    //    4
-    int padding = (3 * bmp_info_header.width) % 4;
-    for (unsigned int i = 0; i < bmp_info_header.height; i++)
+    release_data();
+    release_indices();
+    indices = gray;
+    delete[] palette;
+    palette = new RGBQuad[256];
+    for (int k = 0; k < 256; k++)
     {
-        //       
-        for (unsigned int j = 0; j < bmp_info_header.width; j++)
+        palette[k].blue = palette[k].green = palette[k].red =
+            (unsigned char)k;
+        palette[k].reserved = 0;
+    }
+    bmp_info_header.bit_count = 8;
+    masks = get_default_masks(8);
+    compression = COMPRESSION_RGB;
+    update_headers(256);
+}
+
+
+/**
+ * Метод класса ImageAdvanced читает массив пикселей, сжатый RLE8 или
+ * RLE4, и распаковывает его в строки упакованных индексов. Сжатые
+ * данные в памяти распаковываются без копирования в буфер.
+ * @param stream: поток, установленный на поле пикселей.
+ */
+void ImageAdvanced::read_rle(ByteStream& stream)
+{
+    unsigned long width = bmp_info_header.width;
+    unsigned long height = bmp_info_header.height;
+    size_t rows_size = (size_t)get_row_size() * height;
+    StageTimer allocation_timer(&stats, STAGE_ALLOCATION);
+    indices = new unsigned char[rows_size];
+    memset(indices, 0, rows_size);
+    count_allocation(&stats, rows_size);
+    // Размер сжатых данных берем из заголовка, но не больше, чем может
+    // занять сжатое изображение такого размера
+    size_t size = bmp_info_header.size_image;
+    if (size == 0 && file_header.file_size > file_header.offset_data)
+    {
+        size = file_header.file_size - file_header.offset_data;
+    }
+    size_t bound = get_rle_row_bound(width) * height + 2;
+    if (size == 0 || size > bound)
+    {
+        size = bound;
+    }
+    allocation_timer.stop();
+    unsigned char* buffer = nullptr;
+    const unsigned char* encoded = stream.map_read(size);
+    if (!encoded)
+    {
+        // Данные не лежат в памяти целиком, читаем их в буфер
+        StageTimer buffer_timer(&stats, STAGE_ALLOCATION);
+        buffer = new unsigned char[size];
+        count_allocation(&stats, size);
+        buffer_timer.stop();
+        StageTimer io_timer(&stats, STAGE_IO);
+        size = stream.read(buffer, 1, size);
+        io_timer.stop();
+        encoded = buffer;
+    }
+    count_read(&stats, size);
+    StageTimer convert_timer(&stats, STAGE_CONVERT);
+    decode_rle(encoded, size, bmp_info_header.bit_count, width, height,
+        indices, get_row_size());
+    convert_timer.stop();
+    delete[] buffer;
+}
+
+
+/**
+ * Метод класса ImageAdvanced сжимает строки индексов методом RLE8 или
+ * RLE4 и записывает их. Если пиксели хранятся цветами, они заменяются
+ * индексами ближайших цветов палитры.
+ * @param stream: поток, установленный на поле пикселей.
+ * @return: размер сжатых данных в байтах.
+ */
+unsigned long ImageAdvanced::write_rle(ByteStream& stream)
+{
+    unsigned long width = bmp_info_header.width;
+    unsigned long height = bmp_info_header.height;
+    unsigned short bit_count = bmp_info_header.bit_count;
+    StageTimer lookup_timer(&stats, STAGE_CONVERT);
+    PaletteLookup* lookup = nullptr;
+    if (!indices)
+    {
+        lookup = new PaletteLookup(palette, get_palette_size());
+    }
+    lookup_timer.stop();
+    unsigned char* row_indices = new unsigned char[width + 1];
+    unsigned char* encoded = new unsigned char[get_rle_row_bound(width)];
+    unsigned long size = 0;
+    for (unsigned long i = 0; i < height; i++)
+    {
+        // Цикл для прохода по строкам, каждая строка сжимается отдельно
+        StageTimer convert_timer(&stats, STAGE_CONVERT);
+        const unsigned char* row = row_indices;
+        if (lookup)
         {
-            //       .
-            //  ,    
-            unsigned char byte;
-            fread(&byte, sizeof(unsigned char), 1, file);
-            data[i * bmp_info_header.width + j].blue = palette[byte].blue;
-            data[i * bmp_info_header.width + j].green = palette[byte].green;
-            data[i * bmp_info_header.width + j].red = palette[byte].red;
+            lookup->map_row(&data[(size_t)i * width], row_indices, width);
         }
+        else if (bit_count == 8)
+        {
+            row = get_index_row(i);
+        }
+        else
+        {
+            unpack_indices_4(get_index_row(i), row_indices, width);
+        }
+        size_t bytes = encode_rle_row(row, width, bit_count, i + 1 == height,
+            encoded);
+        convert_timer.stop();
+        StageTimer io_timer(&stats, STAGE_IO);
+        stream.write(encoded, 1, bytes);
+        count_write(&stats, bytes);
+        size += (unsigned long)bytes;
+    }
+    if (height == 0)
+    {
+        // Пустое изображение состоит из одного конца изображения
+        unsigned char end[2] = { 0, RLE_END_OF_BITMAP };
+        stream.write(end, 1, 2);
+        size = 2;
     }
+    delete[] encoded;
+    delete[] row_indices;
+    delete lookup;
+    return size;
 }
 
 
 /**
- *   Image    BMP .
- * @param filename:  ,     .
+ * Метод класса ImageAdvanced разворачивает упакованные индексы в массив
+ * цветов и освобождает индексы.
  */
-void ImageAdvanced::write_image(const char* filename)
+void ImageAdvanced::expand_indices()
 {
-    //  
-    FILE* file;
-    fopen_s(&file, filename, "wb");
-    if (!file)
+    if (!indices)
     {
-        //     
-        std::cout << "!     '" << filename << "'.\n";
         return;
     }
-    //   
-    fwrite(&file_header, sizeof(BMPFileHeader), 1, file);
-    //   
-    fwrite(&bmp_info_header, sizeof(BMPInfoHeader), 1, file);
-    //      
-    unsigned char temp = 0;
-    int count = file_header.offset_data - sizeof(BMPFileHeader) - sizeof(BMPInfoHeader);
-    fwrite(&temp, sizeof(unsigned char), count, file);
-    //     BMP 
-    if (bmp_info_header.bit_count == 24)
+    unsigned long width = bmp_info_header.width;
+    allocate_data((size_t)width * bmp_info_header.height);
+    StageTimer timer(&stats, STAGE_CONVERT);
+    for (unsigned long i = 0; i < bmp_info_header.height; i++)
     {
-        //   24-
-        write_data_24(file);
+        get_row(i, &data[(size_t)i * width]);
     }
-    else
+    release_indices();
+}
+
+
+/**
+ * Метод класса ImageAdvanced задает способ хранения пикселей при
+ * следующих загрузках. Если изображение уже хранит индексы, а выбрано
+ * хранение цветами, индексы разворачиваются сразу. При выборе хранения
+ * оттенками серого загруженные пиксели сразу переводятся в яркость.
+ * @param mode: способ хранения.
+ */
+void ImageAdvanced::set_storage_mode(StorageMode mode)
+{
+    storage_mode = mode;
+    if (mode == STORAGE_RGB)
+    {
+        expand_indices();
+    }
+    else if (mode == STORAGE_GRAYSCALE)
+    {
+        convert_to_grayscale();
+    }
+}
+
+
+/**
+ * Метод класса ImageAdvanced возвращает способ хранения пикселей.
+ * @return: способ хранения.
+ */
+StorageMode ImageAdvanced::get_storage_mode() const
+{
+    return storage_mode;
+}
+
+
+/**
+ * Метод класса ImageAdvanced определяет, хранятся ли пиксели
+ * упакованными индексами палитры. В этом случае массив data пуст, а
+ * строки цветов можно получить методом get_row.
+ * @return: true, если пиксели хранятся индексами, иначе false.
+ */
+bool ImageAdvanced::is_indexed() const
+{
+    return indices != nullptr;
+}
+
+
+/**
+ * Метод класса ImageAdvanced возвращает упакованную строку индексов.
+ * @param i: номер строки (снизу вверх, как в BMP файле).
+ * @return: указатель на строку или nullptr, если индексов нет.
+ */
+const unsigned char* ImageAdvanced::get_index_row(unsigned long i) const
+{
+    if (!indices)
     {
-        //   32-
-        write_data_32(file);
+        return nullptr;
     }
+    return indices + (size_t)i * get_row_size();
 }
 
 
 /**
- *   Image     24- BMP .
- * @param file:   .
+ * Метод класса ImageAdvanced разворачивает строку пикселей в цвета.
+ * Работает при любом способе хранения.
+ * @param i: номер строки (снизу вверх, как в BMP файле);
+ * @param row: массив для width пикселей.
  */
-void ImageAdvanced::write_data_1(FILE* file)
+void ImageAdvanced::get_row(unsigned long i, RGBTriple* row) const
 {
-    //   24-,    ,
-    //   4
-    int padding = bmp_info_header.width % 4;
-    for (unsigned int i = 0; i < bmp_info_header.height; i++)
+    unsigned long width = bmp_info_header.width;
+    if (!indices)
     {
-        //       
-        for (unsigned int j = 0; j < bmp_info_header.width; j++)
-        {
-            //       .
-            //   RGBTriple
-            fwrite(&data[i * bmp_info_header.width + j], sizeof(RGBTriple),
-                1, file);
-        }
-        unsigned char temp = 0;
-        fwrite(&temp, sizeof(unsigned char), padding, file);
+        memcpy(row, &data[(size_t)i * width], width * sizeof(RGBTriple));
+        return;
     }
+    if (!unpack_table)
+    {
+        // Таблица строится при первом обращении и хранится до
+        // освобождения индексов
+        get_read_context();
+    }
+    RowContext context = { palette, unpack_table, nullptr, nullptr,
+        nullptr, nullptr };
+    const FormatCodec* codec = get_format_codec(bmp_info_header.bit_count);
+    codec->decode_row(get_index_row(i), row, width, context);
 }
 
 
 /**
- *   Image     32- BMP .
- * @param file:   .
+ * Метод класса ImageAdvanced возвращает палитру.
+ * @return: указатель на палитру или nullptr для беспалитровых
+ * изображений.
  */
-void ImageAdvanced::write_data_4(FILE* file)
+const RGBQuad* ImageAdvanced::get_palette() const
 {
-    //   32-,     4
-    RGBQuad px_data;
-    for (unsigned int i = 0; i < bmp_info_header.height; i++)
+    return palette;
+}
+
+
+/**
+ * Метод класса ImageAdvanced готовит данные для чтения строк
+ * палитрового изображения: палитру и, для 1- и 4-битных строк, таблицу
+ * распаковки байта в цвета. Таблица строится заново, так как палитра
+ * могла измениться.
+ * @return: данные для функций формата.
+ */
+RowContext ImageAdvanced::get_read_context() const
+{
+    RowContext context = { palette, nullptr, nullptr, nullptr, nullptr,
+        nullptr };
+    if (bmp_info_header.bit_count == 1 || bmp_info_header.bit_count == 4)
     {
-        //       
-        for (unsigned int j = 0; j < bmp_info_header.width; j++)
+        if (!unpack_table)
         {
-            //       .
-            //   RGBQuad
-            px_data.blue = data[i * bmp_info_header.width + j].blue;
-            px_data.green = data[i * bmp_info_header.width + j].green;
-            px_data.red = data[i * bmp_info_header.width + j].red;
-            px_data.reserved = 0;
-            fwrite(&px_data, sizeof(RGBQuad), 1, file);
+            unpack_table = new RGBTriple[256 * 8];
         }
+        build_unpack_table(palette, bmp_info_header.bit_count, unpack_table);
+        context.unpack_table = unpack_table;
+    }
+    return context;
+}
+
+
+/**
+ * Метод класса ImageAdvanced задает палитру, с которой палитровое
+ * изображение будет записано. Цвета пикселей заменяются ближайшими
+ * цветами палитры при записи.
+ * @param colors: цвета палитры;
+ * @param colors_num: число цветов, не больше 2 в степени глубины цвета.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageAdvanced::set_palette(const RGBQuad* colors, unsigned long colors_num)
+{
+    if (!check_palette() || colors_num == 0 ||
+        colors_num > (1UL << bmp_info_header.bit_count))
+    {
+        std::cout << "Ошибка! Палитра не подходит к глубине цвета " <<
+            "изображения.\n";
+        return 0;
     }
+    // Индексы относятся к прежней палитре, переходим к цветам
+    expand_indices();
+    unsigned long full = 1UL << bmp_info_header.bit_count;
+    delete[] palette;
+    palette = new RGBQuad[full];
+    memset(palette, 0, full * sizeof(RGBQuad));
+    memcpy(palette, colors, colors_num * sizeof(RGBQuad));
+    bmp_info_header.colors_used = colors_num;
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageAdvanced меняет глубину цвета, с которой изображение
+ * будет записано. При переходе к 1-, 4- или 8-битной глубине палитра
+ * строится по цветам пикселей, если ее нет или она другого размера.
+ * @param bit_count: новая глубина цвета (1, 4, 8, 16, 24 или 32).
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageAdvanced::set_bit_count(unsigned short bit_count)
+{
+    if (!get_format_codec(bit_count))
+    {
+        std::cout << "Ошибка! Глубина цвета должна быть 1, 4, 8, 16, " <<
+            "24 или 32 бит.\n";
+        return 0;
+    }
+    if (bit_count == bmp_info_header.bit_count)
+    {
+        return 1;
+    }
+    // Индексы упакованы для прежней глубины, переходим к цветам
+    expand_indices();
+    delete[] palette;
+    palette = nullptr;
+    bmp_info_header.bit_count = bit_count;
+    bmp_info_header.colors_used = 0;
+    // Маски каналов относятся к прежней глубине цвета
+    masks = get_default_masks(bit_count);
+    if (!check_compression(compression))
+    {
+        // Сжатие RLE подходит только к исходной глубине цвета
+        compression = COMPRESSION_RGB;
+    }
+    if (check_palette())
+    {
+        build_palette_from_data();
+    }
+    update_headers(get_palette_size());
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageAdvanced задает тип сжатия, с которым изображение
+ * будет записано. Сжатие RLE8 подходит к 8-битным изображениям, RLE4 -
+ * к 4-битным. Изображение, прочитанное из сжатого файла, по умолчанию
+ * записывается с тем же сжатием. Маски каналов 16- и 32-битных
+ * изображений задаются методом set_bit_masks.
+ * @param type: тип сжатия (COMPRESSION_RGB, COMPRESSION_RLE8 или
+ * COMPRESSION_RLE4).
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageAdvanced::set_compression(unsigned long type)
+{
+    if (type == COMPRESSION_BITFIELDS || !check_compression(type))
+    {
+        std::cout << "Ошибка! Сжатие RLE8 возможно для 8-битных, RLE4 " <<
+            "- для 4-битных изображений.\n";
+        return 0;
+    }
+    compression = type;
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageAdvanced возвращает тип сжатия, с которым
+ * изображение будет записано.
+ * @return: тип сжатия, COMPRESSION_BITFIELDS для 16- и 32-битных
+ * изображений с масками каналов не по умолчанию.
+ */
+unsigned long ImageAdvanced::get_compression() const
+{
+    if (check_bit_fields())
+    {
+        return COMPRESSION_BITFIELDS;
+    }
+    return compression;
+}
+
+
+/**
+ * Метод класса ImageAdvanced строит палитру по цветам пикселей методом
+ * медианного сечения. Если различных цветов не больше размера палитры,
+ * они попадают в палитру без изменений.
+ */
+void ImageAdvanced::build_palette_from_data()
+{
+    unsigned long full = 1UL << bmp_info_header.bit_count;
+    delete[] palette;
+    palette = new RGBQuad[full];
+    memset(palette, 0, full * sizeof(RGBQuad));
+    unsigned long colors_num = build_palette(data,
+        (size_t)bmp_info_header.width * bmp_info_header.height, full,
+        palette);
+    // Пустому изображению достаточно одного цвета
+    bmp_info_header.colors_used = colors_num ? colors_num : 1;
 }
 
 #endif
@@ -0,0 +1,239 @@
+/*
+Модуль image_color.h содержит определение класса ColorPlanes - плоскостей
+яркости и цветоразностей YCbCr изображения. Плоскости считаются
+векторными функциями модуля pixel_convert.h по весам BT.601 или BT.709,
+строки обрабатываются полосами в нескольких потоках.
+*/
+
+#pragma once
+#ifndef IMAGE_COLOR_H
+#define IMAGE_COLOR_H
+
+#include <iostream>
+#include <vector>
+#include "image.h"
+#include "image_region.h"
+#include "pixel_convert.h"
+#include "thread_pool.h"
+
+
+/**
+ * Плоскости цветового пространства YCbCr.
+ */
+enum ColorPlane
+{
+    // Яркость
+    PLANE_Y = 0,
+    // Синяя цветоразность
+    PLANE_CB = 1,
+    // Красная цветоразность
+    PLANE_CR = 2
+};
+
+
+/**
+ * Класс плоскостей яркости и цветоразностей изображения или его
+ * прямоугольника. Каждая плоскость хранится сплошным массивом байтов
+ * без выравнивания строк, строки нумеруются как в изображении, снизу
+ * вверх. Цветоразности полного диапазона со смещением 128, как в JPEG.
+ */
+class ColorPlanes
+{
+protected:
+    // Плоскости яркости и цветоразностей
+    std::vector<unsigned char> planes[3];
+    // Ширина плоскостей в пикселях
+    unsigned long width;
+    // Высота плоскостей в пикселях
+    unsigned long height;
+    // Число потоков для обработки строк
+    unsigned threads;
+
+public:
+    // Конструктор класса без параметров
+    ColorPlanes();
+    // Метод задает число потоков для обработки строк
+    void set_threads(unsigned);
+    // Метод считает плоскость яркости прямоугольника изображения
+    int compute_luma(const ImageRegion&, LumaStandard);
+    // Метод считает плоскости яркости и цветоразностей прямоугольника
+    // изображения
+    int compute_ycbcr(const ImageRegion&, LumaStandard);
+    // Метод возвращает ширину плоскостей
+    unsigned long get_width() const;
+    // Метод возвращает высоту плоскостей
+    unsigned long get_height() const;
+    // Метод возвращает плоскость
+    const unsigned char* get_plane(ColorPlane) const;
+    // Метод возвращает строку плоскости
+    const unsigned char* get_row(ColorPlane, unsigned long) const;
+
+private:
+    // Метод готовит плоскости и обходит строки прямоугольника полосами
+    int compute(const ImageRegion&, LumaStandard, bool);
+};
+
+
+/**
+ * Конструктор класса ColorPlanes без параметров. Создает пустые
+ * плоскости.
+ */
+ColorPlanes::ColorPlanes()
+{
+    width = 0;
+    height = 0;
+    threads = 1;
+}
+
+
+/**
+ * Метод класса ColorPlanes задает число потоков для обработки строк.
+ * @param threads_num: число потоков (0 - по числу ядер процессора).
+ */
+void ColorPlanes::set_threads(unsigned threads_num)
+{
+    threads = threads_num ? threads_num : get_hardware_threads();
+}
+
+
+/**
+ * Метод класса ColorPlanes считает плоскость яркости прямоугольника
+ * изображения. Плоскости цветоразностей освобождаются.
+ * @param region: прямоугольник изображения (или все изображение);
+ * @param standard: стандарт весов каналов.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ColorPlanes::compute_luma(const ImageRegion& region,
+    LumaStandard standard)
+{
+    return compute(region, standard, false);
+}
+
+
+/**
+ * Метод класса ColorPlanes считает плоскости яркости и цветоразностей
+ * прямоугольника изображения за один проход по пикселям.
+ * @param region: прямоугольник изображения (или все изображение);
+ * @param standard: стандарт весов каналов.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ColorPlanes::compute_ycbcr(const ImageRegion& region,
+    LumaStandard standard)
+{
+    return compute(region, standard, true);
+}
+
+
+/**
+ * Метод класса ColorPlanes готовит плоскости и переводит строки
+ * прямоугольника. Полосы строк обрабатываются параллельно, каждая
+ * строка пишется в свое место плоскостей.
+ * @param region: прямоугольник изображения;
+ * @param standard: стандарт весов каналов;
+ * @param chroma: если true, считаются и цветоразности.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ColorPlanes::compute(const ImageRegion& region, LumaStandard standard,
+    bool chroma)
+{
+    for (std::vector<unsigned char>& plane : planes)
+    {
+        std::vector<unsigned char>().swap(plane);
+    }
+    width = 0;
+    height = 0;
+    if (region.is_empty())
+    {
+        std::cout << "Ошибка! Прямоугольник изображения пуст.\n";
+        return 0;
+    }
+    width = region.get_width();
+    height = region.get_height();
+    size_t size = (size_t)width * height;
+    planes[PLANE_Y].resize(size);
+    if (chroma)
+    {
+        planes[PLANE_CB].resize(size);
+        planes[PLANE_CR].resize(size);
+    }
+    auto body = [this, &region, standard, chroma](size_t first,
+        size_t last)
+    {
+        for (size_t i = first; i < last; i++)
+        {
+            // Цикл для прохода по строкам полосы
+            const RGBTriple* row = region.get_row((unsigned long)i);
+            size_t offset = i * width;
+            if (chroma)
+            {
+                convert_bgr_to_ycbcr(row, &planes[PLANE_Y][offset],
+                    &planes[PLANE_CB][offset], &planes[PLANE_CR][offset],
+                    width, standard);
+            }
+            else
+            {
+                convert_bgr_to_luma(row, &planes[PLANE_Y][offset], width,
+                    standard);
+            }
+        }
+    };
+    if (threads <= 1 || height < 2)
+    {
+        body(0, height);
+    }
+    else
+    {
+        get_thread_pool().parallel_for(0, height,
+            (height + threads - 1) / threads, body);
+    }
+    return 1;
+}
+
+
+/**
+ * Метод класса ColorPlanes возвращает ширину плоскостей.
+ * @return: ширина в пикселях.
+ */
+unsigned long ColorPlanes::get_width() const
+{
+    return width;
+}
+
+
+/**
+ * Метод класса ColorPlanes возвращает высоту плоскостей.
+ * @return: высота в пикселях.
+ */
+unsigned long ColorPlanes::get_height() const
+{
+    return height;
+}
+
+
+/**
+ * Метод класса ColorPlanes возвращает плоскость.
+ * @param plane: плоскость.
+ * @return: указатель на первый байт плоскости или nullptr, если
+ * плоскость не посчитана.
+ */
+const unsigned char* ColorPlanes::get_plane(ColorPlane plane) const
+{
+    return planes[plane].empty() ? nullptr : planes[plane].data();
+}
+
+
+/**
+ * Метод класса ColorPlanes возвращает строку плоскости.
+ * @param plane: плоскость;
+ * @param i: номер строки (снизу вверх, как в изображении).
+ * @return: указатель на первый байт строки или nullptr, если плоскость
+ * не посчитана.
+ */
+const unsigned char* ColorPlanes::get_row(ColorPlane plane, unsigned long i)
+    const
+{
+    const unsigned char* data = get_plane(plane);
+    return data ? data + (size_t)i * width : nullptr;
+}
+
+#endif
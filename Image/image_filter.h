@@ -0,0 +1,677 @@
+/*
+Модуль image_filter.h содержит определение класса ImageFilter -
+сепарабельной свертки изображения (размытие по Гауссу, усредняющее
+размытие, повышение резкости и произвольные сепарабельные ядра).
+Свертка выполняется двумя проходами, по строкам и по столбцам, в
+целых числах с фиксированной точкой. Изображение делится на плитки,
+промежуточные суммы которых помещаются в кэш процессора, плитки
+обрабатываются параллельно в общем пуле потоков. Проходы реализованы
+инструкциями AVX2 и обычным скалярным кодом, результаты реализаций
+совпадают побайтно.
+*/
+
+#pragma once
+#ifndef IMAGE_FILTER_H
+#define IMAGE_FILTER_H
+
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <vector>
+#include "image.h"
+#include "image_region.h"
+#include "pixel_convert.h"
+#include "thread_pool.h"
+
+
+// Число двоичных знаков дробной части весов ядра
+const int FILTER_SHIFT = 12;
+// Число двоичных знаков дробной части сумм после прохода по строкам
+const int FILTER_FRACTION = 4;
+// Наибольший радиус ядра
+const unsigned long FILTER_MAX_RADIUS = 64;
+// Наибольшая сумма модулей весов ядра, при которой суммы не
+// переполняются
+const double FILTER_MAX_GAIN = 6.0;
+// Ширина плитки в пикселях
+const unsigned long FILTER_TILE_WIDTH = 256;
+// Наименьшая высота плитки в строках
+const unsigned long FILTER_TILE_HEIGHT = 64;
+
+
+/**
+ * Функция переводит веса ядра в целые числа с фиксированной точкой.
+ * Ошибка округления переносится на центральный вес, чтобы сумма весов
+ * не изменилась: размытие не меняет яркость однотонной области.
+ * @param weights: веса ядра, их число нечетно;
+ * @param taps: массив для целых весов.
+ * @return: 0, если ядро не подходит для свертки.
+ */
+int quantize_kernel(const std::vector<double>& weights,
+    std::vector<int>& taps)
+{
+    if (weights.size() % 2 == 0 ||
+        weights.size() > 2 * FILTER_MAX_RADIUS + 1)
+    {
+        std::cout << "Ошибка! Ядро фильтра должно содержать нечетное " <<
+            "число весов, не больше " << 2 * FILTER_MAX_RADIUS + 1 <<
+            ".\n";
+        return 0;
+    }
+    double sum = 0;
+    double gain = 0;
+    for (size_t k = 0; k < weights.size(); k++)
+    {
+        sum += weights[k];
+        gain += std::fabs(weights[k]);
+    }
+    if (gain > FILTER_MAX_GAIN)
+    {
+        std::cout << "Ошибка! Сумма модулей весов ядра фильтра больше " <<
+            FILTER_MAX_GAIN << ".\n";
+        return 0;
+    }
+    taps.resize(weights.size());
+    long total = 0;
+    for (size_t k = 0; k < weights.size(); k++)
+    {
+        taps[k] = (int)std::lround(weights[k] * (1 << FILTER_SHIFT));
+        total += taps[k];
+    }
+    taps[taps.size() / 2] += (int)(std::lround(sum * (1 << FILTER_SHIFT)) -
+        total);
+    return 1;
+}
+
+
+/**
+ * Функция строит ядро размытия по Гауссу. Радиус ядра равен трем
+ * стандартным отклонениям.
+ * @param sigma: стандартное отклонение в пикселях.
+ * @return: нормированные веса ядра.
+ */
+std::vector<double> make_gaussian_kernel(double sigma)
+{
+    unsigned long radius = (unsigned long)std::ceil(3 * sigma);
+    if (radius > FILTER_MAX_RADIUS)
+    {
+        radius = FILTER_MAX_RADIUS;
+    }
+    std::vector<double> weights(2 * radius + 1);
+    double sum = 0;
+    for (size_t k = 0; k < weights.size(); k++)
+    {
+        double x = (double)k - radius;
+        weights[k] = std::exp(-x * x / (2 * sigma * sigma));
+        sum += weights[k];
+    }
+    for (size_t k = 0; k < weights.size(); k++)
+    {
+        weights[k] /= sum;
+    }
+    return weights;
+}
+
+
+/**
+ * Функция выполняет проход по строке скалярным кодом. Строка хранит
+ * каналы пикселей подряд и дополнена слева и справа радиусом ядра,
+ * поэтому соседние пиксели канала отстоят на 3 байта.
+ * @param line: дополненная строка;
+ * @param taps: целые веса ядра;
+ * @param taps_num: число весов;
+ * @param dst: массив для сумм;
+ * @param first: номер первого канала;
+ * @param count: число каналов в строке без дополнения.
+ */
+void filter_horizontal_scalar(const unsigned char* line, const int* taps,
+    size_t taps_num, short* dst, size_t first, size_t count)
+{
+    const int shift = FILTER_SHIFT - FILTER_FRACTION;
+    for (size_t c = first; c < count; c++)
+    {
+        int sum = 0;
+        for (size_t k = 0; k < taps_num; k++)
+        {
+            sum += taps[k] * line[c + k * 3];
+        }
+        dst[c] = (short)((sum + (1 << (shift - 1))) >> shift);
+    }
+}
+
+
+/**
+ * Функция выполняет проход по столбцам скалярным кодом: каналы
+ * результата складываются из сумм соседних строк.
+ * @param rows: указатели на суммы строк, по одной строке на вес;
+ * @param taps: целые веса ядра;
+ * @param taps_num: число весов;
+ * @param dst: массив для каналов результата;
+ * @param first: номер первого канала;
+ * @param count: число каналов в строке.
+ */
+void filter_vertical_scalar(const short* const* rows, const int* taps,
+    size_t taps_num, unsigned char* dst, size_t first, size_t count)
+{
+    const int shift = FILTER_SHIFT + FILTER_FRACTION;
+    for (size_t c = first; c < count; c++)
+    {
+        int sum = 0;
+        for (size_t k = 0; k < taps_num; k++)
+        {
+            sum += taps[k] * rows[k][c];
+        }
+        sum = (sum + (1 << (shift - 1))) >> shift;
+        dst[c] = (unsigned char)(sum < 0 ? 0 : sum > 255 ? 255 : sum);
+    }
+}
+
+
+/**
+ * Функция собирает соседние веса ядра в пары для _mm256_madd_epi16:
+ * младшие 16 бит пары содержат четный вес, старшие - следующий за ним.
+ * У ядра с нечетным числом весов последняя пара дополнена нулем.
+ * @param taps: целые веса ядра;
+ * @param taps_num: число весов;
+ * @param pairs: массив для (taps_num + 1) / 2 пар.
+ */
+void make_filter_pairs(const int* taps, size_t taps_num, int* pairs)
+{
+    for (size_t k = 0; k < taps_num; k += 2)
+    {
+        unsigned pair = (unsigned)taps[k] & 0xFFFF;
+        if (k + 1 < taps_num)
+        {
+            pair |= (unsigned)taps[k + 1] << 16;
+        }
+        pairs[k / 2] = (int)pair;
+    }
+}
+
+
+#ifdef IMAGE_SIMD_X86
+/**
+ * Функция выполняет проход по строке инструкциями AVX2. За шаг
+ * считаются 16 каналов, каждая пара весов умножается на каналы двух
+ * соседних пикселей одной инструкцией _mm256_madd_epi16.
+ * @param line: дополненная строка;
+ * @param taps: целые веса ядра;
+ * @param taps_num: число весов;
+ * @param dst: массив для сумм;
+ * @param count: число каналов в строке без дополнения.
+ */
+IMAGE_TARGET_AVX2
+void filter_horizontal_avx2(const unsigned char* line, const int* taps,
+    size_t taps_num, short* dst, size_t count)
+{
+    int pairs[FILTER_MAX_RADIUS + 1];
+    make_filter_pairs(taps, taps_num, pairs);
+    const int shift = FILTER_SHIFT - FILTER_FRACTION;
+    const __m256i round = _mm256_set1_epi32(1 << (shift - 1));
+    size_t c = 0;
+    for (; c + 16 <= count; c += 16)
+    {
+        __m256i low = _mm256_setzero_si256();
+        __m256i high = _mm256_setzero_si256();
+        for (size_t k = 0; k < taps_num; k += 2)
+        {
+            const unsigned char* p = line + c + k * 3;
+            __m256i first = _mm256_cvtepu8_epi16(
+                _mm_loadu_si128((const __m128i*)p));
+            // Вместо пикселя за последним весом берется тот же пиксель,
+            // его вес в паре равен нулю
+            __m256i second = first;
+            if (k + 1 < taps_num)
+            {
+                second = _mm256_cvtepu8_epi16(
+                    _mm_loadu_si128((const __m128i*)(p + 3)));
+            }
+            __m256i weight = _mm256_set1_epi32(pairs[k / 2]);
+            low = _mm256_add_epi32(low, _mm256_madd_epi16(
+                _mm256_unpacklo_epi16(first, second), weight));
+            high = _mm256_add_epi32(high, _mm256_madd_epi16(
+                _mm256_unpackhi_epi16(first, second), weight));
+        }
+        low = _mm256_srai_epi32(_mm256_add_epi32(low, round), shift);
+        high = _mm256_srai_epi32(_mm256_add_epi32(high, round), shift);
+        // Распаковка и упаковка идут внутри 128-битных половин, поэтому
+        // каналы возвращаются в исходный порядок
+        _mm256_storeu_si256((__m256i*)(dst + c),
+            _mm256_packs_epi32(low, high));
+    }
+    filter_horizontal_scalar(line, taps, taps_num, dst, c, count);
+}
+
+
+/**
+ * Функция выполняет проход по столбцам инструкциями AVX2 с готовыми
+ * парами весов. За шаг считаются 16 каналов, суммы двух соседних строк
+ * умножаются на пару весов одной инструкцией _mm256_madd_epi16.
+ * @param rows: указатели на суммы строк, по одной строке на вес;
+ * @param taps: целые веса ядра;
+ * @param pairs: пары весов, собранные make_filter_pairs;
+ * @param taps_num: число весов;
+ * @param dst: массив для каналов результата;
+ * @param count: число каналов в строке.
+ */
+IMAGE_TARGET_AVX2
+void filter_vertical_pairs_avx2(const short* const* rows, const int* taps,
+    const int* pairs, size_t taps_num, unsigned char* dst, size_t count)
+{
+    const int shift = FILTER_SHIFT + FILTER_FRACTION;
+    const __m256i round = _mm256_set1_epi32(1 << (shift - 1));
+    size_t c = 0;
+    for (; c + 16 <= count; c += 16)
+    {
+        __m256i low = _mm256_setzero_si256();
+        __m256i high = _mm256_setzero_si256();
+        for (size_t k = 0; k < taps_num; k += 2)
+        {
+            __m256i first = _mm256_loadu_si256((const __m256i*)(rows[k] + c));
+            __m256i second = first;
+            if (k + 1 < taps_num)
+            {
+                second = _mm256_loadu_si256(
+                    (const __m256i*)(rows[k + 1] + c));
+            }
+            __m256i weight = _mm256_set1_epi32(pairs[k / 2]);
+            low = _mm256_add_epi32(low, _mm256_madd_epi16(
+                _mm256_unpacklo_epi16(first, second), weight));
+            high = _mm256_add_epi32(high, _mm256_madd_epi16(
+                _mm256_unpackhi_epi16(first, second), weight));
+        }
+        low = _mm256_srai_epi32(_mm256_add_epi32(low, round), shift);
+        high = _mm256_srai_epi32(_mm256_add_epi32(high, round), shift);
+        __m256i words = _mm256_packs_epi32(low, high);
+        // Упаковка в байты с насыщением дублирует по 8 байт в каждой
+        // половине, первые 8 байт половин собираются в 16 байт
+        __m256i bytes = _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(words, words), 0x08);
+        _mm_storeu_si128((__m128i*)(dst + c), _mm256_castsi256_si128(bytes));
+    }
+    filter_vertical_scalar(rows, taps, taps_num, dst, c, count);
+}
+
+
+/**
+ * Функция выполняет проход по столбцам инструкциями AVX2.
+ * @param rows: указатели на суммы строк, по одной строке на вес;
+ * @param taps: целые веса ядра;
+ * @param taps_num: число весов;
+ * @param dst: массив для каналов результата;
+ * @param count: число каналов в строке.
+ */
+IMAGE_TARGET_AVX2
+void filter_vertical_avx2(const short* const* rows, const int* taps,
+    size_t taps_num, unsigned char* dst, size_t count)
+{
+    int pairs[FILTER_MAX_RADIUS + 1];
+    make_filter_pairs(taps, taps_num, pairs);
+    filter_vertical_pairs_avx2(rows, taps, pairs, taps_num, dst, count);
+}
+#endif
+
+
+/**
+ * Функция выполняет проход по строке реализацией для выбранного набора
+ * инструкций.
+ * @param line: дополненная строка;
+ * @param taps: целые веса ядра;
+ * @param taps_num: число весов;
+ * @param dst: массив для сумм;
+ * @param count: число каналов в строке без дополнения.
+ */
+void filter_horizontal(const unsigned char* line, const int* taps,
+    size_t taps_num, short* dst, size_t count)
+{
+#ifdef IMAGE_SIMD_X86
+    if (get_pixel_kernels().level == SIMD_AVX2)
+    {
+        filter_horizontal_avx2(line, taps, taps_num, dst, count);
+        return;
+    }
+#endif
+    filter_horizontal_scalar(line, taps, taps_num, dst, 0, count);
+}
+
+
+/**
+ * Функция выполняет проход по столбцам реализацией для выбранного
+ * набора инструкций.
+ * @param rows: указатели на суммы строк, по одной строке на вес;
+ * @param taps: целые веса ядра;
+ * @param taps_num: число весов;
+ * @param dst: массив для каналов результата;
+ * @param count: число каналов в строке.
+ */
+void filter_vertical(const short* const* rows, const int* taps,
+    size_t taps_num, unsigned char* dst, size_t count)
+{
+#ifdef IMAGE_SIMD_X86
+    if (get_pixel_kernels().level == SIMD_AVX2)
+    {
+        filter_vertical_avx2(rows, taps, taps_num, dst, count);
+        return;
+    }
+#endif
+    filter_vertical_scalar(rows, taps, taps_num, dst, 0, count);
+}
+
+
+/**
+ * Структура для хранения рабочих массивов одного потока.
+ */
+struct FilterBuffers
+{
+    // Строка исходных пикселей, дополненная по краям
+    std::vector<unsigned char> line;
+    // Суммы прохода по строкам для всех строк плитки
+    std::vector<short> sums;
+    // Указатели на суммы строк для прохода по столбцам
+    std::vector<const short*> rows;
+};
+
+
+/**
+ * Класс сепарабельного фильтра изображения или его прямоугольника.
+ * Ядро задается отдельно для прохода по строкам и по столбцам, за
+ * границей изображения повторяются крайние пиксели. Исходное
+ * изображение не меняется и должно существовать, пока существует
+ * фильтр.
+ */
+class ImageFilter
+{
+protected:
+    // Исходные пиксели
+    ImageRegion source;
+    // Целые веса ядра прохода по строкам
+    std::vector<int> horizontal;
+    // Целые веса ядра прохода по столбцам
+    std::vector<int> vertical;
+    // Число потоков для обработки плиток
+    unsigned threads;
+
+public:
+    // Конструктор класса, обрабатывающий все изображение
+    ImageFilter(const Image&);
+    // Конструктор класса, обрабатывающий прямоугольник изображения
+    ImageFilter(const ImageRegion&);
+    // Метод задает одно ядро для обоих проходов
+    int set_kernel(const std::vector<double>&);
+    // Метод задает ядра прохода по строкам и по столбцам
+    int set_kernel(const std::vector<double>&, const std::vector<double>&);
+    // Метод задает размытие по Гауссу
+    int set_gaussian_blur(double);
+    // Метод задает усредняющее размытие
+    int set_box_blur(unsigned long);
+    // Метод задает повышение резкости
+    int set_sharpen(double);
+    // Метод задает число потоков для обработки плиток
+    void set_threads(unsigned);
+    // Метод применяет фильтр и возвращает новое изображение
+    Image run() const;
+
+private:
+    // Метод применяет фильтр к плитке
+    void filter_tile(unsigned long, unsigned long, unsigned long,
+        unsigned long, RGBTriple*, FilterBuffers&) const;
+};
+
+
+/**
+ * Конструктор класса ImageFilter, обрабатывающий все изображение. Ядро
+ * по умолчанию не меняет пиксели.
+ * @param image: исходное изображение.
+ */
+ImageFilter::ImageFilter(const Image& image) :
+    ImageFilter(ImageRegion(image))
+{
+}
+
+
+/**
+ * Конструктор класса ImageFilter, обрабатывающий прямоугольник
+ * изображения. Пиксели за границей прямоугольника не читаются.
+ * @param region: прямоугольник исходного изображения.
+ */
+ImageFilter::ImageFilter(const ImageRegion& region)
+{
+    source = region;
+    horizontal.assign(1, 1 << FILTER_SHIFT);
+    vertical = horizontal;
+    threads = 1;
+}
+
+
+/**
+ * Метод класса ImageFilter задает одно ядро для прохода по строкам и по
+ * столбцам.
+ * @param weights: веса ядра, их число нечетно.
+ * @return: 0, если ядро не подходит для свертки.
+ */
+int ImageFilter::set_kernel(const std::vector<double>& weights)
+{
+    return set_kernel(weights, weights);
+}
+
+
+/**
+ * Метод класса ImageFilter задает ядра прохода по строкам и по
+ * столбцам. Веса не нормируются, поэтому ядро может менять яркость или
+ * выделять границы. Если ядро не подходит, прежнее ядро сохраняется.
+ * @param row_weights: веса ядра прохода по строкам;
+ * @param column_weights: веса ядра прохода по столбцам.
+ * @return: 0, если ядро не подходит для свертки.
+ */
+int ImageFilter::set_kernel(const std::vector<double>& row_weights,
+    const std::vector<double>& column_weights)
+{
+    std::vector<int> row_taps;
+    std::vector<int> column_taps;
+    if (!quantize_kernel(row_weights, row_taps) ||
+        !quantize_kernel(column_weights, column_taps))
+    {
+        return 0;
+    }
+    horizontal.swap(row_taps);
+    vertical.swap(column_taps);
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageFilter задает размытие по Гауссу.
+ * @param sigma: стандартное отклонение в пикселях (радиус ядра не
+ * больше FILTER_MAX_RADIUS).
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageFilter::set_gaussian_blur(double sigma)
+{
+    if (!(sigma > 0))
+    {
+        std::cout << "Ошибка! Стандартное отклонение должно быть " <<
+            "положительным.\n";
+        return 0;
+    }
+    return set_kernel(make_gaussian_kernel(sigma));
+}
+
+
+/**
+ * Метод класса ImageFilter задает усредняющее размытие квадратом со
+ * стороной 2 * radius + 1.
+ * @param radius: радиус квадрата.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageFilter::set_box_blur(unsigned long radius)
+{
+    if (radius > FILTER_MAX_RADIUS)
+    {
+        std::cout << "Ошибка! Радиус размытия больше " <<
+            FILTER_MAX_RADIUS << ".\n";
+        return 0;
+    }
+    return set_kernel(std::vector<double>(2 * radius + 1,
+        1.0 / (2 * radius + 1)));
+}
+
+
+/**
+ * Метод класса ImageFilter задает повышение резкости сепарабельным
+ * ядром [-amount, 1 + 2 * amount, -amount] в обоих проходах.
+ * @param amount: сила повышения резкости (от 0 до 1.25).
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageFilter::set_sharpen(double amount)
+{
+    if (!(amount >= 0))
+    {
+        std::cout << "Ошибка! Сила повышения резкости должна быть " <<
+            "неотрицательной.\n";
+        return 0;
+    }
+    std::vector<double> weights = { -amount, 1 + 2 * amount, -amount };
+    return set_kernel(weights);
+}
+
+
+/**
+ * Метод класса ImageFilter задает число потоков для обработки плиток.
+ * @param count: число потоков (0 - по числу ядер процессора).
+ */
+void ImageFilter::set_threads(unsigned count)
+{
+    threads = count ? count : get_hardware_threads();
+}
+
+
+/**
+ * Метод класса ImageFilter применяет фильтр к плитке результата. Сначала
+ * проход по строкам считает суммы для строк плитки и radius строк над и
+ * под ней, затем проход по столбцам записывает пиксели плитки. Номера
+ * строк и столбцов за границей изображения заменяются ближайшими.
+ * @param row: номер первой строки плитки;
+ * @param column: номер первого столбца плитки;
+ * @param rows_num: число строк плитки;
+ * @param columns_num: число столбцов плитки;
+ * @param data: массив пикселей результата;
+ * @param buffers: рабочие массивы потока.
+ */
+void ImageFilter::filter_tile(unsigned long row, unsigned long column,
+    unsigned long rows_num, unsigned long columns_num, RGBTriple* data,
+    FilterBuffers& buffers) const
+{
+    long width = (long)source.get_width();
+    long height = (long)source.get_height();
+    long row_radius = (long)horizontal.size() / 2;
+    long column_radius = (long)vertical.size() / 2;
+    size_t count = (size_t)columns_num * 3;
+    size_t line_size = count + row_radius * 6;
+    unsigned long sums_num = rows_num + 2 * column_radius;
+    buffers.line.resize(line_size);
+    buffers.sums.resize((size_t)sums_num * count);
+    buffers.rows.resize(vertical.size());
+    long first = (long)column - row_radius;
+    long last = (long)(column + columns_num) + row_radius;
+    long inner_first = first < 0 ? 0 : first;
+    long inner_last = last > width ? width : last;
+    for (unsigned long i = 0; i < sums_num; i++)
+    {
+        // Цикл для прохода по строкам, нужным плитке
+        long source_row = (long)row - column_radius + (long)i;
+        source_row = source_row < 0 ? 0 : source_row >= height ?
+            height - 1 : source_row;
+        const RGBTriple* pixels = source.get_row(source_row);
+        unsigned char* line = buffers.line.data();
+        for (long j = first; j < inner_first; j++)
+        {
+            memcpy(line + (j - first) * 3, &pixels[0], 3);
+        }
+        memcpy(line + (inner_first - first) * 3, &pixels[inner_first],
+            (inner_last - inner_first) * 3);
+        for (long j = inner_last; j < last; j++)
+        {
+            memcpy(line + (j - first) * 3, &pixels[width - 1], 3);
+        }
+        filter_horizontal(line, horizontal.data(), horizontal.size(),
+            &buffers.sums[(size_t)i * count], count);
+    }
+    for (unsigned long i = 0; i < rows_num; i++)
+    {
+        // Цикл для прохода по строкам плитки
+        for (size_t k = 0; k < vertical.size(); k++)
+        {
+            buffers.rows[k] = &buffers.sums[(i + k) * count];
+        }
+        unsigned char* dst = (unsigned char*)&data[(size_t)(row + i) *
+            width + column];
+        filter_vertical(buffers.rows.data(), vertical.data(),
+            vertical.size(), dst, count);
+    }
+}
+
+
+/**
+ * Метод класса ImageFilter применяет фильтр и возвращает новое
+ * изображение с глубиной цвета и масками каналов исходного. Плитки
+ * шириной FILTER_TILE_WIDTH пикселей делятся между потоками, суммы
+ * прохода по строкам одной плитки не покидают кэш процессора.
+ * @return: изображение с результатом (пустое, если исходное пусто).
+ */
+Image ImageFilter::run() const
+{
+    Image image;
+    if (source.is_empty())
+    {
+        return image;
+    }
+    unsigned long width = source.get_width();
+    unsigned long height = source.get_height();
+    image.bmp_info_header.size = sizeof(BMPInfoHeader);
+    image.bmp_info_header.width = width;
+    image.bmp_info_header.height = height;
+    image.bmp_info_header.bit_count = source.get_bit_count();
+    image.masks = source.get_bit_masks();
+    image.update_headers(0);
+    image.allocate_data((size_t)width * height);
+    // Высокая плитка уменьшает долю строк, которые считаются повторно
+    // для соседних плиток сверху и снизу
+    unsigned long tile_height = FILTER_TILE_HEIGHT;
+    if (tile_height < 4 * (vertical.size() / 2))
+    {
+        tile_height = 4 * (unsigned long)(vertical.size() / 2);
+    }
+    unsigned long columns = (width + FILTER_TILE_WIDTH - 1) /
+        FILTER_TILE_WIDTH;
+    unsigned long rows = (height + tile_height - 1) / tile_height;
+    size_t tiles = (size_t)columns * rows;
+    RGBTriple* data = image.data;
+    auto body = [&](size_t first, size_t last)
+    {
+        FilterBuffers buffers;
+        for (size_t t = first; t < last; t++)
+        {
+            // Цикл для прохода по плиткам части
+            unsigned long row = (unsigned long)(t / columns) * tile_height;
+            unsigned long column = (unsigned long)(t % columns) *
+                FILTER_TILE_WIDTH;
+            unsigned long rows_num = height - row < tile_height ?
+                height - row : tile_height;
+            unsigned long columns_num = width - column < FILTER_TILE_WIDTH ?
+                width - column : FILTER_TILE_WIDTH;
+            filter_tile(row, column, rows_num, columns_num, data, buffers);
+        }
+    };
+    if (threads <= 1 || tiles < 2)
+    {
+        body(0, tiles);
+    }
+    else
+    {
+        get_thread_pool().parallel_for(0, tiles, 1, body);
+    }
+    return image;
+}
+
+#endif
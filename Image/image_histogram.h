@@ -0,0 +1,376 @@
+/*
+Модуль image_histogram.h содержит определение класса ImageHistogram -
+гистограмм каналов и яркости изображения и статистик, которые по ним
+считаются: наименьшего и наибольшего значений, среднего и дисперсии.
+Массив пикселей проходится один раз полосами строк в нескольких
+потоках, у каждой полосы свои счетчики, которые затем складываются.
+*/
+
+#pragma once
+#ifndef IMAGE_HISTOGRAM_H
+#define IMAGE_HISTOGRAM_H
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include "image.h"
+#include "image_region.h"
+#include "pixel_convert.h"
+#include "thread_pool.h"
+
+
+/**
+ * Каналы, для которых строятся гистограммы.
+ */
+enum HistogramChannel
+{
+    // Синий канал
+    HISTOGRAM_BLUE = 0,
+    // Зеленый канал
+    HISTOGRAM_GREEN = 1,
+    // Красный канал
+    HISTOGRAM_RED = 2,
+    // Яркость по весам BT.601
+    HISTOGRAM_LUMA = 3
+};
+
+
+// Число копий счетчиков каждого канала. Четыре соседних пикселя
+// попадают в разные копии, поэтому увеличение счетчика не ждет записи
+// предыдущего увеличения того же счетчика при одинаковых значениях
+// подряд
+const int HISTOGRAM_COPIES = 4;
+// Число пикселей, после которого 32-битные счетчики полосы переносятся
+// в 64-битные, чтобы не переполниться
+const size_t HISTOGRAM_FLUSH_PIXELS = (size_t)1 << 30;
+
+
+/**
+ * Структура для хранения счетчиков одной полосы строк.
+ */
+struct HistogramCounters
+{
+    // Счетчики: копия, канал, значение
+    std::uint32_t counts[HISTOGRAM_COPIES][4][256];
+};
+
+
+/**
+ * Класс гистограмм изображения или его прямоугольника. Гистограммы
+ * строятся методом compute, статистики каналов считаются по
+ * гистограммам без повторного прохода по пикселям.
+ */
+class ImageHistogram
+{
+protected:
+    // Гистограммы синего, зеленого, красного каналов и яркости
+    std::uint64_t histograms[4][256];
+    // Число учтенных пикселей
+    std::uint64_t count;
+    // Число потоков для обработки строк
+    unsigned threads;
+
+public:
+    // Конструктор класса без параметров
+    ImageHistogram();
+    // Метод задает число потоков для обработки строк
+    void set_threads(unsigned);
+    // Метод строит гистограммы изображения
+    int compute(const Image&);
+    // Метод строит гистограммы прямоугольника изображения
+    int compute(const ImageRegion&);
+    // Метод возвращает число учтенных пикселей
+    std::uint64_t get_count() const;
+    // Метод возвращает гистограмму канала
+    const std::uint64_t* get_histogram(HistogramChannel) const;
+    // Метод возвращает наименьшее значение канала
+    unsigned char get_min(HistogramChannel) const;
+    // Метод возвращает наибольшее значение канала
+    unsigned char get_max(HistogramChannel) const;
+    // Метод возвращает среднее значение канала
+    double get_mean(HistogramChannel) const;
+    // Метод возвращает дисперсию значений канала
+    double get_variance(HistogramChannel) const;
+
+private:
+    // Метод добавляет к гистограммам счетчики полосы и обнуляет их
+    void add_counters(HistogramCounters&);
+    // Метод считает строки прямоугольника и добавляет их к гистограммам
+    void count_rows(const ImageRegion&, unsigned long, unsigned long,
+        std::mutex&);
+};
+
+
+/**
+ * Конструктор класса ImageHistogram без параметров. Создает пустые
+ * гистограммы.
+ */
+ImageHistogram::ImageHistogram()
+{
+    memset(histograms, 0, sizeof(histograms));
+    count = 0;
+    threads = 1;
+}
+
+
+/**
+ * Метод класса ImageHistogram задает число потоков для обработки строк.
+ * @param threads_num: число потоков (0 - по числу ядер процессора).
+ */
+void ImageHistogram::set_threads(unsigned threads_num)
+{
+    threads = threads_num ? threads_num : get_hardware_threads();
+}
+
+
+/**
+ * Метод класса ImageHistogram строит гистограммы изображения.
+ * @param image: изображение.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageHistogram::compute(const Image& image)
+{
+    return compute(ImageRegion(image));
+}
+
+
+/**
+ * Метод класса ImageHistogram строит гистограммы прямоугольника
+ * изображения. Прежние гистограммы заменяются. Полосы строк
+ * обрабатываются параллельно, счетчики полос складываются по
+ * окончании полосы.
+ * @param region: прямоугольник изображения.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageHistogram::compute(const ImageRegion& region)
+{
+    memset(histograms, 0, sizeof(histograms));
+    count = 0;
+    if (region.is_empty())
+    {
+        std::cout << "Ошибка! Прямоугольник изображения пуст.\n";
+        return 0;
+    }
+    unsigned long height = region.get_height();
+    std::mutex mutex;
+    auto body = [this, &region, &mutex](size_t first, size_t last)
+    {
+        count_rows(region, (unsigned long)first, (unsigned long)last,
+            mutex);
+    };
+    if (threads <= 1 || height < 2)
+    {
+        body(0, height);
+    }
+    else
+    {
+        get_thread_pool().parallel_for(0, height,
+            (height + threads - 1) / threads, body);
+    }
+    count = (std::uint64_t)region.get_width() * height;
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageHistogram добавляет к гистограммам счетчики полосы,
+ * складывая их копии, и обнуляет счетчики.
+ * @param counters: счетчики полосы.
+ */
+void ImageHistogram::add_counters(HistogramCounters& counters)
+{
+    for (int c = 0; c < 4; c++)
+    {
+        for (int v = 0; v < 256; v++)
+        {
+            std::uint64_t sum = 0;
+            for (int k = 0; k < HISTOGRAM_COPIES; k++)
+            {
+                sum += counters.counts[k][c][v];
+            }
+            histograms[c][v] += sum;
+        }
+    }
+    memset(counters.counts, 0, sizeof(counters.counts));
+}
+
+
+/**
+ * Метод класса ImageHistogram считает строки [first, last)
+ * прямоугольника в собственные счетчики полосы и добавляет их к
+ * гистограммам под замком. Яркость строки считается векторной функцией,
+ * затем пиксели по четыре раскладываются по разным копиям счетчиков.
+ * @param region: прямоугольник изображения;
+ * @param first: номер первой строки;
+ * @param last: номер строки после последней;
+ * @param mutex: замок, под которым меняются гистограммы.
+ */
+void ImageHistogram::count_rows(const ImageRegion& region,
+    unsigned long first, unsigned long last, std::mutex& mutex)
+{
+    HistogramCounters counters;
+    memset(counters.counts, 0, sizeof(counters.counts));
+    size_t width = region.get_width();
+    std::vector<unsigned char> luma(width);
+    size_t pixels = 0;
+    for (unsigned long i = first; i < last; i++)
+    {
+        // Цикл для прохода по строкам полосы
+        const RGBTriple* row = region.get_row(i);
+        convert_bgr_to_luma(row, luma.data(), width, LUMA_BT601);
+        const unsigned char* bytes = (const unsigned char*)row;
+        size_t j = 0;
+        for (; j + 4 <= width; j += 4)
+        {
+            // Четыре пикселя читаются тремя 32-битными словами (байты
+            // b0 g0 r0 b1, g1 r1 b2 g2, r2 b3 g3 r3), каждый пиксель
+            // попадает в свою копию счетчиков
+            std::uint32_t words[3];
+            std::uint32_t lumas;
+            memcpy(words, bytes + j * 3, sizeof(words));
+            memcpy(&lumas, &luma[j], sizeof(lumas));
+            std::uint32_t (*copy)[256] = counters.counts[0];
+            copy[HISTOGRAM_BLUE][words[0] & 0xFF]++;
+            copy[HISTOGRAM_GREEN][(words[0] >> 8) & 0xFF]++;
+            copy[HISTOGRAM_RED][(words[0] >> 16) & 0xFF]++;
+            copy[HISTOGRAM_LUMA][lumas & 0xFF]++;
+            copy = counters.counts[1];
+            copy[HISTOGRAM_BLUE][words[0] >> 24]++;
+            copy[HISTOGRAM_GREEN][words[1] & 0xFF]++;
+            copy[HISTOGRAM_RED][(words[1] >> 8) & 0xFF]++;
+            copy[HISTOGRAM_LUMA][(lumas >> 8) & 0xFF]++;
+            copy = counters.counts[2];
+            copy[HISTOGRAM_BLUE][(words[1] >> 16) & 0xFF]++;
+            copy[HISTOGRAM_GREEN][words[1] >> 24]++;
+            copy[HISTOGRAM_RED][words[2] & 0xFF]++;
+            copy[HISTOGRAM_LUMA][(lumas >> 16) & 0xFF]++;
+            copy = counters.counts[3];
+            copy[HISTOGRAM_BLUE][(words[2] >> 8) & 0xFF]++;
+            copy[HISTOGRAM_GREEN][(words[2] >> 16) & 0xFF]++;
+            copy[HISTOGRAM_RED][words[2] >> 24]++;
+            copy[HISTOGRAM_LUMA][lumas >> 24]++;
+        }
+        for (; j < width; j++)
+        {
+            // Последние пиксели строки попадают в первую копию
+            const unsigned char* px = bytes + j * 3;
+            counters.counts[0][HISTOGRAM_BLUE][px[0]]++;
+            counters.counts[0][HISTOGRAM_GREEN][px[1]]++;
+            counters.counts[0][HISTOGRAM_RED][px[2]]++;
+            counters.counts[0][HISTOGRAM_LUMA][luma[j]]++;
+        }
+        pixels += width;
+        if (pixels >= HISTOGRAM_FLUSH_PIXELS || i + 1 == last)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            add_counters(counters);
+            pixels = 0;
+        }
+    }
+}
+
+
+/**
+ * Метод класса ImageHistogram возвращает число пикселей, учтенных в
+ * гистограммах.
+ * @return: число пикселей.
+ */
+std::uint64_t ImageHistogram::get_count() const
+{
+    return count;
+}
+
+
+/**
+ * Метод класса ImageHistogram возвращает гистограмму канала.
+ * @param channel: канал.
+ * @return: массив из 256 счетчиков.
+ */
+const std::uint64_t* ImageHistogram::get_histogram(
+    HistogramChannel channel) const
+{
+    return histograms[channel];
+}
+
+
+/**
+ * Метод класса ImageHistogram возвращает наименьшее значение канала.
+ * @param channel: канал.
+ * @return: наименьшее значение (0 для пустых гистограмм).
+ */
+unsigned char ImageHistogram::get_min(HistogramChannel channel) const
+{
+    for (int v = 0; v < 256; v++)
+    {
+        if (histograms[channel][v])
+        {
+            return (unsigned char)v;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * Метод класса ImageHistogram возвращает наибольшее значение канала.
+ * @param channel: канал.
+ * @return: наибольшее значение (0 для пустых гистограмм).
+ */
+unsigned char ImageHistogram::get_max(HistogramChannel channel) const
+{
+    for (int v = 255; v >= 0; v--)
+    {
+        if (histograms[channel][v])
+        {
+            return (unsigned char)v;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * Метод класса ImageHistogram возвращает среднее значение канала.
+ * @param channel: канал.
+ * @return: среднее значение (0 для пустых гистограмм).
+ */
+double ImageHistogram::get_mean(HistogramChannel channel) const
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    std::uint64_t sum = 0;
+    for (int v = 0; v < 256; v++)
+    {
+        sum += histograms[channel][v] * v;
+    }
+    return (double)sum / count;
+}
+
+
+/**
+ * Метод класса ImageHistogram возвращает дисперсию значений канала по
+ * всем пикселям (без поправки на выборку).
+ * @param channel: канал.
+ * @return: дисперсия (0 для пустых гистограмм).
+ */
+double ImageHistogram::get_variance(HistogramChannel channel) const
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    double mean = get_mean(channel);
+    double sum = 0;
+    for (int v = 0; v < 256; v++)
+    {
+        sum += histograms[channel][v] * (v - mean) * (v - mean);
+    }
+    return sum / count;
+}
+
+#endif
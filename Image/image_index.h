@@ -0,0 +1,480 @@
+/*
+Модуль image_index.h содержит определение класса ImageIndex - индекса
+сведений о BMP файлах каталога. Индекс хранится в текстовом файле и
+обновляется инкрементально: заголовки заново читаются только у новых
+файлов и у файлов, время изменения или размер которых изменились.
+Модулю нужен стандарт C++17 (std::filesystem).
+*/
+
+#pragma once
+#ifndef IMAGE_INDEX_H
+#define IMAGE_INDEX_H
+
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+#include "byte_stream.h"
+#include "image_probe.h"
+#include "thread_pool.h"
+
+
+// Первая строка файла индекса, задающая версию формата
+const char INDEX_SIGNATURE[] = "# bmp-index 1";
+// Число файлов, заголовки которых читает одна задача пула потоков
+const size_t INDEX_PROBE_GRAIN = 64;
+
+
+/**
+ * Функция определяет, является ли файл BMP изображением по расширению.
+ * @param path: путь к файлу.
+ * @return: true, если расширение .bmp в любом регистре.
+ */
+bool is_bmp(const std::filesystem::path& path)
+{
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+        [](unsigned char c) { return (char)tolower(c); });
+    return extension == ".bmp";
+}
+
+
+/**
+ * Структура для хранения записи индекса об одном файле.
+ */
+struct IndexEntry
+{
+    // Путь к файлу
+    std::string path;
+    // Время последнего изменения файла в единицах часов файловой системы
+    std::int64_t mtime;
+    // Если true, заголовки файла прошли проверку
+    bool valid;
+    // Сведения из заголовков, у неверных файлов задан только размер
+    ImageInfo info;
+    // Если true, время изменения и размер файла не удалось получить из
+    // каталога, и запись не берется из индекса без чтения файла
+    bool unknown;
+};
+
+
+/**
+ * Класс для хранения и инкрементального обновления индекса BMP файлов.
+ * Записи упорядочены по пути к файлу.
+ */
+class ImageIndex
+{
+protected:
+    // Записи индекса
+    std::vector<IndexEntry> entries;
+    // Число файлов, заголовки которых прочитаны при обновлении
+    size_t probed;
+    // Число записей, взятых из индекса без чтения файла
+    size_t reused;
+    // Число записей об удаленных файлах
+    size_t removed;
+
+public:
+    // Конструктор класса без параметров
+    ImageIndex();
+    // Метод читает индекс из файла
+    int load_index(const char*);
+    // Метод записывает индекс в файл
+    int save_index(const char*) const;
+    // Метод обновляет индекс по содержимому каталога
+    int update_index(const char*);
+    // Метод удаляет все записи индекса
+    void clear();
+    // Метод возвращает число записей
+    size_t get_size() const;
+    // Метод возвращает запись по номеру
+    const IndexEntry& get_entry(size_t) const;
+    // Метод ищет запись по пути к файлу
+    const IndexEntry* find_entry(const std::string&) const;
+    // Метод возвращает число файлов, прочитанных при обновлении
+    size_t get_probed() const;
+    // Метод возвращает число записей, взятых без чтения файла
+    size_t get_reused() const;
+    // Метод возвращает число записей об удаленных файлах
+    size_t get_removed() const;
+
+protected:
+    // Метод разбирает строку файла индекса
+    static bool parse_entry(const std::string&, IndexEntry&);
+};
+
+
+/**
+ * Функция читает строку текстового файла без символа конца строки.
+ * @param file: открытый файл;
+ * @param line: строка для результата.
+ * @return: false, если файл закончился.
+ */
+bool read_line(FILE* file, std::string& line)
+{
+    line.clear();
+    char buffer[4096];
+    while (fgets(buffer, sizeof(buffer), file))
+    {
+        line += buffer;
+        if (!line.empty() && line.back() == '\n')
+        {
+            line.pop_back();
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+            return true;
+        }
+    }
+    return !line.empty();
+}
+
+
+/**
+ * Конструктор класса ImageIndex без параметров. Создает пустой индекс.
+ */
+ImageIndex::ImageIndex()
+{
+    probed = 0;
+    reused = 0;
+    removed = 0;
+}
+
+
+/**
+ * Метод класса ImageIndex разбирает строку файла индекса. Поля строки
+ * разделены табуляцией, путь к файлу идет последним и может содержать
+ * любые символы, кроме конца строки.
+ * @param line: строка файла индекса;
+ * @param entry: запись для результата.
+ * @return: true, если строка разобрана.
+ */
+bool ImageIndex::parse_entry(const std::string& line, IndexEntry& entry)
+{
+    std::int64_t mtime;
+    std::uint64_t file_size;
+    std::uint64_t data_size;
+    std::uint64_t fields[7];
+    int length = 0;
+    int count = sscanf(line.c_str(), "%" SCNd64 "\t%" SCNu64 "\t%" SCNu64
+        "\t%" SCNu64 "\t%" SCNu64 "\t%" SCNu64 "\t%" SCNu64 "\t%" SCNu64
+        "\t%" SCNu64 "\t%" SCNu64 "%n", &mtime, &file_size, &fields[0],
+        &fields[1], &fields[2], &fields[3], &fields[4], &fields[5],
+        &fields[6], &data_size, &length);
+    if (count != 10 || length == 0 || (size_t)length + 1 >= line.size() ||
+        line[length] != '\t')
+    {
+        return false;
+    }
+    entry.path = line.substr(length + 1);
+    entry.mtime = mtime;
+    entry.valid = fields[0] != 0;
+    entry.info.file_size = file_size;
+    entry.info.width = (unsigned long)fields[1];
+    entry.info.height = (unsigned long)fields[2];
+    entry.info.bit_count = (unsigned short)fields[3];
+    entry.info.compression = (unsigned long)fields[4];
+    entry.info.colors_num = (unsigned long)fields[5];
+    entry.info.offset_data = (unsigned long)fields[6];
+    entry.info.data_size = data_size;
+    entry.unknown = false;
+    return true;
+}
+
+
+/**
+ * Метод класса ImageIndex читает индекс из файла. Прежние записи
+ * удаляются. Строки, которые не удалось разобрать, пропускаются: их
+ * файлы будут прочитаны заново при обновлении.
+ * @param filename: имя файла индекса.
+ * @return: 0, если файл не удалось открыть или он не является индексом.
+ */
+int ImageIndex::load_index(const char* filename)
+{
+    clear();
+    FILE* file = open_file(filename, "rb");
+    if (!file)
+    {
+        std::cout << "Ошибка! Не удалось открыть файл индекса '" <<
+            filename << "'.\n";
+        return 0;
+    }
+    std::string line;
+    if (!read_line(file, line) || line != INDEX_SIGNATURE)
+    {
+        fclose(file);
+        std::cout << "Ошибка! Файл '" << filename <<
+            "' не является индексом BMP файлов.\n";
+        return 0;
+    }
+    IndexEntry entry;
+    while (read_line(file, line))
+    {
+        if (parse_entry(line, entry))
+        {
+            entries.push_back(entry);
+        }
+    }
+    fclose(file);
+    // Индекс мог быть изменен вручную, восстанавливаем порядок записей
+    std::sort(entries.begin(), entries.end(),
+        [](const IndexEntry& a, const IndexEntry& b)
+        { return a.path < b.path; });
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageIndex записывает индекс в файл. Индекс сначала
+ * пишется во временный файл, который затем заменяет прежний, поэтому
+ * прерванная запись не портит индекс.
+ * @param filename: имя файла индекса.
+ * @return: 0, если индекс не удалось записать.
+ */
+int ImageIndex::save_index(const char* filename) const
+{
+    std::string temp_name = std::string(filename) + ".tmp";
+    FILE* file = open_file(temp_name.c_str(), "wb");
+    if (!file)
+    {
+        std::cout << "Ошибка! Не удалось создать файл индекса '" <<
+            filename << "'.\n";
+        return 0;
+    }
+    fprintf(file, "%s\n", INDEX_SIGNATURE);
+    for (const IndexEntry& entry : entries)
+    {
+        const ImageInfo& info = entry.info;
+        fprintf(file, "%" PRId64 "\t%" PRIu64 "\t%u\t%" PRIu64 "\t%" PRIu64
+            "\t%u\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%s\n",
+            entry.mtime, info.file_size, entry.valid ? 1u : 0u,
+            (std::uint64_t)info.width, (std::uint64_t)info.height,
+            (unsigned)info.bit_count, (std::uint64_t)info.compression,
+            (std::uint64_t)info.colors_num, (std::uint64_t)info.offset_data,
+            info.data_size, entry.path.c_str());
+    }
+    bool failed = ferror(file) != 0;
+    failed = fclose(file) != 0 || failed;
+    std::error_code error;
+    if (!failed)
+    {
+        std::filesystem::rename(temp_name, filename, error);
+    }
+    if (failed || error)
+    {
+        std::filesystem::remove(temp_name, error);
+        std::cout << "Ошибка! Не удалось записать файл индекса '" <<
+            filename << "'.\n";
+        return 0;
+    }
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageIndex обновляет индекс по BMP файлам каталога и его
+ * подкаталогов. Запись о файле берется из индекса без чтения файла, если
+ * время изменения и размер файла совпадают с записанными. Заголовки
+ * остальных файлов читаются параллельно общим пулом потоков. Записи об
+ * удаленных файлах удаляются. Каталоги без прав доступа пропускаются.
+ * Файл, сведения о котором не удалось получить из каталога, остается в
+ * индексе с нулевым временем изменения и отметкой unknown и читается
+ * заново при каждом обновлении, пока сведения не будут получены: такая
+ * запись не берется из индекса, а нулевое время не совпадет с временем,
+ * полученным позже. Если обход прерван, индекс не меняется:
+ * непройденные файлы нельзя считать удаленными.
+ * @param directory: каталог с изображениями.
+ * @return: 0, если каталог не удалось открыть или обойти.
+ */
+int ImageIndex::update_index(const char* directory)
+{
+    namespace fs = std::filesystem;
+    probed = 0;
+    reused = 0;
+    removed = 0;
+    std::error_code error;
+    fs::recursive_directory_iterator it(directory,
+        fs::directory_options::skip_permission_denied, error);
+    if (error)
+    {
+        std::cout << "Ошибка! Не удалось открыть каталог '" << directory <<
+            "'.\n";
+        return 0;
+    }
+    std::vector<IndexEntry> found;
+    for (; it != fs::recursive_directory_iterator(); it.increment(error))
+    {
+        if (error)
+        {
+            break;
+        }
+        // Ошибка сведений об одном файле не прерывает обход: запись
+        // отмечается неизвестной, и файл читается заново
+        std::error_code entry_error;
+        bool regular = it->is_regular_file(entry_error);
+        if ((!regular && !entry_error) || !is_bmp(it->path()))
+        {
+            continue;
+        }
+        IndexEntry entry = {};
+        entry.path = it->path().string();
+        fs::file_time_type mtime;
+        std::uintmax_t file_size = 0;
+        if (!entry_error)
+        {
+            mtime = it->last_write_time(entry_error);
+        }
+        if (!entry_error)
+        {
+            file_size = it->file_size(entry_error);
+        }
+        if (!entry_error)
+        {
+            entry.mtime = (std::int64_t)mtime.time_since_epoch().count();
+            entry.info.file_size = file_size;
+        }
+        entry.unknown = entry_error ? true : false;
+        found.push_back(entry);
+    }
+    if (error)
+    {
+        // Ошибка перехода к следующему файлу может закончить обход
+        std::cout << "Ошибка! Не удалось обойти каталог '" << directory <<
+            "'.\n";
+        return 0;
+    }
+    std::sort(found.begin(), found.end(),
+        [](const IndexEntry& a, const IndexEntry& b)
+        { return a.path < b.path; });
+    // Оба списка упорядочены по пути, сравниваем их за один проход
+    std::vector<size_t> pending;
+    size_t kept = 0;
+    size_t j = 0;
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        while (j < entries.size() && entries[j].path < found[i].path)
+        {
+            j++;
+        }
+        if (j < entries.size() && entries[j].path == found[i].path)
+        {
+            kept++;
+            if (!found[i].unknown && entries[j].mtime == found[i].mtime &&
+                entries[j].info.file_size == found[i].info.file_size)
+            {
+                found[i] = entries[j];
+                reused++;
+                continue;
+            }
+        }
+        pending.push_back(i);
+    }
+    removed = entries.size() - kept;
+    get_thread_pool().parallel_for(0, pending.size(), INDEX_PROBE_GRAIN,
+        [&](size_t first, size_t last)
+        {
+            for (size_t k = first; k < last; k++)
+            {
+                IndexEntry& entry = found[pending[k]];
+                // Размер из каталога сохраняем, чтобы запись о неверном
+                // файле тоже не читалась повторно
+                std::uint64_t file_size = entry.info.file_size;
+                entry.valid = !read_image_info(entry.path.c_str(),
+                    entry.info);
+                entry.info.file_size = file_size;
+            }
+        });
+    probed = pending.size();
+    entries.swap(found);
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageIndex удаляет все записи индекса.
+ */
+void ImageIndex::clear()
+{
+    entries.clear();
+}
+
+
+/**
+ * Метод класса ImageIndex возвращает число записей.
+ * @return: число записей.
+ */
+size_t ImageIndex::get_size() const
+{
+    return entries.size();
+}
+
+
+/**
+ * Метод класса ImageIndex возвращает запись по номеру.
+ * @param index: номер записи.
+ * @return: запись индекса.
+ */
+const IndexEntry& ImageIndex::get_entry(size_t index) const
+{
+    return entries[index];
+}
+
+
+/**
+ * Метод класса ImageIndex ищет запись по пути к файлу.
+ * @param path: путь к файлу в том виде, в котором он записан в индексе.
+ * @return: запись или nullptr, если файла нет в индексе.
+ */
+const IndexEntry* ImageIndex::find_entry(const std::string& path) const
+{
+    auto it = std::lower_bound(entries.begin(), entries.end(), path,
+        [](const IndexEntry& entry, const std::string& value)
+        { return entry.path < value; });
+    if (it == entries.end() || it->path != path)
+    {
+        return nullptr;
+    }
+    return &*it;
+}
+
+
+/**
+ * Метод класса ImageIndex возвращает число файлов, заголовки которых
+ * прочитаны при последнем обновлении.
+ * @return: число файлов.
+ */
+size_t ImageIndex::get_probed() const
+{
+    return probed;
+}
+
+
+/**
+ * Метод класса ImageIndex возвращает число записей, взятых при последнем
+ * обновлении из индекса без чтения файла.
+ * @return: число записей.
+ */
+size_t ImageIndex::get_reused() const
+{
+    return reused;
+}
+
+
+/**
+ * Метод класса ImageIndex возвращает число записей об удаленных файлах,
+ * исключенных при последнем обновлении.
+ * @return: число записей.
+ */
+size_t ImageIndex::get_removed() const
+{
+    return removed;
+}
+
+#endif
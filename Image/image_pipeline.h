@@ -0,0 +1,609 @@
+/*
+Модуль image_pipeline.h содержит определение класса ImagePipeline -
+отложенной цепочки операций над пикселями изображения. Операции
+(оттенки серого, порог, таблицы преобразования каналов, отражения,
+смена глубины цвета и собственные операции над строками) только
+запоминаются, а выполняются при получении результата за один проход по
+строкам: каждая строка проходит всю цепочку, пока находится в кэше, и
+промежуточные изображения не создаются.
+*/
+
+#pragma once
+#ifndef IMAGE_PIPELINE_H
+#define IMAGE_PIPELINE_H
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <vector>
+#include "image.h"
+#include "image_region.h"
+#include "pixel_convert.h"
+#include "thread_pool.h"
+
+
+// Функция обработки строки пикселей: строка, ширина и номер строки
+// результата
+typedef std::function<void(RGBTriple*, unsigned long, unsigned long)>
+    RowStage;
+
+
+/**
+ * Виды операций цепочки.
+ */
+enum PipelineStageType
+{
+    // Замена каналов по таблицам преобразования
+    PIPELINE_LUT = 0,
+    // Оттенки серого
+    PIPELINE_GRAYSCALE = 1,
+    // Отражение строки слева направо
+    PIPELINE_FLIP = 2,
+    // Собственная операция над строкой
+    PIPELINE_CUSTOM = 3
+};
+
+
+/**
+ * Структура для хранения одной операции цепочки.
+ */
+struct PipelineStage
+{
+    // Вид операции
+    PipelineStageType type;
+    // Таблицы преобразования каналов в порядке синий, зеленый, красный
+    unsigned char tables[3][256];
+    // Собственная операция над строкой
+    RowStage function;
+};
+
+
+// Число пикселей, яркость которых считается за один вызов векторной
+// функции при переводе строки в оттенки серого
+const unsigned long GRAYSCALE_CHUNK = 256;
+
+
+/**
+ * Функция заменяет пиксели строки оттенками серого. Яркость считается
+ * векторной функцией по весам BT.601: (77 * R + 150 * G + 29 * B) / 256,
+ * строка обрабатывается кусками, которые остаются в кэше.
+ * @param row: строка пикселей;
+ * @param width: число пикселей.
+ */
+void convert_row_to_grayscale(RGBTriple* row, unsigned long width)
+{
+    unsigned char luma[GRAYSCALE_CHUNK];
+    for (unsigned long j = 0; j < width; j += GRAYSCALE_CHUNK)
+    {
+        unsigned long count = width - j < GRAYSCALE_CHUNK ? width - j :
+            GRAYSCALE_CHUNK;
+        convert_bgr_to_luma(row + j, luma, count, LUMA_BT601);
+        for (unsigned long k = 0; k < count; k++)
+        {
+            row[j + k].blue = row[j + k].green = row[j + k].red = luma[k];
+        }
+    }
+}
+
+
+/**
+ * Класс отложенной цепочки операций над пикселями изображения или его
+ * прямоугольника. Методы add_* запоминают операции и возвращают ссылку
+ * на цепочку, чтобы операции можно было записывать подряд. Результат
+ * получается методами run и write_image за один проход по строкам.
+ * Исходное изображение не меняется и должно существовать, пока
+ * существует цепочка.
+ */
+class ImagePipeline
+{
+protected:
+    // Исходные пиксели
+    ImageRegion source;
+    // Операции в порядке выполнения
+    std::vector<PipelineStage> stages;
+    // Если true, строки результата идут в обратном порядке
+    bool flipped;
+    // Глубина цвета результата
+    unsigned short bit_count;
+    // Маски каналов 16- и 32-битного результата
+    BitMasks masks;
+    // Число потоков для обработки строк
+    unsigned threads;
+
+public:
+    // Конструктор класса, обрабатывающий все изображение
+    ImagePipeline(const Image&);
+    // Конструктор класса, обрабатывающий прямоугольник изображения
+    ImagePipeline(const ImageRegion&);
+    // Метод добавляет перевод в оттенки серого
+    ImagePipeline& add_grayscale();
+    // Метод добавляет порог яркости
+    ImagePipeline& add_threshold(unsigned char);
+    // Метод добавляет одну таблицу преобразования для всех каналов
+    ImagePipeline& add_lut(const unsigned char*);
+    // Метод добавляет таблицы преобразования для каждого канала
+    ImagePipeline& add_lut(const unsigned char*, const unsigned char*,
+        const unsigned char*);
+    // Метод добавляет отражение слева направо
+    ImagePipeline& add_flip_horizontal();
+    // Метод добавляет отражение сверху вниз
+    ImagePipeline& add_flip_vertical();
+    // Метод добавляет собственную операцию над строкой
+    ImagePipeline& add_stage(const RowStage&);
+    // Метод задает глубину цвета результата
+    int set_bit_count(unsigned short);
+    // Метод задает число потоков для обработки строк
+    void set_threads(unsigned);
+    // Метод возвращает число запомненных операций
+    size_t get_stages_num() const;
+    // Метод возвращает ширину результата
+    unsigned long get_width() const;
+    // Метод возвращает высоту результата
+    unsigned long get_height() const;
+    // Метод выполняет цепочку и возвращает новое изображение
+    Image run() const;
+    // Метод выполняет цепочку и записывает результат в BMP файл
+    int write_image(const char*) const;
+    // Метод выполняет цепочку и записывает результат в буфер в памяти
+    int write_image(std::vector<unsigned char>&) const;
+
+private:
+    // Метод получает строку результата
+    void process_row(unsigned long, RGBTriple*) const;
+    // Метод выполняет цепочку для строк в нескольких потоках
+    void process_rows(unsigned long, unsigned long,
+        const std::function<void(unsigned long, unsigned long)>&) const;
+    // Метод выполняет цепочку и записывает результат в поток BMP данных
+    int write_stream(ByteStream&) const;
+};
+
+
+/**
+ * Конструктор класса ImagePipeline, обрабатывающий все изображение.
+ * @param image: исходное изображение.
+ */
+ImagePipeline::ImagePipeline(const Image& image) :
+    ImagePipeline(ImageRegion(image))
+{
+}
+
+
+/**
+ * Конструктор класса ImagePipeline, обрабатывающий прямоугольник
+ * изображения. Результат по умолчанию записывается с глубиной цвета
+ * прямоугольника.
+ * @param region: прямоугольник исходного изображения.
+ */
+ImagePipeline::ImagePipeline(const ImageRegion& region)
+{
+    source = region;
+    flipped = false;
+    bit_count = region.get_bit_count();
+    masks = region.get_bit_masks();
+    threads = 1;
+}
+
+
+/**
+ * Метод класса ImagePipeline добавляет перевод в оттенки серого.
+ * Повторный перевод подряд ничего не меняет и не добавляется.
+ * @return: ссылка на цепочку.
+ */
+ImagePipeline& ImagePipeline::add_grayscale()
+{
+    if (!stages.empty() && stages.back().type == PIPELINE_GRAYSCALE)
+    {
+        return *this;
+    }
+    PipelineStage stage = {};
+    stage.type = PIPELINE_GRAYSCALE;
+    stages.push_back(stage);
+    return *this;
+}
+
+
+/**
+ * Метод класса ImagePipeline добавляет порог яркости: пиксели с
+ * яркостью не меньше порога становятся белыми, остальные черными.
+ * Порог складывается из перевода в оттенки серого и таблицы.
+ * @param level: порог яркости.
+ * @return: ссылка на цепочку.
+ */
+ImagePipeline& ImagePipeline::add_threshold(unsigned char level)
+{
+    unsigned char table[256];
+    for (int i = 0; i < 256; i++)
+    {
+        table[i] = i >= level ? 255 : 0;
+    }
+    add_grayscale();
+    return add_lut(table);
+}
+
+
+/**
+ * Метод класса ImagePipeline добавляет таблицу преобразования, общую
+ * для всех каналов.
+ * @param table: таблица из 256 значений.
+ * @return: ссылка на цепочку.
+ */
+ImagePipeline& ImagePipeline::add_lut(const unsigned char* table)
+{
+    return add_lut(table, table, table);
+}
+
+
+/**
+ * Метод класса ImagePipeline добавляет таблицы преобразования каналов.
+ * Таблица, идущая сразу за другой таблицей, объединяется с ней, поэтому
+ * любая последовательность таблиц выполняется одним обращением к
+ * таблице на канал.
+ * @param blue: таблица синего канала из 256 значений;
+ * @param green: таблица зеленого канала;
+ * @param red: таблица красного канала.
+ * @return: ссылка на цепочку.
+ */
+ImagePipeline& ImagePipeline::add_lut(const unsigned char* blue,
+    const unsigned char* green, const unsigned char* red)
+{
+    const unsigned char* tables[3] = { blue, green, red };
+    if (!stages.empty() && stages.back().type == PIPELINE_LUT)
+    {
+        // Объединяем таблицы: новая таблица применяется к результату
+        // предыдущей
+        PipelineStage& last = stages.back();
+        for (int k = 0; k < 3; k++)
+        {
+            for (int i = 0; i < 256; i++)
+            {
+                last.tables[k][i] = tables[k][last.tables[k][i]];
+            }
+        }
+        return *this;
+    }
+    PipelineStage stage = {};
+    stage.type = PIPELINE_LUT;
+    for (int k = 0; k < 3; k++)
+    {
+        memcpy(stage.tables[k], tables[k], 256);
+    }
+    stages.push_back(stage);
+    return *this;
+}
+
+
+/**
+ * Метод класса ImagePipeline добавляет отражение строк слева направо.
+ * Два отражения подряд взаимно уничтожаются.
+ * @return: ссылка на цепочку.
+ */
+ImagePipeline& ImagePipeline::add_flip_horizontal()
+{
+    if (!stages.empty() && stages.back().type == PIPELINE_FLIP)
+    {
+        stages.pop_back();
+        return *this;
+    }
+    PipelineStage stage = {};
+    stage.type = PIPELINE_FLIP;
+    stages.push_back(stage);
+    return *this;
+}
+
+
+/**
+ * Метод класса ImagePipeline добавляет отражение сверху вниз. Отражение
+ * меняет только порядок чтения исходных строк и не требует прохода по
+ * пикселям.
+ * @return: ссылка на цепочку.
+ */
+ImagePipeline& ImagePipeline::add_flip_vertical()
+{
+    flipped = !flipped;
+    return *this;
+}
+
+
+/**
+ * Метод класса ImagePipeline добавляет собственную операцию над
+ * строкой. Если задано больше одного потока, операция вызывается для
+ * разных строк одновременно.
+ * @param function: операция, получающая строку, ширину и номер строки
+ * результата.
+ * @return: ссылка на цепочку.
+ */
+ImagePipeline& ImagePipeline::add_stage(const RowStage& function)
+{
+    PipelineStage stage = {};
+    stage.type = PIPELINE_CUSTOM;
+    stage.function = function;
+    stages.push_back(stage);
+    return *this;
+}
+
+
+/**
+ * Метод класса ImagePipeline задает глубину цвета, с которой результат
+ * записывается. Преобразование в формат файла выполняется в том же
+ * проходе по строкам.
+ * @param new_bit_count: глубина цвета 16, 24 или 32 бит.
+ * @return: 0, если глубина цвета не поддерживается.
+ */
+int ImagePipeline::set_bit_count(unsigned short new_bit_count)
+{
+    if (new_bit_count != 16 && new_bit_count != 24 && new_bit_count != 32)
+    {
+        std::cout << "Ошибка! Результат цепочки может иметь глубину " <<
+            "цвета 16, 24 или 32 бит.\n";
+        return 0;
+    }
+    if (new_bit_count != bit_count)
+    {
+        masks = get_default_masks(new_bit_count);
+    }
+    bit_count = new_bit_count;
+    return 1;
+}
+
+
+/**
+ * Метод класса ImagePipeline задает число потоков, которыми строки
+ * обрабатываются. По умолчанию цепочка выполняется одним потоком.
+ * @param count: число потоков, 0 - по числу ядер процессора.
+ */
+void ImagePipeline::set_threads(unsigned count)
+{
+    threads = count ? count : get_hardware_threads();
+}
+
+
+/**
+ * Метод класса ImagePipeline возвращает число запомненных операций
+ * после объединения соседних таблиц и отражений.
+ * @return: число операций.
+ */
+size_t ImagePipeline::get_stages_num() const
+{
+    return stages.size();
+}
+
+
+/**
+ * Метод класса ImagePipeline возвращает ширину результата.
+ * @return: ширина в пикселях.
+ */
+unsigned long ImagePipeline::get_width() const
+{
+    return source.get_width();
+}
+
+
+/**
+ * Метод класса ImagePipeline возвращает высоту результата.
+ * @return: высота в пикселях.
+ */
+unsigned long ImagePipeline::get_height() const
+{
+    return source.get_height();
+}
+
+
+/**
+ * Метод класса ImagePipeline получает строку результата: копирует
+ * исходную строку и проводит ее через все операции цепочки.
+ * @param i: номер строки результата;
+ * @param row: строка для результата.
+ */
+void ImagePipeline::process_row(unsigned long i, RGBTriple* row) const
+{
+    unsigned long width = source.get_width();
+    unsigned long source_row = flipped ? source.get_height() - 1 - i : i;
+    memcpy(row, source.get_row(source_row), width * sizeof(RGBTriple));
+    for (const PipelineStage& stage : stages)
+    {
+        // Цикл для прохода по операциям цепочки
+        switch (stage.type)
+        {
+        case PIPELINE_LUT:
+            for (unsigned long j = 0; j < width; j++)
+            {
+                row[j].blue = stage.tables[0][row[j].blue];
+                row[j].green = stage.tables[1][row[j].green];
+                row[j].red = stage.tables[2][row[j].red];
+            }
+            break;
+        case PIPELINE_GRAYSCALE:
+            convert_row_to_grayscale(row, width);
+            break;
+        case PIPELINE_FLIP:
+            std::reverse(row, row + width);
+            break;
+        case PIPELINE_CUSTOM:
+            stage.function(row, width, i);
+            break;
+        }
+    }
+}
+
+
+/**
+ * Метод класса ImagePipeline делит строки [first, first + count) на
+ * полосы и обрабатывает их в пуле потоков, если задано больше одного
+ * потока.
+ * @param first: номер первой строки;
+ * @param count: число строк;
+ * @param body: функция обработки полосы строк [first, last).
+ */
+void ImagePipeline::process_rows(unsigned long first, unsigned long count,
+    const std::function<void(unsigned long, unsigned long)>& body) const
+{
+    if (threads <= 1 || count < 2)
+    {
+        body(first, first + count);
+        return;
+    }
+    get_thread_pool().parallel_for(first, first + count,
+        (count + threads - 1) / threads, [&body](size_t begin, size_t end)
+        { body((unsigned long)begin, (unsigned long)end); });
+}
+
+
+/**
+ * Метод класса ImagePipeline выполняет цепочку и возвращает новое
+ * изображение. Каждая строка копируется из исходного изображения прямо
+ * в строку результата и обрабатывается там же.
+ * @return: изображение с результатом цепочки.
+ */
+Image ImagePipeline::run() const
+{
+    Image image;
+    if (source.is_empty())
+    {
+        return image;
+    }
+    unsigned long width = source.get_width();
+    image.bmp_info_header.size = sizeof(BMPInfoHeader);
+    image.bmp_info_header.width = width;
+    image.bmp_info_header.height = source.get_height();
+    image.bmp_info_header.bit_count = bit_count;
+    image.masks = masks;
+    image.update_headers(0);
+    image.allocate_data((size_t)width * source.get_height());
+    RGBTriple* data = image.data;
+    process_rows(0, source.get_height(),
+        [this, data, width](unsigned long first, unsigned long last)
+        {
+            for (unsigned long i = first; i < last; i++)
+            {
+                process_row(i, &data[(size_t)i * width]);
+            }
+        });
+    return image;
+}
+
+
+/**
+ * Метод класса ImagePipeline выполняет цепочку и записывает результат в
+ * BMP файл без промежуточного изображения.
+ * @param filename: имя файла.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImagePipeline::write_image(const char* filename) const
+{
+    FileStream file;
+    if (!file.open(filename, "wb"))
+    {
+        // Если файл не был открыт
+        std::cout << "Ошибка! Не удалось открыть файл '" <<
+            filename << "'.\n";
+        return 0;
+    }
+    if (!write_stream(file))
+    {
+        return 0;
+    }
+    if (!file.close())
+    {
+        std::cout << "Ошибка! Не удалось записать файл '" << filename <<
+            "'.\n";
+        return 0;
+    }
+    return 1;
+}
+
+
+/**
+ * Метод класса ImagePipeline выполняет цепочку и записывает результат
+ * BMP данными в буфер в памяти.
+ * @param bytes: буфер, прежнее содержимое которого заменяется BMP
+ * данными.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImagePipeline::write_image(std::vector<unsigned char>& bytes) const
+{
+    MemoryWriter memory(bytes);
+    return write_stream(memory);
+}
+
+
+/**
+ * Метод класса ImagePipeline выполняет цепочку блоками строк и
+ * записывает результат в поток BMP данных. Строки блока проходят
+ * цепочку и сразу преобразуются в формат файла, поэтому в памяти
+ * находится только один блок.
+ * @param stream: поток, установленный на начало BMP данных.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImagePipeline::write_stream(ByteStream& stream) const
+{
+    if (source.is_empty())
+    {
+        std::cout << "Ошибка! Прямоугольник изображения пуст.\n";
+        return 0;
+    }
+    unsigned long width = source.get_width();
+    unsigned long height = source.get_height();
+    BMPFileHeader file_header;
+    BMPInfoHeader info_header;
+    info_header.width = width;
+    info_header.height = height;
+    info_header.bit_count = bit_count;
+    bool bit_fields = need_bit_fields(masks, bit_count);
+    fill_headers(file_header, info_header, 0, bit_fields);
+    bool written =
+        stream.write(&file_header, sizeof(BMPFileHeader), 1) == 1 &&
+        stream.write(&info_header, sizeof(BMPInfoHeader), 1) == 1 &&
+        (!bit_fields || stream.write(&masks, sizeof(BitMasks), 1) == 1);
+    if (!written)
+    {
+        std::cout << "Ошибка! Не удалось записать заголовки BMP данных.\n";
+        return 0;
+    }
+    BitFields fields = make_bit_fields(masks);
+    RowContext context = {};
+    context.fields = &fields;
+    const FormatCodec* codec = get_format_codec(bit_count);
+    unsigned long row_size = (unsigned long)get_bmp_row_size(width,
+        bit_count);
+    unsigned long rows_in_block = get_block_rows(row_size, height);
+    unsigned char* buffer = new unsigned char[(size_t)rows_in_block *
+        row_size];
+    memset(buffer, 0, (size_t)rows_in_block * row_size);
+    for (unsigned long i = 0; i < height; i += rows_in_block)
+    {
+        // Цикл для прохода по блокам строк результата
+        unsigned long rows = rows_in_block;
+        if (rows > height - i)
+        {
+            rows = height - i;
+        }
+        // Поток в памяти отдает место для блока, строки преобразуются
+        // прямо в него
+        unsigned char* block = stream.map_write((size_t)rows * row_size);
+        unsigned char* dst = block ? block : buffer;
+        process_rows(i, rows, [&](unsigned long first, unsigned long last)
+            {
+                RGBTriple* row = new RGBTriple[width];
+                for (unsigned long k = first; k < last; k++)
+                {
+                    process_row(k, row);
+                    codec->encode_row(row, dst + (size_t)(k - i) * row_size,
+                        width, context);
+                }
+                delete[] row;
+            });
+        if (!block && row_size != 0 &&
+            stream.write(buffer, row_size, rows) != rows)
+        {
+            // Оставшиеся блоки не обрабатываются
+            delete[] buffer;
+            std::cout << "Ошибка! Не удалось записать строки BMP данных.\n";
+            return 0;
+        }
+    }
+    delete[] buffer;
+    return 1;
+}
+
+#endif
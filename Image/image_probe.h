@@ -0,0 +1,226 @@
+/*
+Модуль image_probe.h содержит функции, которые читают и проверяют только
+заголовки BMP файла, не трогая массив пикселей. По заголовкам можно
+узнать размеры, глубину цвета и объем памяти изображения до его загрузки.
+*/
+
+#pragma once
+#ifndef IMAGE_PROBE_H
+#define IMAGE_PROBE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include "bmp_format.h"
+#include "byte_stream.h"
+
+
+// Наибольшая ширина и высота изображения, которые допускает проверка
+const unsigned long PROBE_MAX_SIZE = 0x7FFFFFFF;
+
+
+/**
+ * Структура для хранения сведений о BMP файле, полученных из заголовков.
+ */
+struct ImageInfo
+{
+    // Ширина изображения в пикселях
+    unsigned long width;
+    // Высота изображения в пикселях
+    unsigned long height;
+    // Глубина цвета
+    unsigned short bit_count;
+    // Тип сжатия
+    unsigned long compression;
+    // Число цветов палитры (0 для беспалитровых изображений)
+    unsigned long colors_num;
+    // Смещение поля пикселей от начала файла в байтах
+    unsigned long offset_data;
+    // Размер поля пикселей в файле в байтах
+    std::uint64_t data_size;
+    // Размер файла в байтах
+    std::uint64_t file_size;
+};
+
+
+/**
+ * Функция возвращает объем памяти, который занимают пиксели изображения
+ * после загрузки классом Image (по RGBTriple на пиксель).
+ * @param info: сведения о файле.
+ * @return: объем в байтах.
+ */
+std::uint64_t get_image_memory(const ImageInfo& info)
+{
+    return (std::uint64_t)info.width * info.height * sizeof(RGBTriple);
+}
+
+
+/**
+ * Функция проверяет заголовки BMP файла и заполняет по ним сведения о
+ * файле. Проверяются формат, размеры, сочетание глубины цвета и сжатия,
+ * размер палитры и то, что поле пикселей помещается в файл. Файлы со
+ * строками сверху вниз (отрицательная высота) допускаются, если они не
+ * сжаты.
+ * @param file_header: заголовок файла;
+ * @param file_info_header: заголовок изображения;
+ * @param file_size: размер файла в байтах;
+ * @param info: сведения о файле.
+ * @return: nullptr, если заголовки верны, иначе описание ошибки.
+ */
+const char* check_image_headers(const BMPFileHeader& file_header,
+    const BMPInfoHeader& file_info_header, std::uint64_t file_size,
+    ImageInfo& info)
+{
+    info = {};
+    BMPInfoHeader info_header = file_info_header;
+    bool top_down = read_top_down(info_header);
+    info.file_size = file_size;
+    if (file_header.file_type != 0x4D42)
+    {
+        return "Файл не имеет требуемый BMP формат.";
+    }
+    if (info_header.size < sizeof(BMPInfoHeader) || info_header.planes != 1)
+    {
+        return "Заголовок изображения поврежден.";
+    }
+    if (info_header.width == 0 || info_header.height == 0 ||
+        info_header.width > PROBE_MAX_SIZE ||
+        info_header.height > PROBE_MAX_SIZE)
+    {
+        return "Недопустимые размеры изображения.";
+    }
+    unsigned short bit_count = info_header.bit_count;
+    if (bit_count != 1 && bit_count != 4 && bit_count != 8 &&
+        bit_count != 16 && bit_count != 24 && bit_count != 32)
+    {
+        return "Недопустимая глубина цвета.";
+    }
+    unsigned long compression = info_header.compression;
+    if ((compression == COMPRESSION_RLE8 && bit_count != 8) ||
+        (compression == COMPRESSION_RLE4 && bit_count != 4) ||
+        (compression == COMPRESSION_BITFIELDS && bit_count != 16 &&
+        bit_count != 32) || compression > COMPRESSION_BITFIELDS)
+    {
+        return "Тип сжатия не подходит к глубине цвета.";
+    }
+    if (top_down && (compression == COMPRESSION_RLE8 ||
+        compression == COMPRESSION_RLE4))
+    {
+        return "Сжатое изображение не может храниться сверху вниз.";
+    }
+    unsigned long colors_num = 0;
+    if (bit_count <= 8)
+    {
+        colors_num = 1UL << bit_count;
+        if (info_header.colors_used > colors_num)
+        {
+            return "Недопустимое число цветов палитры.";
+        }
+        if (info_header.colors_used != 0)
+        {
+            colors_num = info_header.colors_used;
+        }
+    }
+    // Маски каналов записываются после заголовка версии 3, у
+    // заголовков старших версий они входят в сам заголовок
+    std::uint64_t headers_size = sizeof(BMPFileHeader) +
+        (std::uint64_t)info_header.size + colors_num * sizeof(RGBQuad);
+    if (compression == COMPRESSION_BITFIELDS &&
+        info_header.size == sizeof(BMPInfoHeader))
+    {
+        headers_size += sizeof(BitMasks);
+    }
+    if (file_header.offset_data < headers_size)
+    {
+        return "Поле пикселей пересекается с заголовками.";
+    }
+    std::uint64_t data_size;
+    if (compression == COMPRESSION_RLE8 || compression == COMPRESSION_RLE4)
+    {
+        // Размер сжатых данных берется из заголовка, если он задан
+        if (file_header.offset_data >= file_size)
+        {
+            return "Файл короче поля пикселей.";
+        }
+        data_size = file_size - file_header.offset_data;
+        if (info_header.size_image != 0 && info_header.size_image < data_size)
+        {
+            data_size = info_header.size_image;
+        }
+    }
+    else
+    {
+        std::uint64_t row_size =
+            ((std::uint64_t)info_header.width * bit_count + 31) / 32 * 4;
+        if (row_size > PROBE_MAX_SIZE)
+        {
+            // Размер строки должен помещаться в 32-битные счетчики
+            return "Недопустимые размеры изображения.";
+        }
+        data_size = row_size * info_header.height;
+        if (file_header.offset_data + data_size > file_size)
+        {
+            return "Файл короче поля пикселей.";
+        }
+    }
+    info.width = info_header.width;
+    info.height = info_header.height;
+    info.bit_count = bit_count;
+    info.compression = compression;
+    info.colors_num = colors_num;
+    info.offset_data = file_header.offset_data;
+    info.data_size = data_size;
+    return nullptr;
+}
+
+
+/**
+ * Функция читает заголовки BMP файла и проверяет их. Сообщения об
+ * ошибках не выводятся, что удобно при обходе большого числа файлов.
+ * @param filename: имя файла;
+ * @param info: сведения о файле.
+ * @return: nullptr, если заголовки верны, иначе описание ошибки.
+ */
+const char* read_image_info(const char* filename, ImageInfo& info)
+{
+    info = {};
+    // Файл открывается с совместным доступом: в каталоге, который
+    // обходит индекс, другие программы могут писать файлы
+    FileStream file;
+    if (!file.open(filename, "rb"))
+    {
+        return "Не удалось открыть файл.";
+    }
+    BMPFileHeader file_header;
+    BMPInfoHeader info_header;
+    bool read = file.read(&file_header, sizeof(BMPFileHeader), 1) == 1 &&
+        file.read(&info_header, sizeof(BMPInfoHeader), 1) == 1;
+    std::uint64_t file_size = file.get_size();
+    file.close();
+    if (!read)
+    {
+        info.file_size = file_size;
+        return "Файл не имеет требуемый BMP формат.";
+    }
+    return check_image_headers(file_header, info_header, file_size, info);
+}
+
+
+/**
+ * Функция читает и проверяет заголовки BMP файла без чтения пикселей.
+ * @param filename: имя файла;
+ * @param info: сведения о файле.
+ * @return: 0, если файл не является верным BMP файлом.
+ */
+int probe_image(const char* filename, ImageInfo& info)
+{
+    const char* error = read_image_info(filename, info);
+    if (error)
+    {
+        std::cout << "Ошибка! Файл '" << filename << "': " << error << "\n";
+        return 0;
+    }
+    return 1;
+}
+
+#endif
@@ -0,0 +1,413 @@
+/*
+Модуль image_pyramid.h содержит определение класса ImagePyramid -
+пирамиды уменьшенных вдвое копий изображения. Уровни строятся за один
+проход по строкам файла: каждый уровень хранит одну строку, ожидающую
+пары, и из двух строк сразу получает строку следующего уровня. Поэтому
+изображение не загружается целиком, а уровни записываются в файлы
+по мере получения строк.
+*/
+
+#pragma once
+#ifndef IMAGE_PYRAMID_H
+#define IMAGE_PYRAMID_H
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "image.h"
+#include "image_stream.h"
+
+
+// Наибольшая сторона верхнего уровня пирамиды по умолчанию
+const unsigned long PYRAMID_MIN_SIZE = 256;
+
+
+/**
+ * Функция уменьшает вдвое две соседние строки: каждый пиксель результата
+ * - среднее квадрата 2x2 с округлением. У строки нечетной ширины
+ * последний пиксель усредняется сам с собой.
+ * @param first: первая строка;
+ * @param second: вторая строка;
+ * @param width: ширина строк;
+ * @param dst: строка результата из (width + 1) / 2 пикселей.
+ */
+void reduce_rows(const RGBTriple* first, const RGBTriple* second,
+    unsigned long width, RGBTriple* dst)
+{
+    const unsigned char* a = (const unsigned char*)first;
+    const unsigned char* b = (const unsigned char*)second;
+    unsigned char* out = (unsigned char*)dst;
+    unsigned long pairs = width / 2;
+    for (unsigned long j = 0; j < pairs; j++)
+    {
+        // Цикл для прохода по парам пикселей
+        for (int c = 0; c < 3; c++)
+        {
+            out[c] = (unsigned char)((a[c] + a[c + 3] + b[c] + b[c + 3] +
+                2) >> 2);
+        }
+        a += 6;
+        b += 6;
+        out += 3;
+    }
+    if (width % 2)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            out[c] = (unsigned char)((a[c] + b[c] + 1) >> 1);
+        }
+    }
+}
+
+
+/**
+ * Структура для хранения состояния одного уровня пирамиды.
+ */
+struct PyramidLevel
+{
+    // Ширина уровня
+    unsigned long width;
+    // Высота уровня
+    unsigned long height;
+    // Строка предыдущего уровня, ожидающая пары
+    std::vector<RGBTriple> pending;
+    // Если true, строка в pending ожидает пары
+    bool has_pending;
+    // Последняя полученная строка уровня
+    std::vector<RGBTriple> row;
+    // Число полученных строк уровня
+    unsigned long rows;
+};
+
+
+/**
+ * Класс построения пирамиды изображения. Строки изображения подаются
+ * по одной в порядке файла, каждая полученная строка уровня передается
+ * функции вместе с номером уровня (от 1) и номером строки в том же
+ * порядке. Уровень k вдвое меньше уровня k - 1, нечетные стороны
+ * округляются вверх; уровни строятся, пока большая сторона больше
+ * наименьшего размера.
+ */
+class ImagePyramid
+{
+protected:
+    // Наибольшая сторона верхнего уровня
+    unsigned long min_size;
+    // Уровни пирамиды начиная с первого уменьшенного
+    std::vector<PyramidLevel> levels;
+    // Функция, получающая строки уровней
+    std::function<bool(unsigned long, unsigned long, const RGBTriple*)>
+        output;
+
+public:
+    // Конструктор класса без параметров
+    ImagePyramid();
+    // Метод задает наибольшую сторону верхнего уровня
+    void set_min_size(unsigned long);
+    // Метод готовит уровни для изображения заданного размера
+    int open(unsigned long, unsigned long, const std::function<bool(
+        unsigned long, unsigned long, const RGBTriple*)>&);
+    // Метод принимает следующую строку изображения
+    int push_row(const RGBTriple*);
+    // Метод достраивает уровни с нечетной высотой
+    int finish();
+    // Метод возвращает число уровней
+    unsigned long get_levels_num() const;
+    // Метод возвращает ширину уровня
+    unsigned long get_level_width(unsigned long) const;
+    // Метод возвращает высоту уровня
+    unsigned long get_level_height(unsigned long) const;
+    // Метод строит пирамиду BMP файла и записывает уровни в файлы
+    int write_levels(const char*, const char*);
+    // Метод строит пирамиду BMP файла в памяти
+    int build_images(const char*, std::vector<Image>&);
+
+private:
+    // Метод добавляет строку уровня и передает готовые строки выше
+    int add_row(unsigned long, const RGBTriple*);
+};
+
+
+/**
+ * Конструктор класса ImagePyramid без параметров.
+ */
+ImagePyramid::ImagePyramid()
+{
+    min_size = PYRAMID_MIN_SIZE;
+}
+
+
+/**
+ * Метод класса ImagePyramid задает наибольшую сторону верхнего уровня.
+ * Действует при следующем вызове open.
+ * @param size: размер в пикселях (0 - до уровня 1x1).
+ */
+void ImagePyramid::set_min_size(unsigned long size)
+{
+    min_size = size ? size : 1;
+}
+
+
+/**
+ * Метод класса ImagePyramid готовит уровни для изображения заданного
+ * размера. Для каждого уровня выделяются две строки.
+ * @param width: ширина изображения;
+ * @param height: высота изображения;
+ * @param func: функция, получающая номер уровня, номер строки уровня и
+ * строку; если она возвращает false, построение прекращается.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImagePyramid::open(unsigned long width, unsigned long height,
+    const std::function<bool(unsigned long, unsigned long,
+    const RGBTriple*)>& func)
+{
+    levels.clear();
+    if (width == 0 || height == 0)
+    {
+        std::cout << "Ошибка! Размеры изображения должны быть " <<
+            "положительными.\n";
+        return 0;
+    }
+    output = func;
+    while (width > min_size || height > min_size)
+    {
+        PyramidLevel level;
+        level.pending.resize(width);
+        level.has_pending = false;
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        level.width = width;
+        level.height = height;
+        level.row.resize(width);
+        level.rows = 0;
+        levels.push_back(std::move(level));
+    }
+    return 1;
+}
+
+
+/**
+ * Метод класса ImagePyramid добавляет строку уровня k: первая строка
+ * пары запоминается, вторая вместе с первой дает строку уровня k + 1,
+ * которая передается функции и добавляется к следующему уровню.
+ * @param k: номер уровня строки (0 - исходное изображение);
+ * @param row: строка уровня.
+ * @return: 0, если функция прекратила построение.
+ */
+int ImagePyramid::add_row(unsigned long k, const RGBTriple* row)
+{
+    PyramidLevel& level = levels[k];
+    if (!level.has_pending)
+    {
+        std::copy(row, row + level.pending.size(), level.pending.begin());
+        level.has_pending = true;
+        return 1;
+    }
+    reduce_rows(level.pending.data(), row,
+        (unsigned long)level.pending.size(), level.row.data());
+    level.has_pending = false;
+    if (!output(k + 1, level.rows++, level.row.data()))
+    {
+        return 0;
+    }
+    if (k + 1 < levels.size())
+    {
+        return add_row(k + 1, level.row.data());
+    }
+    return 1;
+}
+
+
+/**
+ * Метод класса ImagePyramid принимает следующую строку изображения.
+ * @param row: строка из ширины изображения пикселей.
+ * @return: 0, если функция прекратила построение.
+ */
+int ImagePyramid::push_row(const RGBTriple* row)
+{
+    if (levels.empty())
+    {
+        return 1;
+    }
+    return add_row(0, row);
+}
+
+
+/**
+ * Метод класса ImagePyramid достраивает уровни после последней строки
+ * изображения: строка без пары усредняется сама с собой. Уровни
+ * проходятся снизу вверх, потому что достроенная строка может дать пару
+ * строке следующего уровня.
+ * @return: 0, если функция прекратила построение.
+ */
+int ImagePyramid::finish()
+{
+    for (unsigned long k = 0; k < levels.size(); k++)
+    {
+        // Цикл для прохода по уровням
+        if (levels[k].has_pending && !add_row(k, levels[k].pending.data()))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/**
+ * Метод класса ImagePyramid возвращает число уровней без исходного
+ * изображения.
+ * @return: число уровней.
+ */
+unsigned long ImagePyramid::get_levels_num() const
+{
+    return (unsigned long)levels.size();
+}
+
+
+/**
+ * Метод класса ImagePyramid возвращает ширину уровня.
+ * @param k: номер уровня (от 1).
+ * @return: ширина или 0, если уровня нет.
+ */
+unsigned long ImagePyramid::get_level_width(unsigned long k) const
+{
+    return k >= 1 && k <= levels.size() ? levels[k - 1].width : 0;
+}
+
+
+/**
+ * Метод класса ImagePyramid возвращает высоту уровня.
+ * @param k: номер уровня (от 1).
+ * @return: высота или 0, если уровня нет.
+ */
+unsigned long ImagePyramid::get_level_height(unsigned long k) const
+{
+    return k >= 1 && k <= levels.size() ? levels[k - 1].height : 0;
+}
+
+
+/**
+ * Метод класса ImagePyramid строит пирамиду BMP файла за один проход
+ * чтения и записывает уровень k в файл prefix_k.bmp по мере получения
+ * строк. Уровни 32-битного изображения записываются с глубиной 32 бит,
+ * остальных - 24 бит, порядок строк совпадает с исходным файлом.
+ * @param filename: имя исходного файла;
+ * @param prefix: начало имен файлов уровней.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImagePyramid::write_levels(const char* filename, const char* prefix)
+{
+    ImageReader reader;
+    if (!reader.open_image(filename))
+    {
+        return 0;
+    }
+    std::vector<std::unique_ptr<ImageWriter>> writers;
+    auto func = [&writers](unsigned long k, unsigned long,
+        const RGBTriple* row)
+    {
+        return writers[k - 1]->write_row(row) != 0;
+    };
+    if (!open(reader.get_width(), reader.get_height(), func))
+    {
+        return 0;
+    }
+    unsigned short bit_count = reader.get_bit_count() == 32 ? 32 : 24;
+    for (unsigned long k = 1; k <= levels.size(); k++)
+    {
+        std::string name = std::string(prefix) + "_" + std::to_string(k) +
+            ".bmp";
+        writers.emplace_back(new ImageWriter());
+        writers.back()->set_top_down(reader.is_top_down());
+        if (!writers.back()->open_image(name.c_str(), get_level_width(k),
+            get_level_height(k), bit_count))
+        {
+            return 0;
+        }
+    }
+    bool result = true;
+    reader.read_rows([this, &result](unsigned long, const RGBTriple* row)
+    {
+        result = push_row(row) != 0;
+        return result;
+    });
+    result = result && reader.get_row_number() == reader.get_height() &&
+        finish();
+    for (std::unique_ptr<ImageWriter>& writer : writers)
+    {
+        result = writer->close_image() && result;
+    }
+    if (!result)
+    {
+        std::cout << "Ошибка! Пирамиду файла '" << filename <<
+            "' не удалось построить.\n";
+        return 0;
+    }
+    return 1;
+}
+
+
+/**
+ * Метод класса ImagePyramid строит пирамиду BMP файла за один проход
+ * чтения и сохраняет уровни в памяти. Исходное изображение целиком в
+ * память не загружается, уровни вместе занимают около трети его объема.
+ * @param filename: имя исходного файла;
+ * @param images: массив для уровней, images[k - 1] - уровень k.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImagePyramid::build_images(const char* filename,
+    std::vector<Image>& images)
+{
+    images.clear();
+    ImageReader reader;
+    if (!reader.open_image(filename))
+    {
+        return 0;
+    }
+    bool top_down = reader.is_top_down();
+    auto func = [&images, top_down](unsigned long k, unsigned long i,
+        const RGBTriple* row)
+    {
+        // Строки уровня нумеруются снизу вверх, как в Image
+        Image& image = images[k - 1];
+        unsigned long width = image.get_width();
+        unsigned long number = top_down ? image.get_height() - 1 - i : i;
+        std::copy(row, row + width, image.get_data() +
+            (size_t)number * width);
+        return true;
+    };
+    if (!open(reader.get_width(), reader.get_height(), func))
+    {
+        return 0;
+    }
+    images.resize(levels.size());
+    for (unsigned long k = 1; k <= levels.size(); k++)
+    {
+        images[k - 1] = Image(0, 24, get_level_width(k),
+            get_level_height(k));
+        if (images[k - 1].get_data() == nullptr)
+        {
+            images.clear();
+            return 0;
+        }
+    }
+    reader.read_rows([this](unsigned long, const RGBTriple* row)
+    {
+        push_row(row);
+        return true;
+    });
+    if (reader.get_row_number() != reader.get_height() || !finish())
+    {
+        images.clear();
+        std::cout << "Ошибка! Пирамиду файла '" << filename <<
+            "' не удалось построить.\n";
+        return 0;
+    }
+    return 1;
+}
+
+#endif
@@ -0,0 +1,450 @@
+/*
+Модуль image_region.h содержит определение класса ImageRegion - легкого
+прямоугольника изображения, который ссылается на пиксели исходного
+изображения без копирования. Прямоугольник можно записать в файл или в
+память и вырезать в отдельное изображение только тогда, когда это нужно.
+Отражение прямоугольника по вертикали меняет только знак шага между
+строками.
+*/
+
+#pragma once
+#ifndef IMAGE_REGION_H
+#define IMAGE_REGION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "image.h"
+
+
+/**
+ * Класс прямоугольника BMP изображения. Прямоугольник задается первой
+ * строкой и первым столбцом, размерами и шагом между строками, пиксели
+ * не копируются. Строки нумеруются как в изображении, снизу вверх, у
+ * отраженного по вертикали прямоугольника - сверху вниз.
+ * Прямоугольник действителен, пока исходное изображение существует и
+ * не получает новый массив пикселей (загрузка, смена глубины цвета,
+ * запись в разделяемый при копировании массив).
+ */
+class ImageRegion
+{
+protected:
+    // Первый пиксель первой строки прямоугольника
+    const RGBTriple* pixels;
+    // Ширина прямоугольника в пикселях
+    unsigned long width;
+    // Высота прямоугольника в пикселях
+    unsigned long height;
+    // Шаг между строками в пикселях, отрицательный у отраженного по
+    // вертикали прямоугольника
+    ptrdiff_t stride;
+    // Глубина цвета, с которой прямоугольник записывается
+    unsigned short bit_count;
+    // Маски каналов 16- и 32-битных пикселей
+    BitMasks masks;
+
+public:
+    // Конструктор класса без параметров
+    ImageRegion();
+    // Конструктор класса, охватывающий все изображение
+    ImageRegion(const Image&);
+    // Конструктор класса, задающий прямоугольник изображения
+    ImageRegion(const Image&, unsigned long, unsigned long, unsigned long,
+        unsigned long);
+    // Метод возвращает прямоугольник внутри этого прямоугольника
+    ImageRegion get_region(unsigned long, unsigned long, unsigned long,
+        unsigned long) const;
+    // Метод возвращает прямоугольник, отраженный по вертикали
+    ImageRegion flip_vertical() const;
+    // Метод определяет, отражен ли прямоугольник по вертикали
+    bool is_flipped() const;
+    // Метод определяет, является ли прямоугольник пустым
+    bool is_empty() const;
+    // Метод возвращает ширину прямоугольника
+    unsigned long get_width() const;
+    // Метод возвращает высоту прямоугольника
+    unsigned long get_height() const;
+    // Метод возвращает шаг между строками в пикселях
+    ptrdiff_t get_stride() const;
+    // Метод возвращает глубину цвета, с которой прямоугольник записывается
+    unsigned short get_bit_count() const;
+    // Метод возвращает маски каналов, с которыми прямоугольник
+    // записывается
+    BitMasks get_bit_masks() const;
+    // Метод возвращает строку пикселей
+    const RGBTriple* get_row(unsigned long) const;
+    // Метод возвращает пиксель по номерам строки и столбца
+    const RGBTriple& get_pixel(unsigned long, unsigned long) const;
+    // Метод вырезает прямоугольник в отдельное изображение
+    Image crop() const;
+    // Метод записывает прямоугольник в BMP файл
+    int write_image(const char*) const;
+    // Метод записывает прямоугольник BMP данными в буфер в памяти
+    int write_image(std::vector<unsigned char>&) const;
+
+private:
+    // Метод задает прямоугольник внутри массива пикселей
+    void set_region(const RGBTriple*, unsigned long, unsigned long,
+        ptrdiff_t, unsigned long, unsigned long, unsigned long,
+        unsigned long);
+    // Метод записывает прямоугольник в поток BMP данных
+    int write_stream(ByteStream&) const;
+};
+
+
+/**
+ * Конструктор класса ImageRegion без параметров. Создает пустой
+ * прямоугольник.
+ */
+ImageRegion::ImageRegion()
+{
+    pixels = nullptr;
+    width = 0;
+    height = 0;
+    stride = 0;
+    bit_count = 24;
+    masks = get_default_masks(bit_count);
+}
+
+
+/**
+ * Конструктор класса ImageRegion, охватывающий все изображение.
+ * @param image: исходное изображение.
+ */
+ImageRegion::ImageRegion(const Image& image) :
+    ImageRegion(image, 0, 0, image.get_width(), image.get_height())
+{
+}
+
+
+/**
+ * Конструктор класса ImageRegion, задающий прямоугольник изображения.
+ * Прямоугольник обрезается по границам изображения. Палитровые
+ * изображения записываются из прямоугольника 24-битными, изображения,
+ * пиксели которых хранятся индексами палитры, дают пустой прямоугольник.
+ * @param image: исходное изображение;
+ * @param row: номер первой строки;
+ * @param column: номер первого столбца;
+ * @param region_width: ширина прямоугольника;
+ * @param region_height: высота прямоугольника.
+ */
+ImageRegion::ImageRegion(const Image& image, unsigned long row,
+    unsigned long column, unsigned long region_width,
+    unsigned long region_height) : ImageRegion()
+{
+    unsigned short image_bit_count = image.get_bit_count();
+    if (image_bit_count == 16 || image_bit_count == 32)
+    {
+        // Беспалитровые форматы записываются с глубиной цвета и
+        // масками каналов исходного изображения
+        bit_count = image_bit_count;
+        masks = image.get_bit_masks();
+    }
+    set_region(image.get_data(), image.get_width(), image.get_height(),
+        image.get_width(), row, column, region_width, region_height);
+}
+
+
+/**
+ * Метод класса ImageRegion задает прямоугольник внутри массива пикселей
+ * и обрезает его по границам массива.
+ * @param data: первый пиксель массива;
+ * @param data_width: ширина массива;
+ * @param data_height: высота массива;
+ * @param data_stride: шаг между строками массива в пикселях (со знаком);
+ * @param row: номер первой строки;
+ * @param column: номер первого столбца;
+ * @param region_width: ширина прямоугольника;
+ * @param region_height: высота прямоугольника.
+ */
+void ImageRegion::set_region(const RGBTriple* data, unsigned long data_width,
+    unsigned long data_height, ptrdiff_t data_stride, unsigned long row,
+    unsigned long column, unsigned long region_width,
+    unsigned long region_height)
+{
+    if (!data || row >= data_height || column >= data_width)
+    {
+        // Прямоугольник лежит вне массива
+        pixels = nullptr;
+        width = 0;
+        height = 0;
+        stride = 0;
+        return;
+    }
+    width = region_width < data_width - column ? region_width :
+        data_width - column;
+    height = region_height < data_height - row ? region_height :
+        data_height - row;
+    stride = data_stride;
+    pixels = data + (ptrdiff_t)row * data_stride + column;
+    if (width == 0 || height == 0)
+    {
+        pixels = nullptr;
+        width = 0;
+        height = 0;
+    }
+}
+
+
+/**
+ * Метод класса ImageRegion возвращает прямоугольник внутри этого
+ * прямоугольника. Новый прямоугольник ссылается на те же пиксели.
+ * @param row: номер первой строки относительно этого прямоугольника;
+ * @param column: номер первого столбца;
+ * @param region_width: ширина прямоугольника;
+ * @param region_height: высота прямоугольника.
+ * @return: прямоугольник, обрезанный по границам этого прямоугольника.
+ */
+ImageRegion ImageRegion::get_region(unsigned long row, unsigned long column,
+    unsigned long region_width, unsigned long region_height) const
+{
+    ImageRegion region;
+    region.bit_count = bit_count;
+    region.masks = masks;
+    region.set_region(pixels, width, height, stride, row, column,
+        region_width, region_height);
+    return region;
+}
+
+
+/**
+ * Метод класса ImageRegion возвращает прямоугольник, отраженный по
+ * вертикали: первой строкой становится последняя, шаг между строками
+ * меняет знак. Пиксели не копируются, поэтому отражение ничего не
+ * стоит. Отражение изображения дает его строки сверху вниз.
+ * @return: отраженный прямоугольник.
+ */
+ImageRegion ImageRegion::flip_vertical() const
+{
+    ImageRegion region = *this;
+    if (!is_empty())
+    {
+        region.pixels = get_row(height - 1);
+        region.stride = -stride;
+    }
+    return region;
+}
+
+
+/**
+ * Метод класса ImageRegion определяет, отражен ли прямоугольник по
+ * вертикали относительно исходного изображения.
+ * @return: true, если строки идут сверху вниз, иначе false.
+ */
+bool ImageRegion::is_flipped() const
+{
+    return stride < 0;
+}
+
+
+/**
+ * Метод класса ImageRegion определяет, является ли прямоугольник
+ * пустым.
+ * @return: true, если в прямоугольнике нет пикселей, иначе false.
+ */
+bool ImageRegion::is_empty() const
+{
+    return pixels == nullptr;
+}
+
+
+/**
+ * Метод класса ImageRegion возвращает ширину прямоугольника.
+ * @return: ширина в пикселях.
+ */
+unsigned long ImageRegion::get_width() const
+{
+    return width;
+}
+
+
+/**
+ * Метод класса ImageRegion возвращает высоту прямоугольника.
+ * @return: высота в пикселях.
+ */
+unsigned long ImageRegion::get_height() const
+{
+    return height;
+}
+
+
+/**
+ * Метод класса ImageRegion возвращает шаг между строками прямоугольника.
+ * @return: шаг в пикселях (ширина исходного изображения), отрицательный
+ * у отраженного прямоугольника.
+ */
+ptrdiff_t ImageRegion::get_stride() const
+{
+    return stride;
+}
+
+
+/**
+ * Метод класса ImageRegion возвращает глубину цвета, с которой
+ * прямоугольник записывается и вырезается.
+ * @return: число бит на пиксель.
+ */
+unsigned short ImageRegion::get_bit_count() const
+{
+    return bit_count;
+}
+
+
+/**
+ * Метод класса ImageRegion возвращает маски каналов, с которыми
+ * прямоугольник записывается и вырезается.
+ * @return: маски каналов.
+ */
+BitMasks ImageRegion::get_bit_masks() const
+{
+    return masks;
+}
+
+
+/**
+ * Метод класса ImageRegion возвращает строку пикселей прямоугольника.
+ * @param i: номер строки.
+ * @return: указатель на первый пиксель строки.
+ */
+const RGBTriple* ImageRegion::get_row(unsigned long i) const
+{
+    return pixels + (ptrdiff_t)i * stride;
+}
+
+
+/**
+ * Метод класса ImageRegion возвращает пиксель прямоугольника.
+ * @param i: номер строки;
+ * @param j: номер столбца.
+ * @return: ссылка на пиксель.
+ */
+const RGBTriple& ImageRegion::get_pixel(unsigned long i, unsigned long j)
+    const
+{
+    return get_row(i)[j];
+}
+
+
+/**
+ * Метод класса ImageRegion вырезает прямоугольник в отдельное
+ * изображение. Копируются только пиксели прямоугольника.
+ * @return: изображение с пикселями прямоугольника.
+ */
+Image ImageRegion::crop() const
+{
+    Image image;
+    if (is_empty())
+    {
+        return image;
+    }
+    image.bmp_info_header.size = sizeof(BMPInfoHeader);
+    image.bmp_info_header.width = width;
+    image.bmp_info_header.height = height;
+    image.bmp_info_header.bit_count = bit_count;
+    image.masks = masks;
+    image.update_headers(0);
+    image.allocate_data((size_t)width * height);
+    for (unsigned long i = 0; i < height; i++)
+    {
+        // Цикл для прохода по строкам прямоугольника
+        memcpy(&image.data[(size_t)i * width], get_row(i),
+            width * sizeof(RGBTriple));
+    }
+    return image;
+}
+
+
+/**
+ * Метод класса ImageRegion записывает прямоугольник в BMP файл. Пиксели
+ * не копируются в промежуточное изображение, поэтому несколько
+ * прямоугольников одного изображения можно записывать параллельно.
+ * @param filename: имя файла.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageRegion::write_image(const char* filename) const
+{
+    FileStream file;
+    if (!file.open(filename, "wb"))
+    {
+        // Если файл не был открыт
+        std::cout << "Ошибка! Не удалось открыть файл '" <<
+            filename << "'.\n";
+        return 0;
+    }
+    if (!write_stream(file))
+    {
+        return 0;
+    }
+    if (!file.close())
+    {
+        std::cout << "Ошибка! Не удалось записать файл '" << filename <<
+            "'.\n";
+        return 0;
+    }
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageRegion записывает прямоугольник BMP данными в буфер
+ * в памяти.
+ * @param bytes: буфер, прежнее содержимое которого заменяется BMP
+ * данными.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageRegion::write_image(std::vector<unsigned char>& bytes) const
+{
+    MemoryWriter memory(bytes);
+    return write_stream(memory);
+}
+
+
+/**
+ * Метод класса ImageRegion записывает заголовки и строки прямоугольника
+ * в поток BMP данных функцией формата, выбранной по глубине цвета.
+ * @param stream: поток, установленный на начало BMP данных.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageRegion::write_stream(ByteStream& stream) const
+{
+    if (is_empty())
+    {
+        std::cout << "Ошибка! Прямоугольник изображения пуст.\n";
+        return 0;
+    }
+    BMPFileHeader file_header;
+    BMPInfoHeader info_header;
+    info_header.width = width;
+    info_header.height = height;
+    info_header.bit_count = bit_count;
+    bool bit_fields = need_bit_fields(masks, bit_count);
+    fill_headers(file_header, info_header, 0, bit_fields);
+    bool written =
+        stream.write(&file_header, sizeof(BMPFileHeader), 1) == 1 &&
+        stream.write(&info_header, sizeof(BMPInfoHeader), 1) == 1 &&
+        (!bit_fields || stream.write(&masks, sizeof(BitMasks), 1) == 1);
+    if (!written)
+    {
+        std::cout << "Ошибка! Не удалось записать заголовки BMP данных.\n";
+        return 0;
+    }
+    BitFields fields = make_bit_fields(masks);
+    RowContext context = {};
+    context.fields = &fields;
+    const FormatCodec* codec = get_format_codec(bit_count);
+    // Функция формата не сообщает об ошибках записи, неполную запись
+    // выдает положение в потоке после строк
+    std::uint64_t end = stream.tell() +
+        get_bmp_row_size(width, bit_count) * height;
+    codec->write_rows(stream, pixels, width, height, stride, context);
+    if (stream.tell() != end)
+    {
+        std::cout << "Ошибка! Не удалось записать строки BMP данных.\n";
+        return 0;
+    }
+    return 1;
+}
+
+#endif
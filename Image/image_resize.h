@@ -0,0 +1,577 @@
+/*
+Модуль image_resize.h содержит определение класса ImageResize -
+уменьшения и увеличения изображения фильтрами box, билинейным,
+бикубическим и Ланцоша. Размер меняется двумя проходами, по строкам и
+по столбцам, в целых числах с фиксированной точкой, как свертка модуля
+image_filter.h. Веса считаются заранее для каждого столбца и каждой
+строки результата. Строки результата делятся на полосы, полосы
+обрабатываются параллельно в общем пуле потоков.
+*/
+
+#pragma once
+#ifndef IMAGE_RESIZE_H
+#define IMAGE_RESIZE_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "image.h"
+#include "image_filter.h"
+#include "image_region.h"
+#include "pixel_convert.h"
+#include "thread_pool.h"
+
+
+/**
+ * Фильтры изменения размера.
+ */
+enum ResizeFilter
+{
+    // Усреднение пикселей, которые накрывает пиксель результата
+    RESIZE_BOX = 0,
+    // Билинейная интерполяция (треугольное ядро)
+    RESIZE_BILINEAR = 1,
+    // Бикубическая интерполяция (ядро Кейса, a = -0.5)
+    RESIZE_BICUBIC = 2,
+    // Фильтр Ланцоша с тремя лепестками
+    RESIZE_LANCZOS = 3
+};
+
+
+// Число лепестков фильтра Ланцоша
+const int RESIZE_LANCZOS_LOBES = 3;
+// Число пикселей, которые проход по строке инструкциями AVX2 читает за
+// последним весом окна
+const unsigned long RESIZE_OVERREAD = 2;
+
+
+/**
+ * Функция возвращает радиус ядра фильтра при неизменном размере.
+ * @param filter: фильтр.
+ * @return: радиус в пикселях.
+ */
+double get_resize_support(ResizeFilter filter)
+{
+    switch (filter)
+    {
+    case RESIZE_BOX:
+        return 0.5;
+    case RESIZE_BILINEAR:
+        return 1.0;
+    case RESIZE_BICUBIC:
+        return 2.0;
+    default:
+        return RESIZE_LANCZOS_LOBES;
+    }
+}
+
+
+/**
+ * Функция возвращает значение ядра фильтра.
+ * @param filter: фильтр;
+ * @param x: расстояние от центра ядра в пикселях.
+ * @return: вес пикселя до нормировки.
+ */
+double get_resize_weight(ResizeFilter filter, double x)
+{
+    const double pi = 3.14159265358979323846;
+    double t = std::fabs(x);
+    switch (filter)
+    {
+    case RESIZE_BOX:
+        return x > -0.5 && x <= 0.5 ? 1.0 : 0.0;
+    case RESIZE_BILINEAR:
+        return t < 1.0 ? 1.0 - t : 0.0;
+    case RESIZE_BICUBIC:
+        if (t < 1.0)
+        {
+            return (1.5 * t - 2.5) * t * t + 1.0;
+        }
+        return t < 2.0 ? ((-0.5 * t + 2.5) * t - 4.0) * t + 2.0 : 0.0;
+    default:
+        if (t < 1e-9)
+        {
+            return 1.0;
+        }
+        if (t >= RESIZE_LANCZOS_LOBES)
+        {
+            return 0.0;
+        }
+        return RESIZE_LANCZOS_LOBES * std::sin(pi * t) *
+            std::sin(pi * t / RESIZE_LANCZOS_LOBES) / (pi * pi * t * t);
+    }
+}
+
+
+/**
+ * Структура для хранения весов одного прохода: окна исходных пикселей
+ * (или строк) для каждого пикселя (или строки) результата.
+ */
+struct ResizeWeights
+{
+    // Номер первого пикселя окна каждого результата, сдвинутый на
+    // padding, чтобы окна у левого края не уходили в минус
+    std::vector<unsigned long> starts;
+    // Целые веса: по taps_num весов на каждый результат
+    std::vector<int> taps;
+    // Пары весов для _mm256_madd_epi16: по taps_num / 2 на результат
+    std::vector<int> pairs;
+    // Число весов окна, кратное 4 (лишние веса равны нулю)
+    size_t taps_num;
+    // Число пикселей перед первым исходным пикселем, которые читают окна
+    unsigned long padding;
+    // Число пикселей, которые читают окна, вместе с дополнением
+    unsigned long length;
+};
+
+
+/**
+ * Функция считает веса прохода. Центр пикселя результата i
+ * приходится на (i + 0.5) * scale исходного пикселя, при уменьшении ядро
+ * растягивается в scale раз. Веса окна нормируются и переводятся в
+ * целые числа, ошибка округления переносится на наибольший вес. Пиксели
+ * окна за границей изображения заменяются крайними при чтении.
+ * @param filter: фильтр;
+ * @param source_size: исходный размер в пикселях;
+ * @param size: размер результата в пикселях;
+ * @param weights: структура для весов.
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int make_resize_weights(ResizeFilter filter, unsigned long source_size,
+    unsigned long size, ResizeWeights& weights)
+{
+    double scale = (double)source_size / size;
+    double filter_scale = scale > 1.0 ? scale : 1.0;
+    double support = get_resize_support(filter) * filter_scale;
+    size_t window = (size_t)std::ceil(support) * 2 + 1;
+    weights.taps_num = (window + 3) / 4 * 4;
+    weights.starts.resize(size);
+    weights.taps.assign((size_t)size * weights.taps_num, 0);
+    std::vector<double> values(window);
+    std::vector<long> firsts(size);
+    long min_first = 0;
+    long max_last = (long)source_size;
+    for (unsigned long i = 0; i < size; i++)
+    {
+        // Цикл для прохода по пикселям результата
+        double center = (i + 0.5) * scale;
+        long first = (long)std::floor(center - support + 0.5);
+        double sum = 0;
+        for (size_t k = 0; k < window; k++)
+        {
+            values[k] = get_resize_weight(filter,
+                (first + (long)k + 0.5 - center) / filter_scale);
+            sum += values[k];
+        }
+        if (!(sum > 0))
+        {
+            std::cout << "Ошибка! Веса фильтра изменения размера не " <<
+                "удалось нормировать.\n";
+            return 0;
+        }
+        int* taps = &weights.taps[(size_t)i * weights.taps_num];
+        int total = 0;
+        size_t largest = 0;
+        for (size_t k = 0; k < window; k++)
+        {
+            taps[k] = (int)std::lround(values[k] / sum * (1 << FILTER_SHIFT));
+            total += taps[k];
+            largest = values[k] > values[largest] ? k : largest;
+        }
+        taps[largest] += (1 << FILTER_SHIFT) - total;
+        firsts[i] = first;
+        min_first = first < min_first ? first : min_first;
+        long last = first + (long)weights.taps_num + (long)RESIZE_OVERREAD;
+        max_last = last > max_last ? last : max_last;
+    }
+    weights.padding = (unsigned long)-min_first;
+    weights.length = (unsigned long)(max_last - min_first);
+    for (unsigned long i = 0; i < size; i++)
+    {
+        weights.starts[i] = (unsigned long)(firsts[i] - min_first);
+    }
+    size_t pairs_num = weights.taps_num / 2;
+    weights.pairs.resize((size_t)size * pairs_num);
+    for (unsigned long i = 0; i < size; i++)
+    {
+        make_filter_pairs(&weights.taps[(size_t)i * weights.taps_num],
+            weights.taps_num, &weights.pairs[(size_t)i * pairs_num]);
+    }
+    return 1;
+}
+
+
+/**
+ * Функция выполняет проход по строке скалярным кодом: каждый пиксель
+ * результата складывается из окна пикселей строки со своими весами.
+ * @param line: строка, дополненная по краям крайними пикселями;
+ * @param weights: веса прохода по строкам;
+ * @param dst: массив для сумм, по 3 канала на пиксель результата;
+ * @param first: номер первого пикселя результата;
+ * @param count: число пикселей результата.
+ */
+void resize_horizontal_scalar(const unsigned char* line,
+    const ResizeWeights& weights, short* dst, size_t first, size_t count)
+{
+    const int shift = FILTER_SHIFT - FILTER_FRACTION;
+    const int round = 1 << (shift - 1);
+    size_t taps_num = weights.taps_num;
+    for (size_t i = first; i < count; i++)
+    {
+        const unsigned char* p = line + (size_t)weights.starts[i] * 3;
+        const int* taps = &weights.taps[i * taps_num];
+        int sums[3] = { 0, 0, 0 };
+        for (size_t k = 0; k < taps_num; k++)
+        {
+            sums[0] += taps[k] * p[k * 3];
+            sums[1] += taps[k] * p[k * 3 + 1];
+            sums[2] += taps[k] * p[k * 3 + 2];
+        }
+        for (int c = 0; c < 3; c++)
+        {
+            dst[i * 3 + c] = (short)((sums[c] + round) >> shift);
+        }
+    }
+}
+
+
+#ifdef IMAGE_SIMD_X86
+/**
+ * Функция выполняет проход по строке инструкциями AVX2. За шаг окна
+ * берутся 4 пикселя: 16 байт строки копируются в обе половины регистра,
+ * перестановка собирает в младшей половине синие и зеленые каналы, в
+ * старшей - красные, попарно для _mm256_madd_epi16 с парами весов.
+ * Строка должна быть дополнена RESIZE_OVERREAD пикселями за окнами.
+ * @param line: строка, дополненная по краям крайними пикселями;
+ * @param weights: веса прохода по строкам;
+ * @param dst: массив для сумм, по 3 канала на пиксель результата;
+ * @param count: число пикселей результата.
+ */
+IMAGE_TARGET_AVX2
+void resize_horizontal_avx2(const unsigned char* line,
+    const ResizeWeights& weights, short* dst, size_t count)
+{
+    const int shift = FILTER_SHIFT - FILTER_FRACTION;
+    const int round = 1 << (shift - 1);
+    // Слова: (b0, b1), (b2, b3), (g0, g1), (g2, g3) | (r0, r1), (r2, r3)
+    const __m256i order = _mm256_setr_epi8(
+        0, -1, 3, -1, 6, -1, 9, -1, 1, -1, 4, -1, 7, -1, 10, -1,
+        2, -1, 5, -1, 8, -1, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    size_t taps_num = weights.taps_num;
+    size_t pairs_num = taps_num / 2;
+    for (size_t i = 0; i < count; i++)
+    {
+        const unsigned char* p = line + (size_t)weights.starts[i] * 3;
+        const int* pairs = &weights.pairs[i * pairs_num];
+        __m256i sum = _mm256_setzero_si256();
+        for (size_t k = 0; k < taps_num; k += 4)
+        {
+            __m256i bytes = _mm256_broadcastsi128_si256(
+                _mm_loadu_si128((const __m128i*)(p + k * 3)));
+            // Две пары весов повторяются в обеих половинах регистра
+            std::int64_t two_pairs;
+            memcpy(&two_pairs, pairs + k / 2, sizeof(two_pairs));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(
+                _mm256_shuffle_epi8(bytes, order),
+                _mm256_set1_epi64x(two_pairs)));
+        }
+        // После сложения соседних слов: (b, g, b, g) | (r, 0, r, 0)
+        sum = _mm256_hadd_epi32(sum, sum);
+        __m128i low = _mm256_castsi256_si128(sum);
+        __m128i high = _mm256_extracti128_si256(sum, 1);
+        short* px = dst + i * 3;
+        px[0] = (short)((_mm_cvtsi128_si32(low) + round) >> shift);
+        px[1] = (short)((_mm_extract_epi32(low, 1) + round) >> shift);
+        px[2] = (short)((_mm_cvtsi128_si32(high) + round) >> shift);
+    }
+}
+#endif
+
+
+/**
+ * Функция выполняет проход по строке реализацией для выбранного набора
+ * инструкций.
+ * @param line: строка, дополненная по краям крайними пикселями;
+ * @param weights: веса прохода по строкам;
+ * @param dst: массив для сумм, по 3 канала на пиксель результата;
+ * @param count: число пикселей результата.
+ */
+void resize_horizontal(const unsigned char* line,
+    const ResizeWeights& weights, short* dst, size_t count)
+{
+#ifdef IMAGE_SIMD_X86
+    if (get_pixel_kernels().level == SIMD_AVX2)
+    {
+        resize_horizontal_avx2(line, weights, dst, count);
+        return;
+    }
+#endif
+    resize_horizontal_scalar(line, weights, dst, 0, count);
+}
+
+
+/**
+ * Функция выполняет проход по столбцам реализацией для выбранного
+ * набора инструкций: строка результата складывается из сумм строк окна
+ * с весами этой строки.
+ * @param rows: указатели на суммы строк окна;
+ * @param weights: веса прохода по столбцам;
+ * @param i: номер строки результата;
+ * @param dst: массив для каналов результата;
+ * @param count: число каналов в строке.
+ */
+void resize_vertical(const short* const* rows, const ResizeWeights& weights,
+    unsigned long i, unsigned char* dst, size_t count)
+{
+    const int* taps = &weights.taps[(size_t)i * weights.taps_num];
+#ifdef IMAGE_SIMD_X86
+    if (get_pixel_kernels().level == SIMD_AVX2)
+    {
+        filter_vertical_pairs_avx2(rows, taps,
+            &weights.pairs[(size_t)i * weights.taps_num / 2],
+            weights.taps_num, dst, count);
+        return;
+    }
+#endif
+    filter_vertical_scalar(rows, taps, weights.taps_num, dst, 0, count);
+}
+
+
+/**
+ * Класс изменения размера изображения или его прямоугольника.
+ * Результат - новое изображение, исходное изображение не меняется и
+ * должно существовать, пока существует объект класса. Веса хранятся с
+ * FILTER_SHIFT двоичными знаками, поэтому при уменьшении до 64 раз
+ * каналы отличаются от точного расчета не больше чем на 2, при большем
+ * уменьшении ошибка округления малых весов растет.
+ */
+class ImageResize
+{
+protected:
+    // Исходные пиксели
+    ImageRegion source;
+    // Фильтр
+    ResizeFilter filter;
+    // Число потоков для обработки полос строк
+    unsigned threads;
+
+public:
+    // Конструктор класса, обрабатывающий все изображение
+    ImageResize(const Image&);
+    // Конструктор класса, обрабатывающий прямоугольник изображения
+    ImageResize(const ImageRegion&);
+    // Метод задает фильтр
+    void set_filter(ResizeFilter);
+    // Метод задает число потоков для обработки полос строк
+    void set_threads(unsigned);
+    // Метод меняет размер и возвращает новое изображение
+    Image run(unsigned long, unsigned long) const;
+    // Метод уменьшает изображение, сохраняя соотношение сторон
+    Image run_thumbnail(unsigned long) const;
+
+private:
+    // Метод считает полосу строк результата
+    void resize_rows(const ResizeWeights&, const ResizeWeights&,
+        unsigned long, unsigned long, RGBTriple*) const;
+};
+
+
+/**
+ * Конструктор класса ImageResize, обрабатывающий все изображение.
+ * Фильтр по умолчанию - билинейный.
+ * @param image: исходное изображение.
+ */
+ImageResize::ImageResize(const Image& image) :
+    ImageResize(ImageRegion(image))
+{
+}
+
+
+/**
+ * Конструктор класса ImageResize, обрабатывающий прямоугольник
+ * изображения. Пиксели за границей прямоугольника не читаются.
+ * @param region: прямоугольник исходного изображения.
+ */
+ImageResize::ImageResize(const ImageRegion& region)
+{
+    source = region;
+    filter = RESIZE_BILINEAR;
+    threads = 1;
+}
+
+
+/**
+ * Метод класса ImageResize задает фильтр.
+ * @param resize_filter: фильтр.
+ */
+void ImageResize::set_filter(ResizeFilter resize_filter)
+{
+    filter = resize_filter;
+}
+
+
+/**
+ * Метод класса ImageResize задает число потоков для обработки полос
+ * строк.
+ * @param count: число потоков (0 - по числу ядер процессора).
+ */
+void ImageResize::set_threads(unsigned count)
+{
+    threads = count ? count : get_hardware_threads();
+}
+
+
+/**
+ * Метод класса ImageResize считает строки [first, last) результата.
+ * Суммы прохода по строкам хранятся в кольце из taps_num строк: окна
+ * соседних строк результата сдвигаются вверх, поэтому каждая исходная
+ * строка полосы проходится по строке один раз. Строки окна за границей
+ * изображения заменяются крайними.
+ * @param columns: веса прохода по строкам;
+ * @param rows: веса прохода по столбцам;
+ * @param first: номер первой строки полосы;
+ * @param last: номер строки после последней;
+ * @param data: массив пикселей результата.
+ */
+void ImageResize::resize_rows(const ResizeWeights& columns,
+    const ResizeWeights& rows, unsigned long first, unsigned long last,
+    RGBTriple* data) const
+{
+    long source_width = (long)source.get_width();
+    long source_height = (long)source.get_height();
+    size_t width = columns.starts.size();
+    size_t count = width * 3;
+    size_t ring_rows = rows.taps_num;
+    std::vector<unsigned char> line((size_t)columns.length * 3);
+    std::vector<short> ring(ring_rows * count);
+    std::vector<const short*> window(rows.taps_num);
+    // Номер исходной строки, с которой кольцо еще не заполнено
+    long next = -1;
+    for (unsigned long i = first; i < last; i++)
+    {
+        // Цикл для прохода по строкам полосы
+        long top = (long)rows.starts[i] - (long)rows.padding;
+        long low = top < 0 ? 0 : top;
+        long high = top + (long)rows.taps_num - 1;
+        high = high >= source_height ? source_height - 1 : high;
+        for (long r = next > low ? next : low; r <= high; r++)
+        {
+            // Строки, которых еще нет в кольце, проходятся по строке
+            const RGBTriple* pixels = source.get_row((unsigned long)r);
+            unsigned char* bytes = line.data();
+            for (unsigned long j = 0; j < columns.padding; j++)
+            {
+                memcpy(bytes + (size_t)j * 3, &pixels[0], 3);
+            }
+            memcpy(bytes + (size_t)columns.padding * 3, pixels,
+                (size_t)source_width * 3);
+            for (unsigned long j = columns.padding + source_width;
+                j < columns.length; j++)
+            {
+                memcpy(bytes + (size_t)j * 3, &pixels[source_width - 1], 3);
+            }
+            resize_horizontal(bytes, columns,
+                &ring[(size_t)r % ring_rows * count], width);
+        }
+        next = high + 1 > next ? high + 1 : next;
+        for (size_t k = 0; k < rows.taps_num; k++)
+        {
+            long r = top + (long)k;
+            r = r < 0 ? 0 : r >= source_height ? source_height - 1 : r;
+            window[k] = &ring[(size_t)r % ring_rows * count];
+        }
+        resize_vertical(window.data(), rows, i,
+            (unsigned char*)&data[(size_t)i * width], count);
+    }
+}
+
+
+/**
+ * Метод класса ImageResize меняет размер и возвращает новое изображение
+ * с глубиной цвета и масками каналов исходного. Веса столбцов и строк
+ * считаются один раз, строки результата делятся на полосы по числу
+ * потоков.
+ * @param width: ширина результата;
+ * @param height: высота результата.
+ * @return: изображение с результатом (пустое, если исходное пусто или
+ * произошла ошибка).
+ */
+Image ImageResize::run(unsigned long width, unsigned long height) const
+{
+    Image image;
+    if (source.is_empty())
+    {
+        return image;
+    }
+    if (width == 0 || height == 0)
+    {
+        std::cout << "Ошибка! Размеры изображения должны быть " <<
+            "положительными.\n";
+        return image;
+    }
+    ResizeWeights columns;
+    ResizeWeights rows;
+    if (!make_resize_weights(filter, source.get_width(), width, columns) ||
+        !make_resize_weights(filter, source.get_height(), height, rows))
+    {
+        return image;
+    }
+    image.bmp_info_header.size = sizeof(BMPInfoHeader);
+    image.bmp_info_header.width = width;
+    image.bmp_info_header.height = height;
+    image.bmp_info_header.bit_count = source.get_bit_count();
+    image.masks = source.get_bit_masks();
+    image.update_headers(0);
+    image.allocate_data((size_t)width * height);
+    RGBTriple* data = image.data;
+    auto body = [this, &columns, &rows, data](size_t first, size_t last)
+    {
+        resize_rows(columns, rows, (unsigned long)first,
+            (unsigned long)last, data);
+    };
+    if (threads <= 1 || height < 2)
+    {
+        body(0, height);
+    }
+    else
+    {
+        get_thread_pool().parallel_for(0, height,
+            (height + threads - 1) / threads, body);
+    }
+    return image;
+}
+
+
+/**
+ * Метод класса ImageResize уменьшает изображение так, чтобы большая
+ * сторона не превышала заданный размер, сохраняя соотношение сторон.
+ * Изображение, которое уже меньше, копируется без изменения размера.
+ * @param size: наибольшая сторона результата.
+ * @return: изображение с результатом (пустое, если исходное пусто или
+ * произошла ошибка).
+ */
+Image ImageResize::run_thumbnail(unsigned long size) const
+{
+    unsigned long width = source.get_width();
+    unsigned long height = source.get_height();
+    if (width > size || height > size)
+    {
+        if (width >= height)
+        {
+            height = (unsigned long)((double)height * size / width + 0.5);
+            width = size;
+        }
+        else
+        {
+            width = (unsigned long)((double)width * size / height + 0.5);
+            height = size;
+        }
+        width = width ? width : 1;
+        height = height ? height : 1;
+    }
+    return run(width, height);
+}
+
+#endif
@@ -0,0 +1,556 @@
+/*
+Модуль image_stats.h содержит счетчики времени этапов, ввода-вывода и
+выделений памяти при загрузке и записи изображений. Счетчики включаются
+при компиляции макросом IMAGE_STATS. Без него классы и функции модуля
+пусты и после встраивания не оставляют в коде чтения и записи ни одной
+команды.
+*/
+
+#pragma once
+#ifndef IMAGE_STATS_H
+#define IMAGE_STATS_H
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#ifdef IMAGE_STATS
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#endif
+
+
+#ifdef IMAGE_STATS
+// Если true, счетчики включены при компиляции
+const bool STATS_ENABLED = true;
+#else
+const bool STATS_ENABLED = false;
+#endif
+
+
+/**
+ * Этапы загрузки и записи изображения.
+ */
+enum StatsStage
+{
+    // Открытие файла, чтение и запись заголовков, масок и палитры
+    STAGE_HEADERS = 0,
+    // Выделение памяти под пиксели, индексы и буферы
+    STAGE_ALLOCATION = 1,
+    // Чтение и запись файла
+    STAGE_IO = 2,
+    // Преобразование пикселей между форматом файла и RGBTriple
+    STAGE_CONVERT = 3,
+    // Число этапов
+    STAGE_COUNT = 4
+};
+
+
+/**
+ * Операции, для которых ведутся общие счетчики программы.
+ */
+enum StatsOperation
+{
+    // Загрузка изображения
+    OPERATION_LOAD = 0,
+    // Запись изображения
+    OPERATION_WRITE = 1,
+    // Число операций
+    OPERATION_COUNT = 2
+};
+
+
+/**
+ * Структура со счетчиками одного вызова или суммой счетчиков вызовов.
+ * Время этапов суммируется по потокам, поэтому при чтении полосами в
+ * нескольких потоках оно может превышать время вызова.
+ */
+struct ImageStats
+{
+    // Число вызовов
+    std::uint64_t calls;
+    // Время вызовов в секундах
+    double total_time;
+    // Время этапов в секундах
+    double stage_time[STAGE_COUNT];
+    // Число прочитанных байтов
+    std::uint64_t bytes_read;
+    // Число записанных байтов
+    std::uint64_t bytes_written;
+    // Число вызовов чтения и записи файла
+    std::uint64_t io_calls;
+    // Число выделений памяти
+    std::uint64_t allocations;
+    // Объем выделенной памяти в байтах
+    std::uint64_t allocated_bytes;
+    // Наибольшее выделение памяти в байтах
+    std::uint64_t max_allocation;
+};
+
+
+/**
+ * Класс для сбора счетчиков одного вызова загрузки или записи. Счетчики
+ * могут пополняться из нескольких потоков одновременно.
+ */
+class StatsCollector
+{
+#ifdef IMAGE_STATS
+protected:
+    // Время этапов в наносекундах
+    std::atomic<std::uint64_t> stage_ns[STAGE_COUNT];
+    // Число прочитанных байтов
+    std::atomic<std::uint64_t> bytes_read;
+    // Число записанных байтов
+    std::atomic<std::uint64_t> bytes_written;
+    // Число вызовов чтения и записи файла
+    std::atomic<std::uint64_t> io_calls;
+    // Число выделений памяти
+    std::atomic<std::uint64_t> allocations;
+    // Объем выделенной памяти в байтах
+    std::atomic<std::uint64_t> allocated_bytes;
+    // Наибольшее выделение памяти в байтах
+    std::atomic<std::uint64_t> max_allocation;
+    // Начало вызова
+    std::chrono::steady_clock::time_point start;
+    // Счетчики последнего завершенного вызова
+    ImageStats last;
+#endif
+
+public:
+    // Конструктор класса без параметров
+    StatsCollector();
+    // Метод обнуляет счетчики в начале вызова
+    void begin();
+    // Метод завершает вызов и добавляет его к общим счетчикам
+    void finish(StatsOperation);
+    // Метод добавляет время этапа
+    void add_time(StatsStage, std::uint64_t);
+    // Метод учитывает вызов чтения файла
+    void add_read(std::uint64_t);
+    // Метод учитывает вызов записи файла
+    void add_write(std::uint64_t);
+    // Метод учитывает выделение памяти
+    void add_allocation(std::uint64_t);
+    // Метод возвращает счетчики последнего завершенного вызова
+    ImageStats get_last() const;
+
+private:
+    // Копировать счетчики нельзя
+    StatsCollector(const StatsCollector&);
+    StatsCollector& operator = (const StatsCollector&);
+};
+
+
+/**
+ * Класс для замера времени этапа от создания объекта до его удаления
+ * или вызова stop.
+ */
+class StageTimer
+{
+#ifdef IMAGE_STATS
+protected:
+    // Счетчики вызова или nullptr
+    StatsCollector* collector;
+    // Этап
+    StatsStage stage;
+    // Начало замера
+    std::chrono::steady_clock::time_point start;
+#endif
+
+public:
+    // Конструктор класса, начинающий замер
+    StageTimer(StatsCollector*, StatsStage);
+    // Деструктор класса, завершающий замер
+    ~StageTimer();
+    // Метод завершает замер до удаления объекта
+    void stop();
+};
+
+
+/**
+ * Функция учитывает вызов чтения файла.
+ * @param collector: счетчики вызова или nullptr;
+ * @param bytes: число прочитанных байтов.
+ */
+void count_read(StatsCollector* collector, std::uint64_t bytes)
+{
+#ifdef IMAGE_STATS
+    if (collector)
+    {
+        collector->add_read(bytes);
+    }
+#else
+    (void)collector;
+    (void)bytes;
+#endif
+}
+
+
+/**
+ * Функция учитывает вызов записи файла.
+ * @param collector: счетчики вызова или nullptr;
+ * @param bytes: число записанных байтов.
+ */
+void count_write(StatsCollector* collector, std::uint64_t bytes)
+{
+#ifdef IMAGE_STATS
+    if (collector)
+    {
+        collector->add_write(bytes);
+    }
+#else
+    (void)collector;
+    (void)bytes;
+#endif
+}
+
+
+/**
+ * Функция учитывает выделение памяти.
+ * @param collector: счетчики вызова или nullptr;
+ * @param bytes: размер выделенной памяти в байтах.
+ */
+void count_allocation(StatsCollector* collector, std::uint64_t bytes)
+{
+#ifdef IMAGE_STATS
+    if (collector)
+    {
+        collector->add_allocation(bytes);
+    }
+#else
+    (void)collector;
+    (void)bytes;
+#endif
+}
+
+
+#ifdef IMAGE_STATS
+/**
+ * Функция возвращает общие счетчики программы и мьютекс для них.
+ * @param mutex: указатель для мьютекса.
+ * @return: массив счетчиков по операциям.
+ */
+ImageStats* get_stats_totals(std::mutex** mutex)
+{
+    static std::mutex totals_mutex;
+    static ImageStats totals[OPERATION_COUNT] = {};
+    *mutex = &totals_mutex;
+    return totals;
+}
+
+
+/**
+ * Функция возвращает время в наносекундах от начала замера.
+ * @param start: начало замера.
+ * @return: время в наносекундах.
+ */
+std::uint64_t get_elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+    return (std::uint64_t)std::chrono::duration_cast<
+        std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+        start).count();
+}
+#endif
+
+
+/**
+ * Функция возвращает сумму счетчиков всех завершенных вызовов операции
+ * за время работы программы.
+ * @param operation: операция.
+ * @return: счетчики; без IMAGE_STATS все счетчики нулевые.
+ */
+ImageStats get_total_stats(StatsOperation operation)
+{
+    ImageStats stats = {};
+#ifdef IMAGE_STATS
+    std::mutex* mutex;
+    ImageStats* totals = get_stats_totals(&mutex);
+    std::lock_guard<std::mutex> lock(*mutex);
+    stats = totals[operation];
+#else
+    (void)operation;
+#endif
+    return stats;
+}
+
+
+/**
+ * Функция обнуляет общие счетчики программы.
+ */
+void reset_total_stats()
+{
+#ifdef IMAGE_STATS
+    std::mutex* mutex;
+    ImageStats* totals = get_stats_totals(&mutex);
+    std::lock_guard<std::mutex> lock(*mutex);
+    for (int i = 0; i < OPERATION_COUNT; i++)
+    {
+        totals[i] = {};
+    }
+#endif
+}
+
+
+/**
+ * Функция записывает счетчики в формате JSON.
+ * @param stats: счетчики.
+ * @return: объект JSON.
+ */
+std::string get_stats_json(const ImageStats& stats)
+{
+    const char* stage_names[STAGE_COUNT] = { "headers", "allocation", "io",
+        "convert" };
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "{\"calls\": %" PRIu64 ", "
+        "\"total_time\": %.9f, \"stages\": {", stats.calls,
+        stats.total_time);
+    std::string json = buffer;
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        snprintf(buffer, sizeof(buffer), "%s\"%s\": %.9f", i ? ", " : "",
+            stage_names[i], stats.stage_time[i]);
+        json += buffer;
+    }
+    snprintf(buffer, sizeof(buffer), "}, \"bytes_read\": %" PRIu64 ", "
+        "\"bytes_written\": %" PRIu64 ", \"io_calls\": %" PRIu64 ", "
+        "\"allocations\": %" PRIu64 ", \"allocated_bytes\": %" PRIu64
+        ", \"max_allocation\": %" PRIu64 "}", stats.bytes_read,
+        stats.bytes_written, stats.io_calls, stats.allocations,
+        stats.allocated_bytes, stats.max_allocation);
+    return json + buffer;
+}
+
+
+/**
+ * Функция записывает общие счетчики программы в формате JSON.
+ * @return: объект JSON со счетчиками загрузки и записи.
+ */
+std::string get_total_stats_json()
+{
+    return std::string("{\"enabled\": ") + (STATS_ENABLED ? "true" :
+        "false") + ", \"load\": " +
+        get_stats_json(get_total_stats(OPERATION_LOAD)) + ", \"write\": " +
+        get_stats_json(get_total_stats(OPERATION_WRITE)) + "}";
+}
+
+
+/**
+ * Функция записывает общие счетчики программы в файл в формате JSON.
+ * @param file: открытый файл, например stdout.
+ */
+void dump_total_stats(FILE* file)
+{
+    fprintf(file, "%s\n", get_total_stats_json().c_str());
+}
+
+
+/**
+ * Конструктор класса StatsCollector без параметров.
+ */
+StatsCollector::StatsCollector()
+{
+#ifdef IMAGE_STATS
+    last = {};
+    begin();
+#endif
+}
+
+
+/**
+ * Метод класса StatsCollector обнуляет счетчики и запоминает начало
+ * вызова.
+ */
+void StatsCollector::begin()
+{
+#ifdef IMAGE_STATS
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        stage_ns[i] = 0;
+    }
+    bytes_read = 0;
+    bytes_written = 0;
+    io_calls = 0;
+    allocations = 0;
+    allocated_bytes = 0;
+    max_allocation = 0;
+    start = std::chrono::steady_clock::now();
+#endif
+}
+
+
+/**
+ * Метод класса StatsCollector завершает вызов: сохраняет его счетчики
+ * как последние и добавляет их к общим счетчикам операции.
+ * @param operation: операция вызова.
+ */
+void StatsCollector::finish(StatsOperation operation)
+{
+#ifdef IMAGE_STATS
+    ImageStats stats = {};
+    stats.calls = 1;
+    stats.total_time = get_elapsed_ns(start) * 1e-9;
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        stats.stage_time[i] = stage_ns[i] * 1e-9;
+    }
+    stats.bytes_read = bytes_read;
+    stats.bytes_written = bytes_written;
+    stats.io_calls = io_calls;
+    stats.allocations = allocations;
+    stats.allocated_bytes = allocated_bytes;
+    stats.max_allocation = max_allocation;
+    last = stats;
+    std::mutex* mutex;
+    ImageStats* totals = get_stats_totals(&mutex);
+    std::lock_guard<std::mutex> lock(*mutex);
+    ImageStats& total = totals[operation];
+    total.calls++;
+    total.total_time += stats.total_time;
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        total.stage_time[i] += stats.stage_time[i];
+    }
+    total.bytes_read += stats.bytes_read;
+    total.bytes_written += stats.bytes_written;
+    total.io_calls += stats.io_calls;
+    total.allocations += stats.allocations;
+    total.allocated_bytes += stats.allocated_bytes;
+    if (stats.max_allocation > total.max_allocation)
+    {
+        total.max_allocation = stats.max_allocation;
+    }
+#else
+    (void)operation;
+#endif
+}
+
+
+/**
+ * Метод класса StatsCollector добавляет время этапа.
+ * @param stage: этап;
+ * @param ns: время в наносекундах.
+ */
+void StatsCollector::add_time(StatsStage stage, std::uint64_t ns)
+{
+#ifdef IMAGE_STATS
+    stage_ns[stage] += ns;
+#else
+    (void)stage;
+    (void)ns;
+#endif
+}
+
+
+/**
+ * Метод класса StatsCollector учитывает вызов чтения файла.
+ * @param bytes: число прочитанных байтов.
+ */
+void StatsCollector::add_read(std::uint64_t bytes)
+{
+#ifdef IMAGE_STATS
+    bytes_read += bytes;
+    io_calls++;
+#else
+    (void)bytes;
+#endif
+}
+
+
+/**
+ * Метод класса StatsCollector учитывает вызов записи файла.
+ * @param bytes: число записанных байтов.
+ */
+void StatsCollector::add_write(std::uint64_t bytes)
+{
+#ifdef IMAGE_STATS
+    bytes_written += bytes;
+    io_calls++;
+#else
+    (void)bytes;
+#endif
+}
+
+
+/**
+ * Метод класса StatsCollector учитывает выделение памяти.
+ * @param bytes: размер выделенной памяти в байтах.
+ */
+void StatsCollector::add_allocation(std::uint64_t bytes)
+{
+#ifdef IMAGE_STATS
+    allocations++;
+    allocated_bytes += bytes;
+    std::uint64_t current = max_allocation;
+    while (bytes > current &&
+        !max_allocation.compare_exchange_weak(current, bytes))
+    {
+    }
+#else
+    (void)bytes;
+#endif
+}
+
+
+/**
+ * Метод класса StatsCollector возвращает счетчики последнего
+ * завершенного вызова.
+ * @return: счетчики; без IMAGE_STATS все счетчики нулевые.
+ */
+ImageStats StatsCollector::get_last() const
+{
+#ifdef IMAGE_STATS
+    return last;
+#else
+    return ImageStats();
+#endif
+}
+
+
+/**
+ * Конструктор класса StageTimer, начинающий замер этапа.
+ * @param collector: счетчики вызова или nullptr;
+ * @param stage: этап.
+ */
+StageTimer::StageTimer(StatsCollector* collector, StatsStage stage)
+{
+#ifdef IMAGE_STATS
+    this->collector = collector;
+    this->stage = stage;
+    if (collector)
+    {
+        start = std::chrono::steady_clock::now();
+    }
+#else
+    (void)collector;
+    (void)stage;
+#endif
+}
+
+
+/**
+ * Деструктор класса StageTimer, завершающий замер этапа, если он не
+ * завершен методом stop.
+ */
+StageTimer::~StageTimer()
+{
+    stop();
+}
+
+
+/**
+ * Метод класса StageTimer завершает замер и добавляет время к этапу.
+ * Повторные вызовы ничего не делают.
+ */
+void StageTimer::stop()
+{
+#ifdef IMAGE_STATS
+    if (collector)
+    {
+        collector->add_time(stage, get_elapsed_ns(start));
+        collector = nullptr;
+    }
+#endif
+}
+
+#endif
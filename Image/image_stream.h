@@ -0,0 +1,867 @@
+/*
+Модуль image_stream.h содержит определение классов ImageReader и
+ImageWriter для построчного чтения и записи BMP изображений. Классы
+держат в памяти только кольцо из нескольких строк, поэтому подходят для
+изображений, которые не помещаются в память целиком.
+*/
+
+#pragma once
+#ifndef IMAGE_STREAM_H
+#define IMAGE_STREAM_H
+
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include "image.h"
+#include "palette_quantizer.h"
+
+
+/**
+ * Функция возвращает число строк в кольце буферов. По умолчанию кольцо
+ * занимает около IO_BLOCK_SIZE байт, но не меньше одной строки.
+ * @param ring_rows: заданное число строк, 0 - по умолчанию;
+ * @param row_bytes: размер строки в байтах;
+ * @param height: высота изображения.
+ * @return: число строк в кольце.
+ */
+unsigned long get_ring_rows(unsigned long ring_rows, unsigned long row_bytes,
+    unsigned long height)
+{
+    if (ring_rows == 0)
+    {
+        ring_rows = row_bytes ? IO_BLOCK_SIZE / row_bytes : height;
+    }
+    if (ring_rows > height)
+    {
+        ring_rows = height;
+    }
+    return ring_rows ? ring_rows : 1;
+}
+
+
+/**
+ * Класс для построчного чтения BMP изображения. Строки выдаются в
+ * порядке файла (снизу вверх или, если is_top_down() возвращает true,
+ * сверху вниз) и разворачиваются в цвета RGBTriple.
+ * Последние get_ring_size() выданных строк остаются доступны.
+ */
+class ImageReader
+{
+protected:
+    // Параметр для хранения заголовка файла
+    BMPFileHeader file_header;
+    // Параметр для хранения заголовка изображения
+    BMPInfoHeader bmp_info_header;
+    // Открытый файл
+    FILE* file;
+    // Палитра палитровых изображений
+    RGBQuad palette[256];
+    // Таблица распаковки байта индексов для 1- и 4-битных строк
+    RGBTriple* unpack_table;
+    // Параметры каналов 16- и 32-битных пикселей
+    BitFields fields;
+    // Функции формата пикселей файла
+    const FormatCodec* codec;
+    // Данные палитры и масок каналов для функций формата
+    RowContext context;
+    // Размер строки в файле с выравниванием
+    unsigned long row_size;
+    // Заданное число строк в кольце, 0 - по умолчанию
+    unsigned long ring_size;
+    // Число строк в кольце открытого изображения
+    unsigned long ring_rows;
+    // Кольцо развернутых строк
+    RGBTriple* ring;
+    // Блок строк, прочитанный из файла
+    unsigned char* block;
+    // Число строк в блоке
+    unsigned long block_rows;
+    // Номер следующей строки блока
+    unsigned long block_next;
+    // Номер следующей строки изображения
+    unsigned long next_row;
+    // Если true, строки в файле идут сверху вниз
+    bool top_down;
+
+public:
+    // Конструктор класса без параметров
+    ImageReader();
+    // Конструктор класса, открывающий BMP файл
+    ImageReader(const char*);
+    // Деструктор класса
+    ~ImageReader();
+    // Метод задает число строк в кольце для следующего открытия
+    void set_ring_size(unsigned long);
+    // Метод открывает BMP файл
+    int open_image(const char*);
+    // Метод закрывает файл
+    void close_image();
+    // Метод возвращает следующую строку
+    const RGBTriple* read_row();
+    // Метод передает оставшиеся строки функции
+    unsigned long read_rows(
+        const std::function<bool(unsigned long, const RGBTriple*)>&);
+    // Метод возвращает строку из кольца по номеру
+    const RGBTriple* get_row(unsigned long) const;
+    // Метод возвращает номер следующей строки
+    unsigned long get_row_number() const;
+    // Метод возвращает число строк в кольце
+    unsigned long get_ring_size() const;
+    // Метод возвращает ширину изображения
+    unsigned long get_width() const;
+    // Метод возвращает высоту изображения
+    unsigned long get_height() const;
+    // Метод возвращает глубину цвета изображения
+    unsigned short get_bit_count() const;
+    // Метод определяет, идут ли строки в файле сверху вниз
+    bool is_top_down() const;
+    // Метод возвращает палитру
+    const RGBQuad* get_palette() const;
+
+private:
+    // Копировать чтение нельзя
+    ImageReader(const ImageReader&);
+    ImageReader& operator = (const ImageReader&);
+};
+
+
+/**
+ * Конструктор класса ImageReader без параметров.
+ */
+ImageReader::ImageReader()
+{
+    file = nullptr;
+    unpack_table = nullptr;
+    codec = nullptr;
+    context = RowContext();
+    row_size = 0;
+    ring_size = 0;
+    ring_rows = 0;
+    ring = nullptr;
+    block = nullptr;
+    block_rows = 0;
+    block_next = 0;
+    next_row = 0;
+    top_down = false;
+}
+
+
+/**
+ * Конструктор класса ImageReader, открывающий BMP файл.
+ * @param filename: имя файла с изображением.
+ */
+ImageReader::ImageReader(const char* filename) : ImageReader()
+{
+    open_image(filename);
+}
+
+
+/**
+ * Деструктор класса ImageReader.
+ */
+ImageReader::~ImageReader()
+{
+    close_image();
+}
+
+
+/**
+ * Метод класса ImageReader задает число строк в кольце. Действует при
+ * следующем открытии файла.
+ * @param rows: число строк, 0 - кольцо размером около IO_BLOCK_SIZE.
+ */
+void ImageReader::set_ring_size(unsigned long rows)
+{
+    ring_size = rows;
+}
+
+
+/**
+ * Метод класса ImageReader открывает BMP файл, читает заголовки и
+ * палитру и выделяет кольцо строк.
+ * @param filename: имя файла с изображением.
+ * @returm: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageReader::open_image(const char* filename)
+{
+    close_image();
+    file = open_file(filename, "rb");
+    if (!file)
+    {
+        // Если файл не был открыт
+        std::cout << "Ошибка! Не удалось открыть файл '" <<
+            filename << "'.\n";
+        return 0;
+    }
+    bool read = fread(&file_header, sizeof(BMPFileHeader), 1, file) == 1 &&
+        fread(&bmp_info_header, sizeof(BMPInfoHeader), 1, file) == 1;
+    if (!read)
+    {
+        close_image();
+        std::cout << "Ошибка! Файл не имеет требуемый BMP формат.\n";
+        return 0;
+    }
+    // Кольцо и блок строк выделяются по размерам из заголовков, поэтому
+    // заголовки сначала проверяются по размеру файла
+    ImageInfo info;
+    const char* error = check_image_headers(file_header, bmp_info_header,
+        get_file_size(file), info);
+    if (error)
+    {
+        close_image();
+        std::cout << "Ошибка! Файл '" << filename << "': " << error << "\n";
+        return 0;
+    }
+    top_down = read_top_down(bmp_info_header);
+    unsigned short bit_count = bmp_info_header.bit_count;
+    codec = get_format_codec(bit_count);
+    BitMasks masks;
+    if (file_header.file_type != 0x4D42 || !codec ||
+        (bmp_info_header.compression != COMPRESSION_RGB &&
+        bmp_info_header.compression != COMPRESSION_BITFIELDS) ||
+        !read_bit_masks(file, bmp_info_header, masks))
+    {
+        // Работаем только с несжатыми BMP файлами и с масками каналов
+        close_image();
+        std::cout << "Ошибка! Файл не имеет требуемый BMP формат.\n";
+        return 0;
+    }
+    if (bit_count == 16 || bit_count == 32)
+    {
+        fields = make_bit_fields(masks);
+        context.fields = &fields;
+    }
+    if (bit_count <= 8)
+    {
+        // Палитра следует сразу за заголовком изображения
+        unsigned long colors_num = info.colors_num;
+        memset(palette, 0, sizeof(palette));
+        seek_file(file, sizeof(BMPFileHeader) + bmp_info_header.size);
+        if (fread(palette, sizeof(RGBQuad), colors_num, file) != colors_num)
+        {
+            close_image();
+            std::cout << "Ошибка! Не удалось прочитать палитру файла '" <<
+                filename << "'.\n";
+            return 0;
+        }
+        if (bit_count < 8)
+        {
+            unpack_table = new RGBTriple[256 * 8];
+            build_unpack_table(palette, bit_count, unpack_table);
+        }
+        context.palette = palette;
+        context.unpack_table = unpack_table;
+    }
+    seek_file(file, file_header.offset_data);
+    unsigned long width = bmp_info_header.width;
+    row_size = (unsigned long)get_bmp_row_size(width, bit_count);
+    ring_rows = get_ring_rows(ring_size, width * sizeof(RGBTriple),
+        bmp_info_header.height);
+    ring = new RGBTriple[(size_t)ring_rows * width];
+    block = new unsigned char[(size_t)ring_rows * row_size];
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageReader закрывает файл и освобождает буферы.
+ */
+void ImageReader::close_image()
+{
+    if (file)
+    {
+        fclose(file);
+    }
+    delete[] unpack_table;
+    delete[] ring;
+    delete[] block;
+    file = nullptr;
+    unpack_table = nullptr;
+    codec = nullptr;
+    context = RowContext();
+    ring = nullptr;
+    block = nullptr;
+    ring_rows = 0;
+    block_rows = 0;
+    block_next = 0;
+    next_row = 0;
+    top_down = false;
+    file_header = BMPFileHeader();
+    bmp_info_header = BMPInfoHeader();
+}
+
+
+/**
+ * Метод класса ImageReader возвращает следующую строку изображения.
+ * Строки читаются из файла блоками по размеру кольца. Указатель
+ * остается действительным, пока не прочитаны еще get_ring_size() строк.
+ * @return: указатель на строку или nullptr, если строки закончились.
+ */
+const RGBTriple* ImageReader::read_row()
+{
+    if (!file || next_row >= bmp_info_header.height)
+    {
+        return nullptr;
+    }
+    if (block_next == block_rows)
+    {
+        // Блок разобран, читаем следующий
+        block_rows = bmp_info_header.height - next_row;
+        if (block_rows > ring_rows)
+        {
+            block_rows = ring_rows;
+        }
+        size_t size = (size_t)block_rows * row_size;
+        size_t count = fread(block, 1, size, file);
+        // Недостающие байты поврежденного файла заполняем нулями
+        memset(block + count, 0, size - count);
+        block_next = 0;
+    }
+    RGBTriple* row = &ring[(size_t)(next_row % ring_rows) *
+        bmp_info_header.width];
+    codec->decode_row(block + (size_t)block_next * row_size, row,
+        bmp_info_header.width, context);
+    block_next++;
+    next_row++;
+    return row;
+}
+
+
+/**
+ * Метод класса ImageReader передает оставшиеся строки функции по одной.
+ * @param func: функция, получающая номер строки и строку; если она
+ * возвращает false, чтение прекращается.
+ * @return: число переданных строк.
+ */
+unsigned long ImageReader::read_rows(
+    const std::function<bool(unsigned long, const RGBTriple*)>& func)
+{
+    unsigned long count = 0;
+    const RGBTriple* row;
+    while ((row = read_row()) != nullptr)
+    {
+        count++;
+        if (!func(next_row - 1, row))
+        {
+            break;
+        }
+    }
+    return count;
+}
+
+
+/**
+ * Метод класса ImageReader возвращает уже прочитанную строку, если она
+ * еще есть в кольце.
+ * @param i: номер строки.
+ * @return: указатель на строку или nullptr.
+ */
+const RGBTriple* ImageReader::get_row(unsigned long i) const
+{
+    if (i >= next_row || next_row - i > ring_rows)
+    {
+        return nullptr;
+    }
+    return &ring[(size_t)(i % ring_rows) * bmp_info_header.width];
+}
+
+
+/**
+ * Метод класса ImageReader возвращает номер следующей строки.
+ * @return: номер строки.
+ */
+unsigned long ImageReader::get_row_number() const
+{
+    return next_row;
+}
+
+
+/**
+ * Метод класса ImageReader возвращает число строк в кольце.
+ * @return: число строк.
+ */
+unsigned long ImageReader::get_ring_size() const
+{
+    return ring_rows;
+}
+
+
+/**
+ * Метод класса ImageReader возвращает ширину изображения.
+ * @return: ширина в пикселях.
+ */
+unsigned long ImageReader::get_width() const
+{
+    return bmp_info_header.width;
+}
+
+
+/**
+ * Метод класса ImageReader возвращает высоту изображения.
+ * @return: высота в пикселях.
+ */
+unsigned long ImageReader::get_height() const
+{
+    return bmp_info_header.height;
+}
+
+
+/**
+ * Метод класса ImageReader возвращает глубину цвета изображения.
+ * @return: число бит на пиксель.
+ */
+unsigned short ImageReader::get_bit_count() const
+{
+    return bmp_info_header.bit_count;
+}
+
+
+/**
+ * Метод класса ImageReader определяет, идут ли строки в файле сверху
+ * вниз. Строки выдаются в порядке файла.
+ * @return: true, если строки идут сверху вниз, иначе false.
+ */
+bool ImageReader::is_top_down() const
+{
+    return top_down;
+}
+
+
+/**
+ * Метод класса ImageReader возвращает палитру.
+ * @return: палитра или nullptr для беспалитровых изображений.
+ */
+const RGBQuad* ImageReader::get_palette() const
+{
+    return bmp_info_header.bit_count <= 8 ? palette : nullptr;
+}
+
+
+/**
+ * Класс для построчной записи BMP изображения. Строки принимаются в
+ * порядке файла (снизу вверх или, после set_top_down(true), сверху
+ * вниз), собираются в кольцо и записываются блоками по заполнении
+ * кольца.
+ */
+class ImageWriter
+{
+protected:
+    // Параметр для хранения заголовка файла
+    BMPFileHeader file_header;
+    // Параметр для хранения заголовка изображения
+    BMPInfoHeader bmp_info_header;
+    // Открытый файл
+    FILE* file;
+    // Палитра для палитровых изображений
+    RGBQuad palette[256];
+    // Число цветов палитры
+    unsigned long colors_num;
+    // Поиск ближайших цветов палитры
+    PaletteLookup* lookup;
+    // Индексы палитры одной строки
+    unsigned char* row_indices;
+    // Функции формата пикселей файла
+    const FormatCodec* codec;
+    // Данные палитры для функций формата
+    RowContext context;
+    // Размер строки в файле с выравниванием
+    unsigned long row_size;
+    // Заданное число строк в кольце, 0 - по умолчанию
+    unsigned long ring_size;
+    // Число строк в кольце открытого изображения
+    unsigned long ring_rows;
+    // Кольцо строк, ожидающих записи
+    RGBTriple* ring;
+    // Число строк в кольце
+    unsigned long ring_count;
+    // Блок строк в формате файла
+    unsigned char* block;
+    // Число принятых строк
+    unsigned long rows_written;
+    // Если true, следующий файл записывается строками сверху вниз
+    bool top_down;
+    // Если true, запись в открытый файл не удалась
+    bool failed;
+
+public:
+    // Конструктор класса без параметров
+    ImageWriter();
+    // Деструктор класса
+    ~ImageWriter();
+    // Метод задает число строк в кольце для следующего открытия
+    void set_ring_size(unsigned long);
+    // Метод задает палитру для следующего открытия
+    int set_palette(const RGBQuad*, unsigned long);
+    // Метод задает порядок строк для следующего открытия
+    void set_top_down(bool);
+    // Метод создает BMP файл и записывает заголовки
+    int open_image(const char*, unsigned long, unsigned long,
+        unsigned short);
+    // Метод записывает оставшиеся строки и закрывает файл
+    int close_image();
+    // Метод принимает следующую строку
+    int write_row(const RGBTriple*);
+    // Метод получает оставшиеся строки от функции
+    unsigned long write_rows(
+        const std::function<bool(unsigned long, RGBTriple*)>&);
+    // Метод возвращает номер следующей строки
+    unsigned long get_row_number() const;
+    // Метод возвращает число строк в кольце
+    unsigned long get_ring_size() const;
+
+private:
+    // Копировать запись нельзя
+    ImageWriter(const ImageWriter&);
+    ImageWriter& operator = (const ImageWriter&);
+    // Метод возвращает свободную строку кольца
+    RGBTriple* next_slot();
+    // Метод записывает строки кольца в файл
+    void flush();
+};
+
+
+/**
+ * Конструктор класса ImageWriter без параметров.
+ */
+ImageWriter::ImageWriter()
+{
+    file = nullptr;
+    colors_num = 0;
+    lookup = nullptr;
+    row_indices = nullptr;
+    codec = nullptr;
+    context = RowContext();
+    row_size = 0;
+    ring_size = 0;
+    ring_rows = 0;
+    ring = nullptr;
+    ring_count = 0;
+    block = nullptr;
+    rows_written = 0;
+    top_down = false;
+    failed = false;
+}
+
+
+/**
+ * Деструктор класса ImageWriter. Незаписанные строки записываются.
+ */
+ImageWriter::~ImageWriter()
+{
+    close_image();
+}
+
+
+/**
+ * Метод класса ImageWriter задает число строк в кольце. Действует при
+ * следующем открытии файла.
+ * @param rows: число строк, 0 - кольцо размером около IO_BLOCK_SIZE.
+ */
+void ImageWriter::set_ring_size(unsigned long rows)
+{
+    ring_size = rows;
+}
+
+
+/**
+ * Метод класса ImageWriter задает палитру палитрового изображения.
+ * Строки с цветами заменяются индексами ближайших цветов палитры.
+ * @param colors: цвета палитры;
+ * @param count: число цветов (от 1 до 256).
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageWriter::set_palette(const RGBQuad* colors, unsigned long count)
+{
+    if (count == 0 || count > 256)
+    {
+        std::cout << "Ошибка! Палитра должна содержать от 1 до 256 " <<
+            "цветов.\n";
+        return 0;
+    }
+    memset(palette, 0, sizeof(palette));
+    memcpy(palette, colors, count * sizeof(RGBQuad));
+    colors_num = count;
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageWriter задает порядок строк файла. Действует при
+ * следующем открытии файла. Строки сверху вниз удобны источникам,
+ * которые получают изображение начиная с верхней строки: их не нужно
+ * собирать в памяти, чтобы записать в обратном порядке.
+ * @param enabled: если true, строки принимаются и записываются сверху
+ * вниз.
+ */
+void ImageWriter::set_top_down(bool enabled)
+{
+    top_down = enabled;
+}
+
+
+/**
+ * Метод класса ImageWriter создает BMP файл, записывает заголовки и
+ * палитру и выделяет кольцо строк. Для глубины 1, 4 и 8 бит палитра
+ * должна быть задана заранее методом set_palette.
+ * @param filename: имя файла;
+ * @param width: ширина изображения;
+ * @param height: высота изображения;
+ * @param bit_count: глубина цвета (1, 4, 8, 16, 24 или 32).
+ * @return: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageWriter::open_image(const char* filename, unsigned long width,
+    unsigned long height, unsigned short bit_count)
+{
+    close_image();
+    codec = get_format_codec(bit_count);
+    if (!codec)
+    {
+        std::cout << "Ошибка! Глубина цвета должна быть 1, 4, 8, 16, " <<
+            "24 или 32 бит.\n";
+        return 0;
+    }
+    unsigned long palette_size = 0;
+    if (bit_count <= 8)
+    {
+        if (colors_num == 0 || colors_num > (1UL << bit_count))
+        {
+            std::cout << "Ошибка! Палитра не подходит к глубине цвета " <<
+                "изображения.\n";
+            return 0;
+        }
+        palette_size = colors_num;
+    }
+    // Размеры проверяются так же, как при чтении: строка, поле пикселей
+    // и весь файл должны помещаться в 32-битные поля заголовков
+    std::uint64_t file_row_size = get_bmp_row_size(width, bit_count);
+    std::uint64_t offset_data = sizeof(BMPFileHeader) +
+        sizeof(BMPInfoHeader) + palette_size * sizeof(RGBQuad);
+    if (width > PROBE_MAX_SIZE || height > PROBE_MAX_SIZE ||
+        file_row_size > PROBE_MAX_SIZE ||
+        offset_data + file_row_size * height > 0xFFFFFFFF)
+    {
+        std::cout << "Ошибка! Размеры изображения не помещаются в " <<
+            "заголовки BMP файла.\n";
+        return 0;
+    }
+    file = open_file(filename, "wb");
+    if (!file)
+    {
+        // Если файл не был открыт
+        std::cout << "Ошибка! Не удалось открыть файл '" << filename <<
+            "'.\n";
+        return 0;
+    }
+    row_size = (unsigned long)file_row_size;
+    bmp_info_header = BMPInfoHeader();
+    bmp_info_header.size = sizeof(BMPInfoHeader);
+    bmp_info_header.width = width;
+    bmp_info_header.height = height;
+    bmp_info_header.bit_count = bit_count;
+    bmp_info_header.colors_used = palette_size;
+    bmp_info_header.size_image = row_size * height;
+    file_header = BMPFileHeader();
+    file_header.offset_data = (unsigned long)offset_data;
+    file_header.file_size = file_header.offset_data +
+        bmp_info_header.size_image;
+    BMPInfoHeader info_header = get_file_info_header(bmp_info_header,
+        top_down);
+    bool written = fwrite(&file_header, sizeof(BMPFileHeader), 1,
+        file) == 1 &&
+        fwrite(&info_header, sizeof(BMPInfoHeader), 1, file) == 1 &&
+        fwrite(palette, sizeof(RGBQuad), palette_size, file) == palette_size;
+    if (!written)
+    {
+        // Сообщение об ошибке выводит close_image
+        failed = true;
+        close_image();
+        return 0;
+    }
+    if (palette_size)
+    {
+        lookup = new PaletteLookup(palette, palette_size);
+        row_indices = new unsigned char[width ? width : 1];
+        context.palette = palette;
+        context.lookup = lookup;
+        context.indices = row_indices;
+    }
+    ring_rows = get_ring_rows(ring_size, width * sizeof(RGBTriple), height);
+    ring = new RGBTriple[(size_t)ring_rows * width];
+    block = new unsigned char[(size_t)ring_rows * row_size];
+    // Байты выравнивания строк остаются нулевыми
+    memset(block, 0, (size_t)ring_rows * row_size);
+    ring_count = 0;
+    rows_written = 0;
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageWriter преобразует строки кольца в формат файла и
+ * записывает их одним вызовом fwrite. Неполная запись отмечается
+ * признаком failed.
+ */
+void ImageWriter::flush()
+{
+    for (unsigned long k = 0; k < ring_count; k++)
+    {
+        codec->encode_row(&ring[(size_t)k * bmp_info_header.width],
+            block + (size_t)k * row_size, bmp_info_header.width, context);
+    }
+    if (row_size != 0 &&
+        fwrite(block, row_size, ring_count, file) != ring_count)
+    {
+        failed = true;
+    }
+    ring_count = 0;
+}
+
+
+/**
+ * Метод класса ImageWriter возвращает свободную строку кольца. Если
+ * кольцо заполнено, его строки сначала записываются в файл.
+ * @return: указатель на строку или nullptr, если все строки приняты или
+ * запись в файл не удалась.
+ */
+RGBTriple* ImageWriter::next_slot()
+{
+    if (!file || failed || rows_written >= bmp_info_header.height)
+    {
+        return nullptr;
+    }
+    if (ring_count == ring_rows)
+    {
+        flush();
+        if (failed)
+        {
+            return nullptr;
+        }
+    }
+    return &ring[(size_t)ring_count * bmp_info_header.width];
+}
+
+
+/**
+ * Метод класса ImageWriter принимает следующую строку изображения.
+ * @param row: строка из width пикселей.
+ * @return: 0, если все строки уже приняты, файл не открыт или запись в
+ * файл не удалась.
+ */
+int ImageWriter::write_row(const RGBTriple* row)
+{
+    RGBTriple* slot = next_slot();
+    if (!slot)
+    {
+        return 0;
+    }
+    memcpy(slot, row, bmp_info_header.width * sizeof(RGBTriple));
+    ring_count++;
+    rows_written++;
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageWriter получает оставшиеся строки от функции. Функция
+ * заполняет строку прямо в кольце, без лишнего копирования.
+ * @param func: функция, получающая номер строки и строку для
+ * заполнения; если она возвращает false, строка не принимается и запись
+ * прекращается.
+ * @return: число принятых строк.
+ */
+unsigned long ImageWriter::write_rows(
+    const std::function<bool(unsigned long, RGBTriple*)>& func)
+{
+    unsigned long count = 0;
+    RGBTriple* slot;
+    while ((slot = next_slot()) != nullptr)
+    {
+        if (!func(rows_written, slot))
+        {
+            break;
+        }
+        ring_count++;
+        rows_written++;
+        count++;
+    }
+    return count;
+}
+
+
+/**
+ * Метод класса ImageWriter записывает строки из кольца и закрывает
+ * файл. Недостающие строки заполняются нулями, чтобы файл оставался
+ * корректным. Только этот метод сообщает, что файл записан целиком:
+ * ошибки записи строк и закрытия файла накапливаются до него.
+ * @return: 0, если были приняты не все строки или запись не удалась.
+ */
+int ImageWriter::close_image()
+{
+    int result = 1;
+    if (file)
+    {
+        if (!failed)
+        {
+            flush();
+        }
+        unsigned long height = bmp_info_header.height;
+        if (rows_written < height)
+        {
+            memset(block, 0, (size_t)ring_rows * row_size);
+            for (; rows_written < height && !failed; rows_written++)
+            {
+                if (row_size != 0 && fwrite(block, row_size, 1, file) != 1)
+                {
+                    failed = true;
+                }
+            }
+            result = 0;
+        }
+        if (fclose(file) != 0)
+        {
+            failed = true;
+        }
+        if (failed)
+        {
+            std::cout << "Ошибка! Не удалось записать BMP файл.\n";
+            result = 0;
+        }
+    }
+    delete lookup;
+    delete[] row_indices;
+    delete[] ring;
+    delete[] block;
+    file = nullptr;
+    lookup = nullptr;
+    row_indices = nullptr;
+    codec = nullptr;
+    context = RowContext();
+    ring = nullptr;
+    block = nullptr;
+    ring_rows = 0;
+    ring_count = 0;
+    failed = false;
+    return result;
+}
+
+
+/**
+ * Метод класса ImageWriter возвращает номер следующей строки.
+ * @return: номер строки.
+ */
+unsigned long ImageWriter::get_row_number() const
+{
+    return rows_written;
+}
+
+
+/**
+ * Метод класса ImageWriter возвращает число строк в кольце.
+ * @return: число строк.
+ */
+unsigned long ImageWriter::get_ring_size() const
+{
+    return ring_rows;
+}
+
+#endif
@@ -0,0 +1,263 @@
+/*
+Модуль image_transform.h содержит определение класса ImageTransform -
+поворотов изображения на 90, 180 и 270 градусов, отражений и
+транспонирования. Повороты на 90 и 270 градусов и транспонирование
+переставляют строки и столбцы, поэтому обрабатываются квадратными
+плитками, которые помещаются в кэш: строки источника, прочитанные для
+одной строки результата, остаются в кэше для следующих строк.
+*/
+
+#pragma once
+#ifndef IMAGE_TRANSFORM_H
+#define IMAGE_TRANSFORM_H
+
+#include <cstddef>
+#include <cstring>
+#include "image.h"
+#include "image_region.h"
+#include "thread_pool.h"
+
+
+/**
+ * Преобразования изображения. Повороты считаются по часовой стрелке на
+ * экране, где верхняя строка изображения показывается сверху.
+ */
+enum TransformType
+{
+    // Поворот на 90 градусов
+    TRANSFORM_ROTATE_90 = 0,
+    // Поворот на 180 градусов
+    TRANSFORM_ROTATE_180 = 1,
+    // Поворот на 270 градусов (на 90 градусов против часовой стрелки)
+    TRANSFORM_ROTATE_270 = 2,
+    // Отражение слева направо
+    TRANSFORM_FLIP_HORIZONTAL = 3,
+    // Отражение сверху вниз
+    TRANSFORM_FLIP_VERTICAL = 4,
+    // Отражение относительно диагонали из левого верхнего угла
+    TRANSFORM_TRANSPOSE = 5
+};
+
+
+// Сторона плитки в пикселях при перестановке строк и столбцов. Плитки
+// источника и результата вместе занимают 24 КБ и помещаются в кэш L1
+const unsigned long TRANSFORM_TILE = 64;
+
+
+/**
+ * Функция переставляет строки и столбцы плитки: строка i результата
+ * составляется из столбца i источника. Источник задается первым
+ * пикселем и шагами между строками и между соседними пикселями строки,
+ * отрицательные шаги отражают источник.
+ * @param src: пиксель источника в строке 0 и столбце 0;
+ * @param src_stride: шаг между строками источника в пикселях;
+ * @param src_step: шаг между пикселями строки источника;
+ * @param dst: первый пиксель плитки результата;
+ * @param dst_stride: шаг между строками результата в пикселях;
+ * @param rows: число строк результата (столбцов источника);
+ * @param columns: число столбцов результата (строк источника).
+ */
+void transpose_tile(const RGBTriple* src, ptrdiff_t src_stride,
+    ptrdiff_t src_step, RGBTriple* dst, ptrdiff_t dst_stride,
+    unsigned long rows, unsigned long columns)
+{
+    for (unsigned long i = 0; i < rows; i++)
+    {
+        // Цикл для прохода по строкам результата
+        const RGBTriple* column = src + (ptrdiff_t)i * src_step;
+        RGBTriple* row = dst + (ptrdiff_t)i * dst_stride;
+        for (unsigned long j = 0; j < columns; j++)
+        {
+            row[j] = column[(ptrdiff_t)j * src_stride];
+        }
+    }
+}
+
+
+/**
+ * Функция копирует плитку пикселей без перестановки строк и столбцов.
+ * Строки источника с шагом 1 между пикселями копируются целиком, с
+ * шагом -1 - в обратном порядке.
+ * @param src: пиксель источника в строке 0 и столбце 0;
+ * @param src_stride: шаг между строками источника в пикселях;
+ * @param src_step: шаг между пикселями строки источника (1 или -1);
+ * @param dst: первый пиксель плитки результата;
+ * @param dst_stride: шаг между строками результата в пикселях;
+ * @param rows: число строк;
+ * @param columns: число столбцов.
+ */
+void copy_tile(const RGBTriple* src, ptrdiff_t src_stride,
+    ptrdiff_t src_step, RGBTriple* dst, ptrdiff_t dst_stride,
+    unsigned long rows, unsigned long columns)
+{
+    for (unsigned long i = 0; i < rows; i++)
+    {
+        // Цикл для прохода по строкам плитки
+        const RGBTriple* src_row = src + (ptrdiff_t)i * src_stride;
+        RGBTriple* row = dst + (ptrdiff_t)i * dst_stride;
+        if (src_step == 1)
+        {
+            memcpy(row, src_row, columns * sizeof(RGBTriple));
+            continue;
+        }
+        for (unsigned long j = 0; j < columns; j++)
+        {
+            row[j] = src_row[-(ptrdiff_t)j];
+        }
+    }
+}
+
+
+/**
+ * Класс поворотов, отражений и транспонирования изображения или его
+ * прямоугольника. Результат - новое изображение, исходное изображение не
+ * меняется. Отражение сверху вниз без копирования дает метод
+ * ImageRegion::flip_vertical.
+ */
+class ImageTransform
+{
+protected:
+    // Исходные пиксели
+    ImageRegion source;
+    // Число потоков для обработки плиток
+    unsigned threads;
+
+public:
+    // Конструктор класса, обрабатывающий все изображение
+    ImageTransform(const Image&);
+    // Конструктор класса, обрабатывающий прямоугольник изображения
+    ImageTransform(const ImageRegion&);
+    // Метод задает число потоков для обработки плиток
+    void set_threads(unsigned);
+    // Метод выполняет преобразование и возвращает новое изображение
+    Image run(TransformType) const;
+};
+
+
+/**
+ * Конструктор класса ImageTransform, обрабатывающий все изображение.
+ * @param image: исходное изображение.
+ */
+ImageTransform::ImageTransform(const Image& image) :
+    ImageTransform(ImageRegion(image))
+{
+}
+
+
+/**
+ * Конструктор класса ImageTransform, обрабатывающий прямоугольник
+ * изображения. Изображение должно существовать, пока существует
+ * преобразование.
+ * @param region: прямоугольник изображения.
+ */
+ImageTransform::ImageTransform(const ImageRegion& region)
+{
+    source = region;
+    threads = 1;
+}
+
+
+/**
+ * Метод класса ImageTransform задает число потоков для обработки плиток.
+ * @param threads_num: число потоков (0 - по числу ядер процессора).
+ */
+void ImageTransform::set_threads(unsigned threads_num)
+{
+    threads = threads_num ? threads_num : get_hardware_threads();
+}
+
+
+/**
+ * Метод класса ImageTransform выполняет преобразование. Каждое
+ * преобразование сводится к чтению источника с отраженными строками
+ * и (или) столбцами, при поворотах на 90 и 270 градусов и
+ * транспонировании - с перестановкой строк и столбцов плитками.
+ * Строки изображения хранятся снизу вверх, поэтому поворот на 90
+ * градусов по часовой стрелке на экране читает столбцы справа налево.
+ * @param type: преобразование.
+ * @return: новое изображение или пустое изображение, если источник
+ * пуст.
+ */
+Image ImageTransform::run(TransformType type) const
+{
+    Image image;
+    if (source.is_empty())
+    {
+        return image;
+    }
+    unsigned long width = source.get_width();
+    unsigned long height = source.get_height();
+    bool transposed = type == TRANSFORM_ROTATE_90 ||
+        type == TRANSFORM_ROTATE_270 || type == TRANSFORM_TRANSPOSE;
+    bool flip_rows = type == TRANSFORM_ROTATE_180 ||
+        type == TRANSFORM_ROTATE_270 || type == TRANSFORM_FLIP_VERTICAL ||
+        type == TRANSFORM_TRANSPOSE;
+    bool flip_columns = type == TRANSFORM_ROTATE_90 ||
+        type == TRANSFORM_ROTATE_180 || type == TRANSFORM_FLIP_HORIZONTAL ||
+        type == TRANSFORM_TRANSPOSE;
+    unsigned long result_width = transposed ? height : width;
+    unsigned long result_height = transposed ? width : height;
+    image.bmp_info_header.size = sizeof(BMPInfoHeader);
+    image.bmp_info_header.width = result_width;
+    image.bmp_info_header.height = result_height;
+    image.bmp_info_header.bit_count = source.get_bit_count();
+    image.masks = source.get_bit_masks();
+    image.update_headers(0);
+    image.allocate_data((size_t)result_width * result_height);
+    // Отраженный источник: пиксель в строке 0 и столбце 0 и шаги
+    const RGBTriple* base = source.get_row(flip_rows ? height - 1 : 0);
+    ptrdiff_t row_step = flip_rows ? -source.get_stride() :
+        source.get_stride();
+    ptrdiff_t column_step = 1;
+    if (flip_columns)
+    {
+        base += width - 1;
+        column_step = -1;
+    }
+    // Без перестановки строки копируются полосами во всю ширину
+    unsigned long tile_width = transposed ? TRANSFORM_TILE : result_width;
+    unsigned long columns = (result_width + tile_width - 1) / tile_width;
+    unsigned long rows = (result_height + TRANSFORM_TILE - 1) /
+        TRANSFORM_TILE;
+    size_t tiles = (size_t)columns * rows;
+    RGBTriple* data = image.data;
+    auto body = [&](size_t first, size_t last)
+    {
+        for (size_t t = first; t < last; t++)
+        {
+            // Цикл для прохода по плиткам части
+            unsigned long row = (unsigned long)(t / columns) *
+                TRANSFORM_TILE;
+            unsigned long column = (unsigned long)(t % columns) * tile_width;
+            unsigned long rows_num = result_height - row < TRANSFORM_TILE ?
+                result_height - row : TRANSFORM_TILE;
+            unsigned long columns_num = result_width - column < tile_width ?
+                result_width - column : tile_width;
+            RGBTriple* dst = data + (size_t)row * result_width + column;
+            if (transposed)
+            {
+                // Строка результата i - столбец i отраженного источника
+                transpose_tile(base + (ptrdiff_t)column * row_step +
+                    (ptrdiff_t)row * column_step, row_step, column_step,
+                    dst, result_width, rows_num, columns_num);
+            }
+            else
+            {
+                copy_tile(base + (ptrdiff_t)row * row_step +
+                    (ptrdiff_t)column * column_step, row_step, column_step,
+                    dst, result_width, rows_num, columns_num);
+            }
+        }
+    };
+    if (threads <= 1 || tiles < 2)
+    {
+        body(0, tiles);
+    }
+    else
+    {
+        get_thread_pool().parallel_for(0, tiles, 1, body);
+    }
+    return image;
+}
+
+#endif
@@ -0,0 +1,428 @@
+/*
+Модуль image_view.h содержит определение класса ImageView, дающего доступ
+только для чтения к пикселям BMP изображения через отображение файла в
+память без копирования.
+*/
+
+#pragma once
+#ifndef IMAGE_VIEW_H
+#define IMAGE_VIEW_H
+
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "image.h"
+#include "rle_codec.h"
+
+
+/**
+ * Класс для чтения BMP изображения, отображенного в память. Строки
+ * 24-битного изображения указывают прямо в отображение файла, для
+ * остальных форматов пиксели копируются в собственный буфер.
+ */
+class ImageView
+{
+protected:
+    // Параметр для хранения заголовка файла
+    BMPFileHeader file_header;
+    // Параметр для хранения заголовка изображения
+    BMPInfoHeader bmp_info_header;
+    // Начало отображения файла в память
+    const unsigned char* mapping;
+    // Размер отображения в байтах
+    size_t mapping_size;
+#ifdef _WIN32
+    // Дескриптор отображения файла
+    HANDLE mapping_handle;
+#endif
+    // Указатель на нижнюю строку пикселей
+    const unsigned char* pixels;
+    // Шаг между строками пикселей в байтах, отрицательный у файла со
+    // строками сверху вниз
+    ptrdiff_t stride;
+    // Копия пикселей, если формат файла не совпадает с RGBTriple
+    RGBTriple* copy;
+
+public:
+    // Конструктор класса без параметров
+    ImageView();
+    // Конструктор класса, отображающий в память BMP файл
+    ImageView(const char*);
+    // Деструктор класса
+    ~ImageView();
+    // Метод отображает в память BMP файл
+    int open_image(const char*);
+    // Метод закрывает отображение файла
+    void close_image();
+    // Метод определяет, указывают ли строки прямо в отображение файла
+    bool is_borrowed() const;
+    // Метод возвращает ширину изображения
+    unsigned long get_width() const;
+    // Метод возвращает высоту изображения
+    unsigned long get_height() const;
+    // Метод возвращает строку пикселей
+    const RGBTriple* get_row(unsigned long) const;
+    // Метод возвращает пиксель по номерам строки и столбца
+    const RGBTriple& get_pixel(unsigned long, unsigned long) const;
+
+private:
+    // Копировать отображение нельзя
+    ImageView(const ImageView&);
+    ImageView& operator = (const ImageView&);
+    // Метод отображает файл в память
+    bool map_file(const char*);
+    // Метод снимает отображение файла
+    void unmap_file();
+    // Метод преобразует пиксели, не совпадающие с RGBTriple, в буфер
+    void copy_data(const BitMasks&, const RGBQuad*);
+};
+
+
+/**
+ * Конструктор класса ImageView без параметров. Создает пустое
+ * представление.
+ */
+ImageView::ImageView()
+{
+    mapping = nullptr;
+    mapping_size = 0;
+#ifdef _WIN32
+    mapping_handle = nullptr;
+#endif
+    pixels = nullptr;
+    stride = 0;
+    copy = nullptr;
+}
+
+
+/**
+ * Конструктор класса ImageView, отображающий в память BMP файл.
+ * @param filename: имя файла с изображением.
+ */
+ImageView::ImageView(const char* filename) : ImageView()
+{
+    open_image(filename);
+}
+
+
+/**
+ * Деструктор класса ImageView.
+ */
+ImageView::~ImageView()
+{
+    close_image();
+}
+
+
+/**
+ * Метод класса ImageView отображает файл в память.
+ * @param filename: имя файла.
+ * @return: true, если файл отображен, иначе false.
+ */
+bool ImageView::map_file(const char* filename)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ,
+        nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+    mapping_handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0,
+        nullptr);
+    // Отображение держит файл открытым само
+    CloseHandle(file);
+    if (!mapping_handle)
+    {
+        return false;
+    }
+    mapping = (const unsigned char*)MapViewOfFile(mapping_handle,
+        FILE_MAP_READ, 0, 0, 0);
+    if (!mapping)
+    {
+        CloseHandle(mapping_handle);
+        mapping_handle = nullptr;
+        return false;
+    }
+    mapping_size = (size_t)size.QuadPart;
+#else
+    int file = open(filename, O_RDONLY);
+    if (file < 0)
+    {
+        return false;
+    }
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0)
+    {
+        ::close(file);
+        return false;
+    }
+    void* address = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED,
+        file, 0);
+    // Отображение держит файл открытым само
+    ::close(file);
+    if (address == MAP_FAILED)
+    {
+        return false;
+    }
+    mapping = (const unsigned char*)address;
+    mapping_size = (size_t)info.st_size;
+#endif
+    return true;
+}
+
+
+/**
+ * Метод класса ImageView отображает в память BMP файл и проверяет его
+ * заголовки. Для 24-битных несжатых изображений строки указывают прямо
+ * в отображение, остальные форматы, в том числе палитровые и сжатые
+ * RLE, преобразуются в буфер функциями формата.
+ * @param filename: имя файла с изображением.
+ * @returm: 0, если при выполнении функции произошла ошибка.
+ */
+int ImageView::open_image(const char* filename)
+{
+    close_image();
+    if (!map_file(filename))
+    {
+        // Если файл не был отображен
+        std::cout << "Ошибка! Не удалось открыть файл '" <<
+            filename << "'.\n";
+        return 0;
+    }
+    if (mapping_size < sizeof(BMPFileHeader) + sizeof(BMPInfoHeader))
+    {
+        close_image();
+        std::cout << "Ошибка! Файл не имеет требуемый BMP формат.\n";
+        return 0;
+    }
+    // Копируем заголовки из отображения
+    memcpy(&file_header, mapping, sizeof(BMPFileHeader));
+    memcpy(&bmp_info_header, mapping + sizeof(BMPFileHeader),
+        sizeof(BMPInfoHeader));
+    // Заголовки проверяются по размеру отображения до того, как по ним
+    // вычисляются адреса строк
+    ImageInfo info;
+    const char* error = check_image_headers(file_header, bmp_info_header,
+        mapping_size, info);
+    if (error)
+    {
+        close_image();
+        std::cout << "Ошибка! Файл '" << filename << "': " << error << "\n";
+        return 0;
+    }
+    bool top_down = read_top_down(bmp_info_header);
+    unsigned short bit_count = bmp_info_header.bit_count;
+    RGBQuad palette[256];
+    memset(palette, 0, sizeof(palette));
+    if (bit_count <= 8)
+    {
+        // Палитра следует сразу за заголовком изображения и по проверке
+        // заголовков лежит перед полем пикселей
+        memcpy(palette, mapping + sizeof(BMPFileHeader) +
+            bmp_info_header.size, info.colors_num * sizeof(RGBQuad));
+    }
+    BitMasks masks = get_default_masks(bit_count);
+    if (bmp_info_header.compression == COMPRESSION_BITFIELDS)
+    {
+        // Маски каналов следуют за первыми 40 байтами заголовка
+        size_t offset = sizeof(BMPFileHeader) + sizeof(BMPInfoHeader);
+        if (mapping_size >= offset + sizeof(BitMasks))
+        {
+            memcpy(&masks, mapping + offset, sizeof(BitMasks));
+        }
+        if (!check_bit_masks(masks, bit_count))
+        {
+            close_image();
+            std::cout << "Ошибка! Маски каналов изображения не " <<
+                "подходят к глубине цвета.\n";
+            return 0;
+        }
+    }
+    // Строки в файле дополняются байтами до кратности 4, массив
+    // пикселей помещается в файл по проверке заголовков
+    size_t row_size = (size_t)get_bmp_row_size(bmp_info_header.width,
+        bit_count);
+    pixels = mapping + file_header.offset_data;
+    stride = (ptrdiff_t)row_size;
+    if (top_down && bmp_info_header.height > 0)
+    {
+        // Нижняя строка файла со строками сверху вниз идет последней,
+        // строки нумеруются снизу вверх отрицательным шагом
+        pixels += (bmp_info_header.height - 1) * row_size;
+        stride = -stride;
+    }
+    unsigned char* indices = nullptr;
+    if (info.compression == COMPRESSION_RLE8 ||
+        info.compression == COMPRESSION_RLE4)
+    {
+        // Сжатые строки сначала распаковываются в строки индексов
+        // формата несжатого файла, сжатые файлы хранятся снизу вверх
+        size_t rows_size = row_size * bmp_info_header.height;
+        indices = new unsigned char[rows_size];
+        memset(indices, 0, rows_size);
+        decode_rle(pixels, (size_t)info.data_size, bit_count,
+            bmp_info_header.width, bmp_info_header.height, indices,
+            (unsigned long)row_size);
+        pixels = indices;
+    }
+    if (bit_count != 24)
+    {
+        // Формат файла не совпадает с RGBTriple, копируем пиксели
+        copy_data(masks, palette);
+    }
+    delete[] indices;
+    return 1;
+}
+
+
+/**
+ * Метод класса ImageView преобразует пиксели палитрового, 16- или
+ * 32-битного изображения из отображения или из распакованных строк
+ * индексов в собственный буфер.
+ * @param masks: маски каналов пикселей;
+ * @param palette: палитра из 256 цветов для палитровых изображений.
+ */
+void ImageView::copy_data(const BitMasks& masks, const RGBQuad* palette)
+{
+    unsigned long width = bmp_info_header.width;
+    unsigned long height = bmp_info_header.height;
+    unsigned short bit_count = bmp_info_header.bit_count;
+    const FormatCodec* codec = get_format_codec(bit_count);
+    BitFields fields = make_bit_fields(masks);
+    RowContext context = {};
+    context.fields = &fields;
+    context.palette = palette;
+    RGBTriple* unpack_table = nullptr;
+    if (bit_count == 1 || bit_count == 4)
+    {
+        unpack_table = new RGBTriple[256 * 8];
+        build_unpack_table(palette, bit_count, unpack_table);
+        context.unpack_table = unpack_table;
+    }
+    copy = new RGBTriple[(size_t)width * height];
+    for (unsigned long i = 0; i < height; i++)
+    {
+        // Цикл для прохода по номерам строк пикселей
+        codec->decode_row(pixels + (ptrdiff_t)i * stride,
+            &copy[(size_t)i * width], width, context);
+    }
+    delete[] unpack_table;
+    // Дальше работаем только с копией, отображение больше не нужно
+    unmap_file();
+    pixels = (const unsigned char*)copy;
+    stride = (ptrdiff_t)(width * sizeof(RGBTriple));
+}
+
+
+/**
+ * Метод класса ImageView снимает отображение файла в память.
+ */
+void ImageView::unmap_file()
+{
+    if (mapping)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(mapping);
+        CloseHandle(mapping_handle);
+        mapping_handle = nullptr;
+#else
+        munmap((void*)mapping, mapping_size);
+#endif
+    }
+    mapping = nullptr;
+    mapping_size = 0;
+}
+
+
+/**
+ * Метод класса ImageView закрывает отображение файла и освобождает
+ * копию пикселей.
+ */
+void ImageView::close_image()
+{
+    unmap_file();
+    delete[] copy;
+    pixels = nullptr;
+    stride = 0;
+    copy = nullptr;
+    file_header = BMPFileHeader();
+    bmp_info_header = BMPInfoHeader();
+}
+
+
+/**
+ * Метод класса ImageView определяет, указывают ли строки пикселей
+ * прямо в отображение файла.
+ * @return: true, если пиксели не копировались, иначе false.
+ */
+bool ImageView::is_borrowed() const
+{
+    return mapping != nullptr;
+}
+
+
+/**
+ * Метод класса ImageView возвращает ширину изображения.
+ * @return: ширина в пикселях.
+ */
+unsigned long ImageView::get_width() const
+{
+    return bmp_info_header.width;
+}
+
+
+/**
+ * Метод класса ImageView возвращает высоту изображения.
+ * @return: высота в пикселях.
+ */
+unsigned long ImageView::get_height() const
+{
+    return bmp_info_header.height;
+}
+
+
+/**
+ * Метод класса ImageView возвращает строку пикселей. Строки нумеруются
+ * снизу вверх, как в Image, и у файлов со строками сверху вниз.
+ * @param i: номер строки.
+ * @return: указатель на первый пиксель строки.
+ */
+const RGBTriple* ImageView::get_row(unsigned long i) const
+{
+    return (const RGBTriple*)(pixels + (ptrdiff_t)i * stride);
+}
+
+
+/**
+ * Метод класса ImageView возвращает пиксель изображения.
+ * @param i: номер строки;
+ * @param j: номер столбца.
+ * @return: ссылка на пиксель.
+ */
+const RGBTriple& ImageView::get_pixel(unsigned long i, unsigned long j) const
+{
+    return get_row(i)[j];
+}
+
+#endif
@@ -0,0 +1,444 @@
+/*
+Модуль palette_quantizer.h содержит построение палитры по цветам
+изображения (медианное сечение) и класс PaletteLookup для быстрого поиска
+ближайшего цвета палитры через трехмерную таблицу.
+*/
+
+#pragma once
+#ifndef PALETTE_QUANTIZER_H
+#define PALETTE_QUANTIZER_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "bmp_format.h"
+
+
+// Число бит на канал в ячейках гистограммы и таблицы поиска
+const int QUANT_BITS = 5;
+// Число значений канала в ячейках
+const int QUANT_SIDE = 1 << QUANT_BITS;
+// Число слотов хеш-таблицы точных цветов палитры
+const unsigned long EXACT_SLOTS = 1024;
+// Значение незаполненной ячейки куба и свободного слота хеш-таблицы
+const unsigned short CELL_EMPTY = 0xFFFF;
+
+
+/**
+ * Функция возвращает номер ячейки цвета в кубе QUANT_SIDE^3.
+ * @param color: цвет.
+ * @return: номер ячейки.
+ */
+unsigned long get_cell(const RGBTriple& color)
+{
+    const int shift = 8 - QUANT_BITS;
+    return ((unsigned long)(color.red >> shift) << (2 * QUANT_BITS)) |
+        ((unsigned long)(color.green >> shift) << QUANT_BITS) |
+        (color.blue >> shift);
+}
+
+
+/**
+ * Функция возвращает номер слота хеш-таблицы для цвета.
+ * @param key: цвет, упакованный в 24 бита.
+ * @return: номер слота.
+ */
+unsigned long get_exact_slot(std::uint32_t key)
+{
+    return (unsigned long)((key * 2654435761u) >> 22) & (EXACT_SLOTS - 1);
+}
+
+
+/**
+ * Функция упаковывает цвет в 24-битный ключ.
+ * @param color: цвет.
+ * @return: ключ.
+ */
+std::uint32_t get_color_key(const RGBTriple& color)
+{
+    return color.blue | ((std::uint32_t)color.green << 8) |
+        ((std::uint32_t)color.red << 16);
+}
+
+
+/**
+ * Функция собирает различные цвета изображения, если их не больше
+ * заданного числа. Такие изображения сохраняются с палитрой без потерь.
+ * @param pixels: пиксели изображения;
+ * @param count: число пикселей;
+ * @param colors_num: наибольшее число цветов;
+ * @param palette: палитра для найденных цветов.
+ * @return: число цветов или 0, если цветов больше colors_num.
+ */
+unsigned long collect_exact_colors(const RGBTriple* pixels, size_t count,
+    unsigned long colors_num, RGBQuad* palette)
+{
+    std::uint32_t keys[EXACT_SLOTS];
+    bool used[EXACT_SLOTS] = {};
+    unsigned long found = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        std::uint32_t key = get_color_key(pixels[i]);
+        unsigned long slot = get_exact_slot(key);
+        while (used[slot] && keys[slot] != key)
+        {
+            slot = (slot + 1) & (EXACT_SLOTS - 1);
+        }
+        if (used[slot])
+        {
+            continue;
+        }
+        if (found == colors_num)
+        {
+            // Цветов больше, чем помещается в палитру
+            return 0;
+        }
+        used[slot] = true;
+        keys[slot] = key;
+        palette[found++] = { pixels[i].blue, pixels[i].green, pixels[i].red,
+            0 };
+    }
+    return found;
+}
+
+
+/**
+ * Структура для хранения параллелепипеда ячеек в алгоритме медианного
+ * сечения.
+ */
+struct ColorBox
+{
+    // Границы по каналам (включительно): 0 - красный, 1 - зеленый,
+    // 2 - синий
+    int low[3];
+    int high[3];
+    // Число пикселей в параллелепипеде
+    std::uint64_t count;
+};
+
+
+/**
+ * Функция возвращает номер ячейки по координатам каналов.
+ * @param c: координаты (красный, зеленый, синий).
+ * @return: номер ячейки.
+ */
+unsigned long get_cell(const int* c)
+{
+    return ((unsigned long)c[0] << (2 * QUANT_BITS)) |
+        ((unsigned long)c[1] << QUANT_BITS) | c[2];
+}
+
+
+/**
+ * Функция сжимает границы параллелепипеда до занятых ячеек и считает
+ * число пикселей в нем.
+ * @param box: параллелепипед;
+ * @param histogram: число пикселей в каждой ячейке.
+ */
+void shrink_box(ColorBox& box, const std::vector<std::uint32_t>& histogram)
+{
+    int low[3] = { QUANT_SIDE, QUANT_SIDE, QUANT_SIDE };
+    int high[3] = { -1, -1, -1 };
+    box.count = 0;
+    int c[3];
+    for (c[0] = box.low[0]; c[0] <= box.high[0]; c[0]++)
+    {
+        for (c[1] = box.low[1]; c[1] <= box.high[1]; c[1]++)
+        {
+            for (c[2] = box.low[2]; c[2] <= box.high[2]; c[2]++)
+            {
+                std::uint32_t n = histogram[get_cell(c)];
+                if (!n)
+                {
+                    continue;
+                }
+                box.count += n;
+                for (int k = 0; k < 3; k++)
+                {
+                    if (c[k] < low[k])
+                    {
+                        low[k] = c[k];
+                    }
+                    if (c[k] > high[k])
+                    {
+                        high[k] = c[k];
+                    }
+                }
+            }
+        }
+    }
+    if (box.count)
+    {
+        memcpy(box.low, low, sizeof(low));
+        memcpy(box.high, high, sizeof(high));
+    }
+}
+
+
+/**
+ * Функция строит палитру по цветам изображения. Если различных цветов
+ * не больше colors_num, палитра состоит из них самих. Иначе цвета
+ * группируются методом медианного сечения по гистограмме с 5 битами на
+ * канал, и цветом палитры становится средний цвет группы.
+ * @param pixels: пиксели изображения;
+ * @param count: число пикселей;
+ * @param colors_num: наибольшее число цветов палитры;
+ * @param palette: массив для colors_num цветов палитры.
+ * @return: число построенных цветов.
+ */
+unsigned long build_palette(const RGBTriple* pixels, size_t count,
+    unsigned long colors_num, RGBQuad* palette)
+{
+    unsigned long exact = collect_exact_colors(pixels, count, colors_num,
+        palette);
+    if (exact || count == 0)
+    {
+        return exact;
+    }
+    // Гистограмма и суммы каналов по ячейкам для средних цветов
+    const unsigned long cells = 1UL << (3 * QUANT_BITS);
+    std::vector<std::uint32_t> histogram(cells, 0);
+    std::vector<std::uint64_t> sums(cells * 3, 0);
+    for (size_t i = 0; i < count; i++)
+    {
+        unsigned long cell = get_cell(pixels[i]);
+        histogram[cell]++;
+        sums[cell * 3] += pixels[i].red;
+        sums[cell * 3 + 1] += pixels[i].green;
+        sums[cell * 3 + 2] += pixels[i].blue;
+    }
+    std::vector<ColorBox> boxes;
+    ColorBox first = { { 0, 0, 0 }, { QUANT_SIDE - 1, QUANT_SIDE - 1,
+        QUANT_SIDE - 1 }, 0 };
+    shrink_box(first, histogram);
+    boxes.push_back(first);
+    while (boxes.size() < colors_num)
+    {
+        // Делим параллелепипед с наибольшим произведением числа пикселей
+        // на длину самой длинной стороны
+        int best = -1;
+        int axis = 0;
+        std::uint64_t best_score = 0;
+        for (size_t b = 0; b < boxes.size(); b++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                int length = boxes[b].high[k] - boxes[b].low[k];
+                std::uint64_t score = boxes[b].count * length;
+                if (length > 0 && score > best_score)
+                {
+                    best_score = score;
+                    best = (int)b;
+                    axis = k;
+                }
+            }
+        }
+        if (best < 0)
+        {
+            // Все параллелепипеды состоят из одной ячейки
+            break;
+        }
+        // Ищем медиану по выбранной оси
+        ColorBox& box = boxes[best];
+        std::vector<std::uint64_t> slices(QUANT_SIDE, 0);
+        int c[3];
+        for (c[0] = box.low[0]; c[0] <= box.high[0]; c[0]++)
+        {
+            for (c[1] = box.low[1]; c[1] <= box.high[1]; c[1]++)
+            {
+                for (c[2] = box.low[2]; c[2] <= box.high[2]; c[2]++)
+                {
+                    slices[c[axis]] += histogram[get_cell(c)];
+                }
+            }
+        }
+        std::uint64_t half = 0;
+        int split = box.low[axis];
+        for (; split < box.high[axis] - 1; split++)
+        {
+            half += slices[split];
+            if (half * 2 >= box.count)
+            {
+                break;
+            }
+        }
+        ColorBox upper = box;
+        box.high[axis] = split;
+        upper.low[axis] = split + 1;
+        shrink_box(box, histogram);
+        shrink_box(upper, histogram);
+        boxes.push_back(upper);
+    }
+    // Цвет палитры - средний цвет пикселей параллелепипеда
+    for (size_t b = 0; b < boxes.size(); b++)
+    {
+        std::uint64_t total[3] = { 0, 0, 0 };
+        int c[3];
+        for (c[0] = boxes[b].low[0]; c[0] <= boxes[b].high[0]; c[0]++)
+        {
+            for (c[1] = boxes[b].low[1]; c[1] <= boxes[b].high[1]; c[1]++)
+            {
+                for (c[2] = boxes[b].low[2]; c[2] <= boxes[b].high[2];
+                    c[2]++)
+                {
+                    unsigned long cell = get_cell(c);
+                    total[0] += sums[cell * 3];
+                    total[1] += sums[cell * 3 + 1];
+                    total[2] += sums[cell * 3 + 2];
+                }
+            }
+        }
+        std::uint64_t n = boxes[b].count ? boxes[b].count : 1;
+        palette[b].red = (unsigned char)((total[0] + n / 2) / n);
+        palette[b].green = (unsigned char)((total[1] + n / 2) / n);
+        palette[b].blue = (unsigned char)((total[2] + n / 2) / n);
+        palette[b].reserved = 0;
+    }
+    return (unsigned long)boxes.size();
+}
+
+
+/**
+ * Класс для поиска ближайшего цвета палитры. Цвета, совпадающие с цветом
+ * палитры, находятся через хеш-таблицу. Для остальных используется куб
+ * ячеек с 5 битами на канал, в ячейке хранится цвет палитры, ближайший
+ * к ее центру. Ячейки заполняются при первом обращении.
+ */
+class PaletteLookup
+{
+protected:
+    // Палитра
+    const RGBQuad* palette;
+    // Число цветов палитры
+    unsigned long colors_num;
+    // Индекс палитры для каждой ячейки, CELL_EMPTY - еще не вычислен
+    std::vector<unsigned short> cube;
+    // Ключи точных цветов палитры
+    std::uint32_t keys[EXACT_SLOTS];
+    // Индексы точных цветов палитры, CELL_EMPTY - слот свободен
+    unsigned short values[EXACT_SLOTS];
+
+public:
+    // Конструктор класса, подготавливающий поиск по палитре
+    PaletteLookup(const RGBQuad*, unsigned long);
+    // Метод возвращает индекс ближайшего цвета палитры
+    unsigned char find(const RGBTriple&);
+    // Метод заменяет строку пикселей индексами палитры
+    void map_row(const RGBTriple*, unsigned char*, size_t);
+
+private:
+    // Метод ищет цвет палитры, ближайший к центру ячейки
+    unsigned short find_nearest(unsigned long) const;
+};
+
+
+/**
+ * Конструктор класса PaletteLookup. Заполняет хеш-таблицу точных цветов
+ * палитры, куб ячеек заполняется при обращении.
+ * @param palette: палитра;
+ * @param colors_num: число цветов палитры (не больше 256).
+ */
+PaletteLookup::PaletteLookup(const RGBQuad* palette,
+    unsigned long colors_num) : palette(palette), colors_num(colors_num),
+    cube(1UL << (3 * QUANT_BITS), CELL_EMPTY)
+{
+    for (unsigned long i = 0; i < EXACT_SLOTS; i++)
+    {
+        values[i] = CELL_EMPTY;
+    }
+    for (unsigned long i = 0; i < colors_num; i++)
+    {
+        RGBTriple color = { palette[i].blue, palette[i].green,
+            palette[i].red };
+        std::uint32_t key = get_color_key(color);
+        unsigned long slot = get_exact_slot(key);
+        while (values[slot] != CELL_EMPTY && keys[slot] != key)
+        {
+            slot = (slot + 1) & (EXACT_SLOTS - 1);
+        }
+        if (values[slot] == CELL_EMPTY)
+        {
+            // Для повторяющихся цветов палитры остается первый индекс
+            keys[slot] = key;
+            values[slot] = (unsigned short)i;
+        }
+    }
+}
+
+
+/**
+ * Метод класса PaletteLookup ищет цвет палитры, ближайший к центру
+ * ячейки, по евклидову расстоянию.
+ * @param cell: номер ячейки.
+ * @return: индекс цвета палитры.
+ */
+unsigned short PaletteLookup::find_nearest(unsigned long cell) const
+{
+    const int shift = 8 - QUANT_BITS;
+    const int half = 1 << (shift - 1);
+    int red = (int)((cell >> (2 * QUANT_BITS)) << shift) + half;
+    int green = (int)(((cell >> QUANT_BITS) & (QUANT_SIDE - 1)) << shift) +
+        half;
+    int blue = (int)((cell & (QUANT_SIDE - 1)) << shift) + half;
+    unsigned short best = 0;
+    long best_distance = -1;
+    for (unsigned long i = 0; i < colors_num; i++)
+    {
+        long dr = palette[i].red - red;
+        long dg = palette[i].green - green;
+        long db = palette[i].blue - blue;
+        long distance = dr * dr + dg * dg + db * db;
+        if (best_distance < 0 || distance < best_distance)
+        {
+            best_distance = distance;
+            best = (unsigned short)i;
+        }
+    }
+    return best;
+}
+
+
+/**
+ * Метод класса PaletteLookup возвращает индекс ближайшего цвета палитры.
+ * @param color: цвет пикселя.
+ * @return: индекс цвета палитры.
+ */
+unsigned char PaletteLookup::find(const RGBTriple& color)
+{
+    std::uint32_t key = get_color_key(color);
+    unsigned long slot = get_exact_slot(key);
+    while (values[slot] != CELL_EMPTY)
+    {
+        if (keys[slot] == key)
+        {
+            // Цвет есть в палитре
+            return (unsigned char)values[slot];
+        }
+        slot = (slot + 1) & (EXACT_SLOTS - 1);
+    }
+    unsigned long cell = get_cell(color);
+    if (cube[cell] == CELL_EMPTY)
+    {
+        cube[cell] = find_nearest(cell);
+    }
+    return (unsigned char)cube[cell];
+}
+
+
+/**
+ * Метод класса PaletteLookup заменяет строку пикселей индексами
+ * ближайших цветов палитры.
+ * @param src: пиксели строки;
+ * @param dst: массив для индексов;
+ * @param width: число пикселей.
+ */
+void PaletteLookup::map_row(const RGBTriple* src, unsigned char* dst,
+    size_t width)
+{
+    for (size_t j = 0; j < width; j++)
+    {
+        dst[j] = find(src[j]);
+    }
+}
+
+#endif
@@ -0,0 +1,1074 @@
+/*
+Модуль pixel_convert.h содержит функции преобразования строк пикселей
+между форматами BGRA (RGBQuad), BGR (RGBTriple) и индексами палитры,
+расчет яркости и цветоразностей YCbCr пикселей BGR (BT.601 и BT.709), а
+также табличную распаковку и упаковку 1- и 4-битных строк.
+Реализация выбирается во время работы по возможностям процессора:
+AVX2, SSSE3 или обычный скалярный код.
+*/
+
+#pragma once
+#ifndef PIXEL_CONVERT_H
+#define PIXEL_CONVERT_H
+
+#include <cstring>
+#include "bmp_format.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || \
+    defined(__i386__)
+#define IMAGE_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC разрешает векторные инструкции в любой функции, GCC и Clang
+// требуют явно указать набор инструкций для функции
+#if defined(IMAGE_SIMD_X86) && !defined(_MSC_VER)
+#define IMAGE_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define IMAGE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define IMAGE_TARGET_SSSE3
+#define IMAGE_TARGET_AVX2
+#endif
+
+
+/**
+ * Наборы инструкций, для которых есть реализации преобразований.
+ */
+enum SimdLevel
+{
+    SIMD_SCALAR = 0,
+    SIMD_SSSE3 = 1,
+    SIMD_AVX2 = 2
+};
+
+
+/**
+ * Стандарты, веса каналов которых используются для расчета яркости и
+ * цветоразностей.
+ */
+enum LumaStandard
+{
+    // Рекомендация ITU-R BT.601 (JPEG, телевидение стандартной четкости)
+    LUMA_BT601 = 0,
+    // Рекомендация ITU-R BT.709 (телевидение высокой четкости, sRGB)
+    LUMA_BT709 = 1
+};
+
+
+// Веса яркости в 1/256 для синего, зеленого и красного каналов. Сумма
+// весов равна 256, поэтому серый цвет сохраняет яркость
+const unsigned short LUMA_WEIGHTS[2][3] = { { 29, 150, 77 },
+    { 19, 183, 54 } };
+// Веса цветоразностей Cb и Cr в 1/16384 для синего, зеленого и красного
+// каналов. Сумма весов равна 0, поэтому у серого цвета Cb = Cr = 128
+const short CHROMA_WEIGHTS[2][2][3] = {
+    { { 8192, -5427, -2765 }, { -1332, -6860, 8192 } },
+    { { 8192, -6315, -1877 }, { -751, -7441, 8192 } }
+};
+// Число двоичных знаков дробной части весов цветоразностей
+const int CHROMA_SHIFT = 14;
+
+
+/**
+ * Структура с указателями на функции преобразования строк пикселей для
+ * выбранного набора инструкций.
+ */
+struct PixelKernels
+{
+    // Преобразование BGRA -> BGR
+    void (*bgra_to_bgr)(const RGBQuad*, RGBTriple*, size_t);
+    // Преобразование BGR -> BGRA с нулевым четвертым байтом
+    void (*bgr_to_bgra)(const RGBTriple*, RGBQuad*, size_t);
+    // Преобразование индексов палитры -> BGR
+    void (*palette_to_bgr)(const unsigned char*, const RGBQuad*, RGBTriple*,
+        size_t);
+    // Расчет яркости пикселей BGR
+    void (*bgr_to_luma)(const RGBTriple*, unsigned char*, size_t,
+        LumaStandard);
+    // Расчет яркости и цветоразностей пикселей BGR
+    void (*bgr_to_ycbcr)(const RGBTriple*, unsigned char*, unsigned char*,
+        unsigned char*, size_t, LumaStandard);
+    // Набор инструкций реализации
+    SimdLevel level;
+};
+
+
+/**
+ * Функция преобразует пиксели BGRA в BGR скалярным кодом.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей.
+ */
+void bgra_to_bgr_scalar(const RGBQuad* src, RGBTriple* dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i].blue = src[i].blue;
+        dst[i].green = src[i].green;
+        dst[i].red = src[i].red;
+    }
+}
+
+
+/**
+ * Функция преобразует пиксели BGR в BGRA скалярным кодом.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей.
+ */
+void bgr_to_bgra_scalar(const RGBTriple* src, RGBQuad* dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i].blue = src[i].blue;
+        dst[i].green = src[i].green;
+        dst[i].red = src[i].red;
+        dst[i].reserved = 0;
+    }
+}
+
+
+/**
+ * Функция заменяет индексы палитры цветами BGR скалярным кодом.
+ * @param indices: индексы цветов;
+ * @param palette: палитра;
+ * @param dst: массив для результата;
+ * @param count: число пикселей.
+ */
+void palette_to_bgr_scalar(const unsigned char* indices,
+    const RGBQuad* palette, RGBTriple* dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        memcpy(&dst[i], &palette[indices[i]], sizeof(RGBTriple));
+    }
+}
+
+
+/**
+ * Функция считает яркость пикселей BGR скалярным кодом. Яркость
+ * считается целочисленно по весам LUMA_WEIGHTS, для BT.601:
+ * (77 * R + 150 * G + 29 * B + 128) / 256.
+ * @param src: исходные пиксели;
+ * @param dst: массив для яркостей;
+ * @param count: число пикселей;
+ * @param standard: стандарт весов каналов.
+ */
+void bgr_to_luma_scalar(const RGBTriple* src, unsigned char* dst,
+    size_t count, LumaStandard standard)
+{
+    const unsigned short* weights = LUMA_WEIGHTS[standard];
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i] = (unsigned char)((weights[0] * src[i].blue +
+            weights[1] * src[i].green + weights[2] * src[i].red + 128) >> 8);
+    }
+}
+
+
+/**
+ * Функция считает цветоразность пикселя по весам CHROMA_WEIGHTS.
+ * @param px: пиксель;
+ * @param weights: веса синего, зеленого и красного каналов.
+ * @return: цветоразность со смещением 128.
+ */
+unsigned char get_chroma(const RGBTriple& px, const short* weights)
+{
+    int value = (weights[0] * px.blue + weights[1] * px.green +
+        weights[2] * px.red + (128 << CHROMA_SHIFT) +
+        (1 << (CHROMA_SHIFT - 1))) >> CHROMA_SHIFT;
+    return (unsigned char)(value > 255 ? 255 : value);
+}
+
+
+/**
+ * Функция переводит пиксели BGR в плоскости яркости и цветоразностей
+ * YCbCr полного диапазона скалярным кодом. Яркость совпадает с
+ * результатом bgr_to_luma_scalar.
+ * @param src: исходные пиксели;
+ * @param y: массив для яркостей;
+ * @param cb: массив для синих цветоразностей;
+ * @param cr: массив для красных цветоразностей;
+ * @param count: число пикселей;
+ * @param standard: стандарт весов каналов.
+ */
+void bgr_to_ycbcr_scalar(const RGBTriple* src, unsigned char* y,
+    unsigned char* cb, unsigned char* cr, size_t count,
+    LumaStandard standard)
+{
+    bgr_to_luma_scalar(src, y, count, standard);
+    for (size_t i = 0; i < count; i++)
+    {
+        cb[i] = get_chroma(src[i], CHROMA_WEIGHTS[standard][0]);
+        cr[i] = get_chroma(src[i], CHROMA_WEIGHTS[standard][1]);
+    }
+}
+
+
+#ifdef IMAGE_SIMD_X86
+/**
+ * Функция преобразует пиксели BGRA в BGR инструкциями SSSE3. За шаг
+ * обрабатываются 4 пикселя, запись 16 байт захватывает 4 байта
+ * следующего шага, поэтому последние пиксели обрабатываются скалярно.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей.
+ */
+IMAGE_TARGET_SSSE3
+void bgra_to_bgr_ssse3(const RGBQuad* src, RGBTriple* dst, size_t count)
+{
+    const __m128i mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13,
+        14, -1, -1, -1, -1);
+    size_t i = 0;
+    for (; i + 6 <= count; i += 4)
+    {
+        __m128i px = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(px, mask));
+    }
+    bgra_to_bgr_scalar(src + i, dst + i, count - i);
+}
+
+
+/**
+ * Функция преобразует пиксели BGR в BGRA инструкциями SSSE3. За шаг
+ * обрабатываются 4 пикселя, чтение 16 байт захватывает 4 байта
+ * следующего шага.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей.
+ */
+IMAGE_TARGET_SSSE3
+void bgr_to_bgra_ssse3(const RGBTriple* src, RGBQuad* dst, size_t count)
+{
+    const __m128i mask = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8,
+        -1, 9, 10, 11, -1);
+    size_t i = 0;
+    for (; i + 6 <= count; i += 4)
+    {
+        __m128i px = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(px, mask));
+    }
+    bgr_to_bgra_scalar(src + i, dst + i, count - i);
+}
+
+
+/**
+ * Функция заменяет индексы палитры цветами BGR инструкциями SSSE3.
+ * Цвета палитры читаются по одному, а упаковка в BGR выполняется
+ * векторно.
+ * @param indices: индексы цветов;
+ * @param palette: палитра;
+ * @param dst: массив для результата;
+ * @param count: число пикселей.
+ */
+IMAGE_TARGET_SSSE3
+void palette_to_bgr_ssse3(const unsigned char* indices,
+    const RGBQuad* palette, RGBTriple* dst, size_t count)
+{
+    const __m128i mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13,
+        14, -1, -1, -1, -1);
+    const int* colors = (const int*)palette;
+    size_t i = 0;
+    for (; i + 6 <= count; i += 4)
+    {
+        __m128i px = _mm_setr_epi32(colors[indices[i]],
+            colors[indices[i + 1]], colors[indices[i + 2]],
+            colors[indices[i + 3]]);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(px, mask));
+    }
+    palette_to_bgr_scalar(indices + i, palette, dst + i, count - i);
+}
+
+// Маски _mm_shuffle_epi8, собирающие один канал 16 пикселей BGR из трех
+// 16-байтных частей: канал, часть, байты
+const signed char SPLIT_BGR_MASKS[3][3][16] = {
+    {
+        { 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13 }
+    },
+    {
+        { 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14 }
+    },
+    {
+        { 2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15 }
+    }
+};
+
+
+/**
+ * Функция разделяет 16 пикселей BGR на каналы инструкциями SSSE3.
+ * @param src: исходные пиксели (48 байт);
+ * @param channels: массив для синего, зеленого и красного каналов.
+ */
+IMAGE_TARGET_SSSE3
+void split_bgr_ssse3(const RGBTriple* src, __m128i* channels)
+{
+    __m128i parts[3];
+    for (int p = 0; p < 3; p++)
+    {
+        parts[p] = _mm_loadu_si128((const __m128i*)src + p);
+    }
+    for (int c = 0; c < 3; c++)
+    {
+        channels[c] = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(parts[0],
+            _mm_loadu_si128((const __m128i*)SPLIT_BGR_MASKS[c][0])),
+            _mm_shuffle_epi8(parts[1],
+            _mm_loadu_si128((const __m128i*)SPLIT_BGR_MASKS[c][1]))),
+            _mm_shuffle_epi8(parts[2],
+            _mm_loadu_si128((const __m128i*)SPLIT_BGR_MASKS[c][2])));
+    }
+}
+
+
+/**
+ * Функция считает яркость пикселей BGR инструкциями SSSE3. За шаг
+ * обрабатываются 16 пикселей, каналы расширяются до 16 бит: наибольшая
+ * взвешенная сумма 256 * 255 помещается в беззнаковое 16-битное число.
+ * @param src: исходные пиксели;
+ * @param dst: массив для яркостей;
+ * @param count: число пикселей;
+ * @param standard: стандарт весов каналов.
+ */
+IMAGE_TARGET_SSSE3
+void bgr_to_luma_ssse3(const RGBTriple* src, unsigned char* dst,
+    size_t count, LumaStandard standard)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i weights[3];
+    for (int c = 0; c < 3; c++)
+    {
+        weights[c] = _mm_set1_epi16((short)LUMA_WEIGHTS[standard][c]);
+    }
+    const __m128i round = _mm_set1_epi16(128);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i channels[3];
+        split_bgr_ssse3(src + i, channels);
+        __m128i low = round;
+        __m128i high = round;
+        for (int c = 0; c < 3; c++)
+        {
+            low = _mm_add_epi16(low, _mm_mullo_epi16(
+                _mm_unpacklo_epi8(channels[c], zero), weights[c]));
+            high = _mm_add_epi16(high, _mm_mullo_epi16(
+                _mm_unpackhi_epi8(channels[c], zero), weights[c]));
+        }
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(
+            _mm_srli_epi16(low, 8), _mm_srli_epi16(high, 8)));
+    }
+    bgr_to_luma_scalar(src + i, dst + i, count - i, standard);
+}
+
+
+/**
+ * Функция считает цветоразность 8 пикселей инструкциями SSE2. Пары
+ * каналов (синий, зеленый) и (красный, 0) умножаются на пары весов
+ * инструкцией _mm_madd_epi16.
+ * @param blue: синие каналы, расширенные до 16 бит;
+ * @param green: зеленые каналы;
+ * @param red: красные каналы;
+ * @param weights: веса синего, зеленого и красного каналов.
+ * @return: цветоразности со смещением 128 в 16-битных числах.
+ */
+IMAGE_TARGET_SSSE3
+__m128i get_chroma_sse(__m128i blue, __m128i green, __m128i red,
+    const short* weights)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i offset = _mm_set1_epi32((128 << CHROMA_SHIFT) +
+        (1 << (CHROMA_SHIFT - 1)));
+    const __m128i pair = _mm_set1_epi32((int)(((unsigned)weights[1] << 16) |
+        (unsigned short)weights[0]));
+    const __m128i single = _mm_set1_epi32((unsigned short)weights[2]);
+    __m128i low = _mm_add_epi32(_mm_add_epi32(
+        _mm_madd_epi16(_mm_unpacklo_epi16(blue, green), pair),
+        _mm_madd_epi16(_mm_unpacklo_epi16(red, zero), single)), offset);
+    __m128i high = _mm_add_epi32(_mm_add_epi32(
+        _mm_madd_epi16(_mm_unpackhi_epi16(blue, green), pair),
+        _mm_madd_epi16(_mm_unpackhi_epi16(red, zero), single)), offset);
+    return _mm_packs_epi32(_mm_srli_epi32(low, CHROMA_SHIFT),
+        _mm_srli_epi32(high, CHROMA_SHIFT));
+}
+
+
+/**
+ * Функция переводит пиксели BGR в плоскости YCbCr инструкциями SSSE3.
+ * За шаг обрабатываются 16 пикселей.
+ * @param src: исходные пиксели;
+ * @param y: массив для яркостей;
+ * @param cb: массив для синих цветоразностей;
+ * @param cr: массив для красных цветоразностей;
+ * @param count: число пикселей;
+ * @param standard: стандарт весов каналов.
+ */
+IMAGE_TARGET_SSSE3
+void bgr_to_ycbcr_ssse3(const RGBTriple* src, unsigned char* y,
+    unsigned char* cb, unsigned char* cr, size_t count,
+    LumaStandard standard)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i weights[3];
+    for (int c = 0; c < 3; c++)
+    {
+        weights[c] = _mm_set1_epi16((short)LUMA_WEIGHTS[standard][c]);
+    }
+    const __m128i round = _mm_set1_epi16(128);
+    const short* cb_weights = CHROMA_WEIGHTS[standard][0];
+    const short* cr_weights = CHROMA_WEIGHTS[standard][1];
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i channels[3];
+        split_bgr_ssse3(src + i, channels);
+        __m128i lumas[2];
+        __m128i blues[2];
+        __m128i reds[2];
+        for (int h = 0; h < 2; h++)
+        {
+            // Младшие и старшие 8 пикселей расширяются до 16 бит
+            __m128i wide[3];
+            for (int c = 0; c < 3; c++)
+            {
+                wide[c] = h ? _mm_unpackhi_epi8(channels[c], zero) :
+                    _mm_unpacklo_epi8(channels[c], zero);
+            }
+            __m128i sum = round;
+            for (int c = 0; c < 3; c++)
+            {
+                sum = _mm_add_epi16(sum, _mm_mullo_epi16(wide[c],
+                    weights[c]));
+            }
+            lumas[h] = _mm_srli_epi16(sum, 8);
+            blues[h] = get_chroma_sse(wide[0], wide[1], wide[2],
+                cb_weights);
+            reds[h] = get_chroma_sse(wide[0], wide[1], wide[2], cr_weights);
+        }
+        _mm_storeu_si128((__m128i*)(y + i),
+            _mm_packus_epi16(lumas[0], lumas[1]));
+        _mm_storeu_si128((__m128i*)(cb + i),
+            _mm_packus_epi16(blues[0], blues[1]));
+        _mm_storeu_si128((__m128i*)(cr + i),
+            _mm_packus_epi16(reds[0], reds[1]));
+    }
+    bgr_to_ycbcr_scalar(src + i, y + i, cb + i, cr + i, count - i,
+        standard);
+}
+
+
+/**
+ * Функция упаковывает 8 пикселей BGRA из регистра AVX2 в 24 младших
+ * байта регистра.
+ * @param px: пиксели BGRA.
+ * @return: пиксели BGR.
+ */
+IMAGE_TARGET_AVX2
+__m256i pack_bgr_avx2(__m256i px)
+{
+    const __m256i mask = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12,
+        13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1,
+        -1, -1, -1);
+    const __m256i order = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    return _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(px, mask), order);
+}
+
+
+/**
+ * Функция преобразует пиксели BGRA в BGR инструкциями AVX2. За шаг
+ * обрабатываются 8 пикселей, запись 32 байт захватывает 8 байт
+ * следующего шага.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей.
+ */
+IMAGE_TARGET_AVX2
+void bgra_to_bgr_avx2(const RGBQuad* src, RGBTriple* dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 11 <= count; i += 8)
+    {
+        __m256i px = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), pack_bgr_avx2(px));
+    }
+    bgra_to_bgr_ssse3(src + i, dst + i, count - i);
+}
+
+
+/**
+ * Функция преобразует пиксели BGR в BGRA инструкциями AVX2. За шаг
+ * обрабатываются 8 пикселей, чтение 32 байт захватывает 8 байт
+ * следующего шага.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей.
+ */
+IMAGE_TARGET_AVX2
+void bgr_to_bgra_avx2(const RGBTriple* src, RGBQuad* dst, size_t count)
+{
+    const __m256i mask = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8,
+        -1, 9, 10, 11, -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+        -1);
+    // Байты 12..23 переносятся в начало старшей половины регистра
+    const __m256i order = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+    size_t i = 0;
+    for (; i + 11 <= count; i += 8)
+    {
+        __m256i px = _mm256_loadu_si256((const __m256i*)(src + i));
+        px = _mm256_permutevar8x32_epi32(px, order);
+        _mm256_storeu_si256((__m256i*)(dst + i),
+            _mm256_shuffle_epi8(px, mask));
+    }
+    bgr_to_bgra_ssse3(src + i, dst + i, count - i);
+}
+
+
+/**
+ * Функция заменяет индексы палитры цветами BGR инструкциями AVX2.
+ * Цвета палитры собираются инструкцией gather по 8 за шаг.
+ * @param indices: индексы цветов;
+ * @param palette: палитра;
+ * @param dst: массив для результата;
+ * @param count: число пикселей.
+ */
+IMAGE_TARGET_AVX2
+void palette_to_bgr_avx2(const unsigned char* indices,
+    const RGBQuad* palette, RGBTriple* dst, size_t count)
+{
+    const int* colors = (const int*)palette;
+    size_t i = 0;
+    for (; i + 11 <= count; i += 8)
+    {
+        __m256i index = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64((const __m128i*)(indices + i)));
+        __m256i px = _mm256_i32gather_epi32(colors, index, 4);
+        _mm256_storeu_si256((__m256i*)(dst + i), pack_bgr_avx2(px));
+    }
+    palette_to_bgr_ssse3(indices + i, palette, dst + i, count - i);
+}
+
+
+/**
+ * Функция разделяет 32 пикселя BGR на каналы инструкциями AVX2: первые
+ * 16 пикселей попадают в младшие половины регистров, следующие 16 - в
+ * старшие.
+ * @param src: исходные пиксели (96 байт);
+ * @param masks: маски SPLIT_BGR_MASKS, повторенные в обеих половинах;
+ * @param channels: массив для синего, зеленого и красного каналов.
+ */
+IMAGE_TARGET_AVX2
+void split_bgr_avx2(const RGBTriple* src, const __m256i (*masks)[3],
+    __m256i* channels)
+{
+    const __m128i* px = (const __m128i*)src;
+    __m256i parts[3];
+    for (int p = 0; p < 3; p++)
+    {
+        parts[p] = _mm256_inserti128_si256(_mm256_castsi128_si256(
+            _mm_loadu_si128(px + p)), _mm_loadu_si128(px + 3 + p), 1);
+    }
+    for (int c = 0; c < 3; c++)
+    {
+        channels[c] = _mm256_or_si256(_mm256_or_si256(
+            _mm256_shuffle_epi8(parts[0], masks[c][0]),
+            _mm256_shuffle_epi8(parts[1], masks[c][1])),
+            _mm256_shuffle_epi8(parts[2], masks[c][2]));
+    }
+}
+
+
+/**
+ * Функция загружает маски SPLIT_BGR_MASKS в обе половины регистров AVX2.
+ * @param masks: массив для масок.
+ */
+IMAGE_TARGET_AVX2
+void load_split_masks_avx2(__m256i (*masks)[3])
+{
+    for (int c = 0; c < 3; c++)
+    {
+        for (int p = 0; p < 3; p++)
+        {
+            masks[c][p] = _mm256_broadcastsi128_si256(_mm_loadu_si128(
+                (const __m128i*)SPLIT_BGR_MASKS[c][p]));
+        }
+    }
+}
+
+
+/**
+ * Функция считает яркость пикселей BGR инструкциями AVX2. За шаг
+ * обрабатываются 32 пикселя.
+ * @param src: исходные пиксели;
+ * @param dst: массив для яркостей;
+ * @param count: число пикселей;
+ * @param standard: стандарт весов каналов.
+ */
+IMAGE_TARGET_AVX2
+void bgr_to_luma_avx2(const RGBTriple* src, unsigned char* dst,
+    size_t count, LumaStandard standard)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i weights[3];
+    for (int c = 0; c < 3; c++)
+    {
+        weights[c] = _mm256_set1_epi16((short)LUMA_WEIGHTS[standard][c]);
+    }
+    const __m256i round = _mm256_set1_epi16(128);
+    __m256i masks[3][3];
+    load_split_masks_avx2(masks);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i channels[3];
+        split_bgr_avx2(src + i, masks, channels);
+        __m256i low = round;
+        __m256i high = round;
+        for (int c = 0; c < 3; c++)
+        {
+            low = _mm256_add_epi16(low, _mm256_mullo_epi16(
+                _mm256_unpacklo_epi8(channels[c], zero), weights[c]));
+            high = _mm256_add_epi16(high, _mm256_mullo_epi16(
+                _mm256_unpackhi_epi8(channels[c], zero), weights[c]));
+        }
+        // Распаковка и упаковка идут внутри 128-битных половин, поэтому
+        // яркости возвращаются в порядок пикселей
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(
+            _mm256_srli_epi16(low, 8), _mm256_srli_epi16(high, 8)));
+    }
+    bgr_to_luma_scalar(src + i, dst + i, count - i, standard);
+}
+
+
+/**
+ * Функция считает цветоразность 16 пикселей инструкциями AVX2 так же,
+ * как get_chroma_sse.
+ * @param blue: синие каналы, расширенные до 16 бит;
+ * @param green: зеленые каналы;
+ * @param red: красные каналы;
+ * @param weights: веса синего, зеленого и красного каналов.
+ * @return: цветоразности со смещением 128 в 16-битных числах.
+ */
+IMAGE_TARGET_AVX2
+__m256i get_chroma_avx2(__m256i blue, __m256i green, __m256i red,
+    const short* weights)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i offset = _mm256_set1_epi32((128 << CHROMA_SHIFT) +
+        (1 << (CHROMA_SHIFT - 1)));
+    const __m256i pair = _mm256_set1_epi32((int)(((unsigned)weights[1] <<
+        16) | (unsigned short)weights[0]));
+    const __m256i single = _mm256_set1_epi32((unsigned short)weights[2]);
+    __m256i low = _mm256_add_epi32(_mm256_add_epi32(
+        _mm256_madd_epi16(_mm256_unpacklo_epi16(blue, green), pair),
+        _mm256_madd_epi16(_mm256_unpacklo_epi16(red, zero), single)),
+        offset);
+    __m256i high = _mm256_add_epi32(_mm256_add_epi32(
+        _mm256_madd_epi16(_mm256_unpackhi_epi16(blue, green), pair),
+        _mm256_madd_epi16(_mm256_unpackhi_epi16(red, zero), single)),
+        offset);
+    return _mm256_packs_epi32(_mm256_srli_epi32(low, CHROMA_SHIFT),
+        _mm256_srli_epi32(high, CHROMA_SHIFT));
+}
+
+
+/**
+ * Функция переводит пиксели BGR в плоскости YCbCr инструкциями AVX2.
+ * За шаг обрабатываются 32 пикселя.
+ * @param src: исходные пиксели;
+ * @param y: массив для яркостей;
+ * @param cb: массив для синих цветоразностей;
+ * @param cr: массив для красных цветоразностей;
+ * @param count: число пикселей;
+ * @param standard: стандарт весов каналов.
+ */
+IMAGE_TARGET_AVX2
+void bgr_to_ycbcr_avx2(const RGBTriple* src, unsigned char* y,
+    unsigned char* cb, unsigned char* cr, size_t count,
+    LumaStandard standard)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i weights[3];
+    for (int c = 0; c < 3; c++)
+    {
+        weights[c] = _mm256_set1_epi16((short)LUMA_WEIGHTS[standard][c]);
+    }
+    const __m256i round = _mm256_set1_epi16(128);
+    const short* cb_weights = CHROMA_WEIGHTS[standard][0];
+    const short* cr_weights = CHROMA_WEIGHTS[standard][1];
+    __m256i masks[3][3];
+    load_split_masks_avx2(masks);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i channels[3];
+        split_bgr_avx2(src + i, masks, channels);
+        __m256i lumas[2];
+        __m256i blues[2];
+        __m256i reds[2];
+        for (int h = 0; h < 2; h++)
+        {
+            __m256i wide[3];
+            for (int c = 0; c < 3; c++)
+            {
+                wide[c] = h ? _mm256_unpackhi_epi8(channels[c], zero) :
+                    _mm256_unpacklo_epi8(channels[c], zero);
+            }
+            __m256i sum = round;
+            for (int c = 0; c < 3; c++)
+            {
+                sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(wide[c],
+                    weights[c]));
+            }
+            lumas[h] = _mm256_srli_epi16(sum, 8);
+            blues[h] = get_chroma_avx2(wide[0], wide[1], wide[2],
+                cb_weights);
+            reds[h] = get_chroma_avx2(wide[0], wide[1], wide[2],
+                cr_weights);
+        }
+        _mm256_storeu_si256((__m256i*)(y + i),
+            _mm256_packus_epi16(lumas[0], lumas[1]));
+        _mm256_storeu_si256((__m256i*)(cb + i),
+            _mm256_packus_epi16(blues[0], blues[1]));
+        _mm256_storeu_si256((__m256i*)(cr + i),
+            _mm256_packus_epi16(reds[0], reds[1]));
+    }
+    bgr_to_ycbcr_scalar(src + i, y + i, cb + i, cr + i, count - i,
+        standard);
+}
+
+
+/**
+ * Функция определяет лучший набор инструкций, который поддерживают
+ * процессор и операционная система.
+ * @return: набор инструкций.
+ */
+SimdLevel detect_simd_level()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+    __cpuid(info, 1);
+    bool ssse3 = (info[2] & (1 << 9)) != 0;
+    // Регистры AVX должны сохраняться операционной системой
+    bool os_avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 &&
+        (_xgetbv(0) & 6) == 6;
+    bool avx2 = false;
+    if (os_avx && max_leaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    bool ssse3 = __builtin_cpu_supports("ssse3");
+    bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+    if (avx2)
+    {
+        return SIMD_AVX2;
+    }
+    if (ssse3)
+    {
+        return SIMD_SSSE3;
+    }
+    return SIMD_SCALAR;
+}
+#else
+/**
+ * Функция определяет лучший набор инструкций. Векторные реализации есть
+ * только для x86.
+ * @return: набор инструкций.
+ */
+SimdLevel detect_simd_level()
+{
+    return SIMD_SCALAR;
+}
+#endif
+
+
+/**
+ * Функция возвращает таблицу функций преобразования для заданного набора
+ * инструкций.
+ * @param level: набор инструкций.
+ * @return: таблица функций.
+ */
+PixelKernels make_pixel_kernels(SimdLevel level)
+{
+    PixelKernels kernels = { bgra_to_bgr_scalar, bgr_to_bgra_scalar,
+        palette_to_bgr_scalar, bgr_to_luma_scalar, bgr_to_ycbcr_scalar,
+        SIMD_SCALAR };
+#ifdef IMAGE_SIMD_X86
+    if (level == SIMD_AVX2)
+    {
+        kernels = { bgra_to_bgr_avx2, bgr_to_bgra_avx2, palette_to_bgr_avx2,
+            bgr_to_luma_avx2, bgr_to_ycbcr_avx2, SIMD_AVX2 };
+    }
+    else if (level == SIMD_SSSE3)
+    {
+        kernels = { bgra_to_bgr_ssse3, bgr_to_bgra_ssse3,
+            palette_to_bgr_ssse3, bgr_to_luma_ssse3, bgr_to_ycbcr_ssse3,
+            SIMD_SSSE3 };
+    }
+#endif
+    return kernels;
+}
+
+
+/**
+ * Функция возвращает текущую таблицу функций преобразования. При первом
+ * вызове выбирается лучший набор инструкций для процессора.
+ * @return: ссылка на таблицу функций.
+ */
+PixelKernels& get_pixel_kernels()
+{
+    static PixelKernels kernels = make_pixel_kernels(detect_simd_level());
+    return kernels;
+}
+
+
+/**
+ * Функция выбирает набор инструкций для преобразований. Набор, который
+ * не поддерживает процессор, заменяется лучшим доступным.
+ * @param level: желаемый набор инструкций.
+ * @return: выбранный набор инструкций.
+ */
+SimdLevel set_simd_level(SimdLevel level)
+{
+    SimdLevel supported = detect_simd_level();
+    if (level > supported)
+    {
+        level = supported;
+    }
+    get_pixel_kernels() = make_pixel_kernels(level);
+    return level;
+}
+
+
+/**
+ * Функция строит таблицу распаковки байта 1- или 4-битного изображения.
+ * Для каждого из 256 значений байта таблица хранит цвета всех пикселей,
+ * упакованных в этот байт, поэтому распаковка совмещена с палитрой.
+ * @param palette: палитра, в которой есть цвет для каждого индекса;
+ * @param bit_count: глубина цвета (1 или 4);
+ * @param table: таблица на 256 * (8 / bit_count) пикселей.
+ */
+void build_unpack_table(const RGBQuad* palette, unsigned short bit_count,
+    RGBTriple* table)
+{
+    int pixels_per_byte = 8 / bit_count;
+    unsigned char mask = (unsigned char)((1 << bit_count) - 1);
+    for (int byte = 0; byte < 256; byte++)
+    {
+        for (int k = 0; k < pixels_per_byte; k++)
+        {
+            // Старшие биты байта соответствуют левому пикселю
+            int shift = 8 - bit_count * (k + 1);
+            memcpy(&table[byte * pixels_per_byte + k],
+                &palette[(byte >> shift) & mask], sizeof(RGBTriple));
+        }
+    }
+}
+
+
+/**
+ * Функция распаковывает строку 1-битного изображения по таблице. Каждый
+ * байт строки превращается в 8 пикселей одним копированием.
+ * @param src: упакованная строка;
+ * @param table: таблица, построенная build_unpack_table;
+ * @param dst: массив для пикселей строки;
+ * @param width: число пикселей в строке.
+ */
+void unpack_row_1(const unsigned char* src, const RGBTriple* table,
+    RGBTriple* dst, size_t width)
+{
+    size_t bytes = width / 8;
+    for (size_t i = 0; i < bytes; i++)
+    {
+        memcpy(dst + i * 8, table + src[i] * 8, 8 * sizeof(RGBTriple));
+    }
+    // Последний байт заполнен пикселями не полностью
+    size_t rest = width % 8;
+    if (rest)
+    {
+        memcpy(dst + bytes * 8, table + src[bytes] * 8,
+            rest * sizeof(RGBTriple));
+    }
+}
+
+
+/**
+ * Функция распаковывает строку 4-битного изображения по таблице. Каждый
+ * байт строки превращается в 2 пикселя одним копированием.
+ * @param src: упакованная строка;
+ * @param table: таблица, построенная build_unpack_table;
+ * @param dst: массив для пикселей строки;
+ * @param width: число пикселей в строке.
+ */
+void unpack_row_4(const unsigned char* src, const RGBTriple* table,
+    RGBTriple* dst, size_t width)
+{
+    size_t bytes = width / 2;
+    for (size_t i = 0; i < bytes; i++)
+    {
+        memcpy(dst + i * 2, table + src[i] * 2, 2 * sizeof(RGBTriple));
+    }
+    // Последний байт содержит только левый пиксель
+    if (width % 2)
+    {
+        memcpy(dst + bytes * 2, table + src[bytes] * 2, sizeof(RGBTriple));
+    }
+}
+
+
+/**
+ * Функция упаковывает индексы палитры в строку 1-битного изображения.
+ * Неиспользуемые младшие биты последнего байта заполняются нулями.
+ * @param src: индексы (0 или 1), по одному на байт;
+ * @param dst: массив для (width + 7) / 8 байт строки;
+ * @param width: число пикселей в строке.
+ */
+void pack_row_1(const unsigned char* src, unsigned char* dst, size_t width)
+{
+    size_t bytes = width / 8;
+    for (size_t i = 0; i < bytes; i++)
+    {
+        const unsigned char* s = src + i * 8;
+        dst[i] = (unsigned char)((s[0] << 7) | (s[1] << 6) | (s[2] << 5) |
+            (s[3] << 4) | (s[4] << 3) | (s[5] << 2) | (s[6] << 1) | s[7]);
+    }
+    size_t rest = width % 8;
+    if (rest)
+    {
+        unsigned char byte = 0;
+        for (size_t k = 0; k < rest; k++)
+        {
+            byte |= (unsigned char)(src[bytes * 8 + k] << (7 - k));
+        }
+        dst[bytes] = byte;
+    }
+}
+
+
+/**
+ * Функция упаковывает индексы палитры в строку 4-битного изображения.
+ * Младшая половина последнего байта при нечетной ширине равна нулю.
+ * @param src: индексы (от 0 до 15), по одному на байт;
+ * @param dst: массив для (width + 1) / 2 байт строки;
+ * @param width: число пикселей в строке.
+ */
+void pack_row_4(const unsigned char* src, unsigned char* dst, size_t width)
+{
+    size_t bytes = width / 2;
+    for (size_t i = 0; i < bytes; i++)
+    {
+        dst[i] = (unsigned char)((src[i * 2] << 4) | src[i * 2 + 1]);
+    }
+    if (width % 2)
+    {
+        dst[bytes] = (unsigned char)(src[bytes * 2] << 4);
+    }
+}
+
+
+/**
+ * Функция распаковывает строку 4-битного изображения в индексы палитры
+ * по одному на байт.
+ * @param src: строка из (width + 1) / 2 байт;
+ * @param dst: массив для width индексов;
+ * @param width: число пикселей в строке.
+ */
+void unpack_indices_4(const unsigned char* src, unsigned char* dst,
+    size_t width)
+{
+    size_t bytes = width / 2;
+    for (size_t i = 0; i < bytes; i++)
+    {
+        dst[i * 2] = (unsigned char)(src[i] >> 4);
+        dst[i * 2 + 1] = (unsigned char)(src[i] & 0x0F);
+    }
+    if (width % 2)
+    {
+        dst[bytes * 2] = (unsigned char)(src[bytes] >> 4);
+    }
+}
+
+
+/**
+ * Функция преобразует пиксели BGRA в BGR.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей.
+ */
+void convert_bgra_to_bgr(const RGBQuad* src, RGBTriple* dst, size_t count)
+{
+    get_pixel_kernels().bgra_to_bgr(src, dst, count);
+}
+
+
+/**
+ * Функция преобразует пиксели BGR в BGRA с нулевым четвертым байтом.
+ * @param src: исходные пиксели;
+ * @param dst: массив для результата;
+ * @param count: число пикселей.
+ */
+void convert_bgr_to_bgra(const RGBTriple* src, RGBQuad* dst, size_t count)
+{
+    get_pixel_kernels().bgr_to_bgra(src, dst, count);
+}
+
+
+/**
+ * Функция заменяет индексы палитры цветами BGR.
+ * @param indices: индексы цветов;
+ * @param palette: палитра, в которой есть цвет для каждого индекса;
+ * @param dst: массив для результата;
+ * @param count: число пикселей.
+ */
+void convert_palette_to_bgr(const unsigned char* indices,
+    const RGBQuad* palette, RGBTriple* dst, size_t count)
+{
+    get_pixel_kernels().palette_to_bgr(indices, palette, dst, count);
+}
+
+
+/**
+ * Функция считает яркость пикселей BGR.
+ * @param src: исходные пиксели;
+ * @param dst: массив для яркостей;
+ * @param count: число пикселей;
+ * @param standard: стандарт весов каналов.
+ */
+void convert_bgr_to_luma(const RGBTriple* src, unsigned char* dst,
+    size_t count, LumaStandard standard)
+{
+    get_pixel_kernels().bgr_to_luma(src, dst, count, standard);
+}
+
+
+/**
+ * Функция переводит пиксели BGR в плоскости яркости и цветоразностей
+ * YCbCr полного диапазона (как в JPEG).
+ * @param src: исходные пиксели;
+ * @param y: массив для яркостей;
+ * @param cb: массив для синих цветоразностей;
+ * @param cr: массив для красных цветоразностей;
+ * @param count: число пикселей;
+ * @param standard: стандарт весов каналов.
+ */
+void convert_bgr_to_ycbcr(const RGBTriple* src, unsigned char* y,
+    unsigned char* cb, unsigned char* cr, size_t count,
+    LumaStandard standard)
+{
+    get_pixel_kernels().bgr_to_ycbcr(src, y, cb, cr, count, standard);
+}
+
+#endif
@@ -0,0 +1,567 @@
+/*
+Модуль pixel_format.h содержит описания форматов пикселей BMP файла
+PixelFormat<BitCount> и шаблонные функции чтения и записи строк. Для
+каждой глубины цвета компилятор строит отдельную функцию, в которой
+преобразование строки известно заранее, поэтому глубина цвета
+проверяется один раз при выборе функции, а не для каждой строки.
+*/
+
+#pragma once
+#ifndef PIXEL_FORMAT_H
+#define PIXEL_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "bit_fields.h"
+#include "bmp_format.h"
+#include "byte_stream.h"
+#include "image_stats.h"
+#include "palette_quantizer.h"
+#include "pixel_convert.h"
+
+
+// Размер буфера в байтах для блочного чтения и записи строк пикселей
+const unsigned long IO_BLOCK_SIZE = 1 << 20;
+
+
+/**
+ * Структура с данными, которые нужны для преобразования строк
+ * палитровых изображений и изображений с масками каналов. Форматы
+ * используют только свои поля.
+ */
+struct RowContext
+{
+    // Палитра
+    const RGBQuad* palette;
+    // Таблица распаковки байта индексов для 1- и 4-битных строк
+    const RGBTriple* unpack_table;
+    // Поиск ближайших цветов палитры при записи
+    PaletteLookup* lookup;
+    // Буфер индексов одной строки при записи 1- и 4-битных строк
+    unsigned char* indices;
+    // Маски каналов 16- и 32-битных пикселей, nullptr - маски по
+    // умолчанию
+    const BitFields* fields;
+    // Счетчики вызова загрузки или записи, nullptr - без счетчиков
+    StatsCollector* stats;
+};
+
+
+/**
+ * Функция возвращает размер строки BMP файла. Строка дополняется
+ * байтами до кратности 4. Размер считается в 64 битах: у широкого
+ * изображения произведение ширины на глубину цвета не помещается в
+ * 32 бита.
+ * @param width: ширина изображения;
+ * @param bit_count: глубина цвета.
+ * @return: размер строки в байтах.
+ */
+std::uint64_t get_bmp_row_size(std::uint64_t width, unsigned short bit_count)
+{
+    return (width * bit_count + 31) / 32 * 4;
+}
+
+
+/**
+ * Функция возвращает число строк, которые помещаются в буфер блочного
+ * чтения и записи.
+ * @param row_size: размер строки в байтах;
+ * @param height: число строк изображения.
+ * @return: число строк в блоке (не меньше 1, если есть строки).
+ */
+unsigned long get_block_rows(unsigned long row_size, unsigned long height)
+{
+    if (row_size == 0)
+    {
+        // Пустые строки, весь массив помещается в один блок
+        return height;
+    }
+    unsigned long rows = IO_BLOCK_SIZE / row_size;
+    if (rows == 0)
+    {
+        // Строка больше буфера, работаем построчно
+        rows = 1;
+    }
+    if (rows > height)
+    {
+        rows = height;
+    }
+    return rows;
+}
+
+
+/**
+ * Описание формата пикселей BMP файла с заданной глубиной цвета.
+ * Каждая специализация содержит:
+ * bit_count - глубину цвета;
+ * indexed - true, если пиксели являются индексами палитры;
+ * contiguous - true, если пиксели строки без выравнивания идут подряд
+ * байтами и несколько строк можно преобразовать одним вызовом;
+ * decode - преобразование пикселей файла в RGBTriple;
+ * encode - преобразование RGBTriple в пиксели файла.
+ */
+template <unsigned short BitCount>
+struct PixelFormat;
+
+
+/**
+ * Формат 1-битных пикселей: 8 индексов палитры в байте.
+ */
+template <>
+struct PixelFormat<1>
+{
+    static const unsigned short bit_count = 1;
+    static const bool indexed = true;
+    static const bool contiguous = false;
+
+    static void decode(const unsigned char* src, RGBTriple* dst,
+        size_t width, const RowContext& context)
+    {
+        unpack_row_1(src, context.unpack_table, dst, width);
+    }
+
+    static void encode(const RGBTriple* src, unsigned char* dst,
+        size_t width, const RowContext& context)
+    {
+        context.lookup->map_row(src, context.indices, width);
+        pack_row_1(context.indices, dst, width);
+    }
+};
+
+
+/**
+ * Формат 4-битных пикселей: 2 индекса палитры в байте.
+ */
+template <>
+struct PixelFormat<4>
+{
+    static const unsigned short bit_count = 4;
+    static const bool indexed = true;
+    static const bool contiguous = false;
+
+    static void decode(const unsigned char* src, RGBTriple* dst,
+        size_t width, const RowContext& context)
+    {
+        unpack_row_4(src, context.unpack_table, dst, width);
+    }
+
+    static void encode(const RGBTriple* src, unsigned char* dst,
+        size_t width, const RowContext& context)
+    {
+        context.lookup->map_row(src, context.indices, width);
+        pack_row_4(context.indices, dst, width);
+    }
+};
+
+
+/**
+ * Формат 8-битных пикселей: индекс палитры в каждом байте.
+ */
+template <>
+struct PixelFormat<8>
+{
+    static const unsigned short bit_count = 8;
+    static const bool indexed = true;
+    static const bool contiguous = true;
+
+    static void decode(const unsigned char* src, RGBTriple* dst,
+        size_t width, const RowContext& context)
+    {
+        convert_palette_to_bgr(src, context.palette, dst, width);
+    }
+
+    static void encode(const RGBTriple* src, unsigned char* dst,
+        size_t width, const RowContext& context)
+    {
+        context.lookup->map_row(src, dst, width);
+    }
+};
+
+
+/**
+ * Формат 16-битных пикселей: каналы заданы масками, по умолчанию 5-5-5.
+ */
+template <>
+struct PixelFormat<16>
+{
+    static const unsigned short bit_count = 16;
+    static const bool indexed = false;
+    static const bool contiguous = true;
+
+    static void decode(const unsigned char* src, RGBTriple* dst,
+        size_t width, const RowContext& context)
+    {
+        convert_bit_fields_16_to_bgr(src, dst, width, context.fields ?
+            *context.fields : get_default_bit_fields(16));
+    }
+
+    static void encode(const RGBTriple* src, unsigned char* dst,
+        size_t width, const RowContext& context)
+    {
+        convert_bgr_to_bit_fields_16(src, dst, width, context.fields ?
+            *context.fields : get_default_bit_fields(16));
+    }
+};
+
+
+/**
+ * Формат 24-битных пикселей: совпадает с RGBTriple.
+ */
+template <>
+struct PixelFormat<24>
+{
+    static const unsigned short bit_count = 24;
+    static const bool indexed = false;
+    static const bool contiguous = true;
+
+    static void decode(const unsigned char* src, RGBTriple* dst,
+        size_t width, const RowContext&)
+    {
+        memcpy(dst, src, width * sizeof(RGBTriple));
+    }
+
+    static void encode(const RGBTriple* src, unsigned char* dst,
+        size_t width, const RowContext&)
+    {
+        memcpy(dst, src, width * sizeof(RGBTriple));
+    }
+};
+
+
+/**
+ * Формат 32-битных пикселей: по умолчанию RGBQuad с неиспользуемым
+ * байтом, при сжатии BI_BITFIELDS каналы заданы масками.
+ */
+template <>
+struct PixelFormat<32>
+{
+    static const unsigned short bit_count = 32;
+    static const bool indexed = false;
+    static const bool contiguous = true;
+
+    static void decode(const unsigned char* src, RGBTriple* dst,
+        size_t width, const RowContext& context)
+    {
+        if (!context.fields)
+        {
+            convert_bgra_to_bgr((const RGBQuad*)src, dst, width);
+            return;
+        }
+        convert_bit_fields_32_to_bgr(src, dst, width, *context.fields);
+    }
+
+    static void encode(const RGBTriple* src, unsigned char* dst,
+        size_t width, const RowContext& context)
+    {
+        if (!context.fields)
+        {
+            convert_bgr_to_bgra(src, (RGBQuad*)dst, width);
+            return;
+        }
+        convert_bgr_to_bit_fields_32(src, dst, width, *context.fields);
+    }
+};
+
+
+/**
+ * Функция преобразует строки BMP данных в массив пикселей. Если строки
+ * формата идут подряд без выравнивания, все строки преобразуются одним
+ * вызовом.
+ * @param src: строки BMP данных;
+ * @param dst: первый пиксель первой строки;
+ * @param width: ширина изображения;
+ * @param rows: число строк;
+ * @param row_size: размер строки BMP данных в байтах;
+ * @param stride: шаг между строками dst в пикселях (отрицательный,
+ * если строки dst идут в обратном порядке);
+ * @param context: палитра и таблицы формата.
+ */
+template <unsigned short BitCount>
+void decode_block(const unsigned char* src, RGBTriple* dst,
+    unsigned long width, unsigned long rows, unsigned long row_size,
+    ptrdiff_t stride, const RowContext& context)
+{
+    typedef PixelFormat<BitCount> Format;
+    if (Format::contiguous && stride == (ptrdiff_t)width &&
+        (size_t)row_size * 8 == (size_t)width * BitCount)
+    {
+        // Строки без выравнивания, преобразуем весь блок
+        Format::decode(src, dst, (size_t)rows * width, context);
+        return;
+    }
+    for (unsigned long k = 0; k < rows; k++)
+    {
+        // Цикл для прохода по строкам блока
+        Format::decode(src + (size_t)k * row_size,
+            dst + (ptrdiff_t)k * stride, width, context);
+    }
+}
+
+
+/**
+ * Функция преобразует массив пикселей в строки BMP данных. Байты
+ * выравнивания строк не меняются. Если строки формата идут подряд без
+ * выравнивания и строки массива тоже идут подряд, все строки
+ * преобразуются одним вызовом.
+ * @param src: первый пиксель первой строки;
+ * @param dst: место для строк BMP данных;
+ * @param width: ширина изображения;
+ * @param rows: число строк;
+ * @param stride: шаг между строками src в пикселях (отрицательный,
+ * если строки src идут в обратном порядке);
+ * @param row_size: размер строки BMP данных в байтах;
+ * @param context: палитра и поиск цветов формата.
+ */
+template <unsigned short BitCount>
+void encode_block(const RGBTriple* src, unsigned char* dst,
+    unsigned long width, unsigned long rows, ptrdiff_t stride,
+    unsigned long row_size, const RowContext& context)
+{
+    typedef PixelFormat<BitCount> Format;
+    if (Format::contiguous && stride == (ptrdiff_t)width &&
+        (size_t)row_size * 8 == (size_t)width * BitCount)
+    {
+        // Строки без выравнивания, преобразуем весь блок
+        Format::encode(src, dst, (size_t)rows * width, context);
+        return;
+    }
+    for (unsigned long k = 0; k < rows; k++)
+    {
+        // Цикл для прохода по строкам блока
+        Format::encode(src + (ptrdiff_t)k * stride,
+            dst + (size_t)k * row_size, width, context);
+    }
+}
+
+
+/**
+ * Функция читает строки [first, first + count) из потока BMP данных
+ * блоками и преобразует их в массив data. Строка потока с номером k
+ * попадает в data + k * stride, поэтому строки файла, записанного
+ * сверху вниз, раскладываются в обратном порядке без лишнего прохода.
+ * 24-битные строки без выравнивания читаются прямо в data. Если поток
+ * хранит байты в памяти, строки преобразуются прямо из нее без буфера.
+ * @param stream: поток, установленный на первую строку;
+ * @param data: место для строки потока с номером 0;
+ * @param width: ширина изображения;
+ * @param first: номер первой строки;
+ * @param count: число строк;
+ * @param stride: шаг между строками data в пикселях (отрицательный,
+ * если строки data идут в обратном порядке);
+ * @param context: палитра и таблицы формата.
+ */
+template <unsigned short BitCount>
+void decode_stream_rows(ByteStream& stream, RGBTriple* data,
+    unsigned long width, unsigned long first, unsigned long count,
+    ptrdiff_t stride, const RowContext& context)
+{
+    typedef PixelFormat<BitCount> Format;
+    unsigned long row_size = (unsigned long)get_bmp_row_size(width,
+        BitCount);
+    bool dense = Format::contiguous &&
+        (size_t)row_size * 8 == (size_t)width * BitCount;
+    if (BitCount == 24 && dense)
+    {
+        // Массив пикселей в потоке совпадает с массивом data, строки в
+        // обратном порядке читаются по одной
+        StageTimer timer(context.stats, STAGE_IO);
+        unsigned long rows = stride == (ptrdiff_t)width ? count : 1;
+        size_t size = (size_t)rows * row_size;
+        for (unsigned long i = first; i < first + count; i += rows)
+        {
+            unsigned char* place = (unsigned char*)(data +
+                (ptrdiff_t)i * stride);
+            size_t read = stream.read(place, 1, size);
+            count_read(context.stats, read);
+            // Недостающие байты поврежденного файла заполняем нулями
+            memset(place + read, 0, size - read);
+        }
+        return;
+    }
+    const unsigned char* mapped = stream.map_read((size_t)count * row_size);
+    if (mapped)
+    {
+        StageTimer convert_timer(context.stats, STAGE_CONVERT);
+        decode_block<BitCount>(mapped, data + (ptrdiff_t)first * stride,
+            width, count, row_size, stride, context);
+        count_read(context.stats, (std::uint64_t)count * row_size);
+        return;
+    }
+    unsigned long rows_in_block = get_block_rows(row_size, count);
+    StageTimer allocation_timer(context.stats, STAGE_ALLOCATION);
+    unsigned char* buffer = new unsigned char[(size_t)rows_in_block *
+        row_size];
+    count_allocation(context.stats, (std::uint64_t)rows_in_block * row_size);
+    allocation_timer.stop();
+    for (unsigned long i = first; i < first + count; i += rows_in_block)
+    {
+        // Цикл для прохода по блокам строк пикселей
+        unsigned long rows = rows_in_block;
+        if (rows > first + count - i)
+        {
+            rows = first + count - i;
+        }
+        size_t size = (size_t)rows * row_size;
+        StageTimer io_timer(context.stats, STAGE_IO);
+        size_t read = stream.read(buffer, 1, size);
+        count_read(context.stats, read);
+        io_timer.stop();
+        // Недостающие байты поврежденного файла заполняем нулями
+        memset(buffer + read, 0, size - read);
+        StageTimer convert_timer(context.stats, STAGE_CONVERT);
+        decode_block<BitCount>(buffer, data + (ptrdiff_t)i * stride, width,
+            rows, row_size, stride, context);
+    }
+    delete[] buffer;
+}
+
+
+/**
+ * Функция преобразует массив data в строки BMP данных и записывает их
+ * в поток блоками. Байты выравнивания строк записываются нулями. Если
+ * поток хранит байты в памяти, строки преобразуются прямо в нее. Строки
+ * data могут отстоять друг от друга дальше ширины, если записывается
+ * прямоугольник большего изображения, и идти в обратном порядке, если
+ * записывается отраженный прямоугольник или файл сверху вниз.
+ * @param stream: поток, установленный на поле пикселей;
+ * @param data: первый пиксель первой строки;
+ * @param width: ширина изображения;
+ * @param height: высота изображения;
+ * @param stride: шаг между строками data в пикселях (отрицательный,
+ * если строки записываются в обратном порядке);
+ * @param context: палитра и поиск цветов формата.
+ */
+template <unsigned short BitCount>
+void encode_stream_rows(ByteStream& stream, const RGBTriple* data,
+    unsigned long width, unsigned long height, ptrdiff_t stride,
+    const RowContext& context)
+{
+    typedef PixelFormat<BitCount> Format;
+    unsigned long row_size = (unsigned long)get_bmp_row_size(width,
+        BitCount);
+    bool dense = Format::contiguous &&
+        (size_t)row_size * 8 == (size_t)width * BitCount;
+    if (BitCount == 24 && dense)
+    {
+        // Строки не дополняются байтами, записываем строки data без
+        // преобразования, смежные строки - одним вызовом
+        StageTimer timer(context.stats, STAGE_IO);
+        unsigned long rows = stride == (ptrdiff_t)width ? height : 1;
+        for (unsigned long i = 0; i < height; i += rows)
+        {
+            size_t written = stream.write(data + (ptrdiff_t)i * stride,
+                row_size, rows);
+            count_write(context.stats, (std::uint64_t)written * row_size);
+        }
+        return;
+    }
+    unsigned char* mapped = stream.map_write((size_t)height * row_size);
+    if (mapped)
+    {
+        StageTimer convert_timer(context.stats, STAGE_CONVERT);
+        encode_block<BitCount>(data, mapped, width, height, stride, row_size,
+            context);
+        count_write(context.stats, (std::uint64_t)height * row_size);
+        return;
+    }
+    unsigned long rows_in_block = get_block_rows(row_size, height);
+    StageTimer allocation_timer(context.stats, STAGE_ALLOCATION);
+    unsigned char* buffer = new unsigned char[(size_t)rows_in_block *
+        row_size];
+    memset(buffer, 0, (size_t)rows_in_block * row_size);
+    count_allocation(context.stats, (std::uint64_t)rows_in_block * row_size);
+    allocation_timer.stop();
+    for (unsigned long i = 0; i < height; i += rows_in_block)
+    {
+        // Цикл для прохода по блокам строк пикселей
+        unsigned long rows = rows_in_block;
+        if (rows > height - i)
+        {
+            rows = height - i;
+        }
+        StageTimer convert_timer(context.stats, STAGE_CONVERT);
+        encode_block<BitCount>(data + (ptrdiff_t)i * stride, buffer, width,
+            rows, stride, row_size, context);
+        convert_timer.stop();
+        StageTimer io_timer(context.stats, STAGE_IO);
+        size_t written = stream.write(buffer, row_size, rows);
+        count_write(context.stats, (std::uint64_t)written * row_size);
+    }
+    delete[] buffer;
+}
+
+
+// Функция преобразования одной строки файла в RGBTriple
+typedef void (*RowDecoder)(const unsigned char*, RGBTriple*, size_t,
+    const RowContext&);
+// Функция преобразования одной строки RGBTriple в формат файла
+typedef void (*RowEncoder)(const RGBTriple*, unsigned char*, size_t,
+    const RowContext&);
+// Функция чтения строк потока в массив пикселей
+typedef void (*RowsReader)(ByteStream&, RGBTriple*, unsigned long,
+    unsigned long, unsigned long, ptrdiff_t, const RowContext&);
+// Функция записи массива пикселей в строки потока
+typedef void (*RowsWriter)(ByteStream&, const RGBTriple*, unsigned long,
+    unsigned long, ptrdiff_t, const RowContext&);
+
+
+/**
+ * Структура с функциями одного формата пикселей, выбираемыми по глубине
+ * цвета во время работы.
+ */
+struct FormatCodec
+{
+    // Глубина цвета
+    unsigned short bit_count;
+    // Если true, пиксели являются индексами палитры
+    bool indexed;
+    // Преобразование одной строки из формата файла
+    RowDecoder decode_row;
+    // Преобразование одной строки в формат файла
+    RowEncoder encode_row;
+    // Чтение строк потока блоками
+    RowsReader read_rows;
+    // Запись строк потока блоками
+    RowsWriter write_rows;
+};
+
+
+/**
+ * Функция собирает функции формата пикселей с заданной глубиной цвета.
+ * @return: функции формата.
+ */
+template <unsigned short BitCount>
+FormatCodec make_format_codec()
+{
+    FormatCodec codec = { BitCount, PixelFormat<BitCount>::indexed,
+        &PixelFormat<BitCount>::decode, &PixelFormat<BitCount>::encode,
+        &decode_stream_rows<BitCount>, &encode_stream_rows<BitCount> };
+    return codec;
+}
+
+
+/**
+ * Функция возвращает функции формата пикселей по глубине цвета.
+ * @param bit_count: глубина цвета.
+ * @return: указатель на функции формата или nullptr, если формат не
+ * поддерживается.
+ */
+const FormatCodec* get_format_codec(unsigned short bit_count)
+{
+    static const FormatCodec codecs[] = { make_format_codec<1>(),
+        make_format_codec<4>(), make_format_codec<8>(),
+        make_format_codec<16>(), make_format_codec<24>(),
+        make_format_codec<32>() };
+    for (const FormatCodec& codec : codecs)
+    {
+        if (codec.bit_count == bit_count)
+        {
+            return &codec;
+        }
+    }
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,316 @@
+/*
+Модуль rle_codec.h содержит функции распаковки и сжатия массива пикселей
+палитровых BMP файлов методом RLE (сжатие длинами серий). Сжатые данные
+состоят из пар байтов: ненулевой первый байт задает длину серии
+одинаковых пикселей, нулевой - конец строки, конец изображения, смещение
+или абсолютную серию несжатых индексов.
+*/
+
+#pragma once
+#ifndef RLE_CODEC_H
+#define RLE_CODEC_H
+
+#include <cstring>
+#include "bmp_format.h"
+
+
+// Второй байт пары с нулевым первым байтом: конец строки
+const unsigned char RLE_END_OF_LINE = 0;
+// Второй байт пары с нулевым первым байтом: конец изображения
+const unsigned char RLE_END_OF_BITMAP = 1;
+// Второй байт пары с нулевым первым байтом: смещение на (dx, dy)
+const unsigned char RLE_DELTA = 2;
+// Наибольшая длина серии
+const unsigned long RLE_MAX_RUN = 255;
+
+
+/**
+ * Функция возвращает наибольший размер сжатой строки. Каждый пиксель
+ * занимает не больше 2 байт, еще 2 байта занимает конец строки.
+ * @param width: ширина изображения.
+ * @return: размер в байтах.
+ */
+size_t get_rle_row_bound(unsigned long width)
+{
+    return (size_t)width * 2 + 2;
+}
+
+
+/**
+ * Функция записывает 4-битный индекс в строку BMP файла.
+ * @param row: строка упакованных индексов;
+ * @param x: номер пикселя;
+ * @param value: индекс (от 0 до 15).
+ */
+void put_nibble(unsigned char* row, unsigned long x, unsigned char value)
+{
+    if (x & 1)
+    {
+        row[x / 2] = (unsigned char)((row[x / 2] & 0xF0) | value);
+    }
+    else
+    {
+        row[x / 2] = (unsigned char)((row[x / 2] & 0x0F) | (value << 4));
+    }
+}
+
+
+/**
+ * Функция заполняет серию пикселей 4-битной строки. Пиксели серии
+ * чередуют старшую и младшую половины байта value.
+ * @param row: строка упакованных индексов;
+ * @param x: номер первого пикселя;
+ * @param count: число пикселей;
+ * @param value: байт с двумя индексами серии.
+ */
+void fill_run_4(unsigned char* row, unsigned long x, unsigned long count,
+    unsigned char value)
+{
+    if (count && (x & 1))
+    {
+        // Первый пиксель попадает в младшую половину байта, дальше
+        // индексы серии идут в байтах в обратном порядке
+        put_nibble(row, x, (unsigned char)(value >> 4));
+        value = (unsigned char)((value << 4) | (value >> 4));
+        x++;
+        count--;
+    }
+    memset(row + x / 2, value, count / 2);
+    if (count & 1)
+    {
+        put_nibble(row, x + count - 1, (unsigned char)(value >> 4));
+    }
+}
+
+
+/**
+ * Функция копирует абсолютную серию упакованных 4-битных индексов в
+ * строку.
+ * @param row: строка упакованных индексов;
+ * @param x: номер первого пикселя;
+ * @param src: индексы серии, по два в байте;
+ * @param count: число пикселей.
+ */
+void copy_run_4(unsigned char* row, unsigned long x, const unsigned char* src,
+    unsigned long count)
+{
+    if (!(x & 1))
+    {
+        // Серия начинается с границы байта
+        memcpy(row + x / 2, src, count / 2);
+        if (count & 1)
+        {
+            put_nibble(row, x + count - 1,
+                (unsigned char)(src[count / 2] >> 4));
+        }
+        return;
+    }
+    for (unsigned long k = 0; k < count; k++)
+    {
+        unsigned char value = (unsigned char)(k & 1 ? src[k / 2] & 0x0F :
+            src[k / 2] >> 4);
+        put_nibble(row, x + k, value);
+    }
+}
+
+
+/**
+ * Функция распаковывает массив пикселей, сжатый RLE8 или RLE4, в строки
+ * упакованных индексов BMP файла. Пиксели, пропущенные смещениями и
+ * концами строк, а также пиксели за концом поврежденных данных остаются
+ * нулевыми. Серии за краем изображения отбрасываются.
+ * @param src: сжатые данные;
+ * @param size: размер сжатых данных в байтах;
+ * @param bit_count: глубина цвета (8 или 4);
+ * @param width: ширина изображения;
+ * @param height: высота изображения;
+ * @param dst: строки индексов, заполненные нулями;
+ * @param row_size: размер строки индексов в байтах.
+ */
+void decode_rle(const unsigned char* src, size_t size, unsigned short bit_count,
+    unsigned long width, unsigned long height, unsigned char* dst,
+    unsigned long row_size)
+{
+    unsigned long x = 0;
+    unsigned long y = 0;
+    size_t position = 0;
+    while (position + 1 < size && y < height)
+    {
+        unsigned long count = src[position];
+        unsigned char value = src[position + 1];
+        position += 2;
+        unsigned char* row = dst + (size_t)y * row_size;
+        if (count)
+        {
+            // Серия одинаковых пикселей
+            unsigned long visible = x < width ? width - x : 0;
+            unsigned long n = count < visible ? count : visible;
+            if (n && bit_count == 8)
+            {
+                memset(row + x, value, n);
+            }
+            else if (n)
+            {
+                fill_run_4(row, x, n, value);
+            }
+            x += count;
+            continue;
+        }
+        if (value == RLE_END_OF_LINE)
+        {
+            x = 0;
+            y++;
+        }
+        else if (value == RLE_END_OF_BITMAP)
+        {
+            return;
+        }
+        else if (value == RLE_DELTA)
+        {
+            if (position + 1 >= size)
+            {
+                return;
+            }
+            x += src[position];
+            y += src[position + 1];
+            position += 2;
+        }
+        else
+        {
+            // Абсолютная серия, данные выровнены на границу 2 байт
+            count = value;
+            size_t bytes = bit_count == 8 ? count : (count + 1) / 2;
+            if (position + bytes > size)
+            {
+                // Данные оборваны, серия укорачивается
+                bytes = size - position;
+                count = bit_count == 8 ? (unsigned long)bytes :
+                    (unsigned long)bytes * 2;
+            }
+            unsigned long visible = x < width ? width - x : 0;
+            unsigned long n = count < visible ? count : visible;
+            if (n && bit_count == 8)
+            {
+                memcpy(row + x, src + position, n);
+            }
+            else if (n)
+            {
+                copy_run_4(row, x, src + position, n);
+            }
+            x += count;
+            position += bytes + (bytes & 1);
+        }
+    }
+}
+
+
+/**
+ * Функция возвращает длину серии, начинающейся с пикселя start. Для
+ * RLE8 серия состоит из одинаковых индексов, для RLE4 - из двух
+ * чередующихся индексов.
+ * @param row: индексы строки, по одному на байт;
+ * @param start: номер первого пикселя серии;
+ * @param width: ширина изображения;
+ * @param bit_count: глубина цвета (8 или 4);
+ * @param limit: наибольшая длина, которую нужно проверить.
+ * @return: длина серии, не больше limit.
+ */
+unsigned long get_run_length(const unsigned char* row, unsigned long start,
+    unsigned long width, unsigned short bit_count, unsigned long limit)
+{
+    unsigned long end = width - start < limit ? width : start + limit;
+    unsigned long period = bit_count == 8 ? 1 : 2;
+    unsigned long i = start + period;
+    while (i < end && row[i] == row[i - period])
+    {
+        i++;
+    }
+    return (i < end ? i : end) - start;
+}
+
+
+/**
+ * Функция сжимает строку индексов методом RLE8 или RLE4. Серии не
+ * короче min_run записываются парой байтов, остальные пиксели
+ * собираются в абсолютные серии. Строка завершается концом строки или,
+ * если она последняя, концом изображения.
+ * @param row: индексы строки, по одному на байт;
+ * @param width: ширина изображения;
+ * @param bit_count: глубина цвета (8 или 4);
+ * @param last: true, если строка последняя;
+ * @param dst: массив для get_rle_row_bound(width) байт.
+ * @return: размер сжатой строки в байтах.
+ */
+size_t encode_rle_row(const unsigned char* row, unsigned long width,
+    unsigned short bit_count, bool last, unsigned char* dst)
+{
+    // Пара байтов выгоднее абсолютной серии начиная с этой длины
+    const unsigned long min_run = bit_count == 8 ? 3 : 5;
+    size_t size = 0;
+    unsigned long i = 0;
+    while (i < width)
+    {
+        unsigned long run = get_run_length(row, i, width, bit_count,
+            RLE_MAX_RUN);
+        if (run >= min_run)
+        {
+            dst[size++] = (unsigned char)run;
+            dst[size++] = bit_count == 8 ? row[i] :
+                (unsigned char)((row[i] << 4) | row[i + 1]);
+            i += run;
+            continue;
+        }
+        // Абсолютная серия продолжается до начала длинной серии
+        unsigned long end = i + run;
+        while (end < width && end - i < RLE_MAX_RUN &&
+            get_run_length(row, end, width, bit_count, min_run) < min_run)
+        {
+            end++;
+        }
+        unsigned long count = end - i < RLE_MAX_RUN ? end - i : RLE_MAX_RUN;
+        if (count < 3)
+        {
+            // Абсолютная серия короче 3 пикселей не допускается
+            for (unsigned long k = 0; k < count; k++)
+            {
+                unsigned long n = bit_count == 4 && k + 1 < count ? 2 : 1;
+                dst[size++] = (unsigned char)n;
+                dst[size++] = bit_count == 8 ? row[i + k] :
+                    (unsigned char)((row[i + k] << 4) |
+                    (n == 2 ? row[i + k + 1] : 0));
+                k += n - 1;
+            }
+            i += count;
+            continue;
+        }
+        dst[size++] = 0;
+        dst[size++] = (unsigned char)count;
+        size_t bytes;
+        if (bit_count == 8)
+        {
+            memcpy(dst + size, row + i, count);
+            bytes = count;
+        }
+        else
+        {
+            bytes = (count + 1) / 2;
+            for (size_t k = 0; k < bytes; k++)
+            {
+                unsigned char low = 2 * k + 1 < count ? row[i + 2 * k + 1] : 0;
+                dst[size + k] = (unsigned char)((row[i + 2 * k] << 4) | low);
+            }
+        }
+        size += bytes;
+        if (bytes & 1)
+        {
+            // Абсолютная серия выравнивается на границу 2 байт
+            dst[size++] = 0;
+        }
+        i += count;
+    }
+    dst[size++] = 0;
+    dst[size++] = last ? RLE_END_OF_BITMAP : RLE_END_OF_LINE;
+    return size;
+}
+
+#endif
@@ -0,0 +1,378 @@
+/*
+Модуль thread_pool.h содержит определение класса ThreadPool - пула
+потоков, который выполняет задачи из общей очереди и делит диапазоны
+индексов (например, строки изображения) между потоками, и класса
+WorkStealingPool для пакетов независимых задач разной длительности.
+*/
+
+#pragma once
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/**
+ * Класс пула потоков с общей очередью задач.
+ */
+class ThreadPool
+{
+protected:
+    // Рабочие потоки
+    std::vector<std::thread> workers;
+    // Очередь задач
+    std::deque<std::function<void()>> tasks;
+    // Мьютекс для очереди задач
+    std::mutex mutex;
+    // Условная переменная для ожидания задач
+    std::condition_variable condition;
+    // Если true, потоки завершают работу
+    bool stop;
+
+public:
+    // Конструктор класса, запускающий заданное число потоков
+    ThreadPool(unsigned);
+    // Деструктор класса, дожидающийся завершения потоков
+    ~ThreadPool();
+    // Метод возвращает число рабочих потоков
+    unsigned get_size() const;
+    // Метод добавляет задачу в очередь
+    void submit(std::function<void()>);
+    // Метод делит диапазон на части и выполняет их параллельно
+    void parallel_for(size_t, size_t, size_t,
+        const std::function<void(size_t, size_t)>&);
+
+private:
+    // Копировать пул нельзя
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator = (const ThreadPool&);
+    // Метод выполняется рабочими потоками
+    void run();
+};
+
+
+/**
+ * Функция возвращает число потоков, которые процессор выполняет
+ * одновременно.
+ * @return: число потоков (не меньше 1).
+ */
+unsigned get_hardware_threads()
+{
+    unsigned threads = std::thread::hardware_concurrency();
+    return threads ? threads : 1;
+}
+
+
+/**
+ * Функция возвращает общий пул потоков программы. Пул создается при
+ * первом обращении с числом потоков по числу ядер процессора.
+ * @return: ссылка на пул.
+ */
+ThreadPool& get_thread_pool()
+{
+    static ThreadPool pool(get_hardware_threads());
+    return pool;
+}
+
+
+/**
+ * Конструктор класса ThreadPool.
+ * @param threads: число рабочих потоков.
+ */
+ThreadPool::ThreadPool(unsigned threads)
+{
+    stop = false;
+    for (unsigned i = 0; i < threads; i++)
+    {
+        workers.emplace_back(&ThreadPool::run, this);
+    }
+}
+
+
+/**
+ * Деструктор класса ThreadPool. Оставшиеся в очереди задачи выполняются
+ * до завершения потоков.
+ */
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    condition.notify_all();
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+
+/**
+ * Метод класса ThreadPool выполняется каждым рабочим потоком: берет
+ * задачи из очереди, пока пул не остановлен.
+ */
+void ThreadPool::run()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return stop || !tasks.empty(); });
+            if (tasks.empty())
+            {
+                // Пул остановлен, задач не осталось
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+
+/**
+ * Метод класса ThreadPool возвращает число рабочих потоков.
+ * @return: число потоков.
+ */
+unsigned ThreadPool::get_size() const
+{
+    return (unsigned)workers.size();
+}
+
+
+/**
+ * Метод класса ThreadPool добавляет задачу в очередь.
+ * @param task: задача.
+ */
+void ThreadPool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    condition.notify_one();
+}
+
+
+/**
+ * Метод класса ThreadPool делит диапазон [begin, end) на части не
+ * меньше grain и выполняет их параллельно. Вызывающий поток тоже берет
+ * части, поэтому метод можно вызывать из задачи этого же пула. Метод
+ * возвращает управление, когда все части выполнены.
+ * @param begin: начало диапазона;
+ * @param end: конец диапазона;
+ * @param grain: наименьший размер части;
+ * @param func: функция, выполняемая для части [first, last).
+ */
+void ThreadPool::parallel_for(size_t begin, size_t end, size_t grain,
+    const std::function<void(size_t, size_t)>& func)
+{
+    if (begin >= end)
+    {
+        return;
+    }
+    if (grain == 0)
+    {
+        grain = 1;
+    }
+    size_t count = end - begin;
+    size_t threads = workers.size() + 1;
+    // Частей в несколько раз больше потоков, чтобы выровнять нагрузку
+    size_t parts = (count + grain - 1) / grain;
+    if (parts > threads * 4)
+    {
+        parts = threads * 4;
+    }
+    if (parts <= 1)
+    {
+        func(begin, end);
+        return;
+    }
+    // Состояние общее для вызывающего потока и помощников, помощник
+    // может начать работу уже после возврата из метода
+    struct State
+    {
+        std::atomic<size_t> next;
+        size_t done;
+        std::mutex mutex;
+        std::condition_variable condition;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    state->next = 0;
+    state->done = 0;
+    size_t part_size = (count + parts - 1) / parts;
+    parts = (count + part_size - 1) / part_size;
+    const std::function<void(size_t, size_t)>* body = &func;
+    auto work = [state, body, begin, end, parts, part_size]()
+    {
+        size_t part;
+        while ((part = state->next++) < parts)
+        {
+            size_t first = begin + part * part_size;
+            size_t last = first + part_size < end ? first + part_size : end;
+            (*body)(first, last);
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (++state->done == parts)
+            {
+                state->condition.notify_all();
+            }
+        }
+    };
+    size_t helpers = parts - 1 < workers.size() ? parts - 1 : workers.size();
+    for (size_t i = 0; i < helpers; i++)
+    {
+        submit(work);
+    }
+    work();
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->condition.wait(lock, [&] { return state->done == parts; });
+}
+
+
+/**
+ * Класс пула потоков с кражей работы. У каждого потока своя очередь
+ * задач: поток берет задачи из начала своей очереди, а когда она
+ * опустеет, забирает задачи из конца очередей других потоков. Так
+ * пакет задач разной длительности распределяется равномерно без общей
+ * очереди, за которую конкурируют все потоки.
+ */
+class WorkStealingPool
+{
+protected:
+    /**
+     * Структура для хранения очереди задач одного потока.
+     */
+    struct WorkerQueue
+    {
+        // Задачи потока
+        std::deque<std::function<void()>> tasks;
+        // Мьютекс для очереди
+        std::mutex mutex;
+    };
+    // Число потоков
+    unsigned threads;
+
+public:
+    // Конструктор класса с заданным числом потоков
+    WorkStealingPool(unsigned);
+    // Метод возвращает число потоков
+    unsigned get_size() const;
+    // Метод выполняет пакет задач и дожидается их завершения
+    void run(std::vector<std::function<void()>>&);
+
+private:
+    // Метод берет задачу из своей очереди или крадет из чужой
+    bool take_task(std::vector<WorkerQueue>&, unsigned,
+        std::function<void()>&);
+};
+
+
+/**
+ * Конструктор класса WorkStealingPool.
+ * @param threads: число потоков, 0 - по числу ядер процессора.
+ */
+WorkStealingPool::WorkStealingPool(unsigned threads)
+{
+    this->threads = threads ? threads : get_hardware_threads();
+}
+
+
+/**
+ * Метод класса WorkStealingPool возвращает число потоков.
+ * @return: число потоков.
+ */
+unsigned WorkStealingPool::get_size() const
+{
+    return threads;
+}
+
+
+/**
+ * Метод класса WorkStealingPool берет задачу из начала своей очереди,
+ * а если она пуста, из конца очереди другого потока.
+ * @param queues: очереди всех потоков;
+ * @param self: номер потока;
+ * @param task: взятая задача.
+ * @return: true, если задача взята, false, если задач не осталось.
+ */
+bool WorkStealingPool::take_task(std::vector<WorkerQueue>& queues,
+    unsigned self, std::function<void()>& task)
+{
+    for (unsigned k = 0; k < queues.size(); k++)
+    {
+        // Сначала своя очередь, затем очереди соседей по кругу
+        unsigned victim = (self + k) % queues.size();
+        WorkerQueue& queue = queues[victim];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+        {
+            continue;
+        }
+        if (victim == self)
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        else
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        return true;
+    }
+    return false;
+}
+
+
+/**
+ * Метод класса WorkStealingPool выполняет пакет задач. Задачи
+ * раздаются по очередям потоков по кругу, поэтому если пакет
+ * упорядочен по убыванию длительности, каждый поток начинает с самых
+ * длинных. Новые задачи во время выполнения не добавляются, поэтому
+ * поток завершается, когда все очереди пусты.
+ * @param tasks: задачи; после выполнения вектор очищается.
+ */
+void WorkStealingPool::run(std::vector<std::function<void()>>& tasks)
+{
+    unsigned count = threads;
+    if (count > tasks.size())
+    {
+        count = tasks.size() ? (unsigned)tasks.size() : 1;
+    }
+    std::vector<WorkerQueue> queues(count);
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        queues[i % count].tasks.push_back(std::move(tasks[i]));
+    }
+    tasks.clear();
+    auto work = [this, &queues](unsigned self)
+    {
+        std::function<void()> task;
+        while (take_task(queues, self, task))
+        {
+            task();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < count; i++)
+    {
+        workers.emplace_back(work, i);
+    }
+    // Вызывающий поток работает как поток с номером 0
+    work(0);
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+#endif